@@ -50,6 +50,7 @@
 
 #include "rdprail.h"
 #include "shared/image-loader.h"
+#include "shared/string-helpers.h"
 
 #if HAVE_GLIB
 #include <glib.h>
@@ -72,6 +73,22 @@
 #define EVENT_TIMEOUT_MS 2000 // 2 seconds
 #define MAX_ICON_RETRY_COUNT 5
 
+/* icon names are looked up as is, then with .png, then with .svg appended */
+#define ICON_INDEX_VARIANTS 3
+#define ICON_INDEX_CACHE_VERSION 1
+
+/* files present for one icon name, bit (folder * ICON_INDEX_VARIANTS +
+ * variant) is set when icon_folder[folder] has the name in that variant,
+ * so the lowest bit set is what the probing order would find first. */
+struct icon_index_entry {
+	uint64_t mask;
+};
+
+struct icon_folder_state {
+	int wd;
+	struct timespec mtime; /* when indexed, zero if not indexed */
+};
+
 struct app_list_context {
 	wHashTable* table;
 	HANDLE thread;
@@ -87,6 +104,10 @@ struct app_list_context {
 	int app_list_pidfd;
 	int weston_pidfd;
 	uint32_t icon_retry_count;
+	/* icon file index, monitor thread only, see icon_index_build() */
+	wHashTable *icon_index;
+	struct icon_folder_state *icon_folders;
+	int icon_fd;
 	struct weston_image *default_icon;
 	struct weston_image *default_overlay_icon;
 	struct {
@@ -251,6 +272,479 @@ is_desktop_file(char *file)
 	return NULL;
 }
 
+static_assert(ARRAY_LENGTH(icon_folder) * ICON_INDEX_VARIANTS <= 64,
+	      "icon_index_entry::mask too small for icon_folder[]");
+
+static void
+icon_index_set(struct app_list_context *context, const char *key, int bit,
+	       bool present)
+{
+	struct icon_index_entry *e;
+
+	e = (struct icon_index_entry *)HashTable_GetItemValue(context->icon_index,
+							      (void *)key);
+	if (present) {
+		if (!e) {
+			e = zalloc(sizeof *e);
+			if (!e)
+				return;
+#if WINPR_VERSION_MAJOR >= 3
+			if (!HashTable_Insert(context->icon_index, key, e)) {
+#else
+			if (HashTable_Add(context->icon_index, (void *)key, e) < 0) {
+#endif
+				free(e);
+				return;
+			}
+		}
+		e->mask |= 1ull << bit;
+	} else if (e) {
+		e->mask &= ~(1ull << bit);
+		if (e->mask == 0)
+			HashTable_Remove(context->icon_index, (void *)key);
+	}
+}
+
+static void
+icon_index_update_file(struct app_list_context *context, int folder,
+		       const char *file, bool present)
+{
+	char stem[512];
+	char *ext = strrchr(file, '.');
+	int variant;
+
+	icon_index_set(context, file, folder * ICON_INDEX_VARIANTS, present);
+
+	if (!ext || ext == file)
+		return;
+	if (strcmp(ext, ".png") == 0)
+		variant = 1;
+#ifdef HAVE_LIBRSVG2
+	else if (strcmp(ext, ".svg") == 0)
+		variant = 2;
+#endif // HAVE_LIBRSVG2
+	else
+		return;
+
+	copy_string(stem, MIN(sizeof stem, (size_t)(ext - file) + 1), file);
+	icon_index_set(context, stem, folder * ICON_INDEX_VARIANTS + variant,
+		       present);
+}
+
+static void
+icon_index_clear_folder(struct app_list_context *context, int folder)
+{
+	uint64_t bits = ((1ull << ICON_INDEX_VARIANTS) - 1) <<
+			(folder * ICON_INDEX_VARIANTS);
+	struct icon_index_entry *e;
+	char **keys = NULL;
+	int num_keys;
+
+	num_keys = HashTable_GetKeys(context->icon_index, (ULONG_PTR **)&keys);
+	for (int i = 0; i < num_keys; i++) {
+		e = (struct icon_index_entry *)HashTable_GetItemValue(context->icon_index,
+								      (void *)keys[i]);
+		if (e && (e->mask & bits)) {
+			e->mask &= ~bits;
+			if (e->mask == 0)
+				HashTable_Remove(context->icon_index, (void *)keys[i]);
+		}
+	}
+	free(keys);
+
+	context->icon_folders[folder].mtime = (struct timespec) {};
+}
+
+/* Adds every file of the folder, one readdir instead of a stat per
+ * icon name and extension. */
+static void
+icon_index_scan_folder(struct desktop_shell *shell, int folder)
+{
+	struct app_list_context *context = (struct app_list_context *)shell->app_list_context;
+	struct icon_folder_state *state = &context->icon_folders[folder];
+	struct dirent *ent;
+	struct stat st;
+	DIR *dir;
+
+	icon_index_clear_folder(context, folder);
+
+	attach_app_list_namespace(shell);
+	dir = opendir(icon_folder[folder]);
+	if (dir && fstat(dirfd(dir), &st) == 0)
+		state->mtime = st.st_mtim;
+	detach_app_list_namespace(shell);
+	if (!dir)
+		return;
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_type != DT_REG) {
+			/* follow links like stat() does for the probing */
+			if (ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN)
+				continue;
+			if (fstatat(dirfd(dir), ent->d_name, &st, 0) != 0 ||
+			    !S_ISREG(st.st_mode))
+				continue;
+		}
+		icon_index_update_file(context, folder, ent->d_name, true);
+	}
+	closedir(dir);
+}
+
+static char *
+icon_index_cache_path(void)
+{
+	char *cache_home = getenv("XDG_CACHE_HOME");
+	char *home = getenv("HOME");
+	char *path = NULL;
+
+	if (cache_home && *cache_home == '/') {
+		str_printf(&path, "%s/weston-rdprail-icon-index", cache_home);
+	} else if (home) {
+		str_printf(&path, "%s/.cache", home);
+		if (path)
+			mkdir(path, 0700);
+		free(path);
+		str_printf(&path, "%s/.cache/weston-rdprail-icon-index", home);
+	}
+
+	return path;
+}
+
+/* Restores the folders whose modification time did not change since the
+ * cache was written, returns a mask of the folders restored. */
+static uint64_t
+icon_index_load_cache(struct app_list_context *context,
+		      const struct timespec *mtimes)
+{
+	char line[1024];
+	char *path;
+	uint64_t restored = 0;
+	FILE *fp;
+	int version;
+
+	path = icon_index_cache_path();
+	if (!path)
+		return 0;
+	fp = fopen(path, "r");
+	free(path);
+	if (!fp)
+		return 0;
+
+	if (!fgets(line, sizeof line, fp) ||
+	    sscanf(line, "weston-rdprail-icon-index %d", &version) != 1 ||
+	    version != ICON_INDEX_CACHE_VERSION)
+		goto out;
+
+	while (fgets(line, sizeof line, fp)) {
+		long long sec;
+		long nsec;
+		int folder, pos;
+		char *name;
+
+		name = strchr(line, '\n');
+		if (!name)
+			break; /* truncated */
+		*name = '\0';
+
+		if (sscanf(line, "D %d %lld %ld %n", &folder, &sec, &nsec, &pos) == 3) {
+			if (folder < 0 || folder >= (int)ARRAY_LENGTH(icon_folder) ||
+			    strcmp(&line[pos], icon_folder[folder]) != 0)
+				continue;
+			if ((sec || nsec) &&
+			    mtimes[folder].tv_sec == sec &&
+			    mtimes[folder].tv_nsec == nsec) {
+				restored |= 1ull << folder;
+				context->icon_folders[folder].mtime = mtimes[folder];
+			}
+		} else if (sscanf(line, "F %d %n", &folder, &pos) == 1) {
+			if (folder >= 0 && folder < (int)ARRAY_LENGTH(icon_folder) &&
+			    (restored & (1ull << folder)))
+				icon_index_update_file(context, folder,
+						       &line[pos], true);
+		}
+	}
+
+out:
+	fclose(fp);
+	return restored;
+}
+
+static void
+icon_index_save_cache(struct app_list_context *context)
+{
+	struct icon_index_entry *e;
+	char **keys = NULL;
+	char *path, *tmp;
+	int num_keys;
+	FILE *fp = NULL;
+	int fd;
+
+	path = icon_index_cache_path();
+	if (!path)
+		return;
+	str_printf(&tmp, "%s.XXXXXX", path);
+	if (!tmp) {
+		free(path);
+		return;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd >= 0)
+		fp = fdopen(fd, "w");
+	if (!fp) {
+		weston_log("%s: failed to write %s: %s\n",
+			   __func__, path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp);
+		}
+		goto out;
+	}
+
+	fprintf(fp, "weston-rdprail-icon-index %d\n", ICON_INDEX_CACHE_VERSION);
+	for (int i = 0; i < (int)ARRAY_LENGTH(icon_folder); i++) {
+		struct timespec *mtime = &context->icon_folders[i].mtime;
+
+		if (mtime->tv_sec || mtime->tv_nsec)
+			fprintf(fp, "D %d %lld %ld %s\n", i,
+				(long long)mtime->tv_sec, mtime->tv_nsec,
+				icon_folder[i]);
+	}
+
+	/* the names as is are the file names, the rest is derived */
+	num_keys = HashTable_GetKeys(context->icon_index, (ULONG_PTR **)&keys);
+	for (int i = 0; i < num_keys; i++) {
+		e = (struct icon_index_entry *)HashTable_GetItemValue(context->icon_index,
+								      (void *)keys[i]);
+		if (strchr(keys[i], '\n'))
+			continue;
+		for (int folder = 0; e && folder < (int)ARRAY_LENGTH(icon_folder); folder++) {
+			if (e->mask & (1ull << (folder * ICON_INDEX_VARIANTS)))
+				fprintf(fp, "F %d %s\n", folder, keys[i]);
+		}
+	}
+	free(keys);
+
+	if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+		weston_log("%s: failed to write %s: %s\n",
+			   __func__, path, strerror(errno));
+		unlink(tmp);
+	}
+
+out:
+	free(tmp);
+	free(path);
+}
+
+static void
+icon_index_watch_folder(struct desktop_shell *shell, int folder)
+{
+	struct app_list_context *context = (struct app_list_context *)shell->app_list_context;
+
+	attach_app_list_namespace(shell);
+	context->icon_folders[folder].wd =
+		inotify_add_watch(context->icon_fd, icon_folder[folder],
+				  IN_CREATE|IN_DELETE|IN_MOVED_TO|IN_MOVED_FROM|
+				  IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR);
+	detach_app_list_namespace(shell);
+}
+
+/* Builds the index of icon_folder[] at start, from the cache file for the
+ * folders that did not change since it was written and by scanning the
+ * others. The index is kept up to date from inotify, see
+ * icon_index_handle_events(). Returns false to fall back to probing. */
+static bool
+icon_index_build(struct desktop_shell *shell)
+{
+	struct app_list_context *context = (struct app_list_context *)shell->app_list_context;
+	struct timespec mtimes[ARRAY_LENGTH(icon_folder)] = {};
+	uint64_t restored;
+	int scanned = 0;
+	struct stat st;
+	wHashTable *table;
+#if WINPR_VERSION_MAJOR >= 3
+	wObject *obj;
+#endif
+
+	table = HashTable_New(FALSE /* synchronized */);
+	if (!table)
+		return false;
+#if WINPR_VERSION_MAJOR >= 3
+	if (!HashTable_SetupForStringData(table, false)) {
+		HashTable_Free(table);
+		return false;
+	}
+	obj = HashTable_ValueObject(table);
+	obj->fnObjectNew = NULL; // make sure value won't be cloned.
+	obj->fnObjectFree = free;
+#else
+	table->hash = HashTable_StringHash;
+	table->keyCompare = HashTable_StringCompare;
+	table->keyClone = HashTable_StringClone;
+	table->keyFree = HashTable_StringFree;
+	table->valueClone = NULL; // make sure value won't be cloned.
+	table->valueFree = free;
+#endif
+
+	context->icon_folders = zalloc(ARRAY_LENGTH(icon_folder) *
+				       sizeof *context->icon_folders);
+	context->icon_fd = inotify_init1(IN_CLOEXEC);
+	if (!context->icon_folders || context->icon_fd < 0) {
+		weston_log("%s: failed to watch icon folders\n", __func__);
+		free(context->icon_folders);
+		context->icon_folders = NULL;
+		if (context->icon_fd >= 0)
+			close(context->icon_fd);
+		context->icon_fd = -1;
+		HashTable_Free(table);
+		return false;
+	}
+	context->icon_index = table;
+
+	/* watch first, so nothing changing during the scan goes unnoticed */
+	for (int i = 0; i < (int)ARRAY_LENGTH(icon_folder); i++) {
+		icon_index_watch_folder(shell, i);
+
+		attach_app_list_namespace(shell);
+		if (stat(icon_folder[i], &st) == 0 && S_ISDIR(st.st_mode))
+			mtimes[i] = st.st_mtim;
+		detach_app_list_namespace(shell);
+	}
+
+	restored = icon_index_load_cache(context, mtimes);
+
+	for (int i = 0; i < (int)ARRAY_LENGTH(icon_folder); i++) {
+		if (context->icon_folders[i].wd < 0 || (restored & (1ull << i)))
+			continue;
+		icon_index_scan_folder(shell, i);
+		scanned++;
+	}
+
+	weston_log("%s: %d icon names, %d folders from cache, %d scanned\n",
+		   __func__, (int)HashTable_Count(context->icon_index),
+		   __builtin_popcountll(restored), scanned);
+
+	if (scanned)
+		icon_index_save_cache(context);
+
+	return true;
+}
+
+static void
+icon_index_destroy(struct app_list_context *context)
+{
+	if (context->icon_fd >= 0) {
+		close(context->icon_fd);
+		context->icon_fd = -1;
+	}
+	if (context->icon_index) {
+		HashTable_Free(context->icon_index);
+		context->icon_index = NULL;
+	}
+	free(context->icon_folders);
+	context->icon_folders = NULL;
+}
+
+/* Picks up icon folders created after the index was built, called along
+ * with the icon lookup retries. */
+static void
+icon_index_watch_new_folders(struct desktop_shell *shell)
+{
+	struct app_list_context *context = (struct app_list_context *)shell->app_list_context;
+	bool scanned = false;
+
+	if (!context->icon_index)
+		return;
+
+	for (int i = 0; i < (int)ARRAY_LENGTH(icon_folder); i++) {
+		if (context->icon_folders[i].wd >= 0)
+			continue;
+		icon_index_watch_folder(shell, i);
+		if (context->icon_folders[i].wd >= 0) {
+			icon_index_scan_folder(shell, i);
+			scanned = true;
+		}
+	}
+
+	if (scanned)
+		icon_index_save_cache(context);
+}
+
+static void
+icon_index_handle_events(struct desktop_shell *shell)
+{
+	struct app_list_context *context = (struct app_list_context *)shell->app_list_context;
+	struct inotify_event *event;
+	char buf[1024 * (sizeof *event + 16)];
+	bool rescan = false;
+	int len, cur, folder;
+
+	len = read(context->icon_fd, buf, sizeof buf);
+	for (cur = 0; cur < len; cur += sizeof *event + event->len) {
+		event = (struct inotify_event *)&buf[cur];
+
+		if (event->mask & IN_Q_OVERFLOW) {
+			rescan = true;
+			continue;
+		}
+
+		for (folder = 0; folder < (int)ARRAY_LENGTH(icon_folder); folder++) {
+			if (context->icon_folders[folder].wd == event->wd)
+				break;
+		}
+		if (folder == (int)ARRAY_LENGTH(icon_folder))
+			continue;
+
+		/* the folder is gone, watched again once it comes back */
+		if (event->mask & (IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF)) {
+			if (!(event->mask & IN_IGNORED))
+				inotify_rm_watch(context->icon_fd, event->wd);
+			context->icon_folders[folder].wd = -1;
+			icon_index_clear_folder(context, folder);
+			continue;
+		}
+
+		if (!event->len || (event->mask & IN_ISDIR))
+			continue;
+
+		/* changed since written to the cache file */
+		context->icon_folders[folder].mtime = (struct timespec) {};
+		icon_index_update_file(context, folder, event->name,
+				       event->mask & (IN_CREATE|IN_MOVED_TO));
+	}
+
+	if (rescan) {
+		weston_log("%s: inotify queue overflow, rescanning icon folders\n",
+			   __func__);
+		for (folder = 0; folder < (int)ARRAY_LENGTH(icon_folder); folder++) {
+			if (context->icon_folders[folder].wd >= 0)
+				icon_index_scan_folder(shell, folder);
+		}
+		icon_index_save_cache(context);
+	}
+}
+
+static bool
+icon_index_find(struct app_list_context *context, const char *name,
+		char *buf, size_t size)
+{
+	static const char *suffix[ICON_INDEX_VARIANTS] = { "", ".png", ".svg" };
+	struct icon_index_entry *e;
+	int bit;
+
+	e = (struct icon_index_entry *)HashTable_GetItemValue(context->icon_index,
+							      (void *)name);
+	if (!e || !e->mask)
+		return false;
+
+	bit = __builtin_ctzll(e->mask);
+	copy_string(buf, size, icon_folder[bit / ICON_INDEX_VARIANTS]);
+	append_string(buf, size, name);
+	append_string(buf, size, suffix[bit % ICON_INDEX_VARIANTS]);
+
+	return true;
+}
+
 static bool
 find_icon_file(struct app_entry *entry)
 {
@@ -270,6 +764,9 @@ find_icon_file(struct app_entry *entry)
 			icon_file = entry->icon_name;
 			goto Found;
 		}
+	} else if (context->icon_index) {
+		if (icon_index_find(context, entry->icon_name, buf, sizeof buf))
+			goto Found;
 	} else {
 		/* TODO: follow icon search path desribed at "Icon Lookup" section at
 		 https://specifications.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html */
@@ -946,7 +1443,9 @@ app_list_monitor_thread(LPVOID arg)
 	DWORD status = 0;
 	DWORD num_events = 0;
 	int num_watch = 0;
-	HANDLE events[NUM_CONTROL_EVENT + ARRAY_LENGTH(app_list_folder)] = {};
+	/* +1 for the icon folders */
+	HANDLE events[NUM_CONTROL_EVENT + ARRAY_LENGTH(app_list_folder) + 1] = {};
+	DWORD icon_event = 0;
 	struct inotify_event *event;
 	char buf[1024 * (sizeof *event + 16)];
 	char path[512];
@@ -1066,6 +1565,15 @@ app_list_monitor_thread(LPVOID arg)
 		}
 		assert(false == context->isAppListNamespaceAttached);
 
+		/* index icon files before the .desktop files look them up */
+		if (icon_index_build(shell)) {
+			events[num_events] = GetFileHandleForFileDescriptor(context->icon_fd);
+			if (events[num_events])
+				icon_event = num_events++;
+			else
+				weston_log("app_list_monitor_thread: GetFileHandleForFileDescriptor failed\n");
+		}
+
 		/* first scan folders to update all existing .desktop files */
 		if (num_watch)
 			app_list_update_all(shell, app_list_folder);
@@ -1085,6 +1593,7 @@ app_list_monitor_thread(LPVOID arg)
 
 		/* Timeout */
 		if (status == WAIT_TIMEOUT) {
+			icon_index_watch_new_folders(shell);
 			retry_find_icon_file(shell);
 			continue;
 		}
@@ -1169,6 +1678,12 @@ app_list_monitor_thread(LPVOID arg)
 			continue;
 		}
 
+		/* Icon files are added or removed */
+		if (icon_event && status == WAIT_OBJECT_0 + icon_event) {
+			icon_index_handle_events(shell);
+			continue;
+		}
+
 		/* Somethings are changed in watch folders */
 		if (shell->rdprail_api->notify_app_list && num_watch) {
 			len = read(fd[status - WAIT_OBJECT_0 - NUM_CONTROL_EVENT], buf, sizeof buf); 
@@ -1205,6 +1720,10 @@ Exit:
 		}
 	}
 
+	if (icon_event)
+		CloseHandle(events[icon_event]);
+	icon_index_destroy(context);
+
 	for (int i = CUSTOM_APP_LIST_FOLDER_INDEX; app_list_folder[i] != NULL; i++) {
 		free(app_list_folder[i]);
 		app_list_folder[i] = NULL;
@@ -1232,6 +1751,7 @@ start_app_list_monitor(struct desktop_shell *shell)
 
 	context->weston_pidfd = -1;
 	context->app_list_pidfd = -1;
+	context->icon_fd = -1;
 
 	context->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 	if (!context->stopEvent)
@@ -1164,6 +1164,8 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	int repaint_threads;
+	int renderer_threads;
 	bool color_management;
 	bool cal;
 
@@ -1204,6 +1206,23 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_int(s, "repaint-threads", &repaint_threads, 0);
+	if (repaint_threads < 0 || repaint_threads > 64) {
+		weston_log("Invalid repaint-threads value in config: %d\n",
+			   repaint_threads);
+	} else {
+		ec->repaint_threads = repaint_threads;
+	}
+
+	weston_config_section_get_int(s, "renderer-threads",
+				      &renderer_threads, 0);
+	if (renderer_threads < 0 || renderer_threads > 64) {
+		weston_log("Invalid renderer-threads value in config: %d\n",
+			   renderer_threads);
+	} else {
+		ec->renderer_threads = renderer_threads;
+	}
+
 	weston_config_section_get_bool(s, "color-management",
 				       &color_management, false);
 	if (color_management) {
@@ -1335,6 +1354,22 @@ wet_output_set_scale(struct weston_output *output,
 	weston_output_set_scale(output, scale);
 }
 
+static void
+wet_output_set_damage_merge(struct weston_output *output,
+			    struct weston_config_section *section)
+{
+	int max_rects;
+	int rect_cost;
+
+	weston_config_section_get_int(section, "damage-merge-rects",
+				      &max_rects, 0);
+	weston_config_section_get_int(section, "damage-merge-cost",
+				      &rect_cost, 1024);
+
+	weston_output_set_damage_merge(output, MAX(max_rects, 0),
+				       MAX(rect_cost, 1));
+}
+
 /* UINT32_MAX is treated as invalid because 0 is a valid
  * enumeration value and the parameter is unsigned
  */
@@ -1877,6 +1912,7 @@ wet_configure_windowed_output_from_config(struct weston_output *output,
 	allow_content_protection(output, section);
 
 	wet_output_set_scale(output, section, defaults->scale, parsed_options->scale);
+	wet_output_set_damage_merge(output, section);
 	if (wet_output_set_transform(output, section, defaults->transform,
 				     parsed_options->transform) < 0) {
 		return -1;
@@ -2391,6 +2427,7 @@ drm_backend_output_configure(struct weston_output *output,
 	}
 
 	wet_output_set_scale(output, section, 1, 0);
+	wet_output_set_damage_merge(output, section);
 	if (wet_output_set_transform(output, section, transform,
 				     UINT32_MAX) < 0) {
 		return -1;
@@ -3067,6 +3104,7 @@ drm_backend_remoted_output_configure(struct weston_output *output,
 	}
 
 	wet_output_set_scale(output, section, 1, 0);
+	wet_output_set_damage_merge(output, section);
 	if (wet_output_set_transform(output, section,
 				     WL_OUTPUT_TRANSFORM_NORMAL,
 				     UINT32_MAX) < 0) {
@@ -3227,6 +3265,7 @@ drm_backend_pipewire_output_configure(struct weston_output *output,
 	}
 
 	wet_output_set_scale(output, section, 1, 0);
+	wet_output_set_damage_merge(output, section);
 	if (wet_output_set_transform(output, section,
 				     WL_OUTPUT_TRANSFORM_NORMAL,
 				     UINT32_MAX) < 0) {
@@ -3591,6 +3630,7 @@ pipewire_backend_output_configure(struct weston_output *output)
 	weston_config_section_get_string(section, "gbm-format", &gbm_format, NULL);
 
 	wet_output_set_scale(output, section, 1, 0);
+	wet_output_set_damage_merge(output, section);
 	weston_output_set_transform(output, WL_OUTPUT_TRANSFORM_NORMAL);
 
 	api->set_gbm_format(output, gbm_format);
@@ -3672,6 +3712,8 @@ weston_rdp_backend_config_init(struct weston_rdp_backend_config *config)
 	config->force_no_compression = 0;
 	config->remotefx_codec = true;
 	config->refresh_rate = RDP_DEFAULT_FREQ;
+	config->encoder_threads = -1;
+	config->clipboard_max_size = 256;
 	config->rail_config.use_rdpapplist = false;
 	config->rail_config.use_shared_memory = false;
 	config->rail_config.enable_hi_dpi_support = false;
@@ -3684,6 +3726,7 @@ weston_rdp_backend_config_init(struct weston_rdp_backend_config *config)
 	config->rail_config.enable_distro_name_title = false;
 	config->rail_config.enable_copy_warning_title = false;
 	config->rail_config.enable_display_power_by_screenupdate = false;
+	config->rail_config.frame_ack_window = 2;
 }
 
 static int
@@ -3739,6 +3782,7 @@ rdp_backend_output_configure(struct weston_output *output)
 	api->output_set_mode(output, &new_mode);
 
 	wet_output_set_scale(output, section, scale, 0);
+	wet_output_set_damage_merge(output, section);
 	weston_output_set_transform(output, WL_OUTPUT_TRANSFORM_NORMAL);
 
 	weston_log("rdp_backend_output_configure.. Done\n");
@@ -3831,6 +3875,8 @@ load_rdp_backend(struct weston_compositor *c,
 
 	/* certain configurations are read from environment variables */
 
+	config.encoder_threads = read_rdp_config_int("WESTON_RDP_ENCODER_THREADS", -1);
+	config.clipboard_max_size = read_rdp_config_int("WESTON_RDP_CLIPBOARD_MAX_SIZE", 256);
 	config.rail_config.use_rdpapplist = read_rdp_config_bool("WESTON_RDP_APPLIST", false);
 	config.rail_config.use_shared_memory = read_rdp_config_bool("WESTON_RDP_SHARED_MEMORY", false);
 
@@ -3871,6 +3917,8 @@ load_rdp_backend(struct weston_compositor *c,
             "WESTON_RDP_WINDOW_SHADOW_REMOTING", true);
 	config.rail_config.enable_display_power_by_screenupdate = read_rdp_config_bool(
             "WESTON_RDP_DISPLAY_POWER_BY_SCREENUPDATE", false);
+	config.rail_config.frame_ack_window = read_rdp_config_int(
+            "WESTON_RDP_FRAME_ACK_WINDOW", 2);
 	config.rail_config.enable_distro_name_title = read_rdp_config_bool(
             "WESTON_RDP_APPEND_DISTRONAME_TITLE", true);
 #if defined(__arm__) || defined(__aarch64__)
@@ -3933,6 +3981,7 @@ vnc_backend_output_configure(struct weston_output *output)
 	}
 
 	wet_output_set_scale(output, section, 1, 0);
+	wet_output_set_damage_merge(output, section);
 	weston_output_set_transform(output, WL_OUTPUT_TRANSFORM_NORMAL);
 
 	if (api->output_set_size(output, width, height, resizeable) < 0) {
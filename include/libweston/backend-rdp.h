@@ -279,7 +279,7 @@ struct weston_surface_rail_state {
 	uint32_t surface_id;
 };
 
-#define WESTON_RDP_BACKEND_CONFIG_VERSION 3
+#define WESTON_RDP_BACKEND_CONFIG_VERSION 6
 
 typedef void *(*rdp_audio_in_setup)(struct weston_compositor *c, void *vcm);
 typedef void (*rdp_audio_in_teardown)(void *audio_private);
@@ -300,6 +300,10 @@ struct weston_rdp_backend_config {
 	bool remotefx_codec;
 	int external_listener_fd;
 	int refresh_rate;
+	/* -1 picks a default from the CPU count, 0 encodes in the compositor */
+	int encoder_threads;
+	/* largest clipboard transfer in MiB, 0 for the protocol limit */
+	int clipboard_max_size;
 	rdp_audio_in_setup audio_in_setup;
 	rdp_audio_in_teardown audio_in_teardown;
 	rdp_audio_out_setup audio_out_setup;
@@ -317,6 +321,8 @@ struct weston_rdp_backend_config {
 		bool enable_distro_name_title;
 		bool enable_copy_warning_title;
 		bool enable_display_power_by_screenupdate;
+		/* RDPGFX frames sent ahead of the client's acknowledgement */
+		int frame_ack_window;
 	} rail_config;
 };
 
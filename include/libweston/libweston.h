@@ -90,6 +90,7 @@ struct weston_color_profile;
 struct weston_color_transform;
 struct pixel_format_info;
 struct weston_output_capture_info;
+struct frame_stats;
 struct weston_output_color_outcome;
 struct weston_tearing_control;
 struct di_info;
@@ -205,6 +206,8 @@ struct weston_testsuite_quirks {
 	bool gl_force_full_redraw_of_shadow_fb;
 	/** Required enum weston_capability bit mask, otherwise skip run. */
 	uint32_t required_capabilities;
+	/** Check incremental view list updates against a full rebuild. */
+	bool check_view_list;
 };
 
 /** Weston test suite data that is given to compositor
@@ -581,6 +584,12 @@ struct weston_output {
 	/** True if the entire contents of the output should be redrawn */
 	bool full_repaint_needed;
 
+	/** Damage rectangle budget, see weston_output_set_damage_merge() */
+	struct {
+		int max_rects;
+		int rect_cost;
+	} damage_merge;
+
 	/** True if the output will be repainted in the currently active
 	 *  repaint handler. */
 	bool will_repaint;
@@ -615,6 +624,7 @@ struct weston_output {
 	int destroying;
 	struct wl_list feedback_list;
 	struct weston_output_capture_info *capture_info;
+	struct frame_stats *frame_stats;
 
 	uint32_t transform;
 	int32_t native_scale;
@@ -1535,6 +1545,9 @@ struct weston_compositor {
 	struct wl_list debug_binding_list;
 
 	bool view_list_needs_rebuild;
+	/* views to restack or re-check for output z-order lists,
+	 * struct weston_view::view_list_dirty.link */
+	struct wl_list view_list_dirty_list;
 
 	uint32_t state;
 	struct wl_event_source *idle_source;
@@ -1551,6 +1564,9 @@ struct weston_compositor {
 	struct weston_idalloc *color_profile_id_generator;
 	struct weston_idalloc *color_transform_id_generator;
 
+	/* hit testing for weston_compositor_pick_view() */
+	struct weston_pick_index *pick_index;
+
 	struct weston_renderer *renderer;
 	const struct pixel_format_info *read_format;
 
@@ -1581,6 +1597,13 @@ struct weston_compositor {
 	int32_t repaint_msec;
 	struct timespec last_repaint_start;
 
+	/* Threads rendering outputs concurrently, 0 renders in turn */
+	int32_t repaint_threads;
+	struct weston_repaint_pool *repaint_pool;
+	/* Extra threads a renderer may split one output repaint across,
+	 * set before the renderer gets created */
+	int32_t renderer_threads;
+
 	unsigned int activate_serial;
 
 	struct wl_global *pointer_constraints;
@@ -1621,7 +1644,10 @@ struct weston_compositor {
 	struct weston_log_context *weston_log_ctx;
 	struct weston_log_scope *debug_scene;
 	struct weston_log_scope *timeline;
+	struct weston_timeline_ring *timeline_ring;
 	struct weston_log_scope *libseat_debug;
+	struct weston_log_scope *damage_merge_scope;
+	struct weston_log_scope *frame_stats_scope;
 
 	struct content_protection *content_protection;
 
@@ -1776,6 +1802,13 @@ struct weston_view {
 	struct wl_list link;             /* weston_compositor::view_list */
 	struct weston_layer_entry layer_link; /* part of geometry */
 
+	struct {
+		/* weston_compositor::view_list_dirty_list */
+		struct wl_list link;
+		/* moved in the layers, not only in the global space */
+		bool restack;
+	} view_list_dirty;
+
 	/* For weston_layer inheritance from another view */
 	struct weston_view *parent_view;
 
@@ -1850,6 +1883,15 @@ struct weston_view {
 	 */
 	uint32_t output_mask;
 
+	/* Managed by libweston/pick-index.c */
+	struct {
+		struct wl_list dirty_link;
+		uint32_t z; /* position in weston_compositor::view_list */
+		int32_t cell_x1, cell_y1, cell_x2, cell_y2;
+		int64_t cells; /* 0 if in no cell */
+		bool indexed;
+	} pick_index;
+
 	bool is_mapped;
 	struct weston_log_pacer subsurface_parent_log_pacer;
 };
@@ -2711,6 +2753,10 @@ void
 weston_output_set_transform(struct weston_output *output,
 			    uint32_t transform);
 
+void
+weston_output_set_damage_merge(struct weston_output *output,
+			       int max_rects, int rect_cost);
+
 bool
 weston_output_set_color_profile(struct weston_output *output,
 				struct weston_color_profile *cprof);
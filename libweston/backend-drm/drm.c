@@ -372,12 +372,11 @@ drm_output_render_pixman(struct drm_output_state *state,
 			 pixman_region32_t *damage)
 {
 	struct drm_output *output = state->output;
-	struct weston_compositor *ec = output->base.compositor;
 
 	output->current_image ^= 1;
 
-	ec->renderer->repaint_output(&output->base, damage,
-				     output->renderbuffer[output->current_image]);
+	weston_output_repaint_renderer(&output->base, damage,
+				       output->renderbuffer[output->current_image]);
 
 	return drm_fb_ref(output->dumb[output->current_image]);
 }
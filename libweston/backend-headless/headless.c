@@ -159,22 +159,19 @@ static int
 headless_output_repaint(struct weston_output *output_base)
 {
 	struct headless_output *output = to_headless_output(output_base);
-	struct weston_compositor *ec;
 	pixman_region32_t damage;
 	int delay_msec;
 
 	assert(output);
 
-	ec = output->base.compositor;
-
 	headless_output_update_gl_border(output);
 
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(&output->base, &damage,
-				     output->renderbuffer);
+	weston_output_repaint_renderer(&output->base, &damage,
+				       output->renderbuffer);
 
 	pixman_region32_fini(&damage);
 
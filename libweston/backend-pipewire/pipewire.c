@@ -1038,7 +1038,6 @@ static int
 pipewire_output_repaint(struct weston_output *base)
 {
 	struct pipewire_output *output = to_pipewire_output(base);
-	struct weston_compositor *ec = output->base.compositor;
 	struct pw_buffer *buffer;
 	struct pipewire_frame_data *frame_data;
 	pixman_region32_t damage;
@@ -1065,7 +1064,7 @@ pipewire_output_repaint(struct weston_output *base)
 
 	frame_data = buffer->user_data;
 	if (frame_data->renderbuffer)
-		ec->renderer->repaint_output(&output->base, &damage, frame_data->renderbuffer);
+		weston_output_render(&output->base, &damage, frame_data->renderbuffer);
 	else
 		output->base.full_repaint_needed = true;
 
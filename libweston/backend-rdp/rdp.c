@@ -27,6 +27,7 @@
 
 #include <assert.h>
 #include <drm_fourcc.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -103,16 +104,18 @@ rdp_peer_seat_led_update(struct weston_seat *seat_base, enum weston_led leds)
 	/*TODO: if Caps/Num lock change is triggered by server side, here can forward to client */
 }
 
+/* Encodes the damage into the peer's encode_stream and fills in the
+ * surface bits command. The codec id is left for the caller to set, since
+ * it is negotiated per peer and is not part of the encoded bitstream.
+ */
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_peer_encode_rfx(pixman_region32_t *damage, pixman_image_t *image,
+		    RdpPeerContext *context, SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height, nrects, i;
 	pixman_box32_t *region, *rects;
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->context->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
 	Stream_Clear(context->encode_stream);
 	Stream_SetPosition(context->encode_stream, 0);
@@ -120,16 +123,15 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd.skipCompression = TRUE;
-	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
-	cmd.destLeft = damage->extents.x1;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	cmd.bmp.bpp = 32;
-	cmd.bmp.codecID = freerdp_settings_get_uint32(peer->context->settings, FreeRDP_RemoteFxCodecId);
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
+	cmd->skipCompression = TRUE;
+	cmd->cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd->destLeft = damage->extents.x1;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
 
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
@@ -152,22 +154,17 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 			pixman_image_get_stride(image)
 	);
 
-	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
-
-	update->SurfaceBits(update->context, &cmd);
+	cmd->bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
+	cmd->bmp.bitmapData = Stream_Buffer(context->encode_stream);
 }
 
-
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_peer_encode_nsc(pixman_region32_t *damage, pixman_image_t *image,
+		    RdpPeerContext *context, SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height;
 	int32_t left;
 	uint32_t *ptr;
-	rdpUpdate *update = peer->context->update;
-	SURFACE_BITS_COMMAND cmd = { 0 };
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
 	Stream_Clear(context->encode_stream);
 	Stream_SetPosition(context->encode_stream, 0);
@@ -181,16 +178,15 @@ rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	width = (damage->extents.x2 - left);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
-	cmd.skipCompression = TRUE;
-	cmd.destLeft = left;
-	cmd.destTop = damage->extents.y1;
-	cmd.destRight = damage->extents.x2;
-	cmd.destBottom = damage->extents.y2;
-	cmd.bmp.bpp = 32;
-	cmd.bmp.codecID = freerdp_settings_get_uint32(peer->context->settings, FreeRDP_NSCodecId);
-	cmd.bmp.width = width;
-	cmd.bmp.height = height;
+	cmd->cmdType = CMDTYPE_SET_SURFACE_BITS;
+	cmd->skipCompression = TRUE;
+	cmd->destLeft = left;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
 
 	ptr = pixman_image_get_data(image) + left +
 				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
@@ -199,10 +195,8 @@ rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 			width, height,
 			pixman_image_get_stride(image));
 
-	cmd.bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd.bmp.bitmapData = Stream_Buffer(context->encode_stream);
-
-	update->SurfaceBits(update->context, &cmd);
+	cmd->bmp.bitmapDataLength = Stream_GetPosition(context->encode_stream);
+	cmd->bmp.bitmapData = Stream_Buffer(context->encode_stream);
 }
 
 static void
@@ -280,19 +274,170 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	update->SurfaceFrameMarker(peer->context, &marker);
 }
 
+bool
+rdp_peer_get_encode_key(freerdp_peer *peer, struct rdp_encode_key *key)
+{
+	rdpSettings *settings = peer->context->settings;
+
+	memset(key, 0, sizeof(*key));
+	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec)) {
+		key->codec = RDP_ENCODE_CODEC_RFX;
+		key->rfx_mode = RLGR3;
+	} else if (freerdp_settings_get_bool(settings, FreeRDP_NSCodec)) {
+		key->codec = RDP_ENCODE_CODEC_NSC;
+	} else {
+		return false;
+	}
+	key->pixel_format = DEFAULT_PIXEL_FORMAT;
+	key->width = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
+	key->height = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
+
+	return true;
+}
+
+uint32_t
+rdp_peer_get_codec_id(freerdp_peer *peer, enum rdp_encode_codec codec)
+{
+	rdpSettings *settings = peer->context->settings;
+
+	switch (codec) {
+	case RDP_ENCODE_CODEC_RFX:
+		return freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId);
+	case RDP_ENCODE_CODEC_NSC:
+		return freerdp_settings_get_uint32(settings, FreeRDP_NSCodecId);
+	}
+
+	unreachable("unknown RDP encode codec");
+}
+
+static struct rdp_encoded_frame *
+rdp_encode_cache_lookup(struct rdp_encode_cache *cache,
+			const struct rdp_encode_key *key)
+{
+	int i;
+
+	for (i = 0; i < cache->count; i++) {
+		if (memcmp(&cache->entries[i].key, key, sizeof(*key)) == 0)
+			return &cache->entries[i];
+	}
+
+	return NULL;
+}
+
+/* Sends the damaged region to the peer. When a cache is given, the encoded
+ * frame is looked up by codec and codec settings first, so peers sharing
+ * the same settings only pay for a single encode per repaint. The cached
+ * bitstream lives in the encode_stream of the peer which produced it and
+ * stays valid until that peer encodes again, i.e. the next repaint.
+ */
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer,
+			struct rdp_encode_cache *cache)
 {
 	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-	struct rdp_output *output = rdp_get_first_output(context->rdpBackend);
-	rdpSettings *settings = peer->context->settings;
+	struct rdp_backend *b = context->rdpBackend;
+	struct rdp_output *output = rdp_get_first_output(b);
+	rdpUpdate *update = peer->context->update;
+	struct rdp_encode_key key;
+	struct rdp_encoded_frame *frame = NULL;
+	SURFACE_BITS_COMMAND cmd = { 0 };
 
-	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec))
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (freerdp_settings_get_bool(settings, FreeRDP_NSCodec))
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
-	else
+	if (!rdp_peer_get_encode_key(peer, &key)) {
 		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+		return;
+	}
+
+	if (cache)
+		frame = rdp_encode_cache_lookup(cache, &key);
+
+	if (frame) {
+		cmd = frame->cmd;
+		cache->shared++;
+	} else {
+		if (key.codec == RDP_ENCODE_CODEC_RFX)
+			rdp_peer_encode_rfx(region, output->shadow_surface, context, &cmd);
+		else
+			rdp_peer_encode_nsc(region, output->shadow_surface, context, &cmd);
+
+		if (cache) {
+			cache->encoded++;
+			if (cache->count < RDP_ENCODE_CACHE_SIZE) {
+				frame = &cache->entries[cache->count++];
+				frame->key = key;
+				frame->cmd = cmd;
+			}
+		}
+	}
+
+	cmd.bmp.codecID = rdp_peer_get_codec_id(peer, key.codec);
+	update->SurfaceBits(update->context, &cmd);
+}
+
+static void
+rdp_output_refresh_peers(struct rdp_output *output, pixman_region32_t *damage)
+{
+	struct rdp_backend *b = output->backend;
+	struct rdp_encode_cache cache = { 0 };
+	struct rdp_peers_item *peer;
+	int peer_count = 0;
+
+	wl_list_for_each(peer, &b->peers, link) {
+		if ((peer->flags & RDP_PEER_ACTIVATED) &&
+		    (peer->flags & RDP_PEER_OUTPUT_ENABLED)) {
+			rdp_peer_refresh_region(damage, peer->peer, &cache);
+			peer_count++;
+		}
+	}
+
+	output->encoded_frames += cache.encoded;
+	output->shared_frames += cache.shared;
+	rdp_debug_verbose(b, "%s: %d peer(s), %d encode(s), %d shared (total %" PRIu64 " encoded, %" PRIu64 " shared)\n",
+			  __func__, peer_count, cache.encoded, cache.shared,
+			  output->encoded_frames, output->shared_frames);
+}
+
+/* Hands the damage over to the encoder threads, once for each distinct set
+ * of codec settings among the peers. Peers without a codec are refreshed
+ * right away. Returns false if nothing was submitted, in which case the
+ * caller falls back to encoding synchronously.
+ */
+static bool
+rdp_output_submit_encode(struct rdp_output *output, pixman_region32_t *damage)
+{
+	struct rdp_backend *b = output->backend;
+	struct rdp_encode_cache keys = { 0 };
+	struct rdp_peers_item *peer;
+	struct rdp_encode_key key;
+
+	wl_list_for_each(peer, &b->peers, link) {
+		if (!(peer->flags & RDP_PEER_ACTIVATED) ||
+		    !(peer->flags & RDP_PEER_OUTPUT_ENABLED))
+			continue;
+
+		if (!rdp_peer_get_encode_key(peer->peer, &key) ||
+		    rdp_encode_cache_lookup(&keys, &key))
+			continue;
+
+		if (keys.count == RDP_ENCODE_CACHE_SIZE)
+			return false;
+		keys.entries[keys.count++].key = key;
+	}
+
+	if (!rdp_encoder_submit(b->encoder, output, damage, &keys))
+		return false;
+
+	wl_list_for_each(peer, &b->peers, link) {
+		if (!(peer->flags & RDP_PEER_ACTIVATED) ||
+		    !(peer->flags & RDP_PEER_OUTPUT_ENABLED))
+			continue;
+
+		if (!rdp_peer_get_encode_key(peer->peer, &key))
+			rdp_peer_refresh_raw(damage, output->shadow_surface, peer->peer);
+	}
+
+	output->encoded_frames += keys.count;
+
+	return true;
 }
 
 static int
@@ -310,9 +455,7 @@ static int
 rdp_output_repaint(struct weston_output *output_base)
 {
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
-	struct weston_compositor *ec = output->base.compositor;
 	struct rdp_backend *b = output->backend;
-	struct rdp_peers_item *peer;
 	pixman_region32_t damage;
 
 	assert(output);
@@ -328,8 +471,8 @@ rdp_output_repaint(struct weston_output *output_base)
 	} else if (output_base->renderer_state) {
 		/* Add above 'output_base->renderer_state' check since this turns NULL when RDP
 		   connection is disconnected and hit fault at pixman_renderer_output_set_buffer() */
-	    ec->renderer->repaint_output(&output->base, &damage,
-	    			     output->renderbuffer);
+	    weston_output_render(&output->base, &damage,
+	    			 output->renderbuffer);
 
 	    if (pixman_region32_not_empty(&damage)) {
 	    	pixman_region32_t transformed_damage;
@@ -337,18 +480,17 @@ rdp_output_repaint(struct weston_output *output_base)
 	    	weston_region_global_to_output(&transformed_damage,
 	    				       output_base,
 	    				       &damage);
-	    	wl_list_for_each(peer, &b->peers, link) {
-	    		if ((peer->flags & RDP_PEER_ACTIVATED) &&
-	    		    (peer->flags & RDP_PEER_OUTPUT_ENABLED)) {
-	    			rdp_peer_refresh_region(&transformed_damage, peer->peer);
-	    		}
-	    	}
+	    	if (!b->encoder ||
+	    	    !rdp_output_submit_encode(output, &transformed_damage))
+	    		rdp_output_refresh_peers(output, &transformed_damage);
 	    	pixman_region32_fini(&transformed_damage);
 	    }
 
 	    pixman_region32_fini(&damage);
     }
 
+	/* with the encoder threads, finishing the frame also waits for them,
+	 * see finish_frame_handler() */
 	weston_output_arm_frame_timer(output_base, output->finish_frame_timer);
 
 	return 0;
@@ -359,6 +501,10 @@ finish_frame_handler(void *data)
 {
 	struct rdp_output *output = data;
 
+	/* frame is still being encoded, it gets finished once posted */
+	if (rdp_encoder_defer_finish_frame(output))
+		return 1;
+
 	weston_output_finish_frame_from_timer(&output->base);
 
 	return 1;
@@ -607,6 +753,8 @@ rdp_output_disable(struct weston_output *base)
 	if (!b->rdp_peer || !b->rdp_peer->context->settings->HiDefRemoteApp) {
         /* Not RAIL */
 
+	    rdp_encoder_output_fini(b->encoder, output);
+
 	    weston_renderbuffer_unref(output->renderbuffer);
 	    output->renderbuffer = NULL;
 	    switch (renderer->type) {
@@ -693,6 +841,7 @@ rdp_output_create(struct weston_backend *backend, const char *name)
 	output->base.switch_mode = rdp_output_switch_mode;
 
 	output->backend = b;
+	wl_list_init(&output->encode_frame.link);
 
 	weston_compositor_add_pending_output(&output->base, compositor);
 
@@ -804,6 +953,8 @@ rdp_destroy(struct weston_backend *backend)
 	
     rdp_rail_destroy(b);
 
+	rdp_encoder_destroy(b->encoder);
+
 	freerdp_listener_free(b->listener);
 
 	free(b->server_cert);
@@ -861,7 +1012,7 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 
 	context->loop_task_event_source_fd = -1;
 	context->loop_task_event_source = NULL;
-	wl_list_init(&context->loop_task_list);
+	wl_list_init(&context->clipboard_transfer_list);
 
 	context->rfx_context = rfx_context_new(TRUE);
 	if (!context->rfx_context)
@@ -1192,7 +1343,10 @@ rdp_full_refresh(freerdp_peer *peer, struct rdp_output *output)
 	box.y2 = output->base.current_mode->height;
 	pixman_region32_init_with_extents(&damage, &box);
 
-	rdp_peer_refresh_region(&damage, peer);
+	/* Not cached: a freshly activated peer gets a frame from its own codec
+	 * context, which also carries the codec headers it has not seen yet.
+	 */
+	rdp_peer_refresh_region(&damage, peer, NULL);
 
 	pixman_region32_fini(&damage);
 }
@@ -2292,6 +2446,14 @@ rdp_backend_create(struct weston_compositor *compositor,
 							    "Debug messages from RDP backend clipboard\n",
 							    NULL, NULL, NULL);
 
+	/* the size of a format data response is 32 bits */
+	if (config->clipboard_max_size > 0 && config->clipboard_max_size < 4096)
+		b->clipboard_max_size = (size_t)config->clipboard_max_size << 20;
+	else
+		b->clipboard_max_size = UINT32_MAX - 1;
+	rdp_debug(b, "RDP backend: WESTON_RDP_CLIPBOARD_MAX_SIZE: %zu bytes\n",
+		  b->clipboard_max_size);
+
 	wl_list_insert(&compositor->backend_list, &b->base.link);
 
 	if (config->server_cert && config->server_key) {
@@ -2356,6 +2518,8 @@ rdp_backend_create(struct weston_compositor *compositor,
 		}
 	}
 
+	b->encoder = rdp_encoder_create(b, config->encoder_threads);
+
 	rdp_head_create(b, NULL);
 
 	if (rdp_rail_backend_create(b, config) < 0)
@@ -2410,6 +2574,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 err_listener:
 	freerdp_listener_free(b->listener);
 err_compositor:
+	rdp_encoder_destroy(b->encoder);
 	wl_list_for_each_safe(base, next, &compositor->head_list, compositor_link) {
 		if (to_rdp_head(base))
 			rdp_head_destroy(base);
@@ -2448,6 +2613,8 @@ config_init_to_defaults(struct weston_rdp_backend_config *config)
 	config->remotefx_codec = true;
 	config->external_listener_fd = -1;
 	config->refresh_rate = RDP_DEFAULT_FREQ;
+	config->encoder_threads = -1;
+	config->clipboard_max_size = 256;
 	config->rail_config.use_rdpapplist = false;
 	config->rail_config.use_shared_memory = false;
 	config->rail_config.enable_hi_dpi_support = false;
@@ -2460,6 +2627,7 @@ config_init_to_defaults(struct weston_rdp_backend_config *config)
 	config->rail_config.enable_distro_name_title = false;
 	config->rail_config.enable_copy_warning_title = false;
 	config->rail_config.enable_display_power_by_screenupdate = false;
+	config->rail_config.frame_ack_window = 2;
 	config->audio_in_setup = NULL;
 	config->audio_in_teardown = NULL;
 	config->audio_out_setup = NULL;
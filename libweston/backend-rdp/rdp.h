@@ -45,6 +45,7 @@
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/rfx.h>
 #include <freerdp/codec/nsc.h>
+#include <freerdp/codec/planar.h>
 #include <freerdp/locale/keyboard.h>
 #include <freerdp/channels/wtsvc.h>
 #include <freerdp/server/cliprdr.h>
@@ -110,6 +111,7 @@
 struct rdp_output;
 struct rdp_clipboard_data_source;
 struct rdp_backend;
+struct rdp_encoder;
 
 struct rdp_id_manager {
 	struct rdp_backend *rdp_backend;
@@ -123,6 +125,25 @@ struct rdp_id_manager {
 	struct hash_table *hash_table;
 };
 
+#define RDP_STAGING_POOL_CLASSES 15 /* 4 KiB up to 64 MiB */
+
+/* Reusable scratch buffers, for data which only lives until it has been
+ * handed to FreeRDP. Unused buffers are freed after a few idle seconds. */
+struct rdp_staging_pool {
+	struct rdp_backend *rdp_backend;
+	const char *name;
+	struct wl_list free[RDP_STAGING_POOL_CLASSES]; /* rdp_staging_buffer::link */
+	int free_count[RDP_STAGING_POOL_CLASSES];
+	size_t cached_bytes;
+	size_t in_use_bytes;
+	size_t high_water;
+	uint64_t requests;
+	uint64_t hits;
+	uint64_t requests_at_last_trim_check;
+	struct wl_event_source *trim_timer;
+	bool trim_armed;
+};
+
 struct rdp_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
@@ -135,6 +156,7 @@ struct rdp_backend {
 
 	struct weston_log_scope *clipboard_debug;
 	struct weston_log_scope *clipboard_verbose;
+	size_t clipboard_max_size;
 
 	struct wl_list peers;
 
@@ -151,6 +173,8 @@ struct rdp_backend {
 	int rdp_monitor_refresh_rate;
 	pid_t compositor_tid;
 
+	struct rdp_encoder *encoder; /* NULL when encoding synchronously */
+
         rdp_audio_in_setup audio_in_setup;
         rdp_audio_in_teardown audio_in_teardown;
         rdp_audio_out_setup audio_out_setup;
@@ -180,6 +204,8 @@ struct rdp_backend {
 
 	bool enable_display_power_by_screenupdate;
 
+	uint32_t frame_ack_window; /* upper bound, between 1 and 16 */
+
 	bool enable_hi_dpi_support;
 	bool enable_fractional_hi_dpi_support;
 	bool enable_fractional_hi_dpi_roundup;
@@ -231,6 +257,70 @@ struct rdp_head {
 	pixman_rectangle32_t workarea; // in weston coordinate.
 };
 
+enum rdp_encode_codec {
+	RDP_ENCODE_CODEC_RFX,
+	RDP_ENCODE_CODEC_NSC,
+};
+
+/* Everything that affects the encoded bitstream. Peers with an identical
+ * key can be sent the same encoded frame. The codec id is negotiated per
+ * peer but only lives in the surface bits header, so it is not part of it.
+ */
+struct rdp_encode_key {
+	enum rdp_encode_codec codec;
+	uint32_t rfx_mode;
+	uint32_t pixel_format;
+	uint32_t width;
+	uint32_t height;
+};
+
+struct rdp_encoded_frame {
+	struct rdp_encode_key key;
+	SURFACE_BITS_COMMAND cmd;
+};
+
+/* distinct codec settings per repaint; peers beyond that encode on their own */
+#define RDP_ENCODE_CACHE_SIZE 4
+
+/* Per repaint cache of encoded frames, shared by all peers. */
+struct rdp_encode_cache {
+	struct rdp_encoded_frame entries[RDP_ENCODE_CACHE_SIZE];
+	int count;
+	int encoded;
+	int shared;
+};
+
+/* One band of the damage encoded with one set of codec settings,
+ * see rdpencode.c */
+struct rdp_encode_job {
+	struct wl_list link; /* rdp_encoder::job_queue, empty once picked */
+	struct rdp_encode_frame *frame;
+	struct rdp_encode_key key;
+	pixman_region32_t damage;
+	SURFACE_BITS_COMMAND cmd;
+	wStream *stream;
+	bool failed;
+};
+
+/* The frame an output has in flight on the encoder threads. Only one per
+ * output, as the repaint loop waits for it before finishing the frame. */
+struct rdp_encode_frame {
+	struct wl_list link; /* rdp_encoder::done_list */
+	struct rdp_output *output;
+	pixman_image_t *snapshot;
+	struct timespec submit_time;
+
+	/* jobs and their streams are kept around and reused */
+	struct rdp_encode_job *jobs;
+	int job_count;
+	int job_alloc;
+	int jobs_outstanding; /* protected by the encoder mutex */
+
+	bool in_flight;
+	bool cancelled;
+	bool finish_deferred;
+};
+
 struct rdp_output {
 	struct weston_output base;
 	struct rdp_backend *backend;
@@ -238,10 +328,86 @@ struct rdp_output {
 	struct weston_renderbuffer *renderbuffer;
 	pixman_image_t *shadow_surface;
 
+	/* encode cache statistics, see rdp_output_repaint() */
+	uint64_t encoded_frames;
+	uint64_t shared_frames;
+
+	/* asynchronous encoding, see rdpencode.c */
+	struct rdp_encode_frame encode_frame;
+	pixman_image_t *encode_snapshot;
+
 	uint32_t index;
 	struct wl_list link; // rdp_backend::output_list
 };
 
+/* A window icon stored in the client's RAIL icon cache, keyed by the
+ * content of the icon it was scaled from and the size it was scaled to. */
+struct rdp_rail_icon {
+	uint64_t hash;
+	uint32_t src_width;
+	uint32_t src_height;
+	uint32_t width;
+	uint32_t height;
+	uint64_t last_use;
+	bool valid;
+};
+
+/* Mirror of the client's icon caches, sized by the Window List capability
+ * set: slot i is cacheId i / entries_per_cache, cacheEntry the remainder. */
+struct rdp_rail_icon_cache {
+	struct rdp_rail_icon *slots;
+	uint32_t num_slots;
+	uint32_t entries_per_cache;
+	bool initialized;
+
+	uint64_t use_count;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bytes_sent;
+};
+
+/* Backend-private part of weston_surface::backend_state */
+struct rdp_rail_surface_state {
+	struct weston_surface_rail_state base;
+
+	/* rdpgfx update statistics */
+	uint64_t bytes_raw;
+	uint64_t bytes_sent;
+	uint64_t update_time_us;
+	uint32_t update_count;
+};
+
+struct rdp_peer_context;
+
+typedef void (*rdp_loop_task_func_t)(bool freeOnly, void *data);
+
+struct rdp_loop_task {
+	struct rdp_loop_task *next; /* accessed atomically */
+	struct rdp_peer_context *peerCtx;
+	rdp_loop_task_func_t func;
+	/* if non-zero, a later task with the same func and key supersedes
+	 * this one when both are waiting to be dispatched */
+	uint32_t coalesce_key;
+	struct timespec queue_time;
+};
+
+/* Lock-free queue of tasks from FreeRDP threads to the display loop,
+ * with any number of producers and the display loop as sole consumer. */
+struct rdp_loop_task_queue {
+	struct rdp_loop_task *head; /* last pushed, accessed atomically */
+	struct rdp_loop_task *tail; /* next to pop */
+	struct rdp_loop_task stub;
+	uint32_t depth; /* accessed atomically */
+
+	/* statistics, display loop only */
+	uint32_t max_depth;
+	uint64_t wakeups;
+	uint64_t dispatched;
+	uint64_t coalesced;
+	uint64_t latency_total_us;
+	uint64_t latency_max_us;
+};
+
 struct rdp_peer_context {
 	rdpContext _p;
 
@@ -272,6 +438,10 @@ struct rdp_peer_context {
 	DrdynvcServerContext *drdynvc_server_context;
 	DispServerContext *disp_server_context;
 	RdpgfxServerContext *rail_grfx_server_context;
+	uint32_t gfxCapsVersion;
+	uint32_t gfxCapsFlags;
+	BITMAP_PLANAR_CONTEXT *rail_planar_context;
+	struct rdp_staging_pool rail_staging_pool;
 #ifdef HAVE_FREERDP_GFXREDIR_H
 	GfxRedirServerContext *gfxredir_server_context;
 #endif // HAVE_FREERDP_GFXREDIR_H
@@ -292,6 +462,13 @@ struct rdp_peer_context {
 	uint32_t currentFrameId;
 	uint32_t acknowledgedFrameId;
 	bool isAcknowledgedSuspended;
+	/* frames which may be unacknowledged, shrinks while the client
+	 * reports a backlog of frames to decode */
+	uint32_t frameAckWindow;
+	/* a repaint held back window updates for the window to open */
+	bool isFrameUpdateDeferred;
+	uint64_t deferredFrameUpdates;
+	struct rdp_rail_icon_cache iconCache;
 	struct wl_client *clientExec;
 	struct wl_listener clientExec_destroy_listener;
 	struct weston_surface *cursorSurface;
@@ -299,8 +476,7 @@ struct rdp_peer_context {
 	// list of outstanding event_source sent from FreeRDP thread to display loop.
 	int loop_task_event_source_fd;
 	struct wl_event_source *loop_task_event_source;
-	pthread_mutex_t loop_task_list_mutex;
-	struct wl_list loop_task_list; // struct rdp_loop_task::link
+	struct rdp_loop_task_queue loop_task_queue;
 
 	// RAIL power management.
 	struct wl_listener idle_listener;
@@ -316,6 +492,13 @@ struct rdp_peer_context {
 
 	struct wl_listener clipboard_selection_listener;
 
+	/* server selections being read for the client, see rdpclip.c */
+	struct wl_list clipboard_transfer_list;
+	uint64_t clipboard_bytes_sent;
+	uint64_t clipboard_bytes_received;
+	uint32_t clipboard_transfers_sent;
+	uint32_t clipboard_transfers_received;
+
 	/* Multiple monitor support (monitor topology) */
 	int32_t desktop_top, desktop_left;
 	int32_t desktop_width, desktop_height;
@@ -326,13 +509,6 @@ struct rdp_peer_context {
 
 typedef struct rdp_peer_context RdpPeerContext;
 
-typedef void (*rdp_loop_task_func_t)(bool freeOnly, void *data);
-
-struct rdp_loop_task {
-	struct wl_list link;
-	RdpPeerContext *peerCtx;
-	rdp_loop_task_func_t func;
-};
 
 #define RDP_RAIL_MARKER_WINDOW_ID  0xFFFFFFFE
 #define RDP_RAIL_DESKTOP_WINDOW_ID 0xFFFFFFFF
@@ -419,6 +595,12 @@ rdp_dispatch_task_to_display_loop(RdpPeerContext *peerCtx,
 				  rdp_loop_task_func_t func,
 				  struct rdp_loop_task *task);
 
+void
+rdp_dispatch_coalescing_task_to_display_loop(RdpPeerContext *peerCtx,
+					     rdp_loop_task_func_t func,
+					     struct rdp_loop_task *task,
+					     uint32_t coalesce_key);
+
 bool
 rdp_initialize_dispatch_task_event_source(RdpPeerContext *peerCtx);
 
@@ -432,7 +614,30 @@ rdp_clipboard_init(freerdp_peer *client);
 void
 rdp_clipboard_destroy(RdpPeerContext *peerCtx);
 
+/* rdpencode.c */
+struct rdp_encoder *
+rdp_encoder_create(struct rdp_backend *b, int thread_count);
+
+void
+rdp_encoder_destroy(struct rdp_encoder *encoder);
+
+bool
+rdp_encoder_submit(struct rdp_encoder *encoder, struct rdp_output *output,
+		   pixman_region32_t *damage, struct rdp_encode_cache *keys);
+
+bool
+rdp_encoder_defer_finish_frame(struct rdp_output *output);
+
+void
+rdp_encoder_output_fini(struct rdp_encoder *encoder, struct rdp_output *output);
+
 /* rdp.c */
+bool
+rdp_peer_get_encode_key(freerdp_peer *peer, struct rdp_encode_key *key);
+
+uint32_t
+rdp_peer_get_codec_id(freerdp_peer *peer, enum rdp_encode_codec codec);
+
 void
 rdp_head_create(struct rdp_backend *backend, rdpMonitor *config);
 
@@ -473,6 +678,11 @@ void rdp_id_manager_for_each(struct rdp_id_manager *id_manager, hash_table_itera
 BOOL rdp_id_manager_allocate_id(struct rdp_id_manager *id_manager, void *object, UINT32 *new_id);
 void rdp_id_manager_free_id(struct rdp_id_manager *id_manager, UINT32 id);
 void dump_id_manager_state(FILE *fp, struct rdp_id_manager *id_manager, char* title);
+void dump_loop_task_queue_state(FILE *fp, struct rdp_loop_task_queue *queue);
+bool rdp_staging_pool_init(struct rdp_backend *b, struct rdp_staging_pool *pool, const char *name);
+void rdp_staging_pool_fini(struct rdp_staging_pool *pool);
+void *rdp_staging_pool_get(struct rdp_staging_pool *pool, size_t size);
+void rdp_staging_pool_put(struct rdp_staging_pool *pool, void *data);
 bool rdp_defer_rdp_task_to_display_loop(RdpPeerContext *peerCtx, wl_event_loop_fd_func_t func, void *data, struct wl_event_source **event_source);
 void rdp_defer_rdp_task_done(RdpPeerContext *peerCtx);
 
@@ -488,6 +698,12 @@ to_rdp_output(struct weston_output *base)
 	return container_of(base, struct rdp_output, base);
 }
 
+static inline struct rdp_rail_surface_state *
+to_rdp_rail_surface_state(struct weston_surface_rail_state *base)
+{
+	return container_of(base, struct rdp_rail_surface_state, base);
+}
+
 static inline struct rdp_backend *
 to_rdp_backend(struct weston_compositor *base)
 {
@@ -0,0 +1,380 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* RDPGFX_CODECID_ALPHA encoder.
+ *
+ * The alpha plane is either sent raw, one byte per pixel, or as
+ * CLEARCODEC_ALPHA_RLE_SEGMENTs covering the bitmap in raster order, runs
+ * carrying over from one row to the next. Both the alpha extraction and
+ * the run scanning work on whole vectors of pixels where the CPU allows,
+ * the implementation being picked at runtime.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define RDP_ALPHA_HAVE_AVX2
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RDP_ALPHA_HAVE_NEON
+#endif
+
+#include <libweston/helpers.h>
+
+#include "rdpalpha.h"
+
+#define RDP_ALPHA_HEADER_SIZE 4
+
+struct rdp_alpha_funcs {
+	/* copies the alpha of 'width' pixels to 'dst' */
+	void (*extract_row)(uint8_t *dst, const uint8_t *argb, int width);
+	/* returns how many pixels from the start have 'alpha' */
+	int (*run_length)(const uint8_t *argb, int width, uint8_t alpha);
+};
+
+static void
+extract_row_scalar(uint8_t *dst, const uint8_t *argb, int width)
+{
+	for (int i = 0; i < width; i++)
+		dst[i] = argb[i * 4 + 3]; /* 3 = xxxA. */
+}
+
+static int
+run_length_scalar(const uint8_t *argb, int width, uint8_t alpha)
+{
+	int n = 0;
+
+	while (n < width && argb[n * 4 + 3] == alpha)
+		n++;
+
+	return n;
+}
+
+static const struct rdp_alpha_funcs scalar_funcs = {
+	.extract_row = extract_row_scalar,
+	.run_length = run_length_scalar,
+};
+
+#if defined(__SSE2__)
+static void
+extract_row_sse2(uint8_t *dst, const uint8_t *argb, int width)
+{
+	int i = 0;
+
+	for (; i + 16 <= width; i += 16) {
+		const __m128i *src = (const __m128i *)(argb + i * 4);
+		__m128i a0 = _mm_srli_epi32(_mm_loadu_si128(src + 0), 24);
+		__m128i a1 = _mm_srli_epi32(_mm_loadu_si128(src + 1), 24);
+		__m128i a2 = _mm_srli_epi32(_mm_loadu_si128(src + 2), 24);
+		__m128i a3 = _mm_srli_epi32(_mm_loadu_si128(src + 3), 24);
+		__m128i lo = _mm_packs_epi32(a0, a1);
+		__m128i hi = _mm_packs_epi32(a2, a3);
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	extract_row_scalar(dst + i, argb + i * 4, width - i);
+}
+
+static int
+run_length_sse2(const uint8_t *argb, int width, uint8_t alpha)
+{
+	const __m128i mask = _mm_set1_epi32((int)0xff000000);
+	const __m128i ref = _mm_set1_epi32((int)((uint32_t)alpha << 24));
+	int n = 0;
+
+	for (; n + 4 <= width; n += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(argb + n * 4));
+		unsigned eq = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, mask), ref));
+
+		if (eq != 0xffff)
+			return n + __builtin_ctz(~eq) / 4;
+	}
+
+	return n + run_length_scalar(argb + n * 4, width - n, alpha);
+}
+
+static const struct rdp_alpha_funcs sse2_funcs = {
+	.extract_row = extract_row_sse2,
+	.run_length = run_length_sse2,
+};
+#endif
+
+#if defined(RDP_ALPHA_HAVE_AVX2)
+__attribute__((target("avx2"))) static void
+extract_row_avx2(uint8_t *dst, const uint8_t *argb, int width)
+{
+	/* the packs work within 128 bit lanes, put the dwords back in order */
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	int i = 0;
+
+	for (; i + 32 <= width; i += 32) {
+		const __m256i *src = (const __m256i *)(argb + i * 4);
+		__m256i a0 = _mm256_srli_epi32(_mm256_loadu_si256(src + 0), 24);
+		__m256i a1 = _mm256_srli_epi32(_mm256_loadu_si256(src + 1), 24);
+		__m256i a2 = _mm256_srli_epi32(_mm256_loadu_si256(src + 2), 24);
+		__m256i a3 = _mm256_srli_epi32(_mm256_loadu_si256(src + 3), 24);
+		__m256i lo = _mm256_packs_epi32(a0, a1);
+		__m256i hi = _mm256_packs_epi32(a2, a3);
+		__m256i a = _mm256_packus_epi16(lo, hi);
+
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_permutevar8x32_epi32(a, order));
+	}
+
+	extract_row_sse2(dst + i, argb + i * 4, width - i);
+}
+
+__attribute__((target("avx2"))) static int
+run_length_avx2(const uint8_t *argb, int width, uint8_t alpha)
+{
+	const __m256i mask = _mm256_set1_epi32((int)0xff000000);
+	const __m256i ref = _mm256_set1_epi32((int)((uint32_t)alpha << 24));
+	int n = 0;
+
+	for (; n + 8 <= width; n += 8) {
+		__m256i px = _mm256_loadu_si256((const __m256i *)(argb + n * 4));
+		uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(px, mask), ref));
+
+		if (eq != 0xffffffff)
+			return n + __builtin_ctz(~eq) / 4;
+	}
+
+	return n + run_length_sse2(argb + n * 4, width - n, alpha);
+}
+
+static const struct rdp_alpha_funcs avx2_funcs = {
+	.extract_row = extract_row_avx2,
+	.run_length = run_length_avx2,
+};
+#endif
+
+#if defined(RDP_ALPHA_HAVE_NEON)
+static void
+extract_row_neon(uint8_t *dst, const uint8_t *argb, int width)
+{
+	int i = 0;
+
+	for (; i + 16 <= width; i += 16) {
+		uint8x16x4_t px = vld4q_u8(argb + i * 4);
+
+		vst1q_u8(dst + i, px.val[3]);
+	}
+
+	extract_row_scalar(dst + i, argb + i * 4, width - i);
+}
+
+static int
+run_length_neon(const uint8_t *argb, int width, uint8_t alpha)
+{
+	const uint8x16_t ref = vdupq_n_u8(alpha);
+	int n = 0;
+
+	for (; n + 16 <= width; n += 16) {
+		uint8x16x4_t px = vld4q_u8(argb + n * 4);
+
+		if (vminvq_u8(vceqq_u8(px.val[3], ref)) != 0xff)
+			break;
+	}
+
+	return n + run_length_scalar(argb + n * 4, width - n, alpha);
+}
+
+static const struct rdp_alpha_funcs neon_funcs = {
+	.extract_row = extract_row_neon,
+	.run_length = run_length_neon,
+};
+#endif
+
+static const struct rdp_alpha_funcs *
+rdp_alpha_get_funcs(enum rdp_alpha_impl impl)
+{
+	switch (impl) {
+	case RDP_ALPHA_IMPL_AUTO:
+#if defined(RDP_ALPHA_HAVE_AVX2)
+		if (__builtin_cpu_supports("avx2"))
+			return &avx2_funcs;
+#endif
+#if defined(RDP_ALPHA_HAVE_NEON)
+		return &neon_funcs;
+#elif defined(__SSE2__)
+		return &sse2_funcs;
+#else
+		return &scalar_funcs;
+#endif
+	case RDP_ALPHA_IMPL_SCALAR:
+		return &scalar_funcs;
+#if defined(__SSE2__)
+	case RDP_ALPHA_IMPL_SSE2:
+		return &sse2_funcs;
+#endif
+#if defined(RDP_ALPHA_HAVE_AVX2)
+	case RDP_ALPHA_IMPL_AVX2:
+		return __builtin_cpu_supports("avx2") ? &avx2_funcs : NULL;
+#endif
+#if defined(RDP_ALPHA_HAVE_NEON)
+	case RDP_ALPHA_IMPL_NEON:
+		return &neon_funcs;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+static size_t
+rle_segment_size(uint32_t count)
+{
+	if (count < 0xff)
+		return 2;
+	else if (count < 0xffff)
+		return 4;
+	else
+		return 8;
+}
+
+/* CLEARCODEC_ALPHA_RLE_SEGMENT, little endian run length */
+static uint8_t *
+write_rle_segment(uint8_t *out, uint8_t alpha, uint32_t count)
+{
+	*out++ = alpha;
+	if (count < 0xff) {
+		*out++ = count;
+		return out;
+	}
+
+	*out++ = 0xff;
+	if (count < 0xffff) {
+		*out++ = count & 0xff;
+		*out++ = count >> 8;
+		return out;
+	}
+
+	*out++ = 0xff;
+	*out++ = 0xff;
+	*out++ = count & 0xff;
+	*out++ = (count >> 8) & 0xff;
+	*out++ = (count >> 16) & 0xff;
+	*out++ = count >> 24;
+	return out;
+}
+
+static size_t
+rdp_alpha_encode_funcs(const struct rdp_alpha_funcs *funcs, uint8_t *dst,
+		       const uint8_t *argb, int width, int height, int stride,
+		       bool opaque)
+{
+	size_t raw_size = (size_t)width * height;
+	uint8_t *out = dst + RDP_ALPHA_HEADER_SIZE;
+	uint8_t *end = out + raw_size;
+	uint8_t run_alpha = 0xff;
+	uint32_t run = 0;
+
+	/* set up alpha codec header */
+	dst[0] = 'L';	/* signature */
+	dst[1] = 'A';	/* signature */
+	dst[2] = 1;	/* compression: RDP spec indicate this is non-zero value for compressed, but it must be 1.*/
+	dst[3] = 0;	/* compression */
+
+	if (opaque) {
+		run = raw_size;
+	} else {
+		for (int y = 0; y < height; y++) {
+			const uint8_t *row = argb + (size_t)y * stride;
+			int x = 0;
+
+			while (x < width) {
+				uint8_t alpha = row[x * 4 + 3];
+				int n;
+
+				if (run && alpha != run_alpha) {
+					if (out + rle_segment_size(run) > end)
+						goto raw;
+					out = write_rle_segment(out, run_alpha, run);
+					run = 0;
+				}
+
+				run_alpha = alpha;
+				n = funcs->run_length(row + x * 4, width - x, alpha);
+				run += n;
+				x += n;
+			}
+		}
+	}
+
+	if (run) {
+		if (out + rle_segment_size(run) > end)
+			goto raw;
+		out = write_rle_segment(out, run_alpha, run);
+	}
+
+	return out - dst;
+
+raw:
+	dst[2] = 0;
+	if (opaque) {
+		memset(dst + RDP_ALPHA_HEADER_SIZE, 0xff, raw_size);
+	} else {
+		for (int y = 0; y < height; y++)
+			funcs->extract_row(dst + RDP_ALPHA_HEADER_SIZE + (size_t)y * width,
+					   argb + (size_t)y * stride, width);
+	}
+
+	return RDP_ALPHA_HEADER_SIZE + raw_size;
+}
+
+WESTON_EXPORT_FOR_TESTS size_t
+rdp_alpha_encode(uint8_t *dst, const uint8_t *argb, int width, int height,
+		 int stride, bool opaque)
+{
+	return rdp_alpha_encode_funcs(rdp_alpha_get_funcs(RDP_ALPHA_IMPL_AUTO),
+				      dst, argb, width, height, stride, opaque);
+}
+
+WESTON_EXPORT_FOR_TESTS size_t
+rdp_alpha_encode_with(enum rdp_alpha_impl impl, uint8_t *dst,
+		      const uint8_t *argb, int width, int height, int stride,
+		      bool opaque)
+{
+	const struct rdp_alpha_funcs *funcs = rdp_alpha_get_funcs(impl);
+
+	if (!funcs)
+		return 0;
+
+	return rdp_alpha_encode_funcs(funcs, dst, argb, width, height,
+				      stride, opaque);
+}
+
+WESTON_EXPORT_FOR_TESTS bool
+rdp_alpha_impl_supported(enum rdp_alpha_impl impl)
+{
+	return rdp_alpha_get_funcs(impl) != NULL;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RDPALPHA_H
+#define RDPALPHA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum rdp_alpha_impl {
+	RDP_ALPHA_IMPL_AUTO = 0,
+	RDP_ALPHA_IMPL_SCALAR,
+	RDP_ALPHA_IMPL_SSE2,
+	RDP_ALPHA_IMPL_AVX2,
+	RDP_ALPHA_IMPL_NEON,
+};
+
+/*
+ * Size of the buffer rdp_alpha_encode() needs for a width x height bitmap:
+ * the 4 bytes RDPGFX_ALPHA_CODEC header followed by at most one byte per
+ * pixel.
+ */
+static inline size_t
+rdp_alpha_encode_bound(int width, int height)
+{
+	return 4 + (size_t)width * height;
+}
+
+/*
+ * Encodes the alpha channel of a 32 bpp ARGB bitmap ('stride' bytes per row)
+ * as an RDPGFX_CODECID_ALPHA bitstream into 'dst', which must hold
+ * rdp_alpha_encode_bound() bytes. Runs of equal alpha are stored as
+ * CLEARCODEC_ALPHA_RLE_SEGMENTs, unless the raw alpha plane is smaller.
+ * If 'opaque' is set, the alpha channel is taken as 0xff everywhere
+ * without looking at the pixels. Returns the number of bytes written.
+ */
+size_t
+rdp_alpha_encode(uint8_t *dst, const uint8_t *argb, int width, int height,
+		 int stride, bool opaque);
+
+/*
+ * Same as rdp_alpha_encode(), using the given implementation instead of
+ * the best one the CPU supports. Returns 0 if 'impl' is not supported.
+ */
+size_t
+rdp_alpha_encode_with(enum rdp_alpha_impl impl, uint8_t *dst,
+		      const uint8_t *argb, int width, int height, int stride,
+		      bool opaque);
+
+bool
+rdp_alpha_impl_supported(enum rdp_alpha_impl impl);
+
+#endif /* RDPALPHA_H */
@@ -26,12 +26,16 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <linux/input.h>
 #include <stdio.h>
 
@@ -40,6 +44,7 @@
 #include <winpr/string.h>
 
 #include "libweston-internal.h"
+#include "shared/timespec-util.h"
 
 /* From MSDN, RegisterClipboardFormat API.
    Registered clipboard formats are identified by values in the range 0xC000 through 0xFFFF. */
@@ -62,38 +67,75 @@ static const char rdp_clipboard_html_header[] = "Version:0.9\r\nStartHTML:-1\r\n
 static const char rdp_clipboard_html_fragment_start[] = "<!--StartFragment-->\r\n";
 static const char rdp_clipboard_html_fragment_end[] = "<!--EndFragment-->\r\n";
 
+/* Largest piece of data converted at once. This bounds the memory used
+ * besides the converted data, and the time a write spends on the
+ * compositor thread. */
+#define RDP_CLIPBOARD_CHUNK_SIZE (64 * 1024)
+
 struct rdp_clipboard_data_source;
+struct rdp_clipboard_transfer;
+
+/* Linux to Windows: converts the next piece of the selection, data is NULL
+ * once the selection is complete. Called on the transfer thread. */
+typedef bool (*pfn_send_data)(struct rdp_clipboard_transfer *transfer,
+			      const char *data, size_t size);
 
-typedef bool (*pfn_process_data)(struct rdp_clipboard_data_source *source, bool is_send);
+/* Windows to Linux: picks the part of the client's data to write and
+ * converts it piece by piece, see clipboard_data_source_write(). Without a
+ * receive_next function, the picked data is written as is. */
+typedef bool (*pfn_receive_begin)(struct rdp_clipboard_data_source *source);
+typedef bool (*pfn_receive_next)(struct rdp_clipboard_data_source *source);
 
 struct rdp_clipboard_supported_format {
 	uint32_t format_id;
 	char *format_name;
 	char *mime_type;
-	pfn_process_data pfn;
+	pfn_send_data send;
+	pfn_receive_begin receive_begin;
+	pfn_receive_next receive_next;
 };
 
 static bool
-clipboard_process_text_utf8(struct rdp_clipboard_data_source *source, bool is_send);
+clipboard_send_text_utf8(struct rdp_clipboard_transfer *transfer, const char *data, size_t size);
+
+static bool
+clipboard_receive_text_utf8_begin(struct rdp_clipboard_data_source *source);
+
+static bool
+clipboard_receive_text_utf8(struct rdp_clipboard_data_source *source);
+
+static bool
+clipboard_send_text_raw(struct rdp_clipboard_transfer *transfer, const char *data, size_t size);
 
 static bool
-clipboard_process_text_raw(struct rdp_clipboard_data_source *source, bool is_send);
+clipboard_receive_text_raw_begin(struct rdp_clipboard_data_source *source);
 
 static bool
-clipboard_process_bmp(struct rdp_clipboard_data_source *source , bool is_send);
+clipboard_send_bmp(struct rdp_clipboard_transfer *transfer, const char *data, size_t size);
 
 static bool
-clipboard_process_html(struct rdp_clipboard_data_source *source, bool is_send);
+clipboard_receive_bmp_begin(struct rdp_clipboard_data_source *source);
+
+static bool
+clipboard_send_html(struct rdp_clipboard_transfer *transfer, const char *data, size_t size);
+
+static bool
+clipboard_receive_html_begin(struct rdp_clipboard_data_source *source);
 
 /* TODO: need to support to 1:n or m:n format conversion.
  * For example, CF_UNICODETEXT to "UTF8_STRING" as well as "text/plain;charset=utf-8".
  */
 struct rdp_clipboard_supported_format clipboard_supported_formats[] = {
-	{ CF_UNICODETEXT,  NULL,               "text/plain;charset=utf-8", clipboard_process_text_utf8 },
-	{ CF_TEXT,         NULL,               "STRING",                   clipboard_process_text_raw  },
-	{ CF_DIB,          NULL,               "image/bmp",                clipboard_process_bmp       },
-	{ CF_PRIVATE_RTF,  "Rich Text Format", "text/rtf",                 clipboard_process_text_raw  },
-	{ CF_PRIVATE_HTML, "HTML Format",      "text/html",                clipboard_process_html      },
+	{ CF_UNICODETEXT,  NULL,               "text/plain;charset=utf-8",
+	  clipboard_send_text_utf8, clipboard_receive_text_utf8_begin, clipboard_receive_text_utf8 },
+	{ CF_TEXT,         NULL,               "STRING",
+	  clipboard_send_text_raw,  clipboard_receive_text_raw_begin,  NULL },
+	{ CF_DIB,          NULL,               "image/bmp",
+	  clipboard_send_bmp,       clipboard_receive_bmp_begin,       NULL },
+	{ CF_PRIVATE_RTF,  "Rich Text Format", "text/rtf",
+	  clipboard_send_text_raw,  clipboard_receive_text_raw_begin,  NULL },
+	{ CF_PRIVATE_HTML, "HTML Format",      "text/html",
+	  clipboard_send_html,      clipboard_receive_html_begin,      NULL },
 };
 #define RDP_NUM_CLIPBOARD_FORMATS ARRAY_LENGTH(clipboard_supported_formats)
 
@@ -111,11 +153,12 @@ enum rdp_clipboard_data_source_state {
 	RDP_CLIPBOARD_SOURCE_FAILED, /* failure occured */
 };
 
+/* Client's clipboard published to the server side applications */
 struct rdp_clipboard_data_source {
 	struct weston_data_source base;
 	struct rdp_loop_task task_base;
 	struct wl_event_source *transfer_event_source; /* used for read/write with pipe */
-	struct wl_array data_contents;
+	struct wl_array data_contents; /* as received from the client */
 	void *context;
 	int refcount;
 	int data_source_fd;
@@ -125,14 +168,41 @@ struct rdp_clipboard_data_source {
 	uint32_t inflight_write_count;
 	void *inflight_data_to_write;
 	size_t inflight_data_size;
-	bool is_data_processed;
-	void *processed_data_start;
-	uint32_t processed_data_size;
-	bool processed_data_is_send;
+	/* rest of data_contents to convert and write, NULL when not writing */
+	const char *receive_pos;
+	size_t receive_left;
+	struct wl_array receive_chunk; /* converted piece being written */
+	uint64_t bytes_written;
+	struct timespec transfer_start;
 	bool is_canceled;
 	uint32_t client_format_id_table[RDP_NUM_CLIPBOARD_FORMATS];
 };
 
+/* Server selection requested by the client. The pipe is read and the data
+ * converted on a thread of its own, which then hands the transfer back to
+ * the display loop, where clipboard_transfer_done() sends the response. */
+struct rdp_clipboard_transfer {
+	struct rdp_loop_task task_base;
+	struct wl_list link; /* RdpPeerContext::clipboard_transfer_list */
+	RdpPeerContext *ctx;
+	pthread_t thread;
+	bool joined;
+	int fd; /* read end of the pipe to the selection */
+	int cancel_fd; /* eventfd, aborts the read */
+	int format_index;
+
+	/* transfer thread only until done */
+	struct wl_array data; /* response converted so far */
+	char carry[4]; /* UTF-8 sequence split across reads */
+	size_t carry_size;
+	bool text_ended; /* NUL seen, the rest is dropped */
+	bool failed;
+	bool canceled;
+	uint64_t bytes_read;
+	struct timespec start;
+	struct timespec end;
+};
+
 struct rdp_clipboard_data_request {
 	struct rdp_loop_task task_base;
 	RdpPeerContext *ctx;
@@ -174,164 +244,234 @@ clipboard_data_source_state_to_string(struct rdp_clipboard_data_source *source)
 }
 
 static bool
-clipboard_process_text_utf8(struct rdp_clipboard_data_source *source, bool is_send)
+clipboard_transfer_append(struct rdp_clipboard_transfer *transfer,
+			  const void *data, size_t size)
 {
-	freerdp_peer *client = (freerdp_peer *)source->context;
-	RdpPeerContext *ctx = (RdpPeerContext *)client->context;
-	struct rdp_backend *b = ctx->rdpBackend;
-	struct wl_array data_contents;
+	void *p;
+
+	if (!size)
+		return true;
+
+	p = wl_array_add(&transfer->data, size);
+	if (!p)
+		return false;
+	memcpy(p, data, size);
 
-	wl_array_init(&data_contents);
+	return true;
+}
+
+static size_t
+clipboard_utf8_sequence_length(char lead)
+{
+	uint8_t c = lead;
+
+	if (c >= 0xF0)
+		return 4;
+	if (c >= 0xE0)
+		return 3;
+	if (c >= 0xC0)
+		return 2;
+	return 1;
+}
 
-	assert(!source->is_data_processed);
+/* size of data without a multi-byte sequence cut at its end */
+static size_t
+clipboard_utf8_complete_size(const char *data, size_t size)
+{
+	size_t i = size;
 
-	if (is_send) {
-		char *data = source->data_contents.data;
-		size_t data_size, data_size_in_char;
+	/* back to the lead byte of the last sequence */
+	while (i > 0 && size - i < 3 && ((uint8_t)data[i - 1] & 0xC0) == 0x80)
+		i--;
+	if (i == 0 || (uint8_t)data[i - 1] < 0xC0)
+		return size;
+	if (size - (i - 1) < clipboard_utf8_sequence_length(data[i - 1]))
+		return i - 1;
 
-		/* Linux to Windows (convert utf-8 to UNICODE) */
-		/* Include terminating NULL in size */
-		assert((source->data_contents.size + 1) <= source->data_contents.alloc);
-		data[source->data_contents.size] = '\0';
-		source->data_contents.size++;
+	return size;
+}
 
-		/* obtain size in UNICODE */
+static bool
+clipboard_utf8_to_unicode_append(struct wl_array *array, const char *data, size_t size)
+{
+	ssize_t length, converted;
+	WCHAR *dst;
+
+	if (!size)
+		return true;
+
+	/* obtain size in UNICODE */
 #if USE_FREERDP_VERSION >= 3
-		data_size = ConvertUtf8NToWChar(data, source->data_contents.size, NULL, 0);
+	length = ConvertUtf8NToWChar(data, size, NULL, 0);
 #else
-		data_size = MultiByteToWideChar(CP_UTF8, 0,
-						data,
-						source->data_contents.size,
-						NULL, 0);
+	length = MultiByteToWideChar(CP_UTF8, 0, data, size, NULL, 0);
 #endif
-		if (data_size < 1)
-			goto error_return;
+	if (length < 1)
+		return false;
 
-		data_size *= 2; /* convert to size in bytes. */
-		if (!wl_array_add(&data_contents, data_size))
-			goto error_return;
+	dst = wl_array_add(array, length * sizeof(WCHAR));
+	if (!dst)
+		return false;
 
-		/* convert to UNICODE */
+	/* convert to UNICODE */
 #if USE_FREERDP_VERSION >= 3
-		data_size_in_char = ConvertUtf8NToWChar(data,
-							source->data_contents.size,
-							data_contents.data,
-							data_size);
+	converted = ConvertUtf8NToWChar(data, size, dst, length);
 #else
-		data_size_in_char = MultiByteToWideChar(CP_UTF8, 0,
-							data,
-							source->data_contents.size,
-							data_contents.data,
-							data_size);
+	converted = MultiByteToWideChar(CP_UTF8, 0, data, size, dst, length);
 #endif
-		assert(data_contents.size == (data_size_in_char * 2));
-	} else {
-		/* Windows to Linux (UNICODE to utf-8) */
-		size_t data_size;
-		LPWSTR data = source->data_contents.data;
-		size_t data_size_in_char = source->data_contents.size / 2;
-
-		/* Windows's data has trailing chars, which Linux doesn't expect. */
-		while (data_size_in_char &&
-		       ((data[data_size_in_char-1] == L'\0') || (data[data_size_in_char-1] == L'\n')))
-			data_size_in_char -= 1;
-		if (!data_size_in_char)
-			goto error_return;
-
-		/* obtain size in utf-8 */
+
+	return converted == length;
+}
+
+static bool
+clipboard_send_text_utf8(struct rdp_clipboard_transfer *transfer, const char *data, size_t size)
+{
+	const WCHAR terminator = 0;
+	const char *end;
+	size_t need, n, complete;
+
+	/* Linux to Windows (convert utf-8 to UNICODE) */
+	if (!data) {
+		/* a sequence cut at the very end is left to the converter */
+		if (!clipboard_utf8_to_unicode_append(&transfer->data, transfer->carry,
+						      transfer->carry_size))
+			return false;
+		transfer->carry_size = 0;
+
+		/* Include terminating NULL in size */
+		return clipboard_transfer_append(transfer, &terminator, sizeof terminator);
+	}
+
+	/* text ends at the first NULL */
+	if (transfer->text_ended)
+		return true;
+	end = memchr(data, '\0', size);
+	if (end) {
+		size = end - data;
+		transfer->text_ended = true;
+	}
+
+	/* complete the sequence cut by the previous read first */
+	if (transfer->carry_size) {
+		need = clipboard_utf8_sequence_length(transfer->carry[0]) - transfer->carry_size;
+		n = MIN(need, size);
+		memcpy(&transfer->carry[transfer->carry_size], data, n);
+		transfer->carry_size += n;
+		data += n;
+		size -= n;
+		if (n < need)
+			return true;
+
+		if (!clipboard_utf8_to_unicode_append(&transfer->data, transfer->carry,
+						      transfer->carry_size))
+			return false;
+		transfer->carry_size = 0;
+	}
+
+	complete = clipboard_utf8_complete_size(data, size);
+	if (!clipboard_utf8_to_unicode_append(&transfer->data, data, complete))
+		return false;
+
+	transfer->carry_size = size - complete;
+	memcpy(transfer->carry, data + complete, transfer->carry_size);
+
+	return true;
+}
+
+static bool
+clipboard_receive_text_utf8_begin(struct rdp_clipboard_data_source *source)
+{
+	const WCHAR *data = source->data_contents.data;
+	size_t length = source->data_contents.size / sizeof(WCHAR);
+	size_t i;
+
+	/* Windows to Linux (UNICODE to utf-8) */
+	/* Windows's data has trailing chars, which Linux doesn't expect. */
+	for (i = 0; i < length; i++) {
+		if (data[i] == 0) {
+			length = i;
+			break;
+		}
+	}
+	while (length && data[length - 1] == L'\n')
+		length--;
+	if (!length)
+		return false;
+
+	source->receive_pos = source->data_contents.data;
+	source->receive_left = length * sizeof(WCHAR);
+
+	return true;
+}
+
+static bool
+clipboard_receive_text_utf8(struct rdp_clipboard_data_source *source)
+{
+	const WCHAR *data = (const WCHAR *)source->receive_pos;
+	size_t left = source->receive_left / sizeof(WCHAR);
+	size_t count = MIN(left, RDP_CLIPBOARD_CHUNK_SIZE / sizeof(WCHAR));
+	ssize_t size, converted;
+
+	/* keep surrogate pairs together */
+	if (count < left && data[count - 1] >= 0xD800 && data[count - 1] <= 0xDBFF)
+		count--;
+
+	/* obtain size in utf-8 */
 #if USE_FREERDP_VERSION >= 3
-		data_size = ConvertWCharNToUtf8(source->data_contents.data,
-						data_size_in_char,
-						NULL, 0);
+	size = ConvertWCharNToUtf8(data, count, NULL, 0);
 #else
-		data_size = WideCharToMultiByte(CP_UTF8, 0,
-						source->data_contents.data,
-						data_size_in_char,
-						NULL, 0,
-						NULL, NULL);
+	size = WideCharToMultiByte(CP_UTF8, 0, data, count, NULL, 0, NULL, NULL);
 #endif
-		if (data_size < 1)
-			goto error_return;
+	if (size < 1)
+		return false;
 
-		if (!wl_array_add(&data_contents, data_size))
-			goto error_return;
+	source->receive_chunk.size = 0;
+	if (!wl_array_add(&source->receive_chunk, size))
+		return false;
 
-		/* convert to utf-8 */
+	/* convert to utf-8 */
 #if USE_FREERDP_VERSION >= 3
-		data_size = ConvertWCharNToUtf8(source->data_contents.data,
-						data_size_in_char,
-						data_contents.data,
-						data_size);
+	converted = ConvertWCharNToUtf8(data, count, source->receive_chunk.data, size);
 #else
-		data_size = WideCharToMultiByte(CP_UTF8, 0,
-						source->data_contents.data,
-						data_size_in_char,
-						data_contents.data,
-						data_size,
-						NULL, NULL);
+	converted = WideCharToMultiByte(CP_UTF8, 0, data, count,
+					source->receive_chunk.data, size,
+					NULL, NULL);
 #endif
-		if (data_contents.size != data_size)
-			goto error_return;
-	}
+	if (converted != size)
+		return false;
 
-	/* swap the data_contents with new one */
-	wl_array_release(&source->data_contents);
-	source->data_contents = data_contents;
-	source->is_data_processed = true;
-	source->processed_data_start = source->data_contents.data;
-	source->processed_data_size = source->data_contents.size;
-	rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s): %s (%u bytes)\n",
-				    __func__, source,
-				    clipboard_data_source_state_to_string(source),
-				    is_send ? "send" : "receive",
-				    (uint32_t)source->data_contents.size);
+	source->inflight_data_to_write = source->receive_chunk.data;
+	source->inflight_data_size = size;
+	source->receive_pos += count * sizeof(WCHAR);
+	source->receive_left -= count * sizeof(WCHAR);
 
 	return true;
+}
 
-error_return:
-	source->state = RDP_CLIPBOARD_SOURCE_FAILED;
-	weston_log("RDP %s FAILED (%p:%s): %s (%u bytes)\n",
-		   __func__, source,
-		   clipboard_data_source_state_to_string(source),
-		   is_send ? "send" : "receive",
-		   (uint32_t)source->data_contents.size);
-
-	wl_array_release(&data_contents);
+static bool
+clipboard_send_text_raw(struct rdp_clipboard_transfer *transfer, const char *data, size_t size)
+{
+	/* Linux to Windows */
+	/* Include terminating NULL in size */
+	if (!data)
+		return clipboard_transfer_append(transfer, "", 1);
 
-	return false;
+	return clipboard_transfer_append(transfer, data, size);
 }
 
 static bool
-clipboard_process_text_raw(struct rdp_clipboard_data_source *source, bool is_send)
+clipboard_receive_text_raw_begin(struct rdp_clipboard_data_source *source)
 {
-	freerdp_peer *client = (freerdp_peer *)source->context;
-	RdpPeerContext *ctx = (RdpPeerContext *)client->context;
-	struct rdp_backend *b = ctx->rdpBackend;
-	char *data = source->data_contents.data;
-	size_t data_size = source->data_contents.size;
+	const char *data = source->data_contents.data;
+	size_t size = source->data_contents.size;
 
-	assert(!source->is_data_processed);
+	/* Windows to Linux */
+	/* Windows's data has trailing chars, which Linux doesn't expect. */
+	while (size && ((data[size-1] == '\0') || (data[size-1] == '\n')))
+		size -= 1;
 
-	if (is_send) {
-		/* Linux to Windows */
-		/* Include terminating NULL in size */
-		assert(data_size + 1 <= source->data_contents.alloc);
-		data[data_size] = '\0';
-		source->data_contents.size++;
-	} else {
-		/* Windows to Linux */
-		/* Windows's data has trailing chars, which Linux doesn't expect. */
-		while (data_size && ((data[data_size-1] == '\0') || (data[data_size-1] == '\n')))
-			data_size -= 1;
-		source->data_contents.size = data_size;
-	}
-	source->is_data_processed = true;
-	source->processed_data_start = source->data_contents.data;
-	source->processed_data_size = source->data_contents.size;
-	rdp_debug_clipboard_verbose(b, "RDP %s (%p): %s (%u bytes)\n",
-				    __func__, source,
-				    is_send ? "send" : "receive",
-				    (uint32_t)source->data_contents.size);
+	source->receive_pos = data;
+	source->receive_left = size;
 
 	return true;
 }
@@ -342,203 +482,177 @@ clipboard_process_text_raw(struct rdp_clipboard_data_source *source, bool is_sen
    because Firefox sends "<meta http-equiv="content-type" content="text/html; charset=utf-8">...", thus
    this needs to property strip meta header and convert to the Windows clipboard style HTML. */
 static bool
-clipboard_process_html(struct rdp_clipboard_data_source *source, bool is_send)
+clipboard_send_html(struct rdp_clipboard_transfer *transfer, const char *data, size_t size)
 {
-	freerdp_peer *client = (freerdp_peer *)source->context;
-	RdpPeerContext *ctx = (RdpPeerContext *)client->context;
-	struct rdp_backend *b = ctx->rdpBackend;
-	struct wl_array data_contents;
-	char *cur = source->data_contents.data;
-
-	assert(!source->is_data_processed);
-
-	/* We're treating the contents as a string for now, so null
-	 * terminate it so strstr can't run off the end. However, we
-	 * don't increase data_contents.size because we don't want
-	 * to affect the content. */
-	assert(source->data_contents.size + 1 <= source->data_contents.alloc);
-	((char *)(source->data_contents.data))[source->data_contents.size] = '\0';
-
-	wl_array_init(&data_contents);
-	cur = strstr(cur, "<html");
+	const size_t header_size = strlen(rdp_clipboard_html_header);
+	const size_t start_size = strlen(rdp_clipboard_html_fragment_start);
+	const size_t end_size = strlen(rdp_clipboard_html_fragment_end);
+	struct wl_array *html = &transfer->data;
+	size_t html_offset, body_offset, end_offset, length, new_size;
+	size_t fragment_start, fragment_end;
+	char digits[9];
+	char *buf, *cur;
+
+	if (data)
+		return clipboard_transfer_append(transfer, data, size);
+
+	/* Linux to Windows: the whole document is here, put the header in
+	 * front and the fragment markers around the body, in place. The
+	 * contents is treated as a string, so null terminate it so strstr
+	 * can't run off the end. */
+	if (!clipboard_transfer_append(transfer, "", 1))
+		return false;
+	buf = html->data;
+	length = strlen(buf);
+
+	cur = strstr(buf, "<html");
 	if (!cur)
-		goto error_return;
-
-	if (!is_send) {
-		/* Windows to Linux */
-		size_t data_size = source->data_contents.size -
-				   (cur - (char *)source->data_contents.data);
-
-		/* Windows's data has trailing chars, which Linux doesn't expect. */
-		while (data_size && ((cur[data_size-1] == '\0') || (cur[data_size-1] == '\n')))
-			data_size -= 1;
+		return false;
+	html_offset = cur - buf;
+	cur = strstr(cur, "<body");
+	if (!cur)
+		return false;
+	cur += 5;
+	while (*cur != '>' && *cur != '\0')
+		cur++;
+	if (*cur == '\0')
+		return false;
+	cur++; /* include '>' */
+	body_offset = cur - buf;
+	cur = strstr(cur, "</body");
+	if (!cur)
+		return false;
+	end_offset = cur - buf;
+
+	fragment_start = header_size + body_offset - html_offset;
+	fragment_end = fragment_start + start_size + end_offset - body_offset;
+	if (fragment_end > 99999999)
+		return false; /* offsets are 8 digits */
+
+	new_size = fragment_end + end_size + length - end_offset + 1; /* +1 for null */
+	if (new_size > html->size) {
+		if (!wl_array_add(html, new_size - html->size))
+			return false;
+		buf = html->data;
+	}
 
-		if (!data_size)
-			goto error_return;
+	/* everything from "<html" behind the header, then the part from
+	 * "</body" and the body behind their markers */
+	memmove(buf + header_size, buf + html_offset, length - html_offset);
+	memmove(buf + fragment_end + end_size,
+		buf + fragment_start + end_offset - body_offset,
+		length - end_offset);
+	memmove(buf + fragment_start + start_size, buf + fragment_start,
+		end_offset - body_offset);
+
+	memcpy(buf, rdp_clipboard_html_header, header_size);
+	memcpy(buf + fragment_start, rdp_clipboard_html_fragment_start, start_size);
+	memcpy(buf + fragment_end, rdp_clipboard_html_fragment_end, end_size);
+	buf[new_size - 1] = '\0';
+	html->size = new_size;
+
+	snprintf(digits, sizeof digits, "%08zu", fragment_start);
+	memcpy(buf + RDP_CLIPBOARD_FRAGMENT_START_OFFSET, digits, 8);
+	snprintf(digits, sizeof digits, "%08zu", fragment_end);
+	memcpy(buf + RDP_CLIPBOARD_FRAGMENT_END_OFFSET, digits, 8);
 
-		if (!wl_array_add(&data_contents, data_size+1)) /* +1 for null */
-			goto error_return;
+	return true;
+}
 
-		memcpy(data_contents.data, cur, data_size);
-		((char *)(data_contents.data))[data_size] = '\0';
-		data_contents.size = data_size;
-	} else {
-		/* Linux to Windows */
-		char *last, *buf;
-		uint32_t fragment_start, fragment_end;
-
-		if (!wl_array_add(&data_contents, source->data_contents.size+200))
-			goto error_return;
-
-		buf = data_contents.data;
-		strcpy(buf, rdp_clipboard_html_header);
-		last = cur;
-		cur = strstr(cur, "<body");
-		if (!cur)
-			goto error_return;
-		cur += 5;
-		while (*cur != '>' && *cur != '\0')
-			cur++;
-		if (*cur == '\0')
-			goto error_return;
-		cur++; /* include '>' */
-		strncat(buf, last, cur-last);
-		last = cur;
-		fragment_start = strlen(buf);
-		strcat(buf, rdp_clipboard_html_fragment_start);
-		cur = strstr(cur, "</body");
-		if (!cur)
-			goto error_return;
-		strncat(buf, last, cur-last);
-		fragment_end = strlen(buf);
-		strcat(buf, rdp_clipboard_html_fragment_end);
-		strcat(buf, cur);
-
-		cur = buf + RDP_CLIPBOARD_FRAGMENT_START_OFFSET;
-		sprintf(cur, "%08u", fragment_start);
-		*(cur+8) = '\r';
-		cur = buf + RDP_CLIPBOARD_FRAGMENT_END_OFFSET;
-		sprintf(cur, "%08u", fragment_end);
-		*(cur+8) = '\r';
-
-		data_contents.size = strlen(buf) + 1; /* +1 to null terminate. */
-	}
+static bool
+clipboard_receive_html_begin(struct rdp_clipboard_data_source *source)
+{
+	/* data_contents is null terminated, see
+	 * clipboard_client_format_data_response() */
+	char *cur = strstr(source->data_contents.data, "<html");
+	size_t data_size;
 
-	/* swap the data_contents with new one */
-	wl_array_release(&source->data_contents);
-	source->data_contents = data_contents;
-	source->is_data_processed = true;
-	source->processed_data_start = source->data_contents.data;
-	source->processed_data_size = source->data_contents.size;
-	rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s): %s (%u bytes)\n",
-				    __func__, source, clipboard_data_source_state_to_string(source),
-				    is_send ? "send" : "receive", (uint32_t)source->data_contents.size);
+	if (!cur)
+		return false;
 
-	return true;
+	/* Windows to Linux */
+	data_size = source->data_contents.size -
+		    (cur - (char *)source->data_contents.data);
 
-error_return:
-	source->state = RDP_CLIPBOARD_SOURCE_FAILED;
-	weston_log("RDP %s FAILED (%p:%s): %s (%u bytes)\n",
-		   __func__, source, clipboard_data_source_state_to_string(source),
-		   is_send ? "send" : "receive", (uint32_t)source->data_contents.size);
+	/* Windows's data has trailing chars, which Linux doesn't expect. */
+	while (data_size && ((cur[data_size-1] == '\0') || (cur[data_size-1] == '\n')))
+		data_size -= 1;
+	if (!data_size)
+		return false;
 
-	wl_array_release(&data_contents);
+	source->receive_pos = cur;
+	source->receive_left = data_size;
 
-	return false;
+	return true;
 }
 
 #define DIB_HEADER_MARKER     ((WORD) ('M' << 8) | 'B')
 #define DIB_WIDTH_BYTES(bits) ((((bits) + 31) & ~31) >> 3)
 
 static bool
-clipboard_process_bmp(struct rdp_clipboard_data_source *source, bool is_send)
+clipboard_send_bmp(struct rdp_clipboard_transfer *transfer, const char *data, size_t size)
 {
-	freerdp_peer *client = (freerdp_peer *)source->context;
-	RdpPeerContext *ctx = (RdpPeerContext *)client->context;
-	struct rdp_backend *b = ctx->rdpBackend;
-	BITMAPFILEHEADER *bmfh = NULL;
-	BITMAPINFOHEADER *bmih = NULL;
-	uint32_t color_table_size = 0;
-	struct wl_array data_contents;
-
-	assert(!source->is_data_processed);
-
-	wl_array_init(&data_contents);
-
-	if (is_send) {
-		/* Linux to Windows (remove BITMAPFILEHEADER) */
-		if (source->data_contents.size <= sizeof(*bmfh))
-			goto error_return;
-
-		bmfh = source->data_contents.data;
-		bmih = (BITMAPINFOHEADER *)(bmfh + 1);
-
-		source->is_data_processed = true;
-		source->processed_data_start = bmih;
-		source->processed_data_size = source->data_contents.size - sizeof(*bmfh);
-	} else {
-		/* Windows to Linux (insert BITMAPFILEHEADER) */
-		BITMAPFILEHEADER _bmfh = {};
-
-		if (source->data_contents.size <= sizeof(*bmih))
-			goto error_return;
-
-		bmih = source->data_contents.data;
-		bmfh = &_bmfh;
-		if (bmih->biCompression == BI_BITFIELDS)
-			color_table_size = sizeof(RGBQUAD) * 3;
-		else
-			color_table_size = sizeof(RGBQUAD) * bmih->biClrUsed;
-
-		bmfh->bfType = DIB_HEADER_MARKER;
-		bmfh->bfOffBits = sizeof(*bmfh) + bmih->biSize + color_table_size;
-		if (bmih->biSizeImage)
-			bmfh->bfSize = bmfh->bfOffBits + bmih->biSizeImage;
-		else if (bmih->biCompression == BI_BITFIELDS || bmih->biCompression == BI_RGB)
-			bmfh->bfSize = bmfh->bfOffBits +
-				       (DIB_WIDTH_BYTES(bmih->biWidth * bmih->biBitCount) * abs(bmih->biHeight));
-		else
-			goto error_return;
-
-		/* source data must have enough size as described in its own bitmap header */
-		if (source->data_contents.size < (bmfh->bfSize - sizeof(*bmfh)))
-			goto error_return;
-
-		if (!wl_array_add(&data_contents, bmfh->bfSize))
-			goto error_return;
-		assert(data_contents.size == bmfh->bfSize);
-
-		/* copy generated BITMAPFILEHEADER */
-		memcpy(data_contents.data, bmfh, sizeof(*bmfh));
-		/* copy rest of bitmap data from source */
-		memcpy((char *)data_contents.data + sizeof(*bmfh),
-		       source->data_contents.data, bmfh->bfSize - sizeof(*bmfh));
-
-		/* swap the data_contents with new one */
-		wl_array_release(&source->data_contents);
-		source->data_contents = data_contents;
-		source->is_data_processed = true;
-		source->processed_data_start = source->data_contents.data;
-		source->processed_data_size = source->data_contents.size;
+	/* offset of this piece in the selection */
+	uint64_t offset = transfer->bytes_read - size;
+	size_t skip;
+
+	/* Linux to Windows (remove BITMAPFILEHEADER) */
+	if (!data)
+		return transfer->data.size > 0;
+
+	if (offset < sizeof(BITMAPFILEHEADER)) {
+		skip = MIN(sizeof(BITMAPFILEHEADER) - offset, size);
+		data += skip;
+		size -= skip;
 	}
 
-	rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s): %s (%d bytes)\n",
-				    __func__, source,
-				    clipboard_data_source_state_to_string(source),
-				    is_send ? "send" : "receive",
-				    (uint32_t)source->data_contents.size);
-
-	return true;
+	return clipboard_transfer_append(transfer, data, size);
+}
 
-error_return:
-	source->state = RDP_CLIPBOARD_SOURCE_FAILED;
-	weston_log("RDP %s FAILED (%p:%s): %s (%d bytes)\n",
-		   __func__, source, clipboard_data_source_state_to_string(source),
-		   is_send ? "send" : "receive", (uint32_t)source->data_contents.size);
+static bool
+clipboard_receive_bmp_begin(struct rdp_clipboard_data_source *source)
+{
+	BITMAPFILEHEADER *bmfh;
+	BITMAPINFOHEADER *bmih;
+	uint32_t color_table_size = 0;
 
-	wl_array_release(&data_contents);
+	/* Windows to Linux (insert BITMAPFILEHEADER) */
+	if (source->data_contents.size <= sizeof(*bmih))
+		return false;
+
+	bmih = source->data_contents.data;
+	if (bmih->biCompression == BI_BITFIELDS)
+		color_table_size = sizeof(RGBQUAD) * 3;
+	else
+		color_table_size = sizeof(RGBQUAD) * bmih->biClrUsed;
+
+	source->receive_chunk.size = 0;
+	bmfh = wl_array_add(&source->receive_chunk, sizeof(*bmfh));
+	if (!bmfh)
+		return false;
+	memset(bmfh, 0, sizeof(*bmfh));
+
+	bmfh->bfType = DIB_HEADER_MARKER;
+	bmfh->bfOffBits = sizeof(*bmfh) + bmih->biSize + color_table_size;
+	if (bmih->biSizeImage)
+		bmfh->bfSize = bmfh->bfOffBits + bmih->biSizeImage;
+	else if (bmih->biCompression == BI_BITFIELDS || bmih->biCompression == BI_RGB)
+		bmfh->bfSize = bmfh->bfOffBits +
+			       (DIB_WIDTH_BYTES(bmih->biWidth * bmih->biBitCount) * abs(bmih->biHeight));
+	else
+		return false;
+
+	/* source data must have enough size as described in its own bitmap header */
+	if (source->data_contents.size < (bmfh->bfSize - sizeof(*bmfh)))
+		return false;
+
+	/* the generated header goes first, then the client's bitmap data */
+	source->inflight_data_to_write = bmfh;
+	source->inflight_data_size = sizeof(*bmfh);
+	source->receive_pos = source->data_contents.data;
+	source->receive_left = bmfh->bfSize - sizeof(*bmfh);
 
-	return false;
+	return true;
 }
 
 static char *
@@ -666,28 +780,6 @@ clipboard_find_supported_format_by_mime_type(const char *mime_type)
 	return -1;
 }
 
-static bool
-clipboard_process_source(struct rdp_clipboard_data_source *source, bool is_send)
-{
-	if (source->is_data_processed) {
-		assert(source->processed_data_is_send == is_send);
-		return true;
-	}
-
-	source->processed_data_start = NULL;
-	source->processed_data_size = 0;
-
-	if (clipboard_supported_formats[source->format_index].pfn)
-		return clipboard_supported_formats[source->format_index].pfn(source, is_send);
-
-	/* No processor, so just set up pointer and length for raw data */
-	source->is_data_processed = true;
-	source->processed_data_start = source->data_contents.data;
-	source->processed_data_size = source->data_contents.size;
-	source->processed_data_is_send = is_send;
-	return true;
-}
-
 static void
 clipboard_data_source_unref(struct rdp_clipboard_data_source *source)
 {
@@ -720,6 +812,7 @@ clipboard_data_source_unref(struct rdp_clipboard_data_source *source)
 			       &source->base);
 
 	wl_array_release(&source->data_contents);
+	wl_array_release(&source->receive_chunk);
 
 	wl_array_for_each(p, &source->base.mime_types)
 		free(*p);
@@ -735,23 +828,21 @@ clipboard_data_source_unref(struct rdp_clipboard_data_source *source)
 
 /* Inform client data request is succeeded with data */
 static void
-clipboard_client_send_format_data_response(RdpPeerContext *ctx, struct rdp_clipboard_data_source *source)
+clipboard_client_send_format_data_response(RdpPeerContext *ctx, struct rdp_clipboard_transfer *transfer)
 {
 	struct rdp_backend *b = ctx->rdpBackend;
 	CLIPRDR_FORMAT_DATA_RESPONSE formatDataResponse = {};
 
-	assert(source->is_data_processed);
-	rdp_debug_clipboard(b, "Client: %s (%p:%s) format_index:%d %s (%d bytes)\n",
-			    __func__, source,
-			    clipboard_data_source_state_to_string(source),
-			    source->format_index,
-			    clipboard_supported_formats[source->format_index].mime_type,
-			    source->processed_data_size);
+	rdp_debug_clipboard(b, "Client: %s (%p) format_index:%d %s (%zu bytes)\n",
+			    __func__, transfer,
+			    transfer->format_index,
+			    clipboard_supported_formats[transfer->format_index].mime_type,
+			    transfer->data.size);
 
 	FORM_DATA_RESP_COMM(formatDataResponse, msgType) = CB_FORMAT_DATA_RESPONSE;
 	FORM_DATA_RESP_COMM(formatDataResponse, msgFlags) = CB_RESPONSE_OK;
-	FORM_DATA_RESP_COMM(formatDataResponse, dataLen) = source->processed_data_size;
-	formatDataResponse.requestedFormatData = source->processed_data_start;
+	FORM_DATA_RESP_COMM(formatDataResponse, dataLen) = transfer->data.size;
+	formatDataResponse.requestedFormatData = transfer->data.data;
 	ctx->clipboard_server_context->ServerFormatDataResponse(ctx->clipboard_server_context, &formatDataResponse);
 	/* if here failed to send response, what can we do ? */
 }
@@ -784,75 +875,119 @@ clipboard_client_send_format_data_response_fail(RdpPeerContext *ctx, struct rdp_
  * Compositor file descritor callbacks *
 \***************************************/
 
-/* Send server clipboard data to client when server side application sent them via pipe. */
-static int
-clipboard_data_source_read(int fd, uint32_t mask, void *arg)
+/* Hand a finished transfer back to the display loop, and send its result
+ * to the client unless the peer is going away. */
+static void
+clipboard_transfer_done(bool freeOnly, void *arg)
 {
-	struct rdp_clipboard_data_source *source = (struct rdp_clipboard_data_source *)arg;
-	freerdp_peer *client = (freerdp_peer *)source->context;
-	RdpPeerContext *ctx = (RdpPeerContext *)client->context;
+	struct rdp_clipboard_transfer *transfer = wl_container_of(arg, transfer, task_base);
+	RdpPeerContext *ctx = transfer->ctx;
 	struct rdp_backend *b = ctx->rdpBackend;
-	int len;
-	bool failed = true;
-
-	rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) fd:%d\n",
-				    __func__, source,
-				    clipboard_data_source_state_to_string(source), fd);
+	int64_t usec;
 
 	assert_compositor_thread(b);
 
-	assert(source->data_source_fd == fd);
-	assert(source->refcount == 1);
+	if (!transfer->joined) {
+		pthread_join(transfer->thread, NULL);
+		wl_list_remove(&transfer->link);
+	}
 
-	/* event source is not removed here, but it will be removed when read is completed,
-	   until it's completed this function will be called whenever next chunk of data is
-	   available for read in pipe. */
-	assert(source->transfer_event_source);
+	/* nobody to answer once the clipboard channel is gone */
+	if (!freeOnly && !transfer->canceled && ctx->clipboard_server_context) {
+		if (transfer->failed) {
+			clipboard_client_send_format_data_response_fail(ctx, NULL);
+		} else {
+			clipboard_client_send_format_data_response(ctx, transfer);
+			ctx->clipboard_bytes_sent += transfer->data.size;
+			ctx->clipboard_transfers_sent++;
+
+			usec = MAX(timespec_sub_to_nsec(&transfer->end, &transfer->start) / 1000, 1);
+			rdp_debug_clipboard(b, "RDP %s (%p) %s: read %" PRIu64 " bytes, sent %zu bytes in %" PRId64 " us (%" PRIu64 " MB/s)\n",
+					    __func__, transfer,
+					    clipboard_supported_formats[transfer->format_index].mime_type,
+					    transfer->bytes_read, transfer->data.size, usec,
+					    transfer->bytes_read / (uint64_t)usec);
+		}
+	}
 
-	source->state = RDP_CLIPBOARD_SOURCE_TRANSFERING;
+	close(transfer->fd);
+	close(transfer->cancel_fd);
+	wl_array_release(&transfer->data);
+	free(transfer);
+}
 
-	len = rdp_wl_array_read_fd(&source->data_contents, fd);
-	if (len < 0) {
-		source->state = RDP_CLIPBOARD_SOURCE_FAILED;
-		weston_log("RDP %s (%p:%s) read failed (%s)\n",
-			   __func__, source,
-			   clipboard_data_source_state_to_string(source),
-			   strerror(errno));
-		goto error_exit;
-	}
+/* Read server clipboard data from the pipe and convert it for the client,
+ * a chunk at a time as the application writes it. */
+static void *
+clipboard_transfer_thread(void *arg)
+{
+	struct rdp_clipboard_transfer *transfer = arg;
+	RdpPeerContext *ctx = transfer->ctx;
+	struct rdp_backend *b = ctx->rdpBackend;
+	pfn_send_data send_data = clipboard_supported_formats[transfer->format_index].send;
+	struct pollfd fds[2] = {
+		{ .fd = transfer->fd, .events = POLLIN },
+		{ .fd = transfer->cancel_fd, .events = POLLIN },
+	};
+	char *buf;
+	ssize_t len;
+
+	buf = malloc(RDP_CLIPBOARD_CHUNK_SIZE);
+	if (!buf)
+		transfer->failed = true;
+
+	while (!transfer->failed) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			transfer->failed = true;
+			break;
+		}
 
-	if (len > 0) {
-		rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) read (%zu bytes)\n",
-					    __func__, source,
-					    clipboard_data_source_state_to_string(source),
-					    source->data_contents.size);
-		/* continue to read next batch */
-		return 0;
-	}
+		if (fds[1].revents) {
+			transfer->canceled = true;
+			break;
+		}
 
-	/* len == 0, all data from source is read, so completed. */
-	source->state = RDP_CLIPBOARD_SOURCE_TRANSFERRED;
-	rdp_debug_clipboard(b, "RDP %s (%p:%s): read completed (%ld bytes)\n",
-			    __func__, source,
-			    clipboard_data_source_state_to_string(source),
-			    source->data_contents.size);
-	if (!source->data_contents.size)
-		goto error_exit;
-	/* process data before sending to client */
-	if (!clipboard_process_source(source, true))
-		goto error_exit;
+		do {
+			len = read(transfer->fd, buf, RDP_CLIPBOARD_CHUNK_SIZE);
+		} while (len < 0 && errno == EINTR);
 
-	clipboard_client_send_format_data_response(ctx, source);
-	failed = false;
+		if (len < 0) {
+			weston_log("RDP %s (%p) read failed (%s)\n",
+				   __func__, transfer, strerror(errno));
+			transfer->failed = true;
+			break;
+		}
 
-error_exit:
-	if (failed)
-		clipboard_client_send_format_data_response_fail(ctx, source);
+		if (len == 0) {
+			/* all data from source is read, so completed. */
+			if (!transfer->bytes_read || !send_data(transfer, NULL, 0))
+				transfer->failed = true;
+			break;
+		}
 
-	/* make sure this is the last reference, so event source is removed at unref */
-	assert(source->refcount == 1);
-	clipboard_data_source_unref(source);
-	return 0;
+		transfer->bytes_read += len;
+		if (transfer->bytes_read > b->clipboard_max_size) {
+			weston_log("RDP %s (%p) data exceeds %zu bytes, dropped\n",
+				   __func__, transfer, b->clipboard_max_size);
+			transfer->failed = true;
+			break;
+		}
+
+		rdp_debug_clipboard_verbose(b, "RDP %s (%p) read %zd bytes (%" PRIu64 " total)\n",
+					    __func__, transfer, len, transfer->bytes_read);
+
+		if (!send_data(transfer, buf, len))
+			transfer->failed = true;
+	}
+
+	free(buf);
+
+	clock_gettime(CLOCK_MONOTONIC, &transfer->end);
+	rdp_dispatch_task_to_display_loop(ctx, clipboard_transfer_done, &transfer->task_base);
+
+	return NULL;
 }
 
 /* client's reply with error for data request, clean up */
@@ -892,8 +1027,8 @@ clipboard_data_source_fail(int fd, uint32_t mask, void *arg)
 	assert(source->inflight_write_count == 0);
 	assert(source->inflight_data_to_write == NULL);
 	assert(source->inflight_data_size == 0);
-	/* data never has been sent to write(), so must not be processed. */
-	assert(source->is_data_processed == FALSE);
+	/* data never has been sent to write(), so must not be converted. */
+	assert(source->receive_pos == NULL);
 	/* close fd to server clipboard stop pulling data. */
 	close(source->data_source_fd);
 	source->data_source_fd = -1;
@@ -904,6 +1039,29 @@ clipboard_data_source_fail(int fd, uint32_t mask, void *arg)
 	return 0;
 }
 
+/* Produce the next piece of data to write, false once there is none. */
+static bool
+clipboard_data_source_next_chunk(struct rdp_clipboard_data_source *source)
+{
+	pfn_receive_next next = clipboard_supported_formats[source->format_index].receive_next;
+	size_t size;
+
+	if (!source->receive_left)
+		return false;
+
+	if (next)
+		return next(source);
+
+	/* written as is, straight from data_contents */
+	size = MIN(source->receive_left, RDP_CLIPBOARD_CHUNK_SIZE);
+	source->inflight_data_to_write = (void *)source->receive_pos;
+	source->inflight_data_size = size;
+	source->receive_pos += size;
+	source->receive_left -= size;
+
+	return true;
+}
+
 /* Send client's clipboard data to the requesting application at server side */
 static int
 clipboard_data_source_write(int fd, uint32_t mask, void *arg)
@@ -912,8 +1070,9 @@ clipboard_data_source_write(int fd, uint32_t mask, void *arg)
 	freerdp_peer *client = (freerdp_peer *)source->context;
 	RdpPeerContext *ctx = (RdpPeerContext *)client->context;
 	struct rdp_backend *b = ctx->rdpBackend;
-	void *data_to_write;
-	size_t data_size;
+	pfn_receive_begin begin;
+	struct timespec now;
+	int64_t usec;
 	ssize_t size;
 
 	rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) fd:%d\n", __func__,
@@ -946,24 +1105,38 @@ clipboard_data_source_write(int fd, uint32_t mask, void *arg)
 	}
 
 	assert(source->refcount > 1);
-	if (source->inflight_data_to_write) {
-		assert(source->inflight_data_size);
+	if (source->receive_pos) {
 		rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) transfer in chunk, count:%d\n",
 					    __func__, source,
 					    clipboard_data_source_state_to_string(source),
 					    source->inflight_write_count);
-		data_to_write = source->inflight_data_to_write;
-		data_size = source->inflight_data_size;
 	} else {
 		fcntl(source->data_source_fd, F_SETFL, O_WRONLY | O_NONBLOCK);
-		clipboard_process_source(source, false);
-		data_to_write = source->processed_data_start;
-		data_size = source->processed_data_size;
+		clock_gettime(CLOCK_MONOTONIC, &source->transfer_start);
+		source->bytes_written = 0;
+		begin = clipboard_supported_formats[source->format_index].receive_begin;
+		if (!begin(source)) {
+			source->state = RDP_CLIPBOARD_SOURCE_FAILED;
+			weston_log("RDP %s (%p:%s) conversion failed\n",
+				   __func__, source,
+				   clipboard_data_source_state_to_string(source));
+			goto fail;
+		}
 	}
-	while (data_to_write && data_size) {
+
+	/* Convert and write a chunk at a time, so only one chunk of
+	 * converted data is held and a large transfer is spread over
+	 * several dispatches as the pipe drains. */
+	for (;;) {
+		if (!source->inflight_data_size &&
+		    !clipboard_data_source_next_chunk(source))
+			break;
+
 		source->state = RDP_CLIPBOARD_SOURCE_TRANSFERING;
 		do {
-			size = write(source->data_source_fd, data_to_write, data_size);
+			size = write(source->data_source_fd,
+				     source->inflight_data_to_write,
+				     source->inflight_data_size);
 		} while (size == -1 && errno == EINTR);
 
 		if (size <= 0) {
@@ -973,31 +1146,43 @@ clipboard_data_source_write(int fd, uint32_t mask, void *arg)
 					   __func__, source,
 					   clipboard_data_source_state_to_string(source),
 					   strerror(errno));
-				break;
+				goto fail;
 			}
 			/* buffer is full, wait until data_source_fd is writable again */
-			source->inflight_data_to_write = data_to_write;
-			source->inflight_data_size = data_size;
 			source->inflight_write_count++;
 			return 0;
-		} else {
-			assert(data_size >= (size_t)size);
-			data_size -= size;
-			data_to_write = (char *)data_to_write + size;
-			rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) wrote %ld bytes, remaining %ld bytes\n",
-						    __func__, source,
-						    clipboard_data_source_state_to_string(source),
-						    size, data_size);
-			if (!data_size) {
-				source->state = RDP_CLIPBOARD_SOURCE_TRANSFERRED;
-				rdp_debug_clipboard(b, "RDP %s (%p:%s) write completed (%ld bytes)\n",
-						    __func__, source,
-						    clipboard_data_source_state_to_string(source),
-						    source->data_contents.size);
-			}
 		}
+
+		assert(source->inflight_data_size >= (size_t)size);
+		source->inflight_data_size -= size;
+		source->inflight_data_to_write = (char *)source->inflight_data_to_write + size;
+		source->bytes_written += size;
+		rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) wrote %zd bytes, remaining %zu bytes to convert\n",
+					    __func__, source,
+					    clipboard_data_source_state_to_string(source),
+					    size, source->receive_left);
 	}
 
+	if (source->receive_left) {
+		/* conversion of the next chunk failed */
+		source->state = RDP_CLIPBOARD_SOURCE_FAILED;
+		weston_log("RDP %s (%p:%s) conversion failed\n",
+			   __func__, source,
+			   clipboard_data_source_state_to_string(source));
+		goto fail;
+	}
+
+	source->state = RDP_CLIPBOARD_SOURCE_TRANSFERRED;
+	ctx->clipboard_bytes_received += source->bytes_written;
+	ctx->clipboard_transfers_received++;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = MAX(timespec_sub_to_nsec(&now, &source->transfer_start) / 1000, 1);
+	rdp_debug_clipboard(b, "RDP %s (%p:%s) write completed (%zu bytes received, %" PRIu64 " bytes written in %" PRId64 " us, %" PRIu64 " MB/s)\n",
+			    __func__, source,
+			    clipboard_data_source_state_to_string(source),
+			    source->data_contents.size, source->bytes_written,
+			    usec, source->bytes_written / (uint64_t)usec);
+
 fail:
 	/* Here write is either completed, canceled or failed, so close the pipe. */
 	close(source->data_source_fd);
@@ -1009,6 +1194,10 @@ fail:
 	source->inflight_write_count = 0;
 	source->inflight_data_to_write = NULL;
 	source->inflight_data_size = 0;
+	source->receive_pos = NULL;
+	source->receive_left = 0;
+	wl_array_release(&source->receive_chunk);
+	wl_array_init(&source->receive_chunk);
 	ctx->clipboard_inflight_client_data_source = NULL;
 	clipboard_data_source_unref(source);
 
@@ -1121,7 +1310,6 @@ clipboard_data_source_send(struct weston_data_source *base,
 			/* purge cached data */
 			wl_array_release(&source->data_contents);
 			wl_array_init(&source->data_contents);
-			source->is_data_processed = false;
 			/* update requesting format property */
 			source->format_index = index;
 			/* request clipboard data from client */
@@ -1194,7 +1382,6 @@ clipboard_data_source_cancel(struct weston_data_source *base)
 	assert(source->transfer_event_source == NULL);
 	wl_array_release(&source->data_contents);
 	wl_array_init(&source->data_contents);
-	source->is_data_processed = false;
 	source->format_index = -1;
 	memset(source->client_format_id_table, 0, sizeof(source->client_format_id_table));
 	source->inflight_write_count = 0;
@@ -1255,13 +1442,11 @@ clipboard_data_source_request(bool freeOnly, void *arg)
 	struct rdp_backend *b = ctx->rdpBackend;
 	struct weston_seat *seat = ctx->item.seat;
 	struct weston_data_source *selection_data_source = seat->selection_data_source;
-	struct wl_event_loop *loop = wl_display_get_event_loop(seat->compositor->wl_display);
-	struct rdp_clipboard_data_source *source = NULL;
+	struct rdp_clipboard_transfer *transfer = NULL;
 	int p[2] = {};
 	const char *requested_mime_type, **mime_type;
 	int index;
 	bool found_requested_format;
-	bool ret;
 
 	assert_compositor_thread(b);
 
@@ -1289,59 +1474,51 @@ clipboard_data_source_request(bool freeOnly, void *arg)
 		goto error_exit_response_fail;
 	}
 
-	source = zalloc(sizeof *source);
-	if (!source)
-		goto error_exit_response_fail;
-
 	/* By now, the server side data availablity is already notified
 	   to client by clipboard_set_selection(). */
-	source->state = RDP_CLIPBOARD_SOURCE_PUBLISHED;
-	rdp_debug_clipboard(b, "RDP %s (%p:%s) for (base:%p)\n",
-			    __func__, source,
-			    clipboard_data_source_state_to_string(source),
-			    selection_data_source);
-	wl_signal_init(&source->base.destroy_signal);
-	wl_array_init(&source->base.mime_types);
-	wl_array_init(&source->data_contents);
-	source->is_data_processed = false;
-	source->context = ctx->item.peer;
-	source->refcount = 1; /* decremented when data sent to client. */
-	source->data_source_fd = -1;
-	source->format_index = index;
+	transfer = zalloc(sizeof *transfer);
+	if (!transfer)
+		goto error_exit_response_fail;
+
+	transfer->ctx = ctx;
+	transfer->format_index = index;
+	wl_array_init(&transfer->data);
+
+	transfer->cancel_fd = eventfd(0, EFD_CLOEXEC);
+	if (transfer->cancel_fd == -1)
+		goto error_exit_free_transfer;
 
 	if (pipe2(p, O_CLOEXEC) == -1)
-		goto error_exit_free_source;
+		goto error_exit_close_cancel_fd;
 
-	source->data_source_fd = p[0];
+	transfer->fd = p[0];
 
-	rdp_debug_clipboard_verbose(b, "RDP %s (%p:%s) pipe write:%d -> read:%d\n",
-				    __func__, source,
-				    clipboard_data_source_state_to_string(source),
+	rdp_debug_clipboard_verbose(b, "RDP %s (%p) for (base:%p) pipe write:%d -> read:%d\n",
+				    __func__, transfer, selection_data_source,
 				    p[1], p[0]);
 
 	/* Request data from data source */
-	source->state = RDP_CLIPBOARD_SOURCE_REQUEST_DATA;
 	selection_data_source->send(selection_data_source, requested_mime_type, p[1]);
 	/* p[1] should be closed by data source */
 
-	ret = rdp_event_loop_add_fd(loop, p[0], WL_EVENT_READABLE,
-				    clipboard_data_source_read, source,
-				    &source->transfer_event_source);
-	if (!ret) {
-		source->state = RDP_CLIPBOARD_SOURCE_FAILED;
-		weston_log("RDP %s (%p:%s) rdp_event_loop_add_fd failed.\n",
-			   __func__, source,
-			   clipboard_data_source_state_to_string(source));
-		goto error_exit_free_source;
+	clock_gettime(CLOCK_MONOTONIC, &transfer->start);
+	wl_list_insert(&ctx->clipboard_transfer_list, &transfer->link);
+	if (pthread_create(&transfer->thread, NULL, clipboard_transfer_thread, transfer) != 0) {
+		weston_log("RDP %s (%p) pthread_create failed.\n",
+			   __func__, transfer);
+		wl_list_remove(&transfer->link);
+		close(transfer->fd);
+		goto error_exit_close_cancel_fd;
 	}
 
 	free(request);
 
 	return;
 
-error_exit_free_source:
-	assert(source->refcount == 1);
-	clipboard_data_source_unref(source);
+error_exit_close_cancel_fd:
+	close(transfer->cancel_fd);
+error_exit_free_transfer:
+	free(transfer);
 error_exit_response_fail:
 	clipboard_client_send_format_data_response_fail(ctx, NULL);
 error_exit_free_request:
@@ -1601,7 +1778,13 @@ clipboard_client_format_data_response(CliprdrServerContext *context, const CLIPR
 		return -1;
 	}
 
-	if (FORM_DATA_RESP_COMM(*formatDataResponse, msgFlags) == CB_RESPONSE_OK) {
+	if (FORM_DATA_RESP_COMM(*formatDataResponse, msgFlags) == CB_RESPONSE_OK &&
+	    FORM_DATA_RESP_COMM(*formatDataResponse, dataLen) > b->clipboard_max_size) {
+		source->state = RDP_CLIPBOARD_SOURCE_FAILED;
+		weston_log("Client: %s (%p:%s) data exceeds %zu bytes, dropped\n",
+			   __func__, source, clipboard_data_source_state_to_string(source),
+			   b->clipboard_max_size);
+	} else if (FORM_DATA_RESP_COMM(*formatDataResponse, msgFlags) == CB_RESPONSE_OK) {
 		/* Recieved data from client, cache to data source */
 		if (wl_array_add(&source->data_contents, FORM_DATA_RESP_COMM(*formatDataResponse, dataLen)+1)) {
 			memcpy(source->data_contents.data,
@@ -1753,10 +1936,25 @@ void
 rdp_clipboard_destroy(RdpPeerContext *ctx)
 {
 	struct rdp_clipboard_data_source *data_source;
+	struct rdp_clipboard_transfer *transfer, *tmp;
 	struct rdp_backend *b = ctx->rdpBackend;
 
 	assert_compositor_thread(b);
 
+	/* Stop the transfer threads, their tasks free them with the rest of
+	 * the peer's pending tasks. */
+	wl_list_for_each_safe(transfer, tmp, &ctx->clipboard_transfer_list, link) {
+		eventfd_write(transfer->cancel_fd, 1);
+		pthread_join(transfer->thread, NULL);
+		transfer->joined = true;
+		wl_list_remove(&transfer->link);
+	}
+
+	rdp_debug_clipboard(b, "%s: sent %u transfers (%" PRIu64 " bytes), received %u transfers (%" PRIu64 " bytes)\n",
+			    __func__,
+			    ctx->clipboard_transfers_sent, ctx->clipboard_bytes_sent,
+			    ctx->clipboard_transfers_received, ctx->clipboard_bytes_received);
+
 	if (ctx->clipboard_selection_listener.notify) {
 		wl_list_remove(&ctx->clipboard_selection_listener.link);
 		ctx->clipboard_selection_listener.notify = NULL;
@@ -0,0 +1,679 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Asynchronous RemoteFX/NSCodec encoding.
+ *
+ * At repaint, the damaged tiles of the output's shadow surface are copied
+ * into a snapshot image, and the damage is cut into horizontal bands of
+ * whole RemoteFX tiles. Each (codec settings, band) pair becomes a job
+ * which one of the encoder threads picks up, using its own codec contexts.
+ * Once every job of a frame is done, the frame is handed back to the
+ * display loop through an eventfd, where the bands are posted as surface
+ * bits to every peer in band order, and only then the frame is finished.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "rdp.h"
+
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+/* RemoteFX tile size, bands are always made of whole tiles */
+#define RDP_ENCODE_TILE_SIZE 64
+#define RDP_ENCODE_MAX_THREADS 16
+
+struct rdp_encoder_worker {
+	pthread_t thread;
+	struct rdp_encoder *encoder;
+
+	/* codec contexts are not thread safe, so each worker has its own */
+	RFX_CONTEXT *rfx_context;
+	NSC_CONTEXT *nsc_context;
+	uint32_t width;
+	uint32_t height;
+	RFX_RECT *rfx_rects;
+	int rfx_rects_alloc;
+};
+
+struct rdp_encoder {
+	struct rdp_backend *backend;
+
+	int thread_count;
+	struct rdp_encoder_worker *workers;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;	/* new job or shutdown */
+	pthread_cond_t done_cond;	/* a job completed */
+	struct wl_list job_queue;	/* rdp_encode_job::link */
+	struct wl_list done_list;	/* rdp_encode_frame::link */
+	bool shutdown;
+
+	int done_fd;
+	struct wl_event_source *done_source;
+};
+
+static bool
+rdp_encoder_worker_reset(struct rdp_encoder_worker *worker,
+			 const struct rdp_encode_key *key)
+{
+	if (!worker->rfx_context) {
+		worker->rfx_context = rfx_context_new(TRUE);
+		if (!worker->rfx_context)
+			return false;
+#if USE_FREERDP_VERSION >= 3
+		rfx_context_set_mode(worker->rfx_context, RLGR3);
+#else
+		worker->rfx_context->mode = RLGR3;
+#endif
+		rfx_context_set_pixel_format(worker->rfx_context, DEFAULT_PIXEL_FORMAT);
+	}
+
+	if (!worker->nsc_context) {
+		worker->nsc_context = nsc_context_new();
+		if (!worker->nsc_context)
+			return false;
+		nsc_context_set_parameters(worker->nsc_context,
+					   NSC_COLOR_FORMAT, DEFAULT_PIXEL_FORMAT);
+	}
+
+	if (worker->width != key->width || worker->height != key->height) {
+		rfx_context_reset(worker->rfx_context, key->width, key->height);
+		nsc_context_reset(worker->nsc_context, key->width, key->height);
+		worker->width = key->width;
+		worker->height = key->height;
+	}
+
+	return true;
+}
+
+static void
+rdp_encoder_worker_encode_rfx(struct rdp_encoder_worker *worker,
+			      struct rdp_encode_job *job,
+			      pixman_image_t *image)
+{
+	pixman_region32_t *damage = &job->damage;
+	SURFACE_BITS_COMMAND *cmd = &job->cmd;
+	pixman_box32_t *rects;
+	int width, height, nrects, i;
+	uint32_t *ptr;
+
+	width = damage->extents.x2 - damage->extents.x1;
+	height = damage->extents.y2 - damage->extents.y1;
+
+	cmd->skipCompression = TRUE;
+	cmd->cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd->destLeft = damage->extents.x1;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
+
+	ptr = pixman_image_get_data(image) + damage->extents.x1 +
+		damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	if (nrects > worker->rfx_rects_alloc) {
+		worker->rfx_rects = xrealloc(worker->rfx_rects,
+					     nrects * sizeof(*worker->rfx_rects));
+		worker->rfx_rects_alloc = nrects;
+	}
+
+	for (i = 0; i < nrects; i++) {
+		worker->rfx_rects[i].x = rects[i].x1 - damage->extents.x1;
+		worker->rfx_rects[i].y = rects[i].y1 - damage->extents.y1;
+		worker->rfx_rects[i].width = rects[i].x2 - rects[i].x1;
+		worker->rfx_rects[i].height = rects[i].y2 - rects[i].y1;
+	}
+
+	job->failed = !rfx_compose_message(worker->rfx_context, job->stream,
+					   worker->rfx_rects, nrects,
+					   (BYTE *)ptr, width, height,
+					   pixman_image_get_stride(image));
+}
+
+static void
+rdp_encoder_worker_encode_nsc(struct rdp_encoder_worker *worker,
+			      struct rdp_encode_job *job,
+			      pixman_image_t *image)
+{
+	pixman_region32_t *damage = &job->damage;
+	SURFACE_BITS_COMMAND *cmd = &job->cmd;
+	int width, height;
+	int32_t left;
+	uint32_t *ptr;
+
+	/* see rdp_peer_encode_nsc() for the 16 pixel alignment */
+	left = damage->extents.x1 - (damage->extents.x1 % 16);
+	width = damage->extents.x2 - left;
+	height = damage->extents.y2 - damage->extents.y1;
+
+	cmd->cmdType = CMDTYPE_SET_SURFACE_BITS;
+	cmd->skipCompression = TRUE;
+	cmd->destLeft = left;
+	cmd->destTop = damage->extents.y1;
+	cmd->destRight = damage->extents.x2;
+	cmd->destBottom = damage->extents.y2;
+	cmd->bmp.bpp = 32;
+	cmd->bmp.width = width;
+	cmd->bmp.height = height;
+
+	ptr = pixman_image_get_data(image) + left +
+		damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+
+	job->failed = !nsc_compose_message(worker->nsc_context, job->stream,
+					   (BYTE *)ptr, width, height,
+					   pixman_image_get_stride(image));
+}
+
+static void
+rdp_encoder_run_job(struct rdp_encoder_worker *worker,
+		    struct rdp_encode_job *job)
+{
+	pixman_image_t *image = job->frame->snapshot;
+
+	Stream_Clear(job->stream);
+	Stream_SetPosition(job->stream, 0);
+
+	if (!rdp_encoder_worker_reset(worker, &job->key)) {
+		job->failed = true;
+		return;
+	}
+
+	if (job->key.codec == RDP_ENCODE_CODEC_RFX)
+		rdp_encoder_worker_encode_rfx(worker, job, image);
+	else
+		rdp_encoder_worker_encode_nsc(worker, job, image);
+
+	job->cmd.bmp.bitmapDataLength = Stream_GetPosition(job->stream);
+	job->cmd.bmp.bitmapData = Stream_Buffer(job->stream);
+}
+
+static void *
+rdp_encoder_worker_thread(void *arg)
+{
+	struct rdp_encoder_worker *worker = arg;
+	struct rdp_encoder *encoder = worker->encoder;
+	struct rdp_encode_job *job;
+	struct rdp_encode_frame *frame;
+
+	pthread_mutex_lock(&encoder->mutex);
+	for (;;) {
+		while (wl_list_empty(&encoder->job_queue) && !encoder->shutdown)
+			pthread_cond_wait(&encoder->job_cond, &encoder->mutex);
+
+		if (encoder->shutdown)
+			break;
+
+		job = container_of(encoder->job_queue.next,
+				   struct rdp_encode_job, link);
+		wl_list_remove(&job->link);
+		wl_list_init(&job->link);
+		pthread_mutex_unlock(&encoder->mutex);
+
+		rdp_encoder_run_job(worker, job);
+
+		pthread_mutex_lock(&encoder->mutex);
+		frame = job->frame;
+		assert(frame->jobs_outstanding > 0);
+		if (--frame->jobs_outstanding == 0 && !frame->cancelled) {
+			wl_list_insert(encoder->done_list.prev, &frame->link);
+			eventfd_write(encoder->done_fd, 1);
+		}
+		pthread_cond_broadcast(&encoder->done_cond);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return NULL;
+}
+
+static void
+rdp_encoder_post_frame(struct rdp_encode_frame *frame)
+{
+	struct rdp_output *output = frame->output;
+	struct rdp_backend *b = output->backend;
+	struct rdp_peers_item *peer;
+	struct rdp_encode_key key;
+	struct timespec now;
+	int i, posted = 0;
+
+	wl_list_for_each(peer, &b->peers, link) {
+		rdpUpdate *update;
+
+		if (!(peer->flags & RDP_PEER_ACTIVATED) ||
+		    !(peer->flags & RDP_PEER_OUTPUT_ENABLED))
+			continue;
+
+		/* raw peers were already refreshed at repaint */
+		if (!rdp_peer_get_encode_key(peer->peer, &key))
+			continue;
+
+		/* A peer activated after the frame was submitted has no
+		 * matching jobs, but its full refresh already covers it. */
+		update = peer->peer->context->update;
+		for (i = 0; i < frame->job_count; i++) {
+			struct rdp_encode_job *job = &frame->jobs[i];
+			SURFACE_BITS_COMMAND cmd;
+
+			if (job->failed ||
+			    memcmp(&job->key, &key, sizeof(key)) != 0)
+				continue;
+
+			cmd = job->cmd;
+			cmd.bmp.codecID = rdp_peer_get_codec_id(peer->peer, key.codec);
+			update->SurfaceBits(update->context, &cmd);
+			posted++;
+		}
+	}
+
+	weston_compositor_read_presentation_clock(b->compositor, &now);
+	rdp_debug_verbose(b, "%s: %d job(s) encoded in %" PRId64 " usec, %d surface bits posted\n",
+			  __func__, frame->job_count,
+			  timespec_sub_to_nsec(&now, &frame->submit_time) / 1000,
+			  posted);
+}
+
+static void
+rdp_encoder_frame_release(struct rdp_encode_frame *frame)
+{
+	int i;
+
+	for (i = 0; i < frame->job_count; i++)
+		pixman_region32_fini(&frame->jobs[i].damage);
+	frame->job_count = 0;
+
+	pixman_image_unref(frame->snapshot);
+	frame->snapshot = NULL;
+	frame->in_flight = false;
+}
+
+static void
+rdp_encoder_frame_complete(struct rdp_encode_frame *frame)
+{
+	struct rdp_output *output = frame->output;
+
+	rdp_encoder_post_frame(frame);
+	rdp_encoder_frame_release(frame);
+
+	/* the frame timer already fired, it was waiting for us */
+	if (frame->finish_deferred) {
+		frame->finish_deferred = false;
+		weston_output_finish_frame_from_timer(&output->base);
+	}
+}
+
+static int
+rdp_encoder_dispatch_done(int fd, uint32_t mask, void *data)
+{
+	struct rdp_encoder *encoder = data;
+	struct rdp_encode_frame *frame, *tmp;
+	struct wl_list done_list;
+	eventfd_t dummy;
+
+	assert_compositor_thread(encoder->backend);
+
+	eventfd_read(encoder->done_fd, &dummy);
+
+	wl_list_init(&done_list);
+	pthread_mutex_lock(&encoder->mutex);
+	wl_list_insert_list(&done_list, &encoder->done_list);
+	wl_list_init(&encoder->done_list);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	wl_list_for_each_safe(frame, tmp, &done_list, link) {
+		wl_list_remove(&frame->link);
+		wl_list_init(&frame->link);
+		rdp_encoder_frame_complete(frame);
+	}
+
+	return 0;
+}
+
+static pixman_image_t *
+rdp_encoder_get_snapshot(struct rdp_output *output)
+{
+	pixman_image_t *shadow = output->shadow_surface;
+	int width = pixman_image_get_width(shadow);
+	int height = pixman_image_get_height(shadow);
+	pixman_image_t *snapshot = output->encode_snapshot;
+
+	/* The snapshot is pooled on the output and reused frame after frame,
+	 * only a mode change makes us allocate a new one. */
+	if (snapshot &&
+	    (pixman_image_get_width(snapshot) != width ||
+	     pixman_image_get_height(snapshot) != height)) {
+		pixman_image_unref(snapshot);
+		snapshot = NULL;
+	}
+
+	if (!snapshot) {
+		snapshot = pixman_image_create_bits(pixman_image_get_format(shadow),
+						    width, height, NULL,
+						    pixman_image_get_stride(shadow));
+		output->encode_snapshot = snapshot;
+	}
+
+	return snapshot;
+}
+
+static void
+rdp_encoder_copy_band(pixman_image_t *snapshot, pixman_image_t *shadow,
+		      const pixman_box32_t *extents)
+{
+	int width = pixman_image_get_width(shadow);
+	int x1, x2;
+
+	/* copy whole tiles, which also satisfies the NSCodec alignment */
+	x1 = extents->x1 - (extents->x1 % RDP_ENCODE_TILE_SIZE);
+	x2 = MIN(ROUND_UP_N(extents->x2, RDP_ENCODE_TILE_SIZE), width);
+
+	pixman_image_composite32(PIXMAN_OP_SRC, shadow, NULL, snapshot,
+				 x1, extents->y1, 0, 0, x1, extents->y1,
+				 x2 - x1, extents->y2 - extents->y1);
+}
+
+static struct rdp_encode_job *
+rdp_encoder_frame_add_job(struct rdp_encode_frame *frame)
+{
+	struct rdp_encode_job *job;
+
+	if (frame->job_count == frame->job_alloc) {
+		int i, n = frame->job_alloc ? frame->job_alloc * 2 : 8;
+
+		frame->jobs = xrealloc(frame->jobs, n * sizeof(*frame->jobs));
+		memset(&frame->jobs[frame->job_alloc], 0,
+		       (n - frame->job_alloc) * sizeof(*frame->jobs));
+		for (i = frame->job_alloc; i < n; i++)
+			wl_list_init(&frame->jobs[i].link);
+		frame->job_alloc = n;
+	}
+
+	job = &frame->jobs[frame->job_count++];
+	if (!job->stream) {
+		job->stream = Stream_New(NULL, 65536);
+		if (!job->stream) {
+			frame->job_count--;
+			return NULL;
+		}
+	}
+	job->frame = frame;
+	job->failed = false;
+	memset(&job->cmd, 0, sizeof(job->cmd));
+	pixman_region32_init(&job->damage);
+
+	return job;
+}
+
+bool
+rdp_encoder_submit(struct rdp_encoder *encoder, struct rdp_output *output,
+		   pixman_region32_t *damage, struct rdp_encode_cache *keys)
+{
+	struct rdp_encode_frame *frame = &output->encode_frame;
+	pixman_box32_t *extents = pixman_region32_extents(damage);
+	pixman_image_t *snapshot;
+	int band_height, y, k;
+
+	assert_compositor_thread(encoder->backend);
+	assert(!frame->in_flight);
+
+	if (keys->count == 0 || !pixman_region32_not_empty(damage))
+		return false;
+
+	snapshot = rdp_encoder_get_snapshot(output);
+	if (!snapshot)
+		return false;
+
+	frame->output = output;
+	frame->snapshot = pixman_image_ref(snapshot);
+	frame->finish_deferred = false;
+	frame->cancelled = false;
+	frame->job_count = 0;
+	weston_compositor_read_presentation_clock(output->base.compositor,
+						  &frame->submit_time);
+
+	/* spread the damage over the threads, in whole tile rows */
+	band_height = (extents->y2 - extents->y1 + encoder->thread_count - 1) /
+		      encoder->thread_count;
+	band_height = MAX(ROUND_UP_N(band_height, RDP_ENCODE_TILE_SIZE),
+			  RDP_ENCODE_TILE_SIZE);
+
+	for (y = extents->y1 - (extents->y1 % RDP_ENCODE_TILE_SIZE);
+	     y < extents->y2; y += band_height) {
+		pixman_region32_t band;
+
+		pixman_region32_init(&band);
+		pixman_region32_intersect_rect(&band, damage, 0, y,
+					       pixman_image_get_width(snapshot),
+					       band_height);
+		if (!pixman_region32_not_empty(&band)) {
+			pixman_region32_fini(&band);
+			continue;
+		}
+
+		rdp_encoder_copy_band(snapshot, output->shadow_surface,
+				      pixman_region32_extents(&band));
+
+		for (k = 0; k < keys->count; k++) {
+			struct rdp_encode_job *job;
+
+			job = rdp_encoder_frame_add_job(frame);
+			if (!job)
+				break;
+			job->key = keys->entries[k].key;
+			pixman_region32_copy(&job->damage, &band);
+		}
+		pixman_region32_fini(&band);
+	}
+
+	if (frame->job_count == 0) {
+		rdp_encoder_frame_release(frame);
+		return false;
+	}
+
+	frame->in_flight = true;
+	pthread_mutex_lock(&encoder->mutex);
+	frame->jobs_outstanding = frame->job_count;
+	for (k = 0; k < frame->job_count; k++)
+		wl_list_insert(encoder->job_queue.prev, &frame->jobs[k].link);
+	pthread_cond_broadcast(&encoder->job_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return true;
+}
+
+bool
+rdp_encoder_defer_finish_frame(struct rdp_output *output)
+{
+	struct rdp_encode_frame *frame = &output->encode_frame;
+
+	if (!frame->in_flight)
+		return false;
+
+	frame->finish_deferred = true;
+	return true;
+}
+
+void
+rdp_encoder_output_fini(struct rdp_encoder *encoder, struct rdp_output *output)
+{
+	struct rdp_encode_frame *frame = &output->encode_frame;
+	int i;
+
+	if (encoder) {
+		pthread_mutex_lock(&encoder->mutex);
+		if (frame->in_flight) {
+			frame->cancelled = true;
+			/* drop what did not start yet, wait for the rest */
+			for (i = 0; i < frame->job_count; i++) {
+				if (wl_list_empty(&frame->jobs[i].link))
+					continue;
+				wl_list_remove(&frame->jobs[i].link);
+				wl_list_init(&frame->jobs[i].link);
+				frame->jobs_outstanding--;
+			}
+			while (frame->jobs_outstanding > 0)
+				pthread_cond_wait(&encoder->done_cond, &encoder->mutex);
+			/* it may have completed just before we got here */
+			wl_list_remove(&frame->link);
+			wl_list_init(&frame->link);
+		}
+		pthread_mutex_unlock(&encoder->mutex);
+	}
+
+	if (frame->in_flight)
+		rdp_encoder_frame_release(frame);
+	frame->finish_deferred = false;
+
+	for (i = 0; i < frame->job_alloc; i++) {
+		if (frame->jobs[i].stream)
+			Stream_Free(frame->jobs[i].stream, TRUE);
+	}
+	free(frame->jobs);
+	frame->jobs = NULL;
+	frame->job_alloc = 0;
+
+	if (output->encode_snapshot) {
+		pixman_image_unref(output->encode_snapshot);
+		output->encode_snapshot = NULL;
+	}
+}
+
+struct rdp_encoder *
+rdp_encoder_create(struct rdp_backend *b, int thread_count)
+{
+	struct rdp_encoder *encoder;
+	struct wl_event_loop *loop;
+	int i, ret;
+
+	if (thread_count < 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		thread_count = cpus > 1 ? MIN(cpus, 4) : 1;
+	}
+	if (thread_count == 0)
+		return NULL;
+	thread_count = MIN(thread_count, RDP_ENCODE_MAX_THREADS);
+
+	encoder = xzalloc(sizeof *encoder);
+	encoder->backend = b;
+	wl_list_init(&encoder->job_queue);
+	wl_list_init(&encoder->done_list);
+	pthread_mutex_init(&encoder->mutex, NULL);
+	pthread_cond_init(&encoder->job_cond, NULL);
+	pthread_cond_init(&encoder->done_cond, NULL);
+
+	encoder->done_fd = eventfd(0, EFD_CLOEXEC);
+	if (encoder->done_fd == -1) {
+		weston_log("%s: eventfd failed. %s\n", __func__, strerror(errno));
+		goto err_eventfd;
+	}
+
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	if (!rdp_event_loop_add_fd(loop, encoder->done_fd, WL_EVENT_READABLE,
+				   rdp_encoder_dispatch_done, encoder,
+				   &encoder->done_source))
+		goto err_event_source;
+
+	encoder->workers = xcalloc(thread_count, sizeof(*encoder->workers));
+	for (i = 0; i < thread_count; i++) {
+		struct rdp_encoder_worker *worker = &encoder->workers[i];
+
+		worker->encoder = encoder;
+		ret = pthread_create(&worker->thread, NULL,
+				     rdp_encoder_worker_thread, worker);
+		if (ret != 0) {
+			weston_log("%s: pthread_create failed. %s\n",
+				   __func__, strerror(ret));
+			break;
+		}
+		encoder->thread_count++;
+	}
+
+	if (encoder->thread_count == 0) {
+		free(encoder->workers);
+		wl_event_source_remove(encoder->done_source);
+		goto err_event_source;
+	}
+
+	rdp_debug(b, "RDP backend: %d encoder thread(s)\n", encoder->thread_count);
+
+	return encoder;
+
+err_event_source:
+	close(encoder->done_fd);
+err_eventfd:
+	pthread_cond_destroy(&encoder->done_cond);
+	pthread_cond_destroy(&encoder->job_cond);
+	pthread_mutex_destroy(&encoder->mutex);
+	free(encoder);
+	return NULL;
+}
+
+void
+rdp_encoder_destroy(struct rdp_encoder *encoder)
+{
+	int i;
+
+	if (!encoder)
+		return;
+
+	/* outputs have cancelled their frames by now */
+	pthread_mutex_lock(&encoder->mutex);
+	assert(wl_list_empty(&encoder->job_queue));
+	encoder->shutdown = true;
+	pthread_cond_broadcast(&encoder->job_cond);
+	pthread_mutex_unlock(&encoder->mutex);
+
+	for (i = 0; i < encoder->thread_count; i++) {
+		struct rdp_encoder_worker *worker = &encoder->workers[i];
+
+		pthread_join(worker->thread, NULL);
+		if (worker->rfx_context)
+			rfx_context_free(worker->rfx_context);
+		if (worker->nsc_context)
+			nsc_context_free(worker->nsc_context);
+		free(worker->rfx_rects);
+	}
+	free(encoder->workers);
+
+	wl_event_source_remove(encoder->done_source);
+	close(encoder->done_fd);
+	pthread_cond_destroy(&encoder->done_cond);
+	pthread_cond_destroy(&encoder->job_cond);
+	pthread_mutex_destroy(&encoder->mutex);
+	free(encoder);
+}
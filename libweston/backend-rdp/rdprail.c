@@ -43,6 +43,7 @@
 #include <strings.h>
 
 #include "rdp.h"
+#include "rdpalpha.h"
 
 #include <libweston/libweston.h>
 #include "libweston-internal.h"
@@ -87,6 +88,7 @@ struct rdp_rail_dispatch_data {
 		RAIL_SNAP_ARRANGE snap_arrange;
 		RAIL_GET_APPID_REQ_ORDER get_appid_req;
 		RAIL_LANGUAGEIME_INFO_ORDER language_ime_info;
+		RDPGFX_FRAME_ACKNOWLEDGE_PDU frame_ack;
 #ifdef HAVE_FREERDP_RDPAPPLIST_H
 		RDPAPPLIST_CLIENT_CAPS_PDU app_list_caps;
 #endif /* HAVE_FREERDP_RDPAPPLIST_H */
@@ -94,6 +96,11 @@ struct rdp_rail_dispatch_data {
 };
 
 #define RDP_DISPATCH_TO_DISPLAY_LOOP(context, arg_type, arg, callback) \
+	RDP_DISPATCH_COALESCING_TO_DISPLAY_LOOP(context, arg_type, arg, callback, 0)
+
+/* a task with a non-zero coalesce_key is dropped if another one for the
+ * same callback and key gets queued before it is dispatched */
+#define RDP_DISPATCH_COALESCING_TO_DISPLAY_LOOP(context, arg_type, arg, callback, coalesce_key) \
 	{ \
 		freerdp_peer *client = (context)->custom; \
 		RdpPeerContext *peer_ctx = (RdpPeerContext *)client->context; \
@@ -103,7 +110,9 @@ struct rdp_rail_dispatch_data {
 		assert_not_compositor_thread(b); \
 		dispatch_data->client = client; \
 		dispatch_data->arg_type = *(arg); \
-		rdp_dispatch_task_to_display_loop(peer_ctx, callback, &dispatch_data->task_base); \
+		rdp_dispatch_coalescing_task_to_display_loop(peer_ctx, callback, \
+							     &dispatch_data->task_base, \
+							     coalesce_key); \
 	}
 
 #ifdef HAVE_FREERDP_RDPAPPLIST_H
@@ -474,8 +483,10 @@ Exit:
 static UINT
 rail_client_WindowMove(RailServerContext *context, const RAIL_WINDOW_MOVE_ORDER *arg)
 {
-	RDP_DISPATCH_TO_DISPLAY_LOOP(context, window_move, arg,
-					 rail_client_WindowMove_callback);
+	/* only the last position matters */
+	RDP_DISPATCH_COALESCING_TO_DISPLAY_LOOP(context, window_move, arg,
+						rail_client_WindowMove_callback,
+						arg->windowId);
 	return CHANNEL_RC_OK;
 }
 
@@ -1182,6 +1193,8 @@ rail_grfx_client_caps_advertise(RdpgfxServerContext *context, const RDPGFX_CAPS_
 
 	capsConfirm.capsSet = capsAdvertise->capsSets; /* TODO: choose right one.*/
 	gfx_ctx->CapsConfirm(gfx_ctx, &capsConfirm);
+	peer_ctx->gfxCapsVersion = capsConfirm.capsSet->version;
+	peer_ctx->gfxCapsFlags = capsConfirm.capsSet->flags;
 
 	/* ready to use graphics channel */
 	rdp_debug_verbose(b, "%s RDPGFX channel finished activation.\n", __func__);
@@ -1204,6 +1217,57 @@ rail_grfx_client_cache_import_offer(RdpgfxServerContext *context,
     return context->CacheImportReply(context, &reply);
 }
 
+static bool
+rdp_rail_can_send_frame(RdpPeerContext *peer_ctx)
+{
+	return peer_ctx->isAcknowledgedSuspended ||
+	       (peer_ctx->currentFrameId - peer_ctx->acknowledgedFrameId) <
+	       peer_ctx->frameAckWindow;
+}
+
+/* The client reports how many frames wait in its decode queue: keep fewer
+ * frames in flight while it has a backlog, open up again once it caught
+ * up. 0 means the client doesn't tell. */
+static void
+rdp_rail_adapt_frame_ack_window(RdpPeerContext *peer_ctx, uint32_t queueDepth)
+{
+	struct rdp_backend *b = peer_ctx->rdpBackend;
+
+	if (queueDepth == 0 || queueDepth == 0xffffffff)
+		return;
+
+	if (queueDepth > 1 && peer_ctx->frameAckWindow > 1)
+		peer_ctx->frameAckWindow--;
+	else if (queueDepth <= 1 && peer_ctx->frameAckWindow < b->frame_ack_window)
+		peer_ctx->frameAckWindow++;
+}
+
+static void
+rail_grfx_client_frame_acknowledge_callback(bool freeOnly, void *arg)
+{
+	struct rdp_rail_dispatch_data *data = wl_container_of(arg, data, task_base);
+	const RDPGFX_FRAME_ACKNOWLEDGE_PDU *frameAcknowledge = &data->frame_ack;
+	freerdp_peer *client = data->client;
+	RdpPeerContext *peer_ctx = (RdpPeerContext *)client->context;
+	struct rdp_backend *b = peer_ctx->rdpBackend;
+
+	assert_compositor_thread(b);
+
+	if (freeOnly)
+		goto free;
+
+	rdp_rail_adapt_frame_ack_window(peer_ctx, frameAcknowledge->queueDepth);
+
+	/* window updates held back meanwhile go out coalesced in one frame */
+	if (peer_ctx->isFrameUpdateDeferred && rdp_rail_can_send_frame(peer_ctx)) {
+		peer_ctx->isFrameUpdateDeferred = false;
+		weston_compositor_schedule_repaint(b->compositor);
+	}
+
+free:
+	free(data);
+}
+
 static UINT
 rail_grfx_client_frame_acknowledge(RdpgfxServerContext *context,
 				   const RDPGFX_FRAME_ACKNOWLEDGE_PDU *frameAcknowledge)
@@ -1213,8 +1277,13 @@ rail_grfx_client_frame_acknowledge(RdpgfxServerContext *context,
 	struct rdp_backend *b = peer_ctx->rdpBackend;
 	rdp_debug_verbose(b, "Client: GrfxFrameAcknowledge(queueDepth = 0x%x, frameId = 0x%x, decodedFrame = %d)\n",
 			  frameAcknowledge->queueDepth, frameAcknowledge->frameId, frameAcknowledge->totalFramesDecoded);
+	/* updated right away, destroying a window waits for these */
 	peer_ctx->acknowledgedFrameId = frameAcknowledge->frameId;
 	peer_ctx->isAcknowledgedSuspended = (frameAcknowledge->queueDepth == 0xffffffff);
+
+	/* only the latest acknowledgement matters to the display loop */
+	RDP_DISPATCH_COALESCING_TO_DISPLAY_LOOP(context, frame_ack, frameAcknowledge,
+						rail_grfx_client_frame_acknowledge_callback, 1);
 	return CHANNEL_RC_OK;
 }
 
@@ -1334,6 +1403,15 @@ gfxredir_client_present_buffer_ack(GfxRedirServerContext *context,
 			  presentAck->presentId);
 
 	peer_ctx->acknowledgedFrameId = (uint32_t)presentAck->presentId;
+	{
+		/* no queue depth here, only let deferred updates go out */
+		RDPGFX_FRAME_ACKNOWLEDGE_PDU frameAcknowledge = {
+			.frameId = peer_ctx->acknowledgedFrameId,
+		};
+
+		RDP_DISPATCH_COALESCING_TO_DISPLAY_LOOP(context, frame_ack, &frameAcknowledge,
+							rail_grfx_client_frame_acknowledge_callback, 1);
+	}
 
 	/* when accessing ID outside of wayland display loop thread, aquire lock */
 	rdp_id_manager_lock(&peer_ctx->windowId);
@@ -1564,7 +1642,9 @@ rdp_rail_create_window(struct wl_listener *listener, void *data)
 	}
 
 	if (!rail_state) {
-		rail_state = xzalloc(sizeof *rail_state);
+		struct rdp_rail_surface_state *state = xzalloc(sizeof *state);
+
+		rail_state = &state->base;
 		surface->backend_state = rail_state;
 	} else {
 		/* If ever encouter error for this window, no more attempt to create window */
@@ -1832,6 +1912,7 @@ rdp_rail_destroy_window(struct wl_listener *listener, void *data)
 	struct weston_compositor *compositor = surface->compositor;
 	struct weston_surface_rail_state *rail_state = surface->backend_state;
 	struct rdp_backend *b = to_rdp_backend(compositor);
+	struct rdp_rail_surface_state *state;
 	RdpgfxServerContext *gfx_ctx;
 	rdpUpdate *update;
 	WINDOW_ORDER_INFO window_order_info = {};
@@ -1842,6 +1923,8 @@ rdp_rail_destroy_window(struct wl_listener *listener, void *data)
 	if (!rail_state)
 		return;
 
+	state = to_rdp_rail_surface_state(rail_state);
+
 	window_id = rail_state->window_id;
 	if (!window_id)
 		goto Exit;
@@ -1917,6 +2000,12 @@ rdp_rail_destroy_window(struct wl_listener *listener, void *data)
 	}
 	pixman_region32_fini(&rail_state->damage);
 
+	if (state->update_count)
+		rdp_debug(b, "WindowId:0x%x sent %" PRIu64 " bytes for %" PRIu64 " damaged bytes in %u updates, %" PRIu64 " us average\n",
+			  window_id, state->bytes_sent, state->bytes_raw,
+			  state->update_count,
+			  state->update_time_us / state->update_count);
+
 	rdp_id_manager_free_id(&peer_ctx->windowId, window_id);
 	rail_state->window_id = 0;
 
@@ -1937,7 +2026,7 @@ rdp_rail_destroy_window(struct wl_listener *listener, void *data)
 	}
 
 Exit:
-	free(rail_state);
+	free(state);
 	surface->backend_state = NULL;
 
 	return;
@@ -1994,6 +2083,180 @@ struct update_window_iter_data {
 	BOOL isUpdatePending;
 };
 
+/* Rectangles smaller than this are cheaper to send uncompressed. */
+#define RDP_RAIL_MIN_COMPRESS_AREA (32 * 32)
+/* Past this many rectangles, the per command overhead outweighs what
+ * is saved by not sending the undamaged parts of the extents. */
+#define RDP_RAIL_MAX_DAMAGE_RECTS 16
+
+static bool
+rdp_rail_gfx_planar_enabled(RdpPeerContext *peer_ctx)
+{
+	/* planar is part of every RDPGFX capability version, but thin
+	 * clients are only required to handle uncompressed bitmaps and
+	 * the codecs explicitly listed for them. */
+	if (peer_ctx->gfxCapsVersion == 0)
+		return false;
+	if (peer_ctx->gfxCapsVersion == RDPGFX_CAPVERSION_8 &&
+	    (peer_ctx->gfxCapsFlags & RDPGFX_CAPS_FLAG_THINCLIENT))
+		return false;
+	return true;
+}
+
+/* Collects the rectangles of the window damage to send, in content buffer
+ * coordinates and clipped to damage_box. Falls back to damage_box alone
+ * when the whole buffer is damaged or the damage is too fragmented.
+ */
+static void
+rdp_rail_get_damage_rects(struct weston_surface *surface,
+			  const pixman_box32_t *damage_box, bool full_damage,
+			  pixman_region32_t *rects)
+{
+	struct weston_surface_rail_state *rail_state = surface->backend_state;
+	pixman_region32_t damage;
+	pixman_box32_t *boxes;
+	int n_boxes;
+
+	pixman_region32_init_rect(rects, damage_box->x1, damage_box->y1,
+				  damage_box->x2 - damage_box->x1,
+				  damage_box->y2 - damage_box->y1);
+	if (full_damage)
+		return;
+
+	boxes = pixman_region32_rectangles(&rail_state->damage, &n_boxes);
+	if (n_boxes <= 1 || n_boxes > RDP_RAIL_MAX_DAMAGE_RECTS)
+		return;
+
+	pixman_region32_init(&damage);
+	for (int i = 0; i < n_boxes; i++) {
+		pixman_box32_t box = boxes[i];
+
+		rdp_matrix_transform_position(&surface->surface_to_buffer_matrix,
+					      &box.x1, &box.y1);
+		rdp_matrix_transform_position(&surface->surface_to_buffer_matrix,
+					      &box.x2, &box.y2);
+		pixman_region32_union_rect(&damage, &damage, box.x1, box.y1,
+					   box.x2 - box.x1, box.y2 - box.y1);
+	}
+	pixman_region32_intersect(rects, rects, &damage);
+	pixman_region32_fini(&damage);
+}
+
+/* Sends one damaged rectangle of a window to its RDPGFX surface: the color,
+ * planar compressed when the client allows it and that makes it smaller,
+ * then the alpha plane. Returns the number of bytes sent, or -1.
+ */
+static int
+rdp_rail_send_surface_rect(struct weston_surface *surface,
+			   const pixman_box32_t *rect,
+			   const struct weston_geometry *window_geometry,
+			   bool hasAlpha, uint32_t frame_id)
+{
+	struct weston_surface_rail_state *rail_state = surface->backend_state;
+	struct rdp_backend *b = to_rdp_backend(surface->compositor);
+	RdpPeerContext *peer_ctx = (RdpPeerContext *)b->rdp_peer->context;
+	RdpgfxServerContext *gfx_ctx = peer_ctx->rail_grfx_server_context;
+	RDPGFX_SURFACE_COMMAND surfaceCommand = {};
+	int width = rect->x2 - rect->x1;
+	int height = rect->y2 - rect->y1;
+	int stride = width * 4;
+	int size = stride * height;
+	BYTE *data, *alpha, *planar = NULL;
+	uint32_t planar_size = 0;
+	int alpha_size;
+
+	data = rdp_staging_pool_get(&peer_ctx->rail_staging_pool, size);
+	alpha = rdp_staging_pool_get(&peer_ctx->rail_staging_pool,
+				     rdp_alpha_encode_bound(width, height));
+
+	if (weston_surface_copy_content(surface,
+					data, size, 0, 0, 0,
+					rect->x1, rect->y1, width, height,
+					false /* y-flip */, true /* is_argb */) < 0) {
+		rdp_debug(b, "weston_surface_copy_content failed for windowId:0x%x, damage:(%d,%d) %dx%d\n",
+			  rail_state->window_id, rect->x1, rect->y1, width, height);
+		rdp_staging_pool_put(&peer_ctx->rail_staging_pool, data);
+		rdp_staging_pool_put(&peer_ctx->rail_staging_pool, alpha);
+		return -1;
+	}
+
+	/* whether buffer has alpha or not, always use alpha to avoid mstsc bug */
+	alpha_size = rdp_alpha_encode(alpha, data, width, height, stride,
+				      !hasAlpha);
+
+	if (width * height >= RDP_RAIL_MIN_COMPRESS_AREA &&
+	    rdp_rail_gfx_planar_enabled(peer_ctx)) {
+		/* alpha is sent on its own, so leave it out of the planes */
+		if (!peer_ctx->rail_planar_context)
+			peer_ctx->rail_planar_context =
+				freerdp_bitmap_planar_context_new(PLANAR_FORMAT_HEADER_RLE |
+								  PLANAR_FORMAT_HEADER_NA,
+								  width, height);
+		if (peer_ctx->rail_planar_context &&
+		    freerdp_bitmap_planar_context_reset(peer_ctx->rail_planar_context,
+							width, height)) {
+			/* FreeRDP never needs more than this for the 3 planes
+			 * and the format header, even when falling back to raw */
+			planar_size = 1 + size;
+			planar = rdp_staging_pool_get(&peer_ctx->rail_staging_pool,
+						      planar_size);
+			if (!freerdp_bitmap_compress_planar(peer_ctx->rail_planar_context,
+							    data, PIXEL_FORMAT_BGRA32,
+							    width, height, stride,
+							    planar, &planar_size) ||
+			    planar_size >= (uint32_t)size) {
+				rdp_staging_pool_put(&peer_ctx->rail_staging_pool,
+						     planar);
+				planar = NULL;
+			}
+		}
+	}
+
+	surfaceCommand.surfaceId = rail_state->surface_id;
+	surfaceCommand.contextId = 0;
+	surfaceCommand.format = PIXEL_FORMAT_BGRA32;
+	surfaceCommand.left = rect->x1 - window_geometry->x;
+	surfaceCommand.top = rect->y1 - window_geometry->y;
+	surfaceCommand.right = rect->x2 - window_geometry->x;
+	surfaceCommand.bottom = rect->y2 - window_geometry->y;
+	surfaceCommand.width = width;
+	surfaceCommand.height = height;
+	surfaceCommand.extra = NULL;
+
+	/* send bitmap data */
+	if (planar) {
+		surfaceCommand.codecId = RDPGFX_CODECID_PLANAR;
+		surfaceCommand.length = planar_size;
+		surfaceCommand.data = planar;
+	} else {
+		surfaceCommand.codecId = RDPGFX_CODECID_UNCOMPRESSED;
+		surfaceCommand.length = size;
+		surfaceCommand.data = data;
+	}
+	rdp_debug_verbose(b, "SurfaceCommand(frameId:0x%x, windowId:0x%x) for bitmap, codec:0x%x %dx%d %d bytes\n",
+			  frame_id, rail_state->window_id,
+			  surfaceCommand.codecId, width, height,
+			  surfaceCommand.length);
+	gfx_ctx->SurfaceCommand(gfx_ctx, &surfaceCommand);
+
+	to_rdp_rail_surface_state(rail_state)->bytes_raw += size;
+	size = alpha_size + surfaceCommand.length;
+
+	/* send alpha channel last, decoding the color sets it opaque */
+	surfaceCommand.codecId = RDPGFX_CODECID_ALPHA;
+	surfaceCommand.length = alpha_size;
+	surfaceCommand.data = alpha;
+	rdp_debug_verbose(b, "SurfaceCommand(frameId:0x%x, windowId:0x%x) for alpha\n",
+			  frame_id, rail_state->window_id);
+	gfx_ctx->SurfaceCommand(gfx_ctx, &surfaceCommand);
+
+	rdp_staging_pool_put(&peer_ctx->rail_staging_pool, planar);
+	rdp_staging_pool_put(&peer_ctx->rail_staging_pool, data);
+	rdp_staging_pool_put(&peer_ctx->rail_staging_pool, alpha);
+
+	return size;
+}
+
 static int
 rdp_rail_update_window(struct weston_surface *surface,
 			   struct update_window_iter_data *iter_data)
@@ -2531,6 +2794,7 @@ rdp_rail_update_window(struct weston_surface *surface,
 		int bufferBpp = 4; /* Bytes Per Pixel. */
 		bool hasAlpha = view ? !weston_view_is_opaque(view, &view->transform.boundingbox) : false;
 		pixman_box32_t damage_box = *pixman_region32_extents(&rail_state->damage);
+		bool full_damage = false;
 		long page_size = sysconf(_SC_PAGESIZE);
 
 		/* clientBuffer represents Windows size on client desktop */
@@ -2675,6 +2939,7 @@ rdp_rail_update_window(struct weston_surface *surface,
 				rail_state->forceRecreateSurface = false;
 
 				/* make entire content buffer damaged */
+				full_damage = true;
 				damage_box.x1 = 0;
 				damage_box.y1 = 0;
 				damage_box.x2 = content_buffer_width;
@@ -2823,82 +3088,15 @@ rdp_rail_update_window(struct weston_surface *surface,
 			} else
 #endif /* HAVE_FREERDP_GFXREDIR_H */
 			if (rail_state->surface_id) {
-				RDPGFX_SURFACE_COMMAND surfaceCommand = {};
-				int damageStride = damage_width * bufferBpp;
-				int damageSize = damageStride * damage_height;
-				BYTE *data = NULL;
-				int alphaCodecHeaderSize = 4;
-				BYTE *alpha = NULL;
-				int alphaSize;
 				RdpgfxServerContext *gfx_ctx = peer_ctx->rail_grfx_server_context;
-				data = xmalloc(damageSize);
-
-				if (hasAlpha)
-					alphaSize = alphaCodecHeaderSize +
-							damage_width *
-							damage_height;
-				else {
-					/* 8 = max of ALPHA_RLE_SEGMENT for single alpha value. */
-					alphaSize = alphaCodecHeaderSize + 8;
-				}
-				alpha = xmalloc(alphaSize);
+				struct rdp_rail_surface_state *state;
+				pixman_region32_t rects;
+				pixman_box32_t *rect;
+				int n_rects, sent, total_sent = 0;
+				struct timespec start, end;
+				int64_t latency_us;
 
-				if (weston_surface_copy_content(surface,
-								data, damageSize, 0, 0, 0,
-								damage_box.x1, damage_box.y1, damage_width, damage_height,
-								false /* y-flip */, true /* is_argb */) < 0) {
-					rdp_debug(b, 
-							"weston_surface_copy_content failed for windowId:0x%x, damageSize:%d, damage:(%d,%d) %dx%d, content:%dx%d\n",
-							window_id, damageSize,
-							damage_box.x1,
-							damage_box.y1,
-							damage_width,
-							damage_height,
-							content_buffer_width,
-							content_buffer_height);
-					free(data);
-					free(alpha);
-					return -1;
-				}
-
-				/* generate alpha only bitmap */
-				/* set up alpha codec header */
-				alpha[0] = 'L';	/* signature */
-				alpha[1] = 'A';	/* signature */
-				alpha[2] = hasAlpha ? 0 : 1; /* compression: RDP spec indicate this is non-zero value for compressed, but it must be 1.*/
-				alpha[3] = 0; /* compression */
-
-				if (hasAlpha) {
-					BYTE *alphaBits = &data[0];
-
-					for (int i = 0; i < damage_height; i++, alphaBits+=damageStride) {
-						BYTE *srcAlphaPixel = alphaBits + 3; /* 3 = xxxA. */
-						BYTE *dstAlphaPixel = &alpha[alphaCodecHeaderSize + (i * damage_width)];
-
-						for (int j = 0; j < damage_width; j++, srcAlphaPixel += bufferBpp, dstAlphaPixel++) {
-							*dstAlphaPixel = *srcAlphaPixel;
-						}
-					}
-				} else {
-					/* whether buffer has alpha or not, always use alpha to avoid mstsc bug */
-					/* CLEARCODEC_ALPHA_RLE_SEGMENT */
-					int bitmapSize = damage_width * damage_height;
-
-					alpha[alphaCodecHeaderSize] = 0xFF; /* alpha value (opaque) */
-					if (bitmapSize < 0xFF) {
-						alpha[alphaCodecHeaderSize + 1] = (BYTE)bitmapSize;
-						alphaSize = alphaCodecHeaderSize + 2; /* alpha value + size in byte. */
-					} else if (bitmapSize < 0xFFFF) {
-						alpha[alphaCodecHeaderSize+1] = 0xFF;
-						*(short*)&(alpha[alphaCodecHeaderSize+2]) = (short)bitmapSize;
-						alphaSize = alphaCodecHeaderSize+4; /* alpha value + 1 + size in short. */
-					} else {
-						alpha[alphaCodecHeaderSize+1] = 0xFF;
-						*(short*)&(alpha[alphaCodecHeaderSize+2]) = 0xFFFF;
-						*(int*)&(alpha[alphaCodecHeaderSize+4]) = bitmapSize;
-						alphaSize = alphaCodecHeaderSize+8; /* alpha value + 1 + 2 + size in int. */
-					}
-				}
+				weston_compositor_read_presentation_clock(compositor, &start);
 
 				if (iter_data->needEndFrame == FALSE) {
 					/* if frame is not started yet, send StartFrame first before sendng surface command. */
@@ -2914,38 +3112,32 @@ rdp_rail_update_window(struct weston_surface *surface,
 					iter_data->isUpdatePending = TRUE;
 				}
 
-				surfaceCommand.surfaceId = rail_state->surface_id;
-				surfaceCommand.contextId = 0;
-				surfaceCommand.format = PIXEL_FORMAT_BGRA32;
-				surfaceCommand.left = damage_box.x1 - content_buffer_window_geometry.x;
-				surfaceCommand.top = damage_box.y1 - content_buffer_window_geometry.y;
-				surfaceCommand.right = damage_box.x2 - content_buffer_window_geometry.x;
-				surfaceCommand.bottom = damage_box.y2 - content_buffer_window_geometry.y;
-				surfaceCommand.width = damage_width;
-				surfaceCommand.height = damage_height;
-				surfaceCommand.extra = NULL;
-
-				/* send alpha channel */
-				surfaceCommand.codecId = RDPGFX_CODECID_ALPHA;
-				surfaceCommand.length = alphaSize;
-				surfaceCommand.data = &alpha[0];
-				rdp_debug_verbose(b, "SurfaceCommand(frameId:0x%x, windowId:0x%x) for alpha\n",
-						  iter_data->startedFrameId,
-						  window_id);
-				gfx_ctx->SurfaceCommand(gfx_ctx,
-							&surfaceCommand);
-
-				/* send bitmap data */
-				surfaceCommand.codecId = RDPGFX_CODECID_UNCOMPRESSED;
-				surfaceCommand.length = damageSize;
-				surfaceCommand.data = &data[0];
-				rdp_debug_verbose(b, "SurfaceCommand(frameId:0x%x, windowId:0x%x) for bitmap\n",
-						  iter_data->startedFrameId,
-						  window_id);
-				gfx_ctx->SurfaceCommand(gfx_ctx, &surfaceCommand);
-
-				free(data);
-				free(alpha);
+				rdp_rail_get_damage_rects(surface, &damage_box,
+							  full_damage, &rects);
+				rect = pixman_region32_rectangles(&rects, &n_rects);
+				for (int i = 0; i < n_rects; i++) {
+					sent = rdp_rail_send_surface_rect(surface, &rect[i],
+									  &content_buffer_window_geometry,
+									  hasAlpha,
+									  iter_data->startedFrameId);
+					if (sent < 0) {
+						pixman_region32_fini(&rects);
+						return -1;
+					}
+					total_sent += sent;
+				}
+				pixman_region32_fini(&rects);
+
+				weston_compositor_read_presentation_clock(compositor, &end);
+				latency_us = timespec_sub_to_nsec(&end, &start) / 1000;
+				state = to_rdp_rail_surface_state(rail_state);
+				state->bytes_sent += total_sent;
+				state->update_time_us += latency_us;
+				state->update_count++;
+				rdp_debug_verbose(b, "update_window: windowId:0x%x %d rect(s) %d bytes in %" PRId64 " us (total %" PRIu64 "/%" PRIu64 " bytes sent/raw over %u updates)\n",
+						  window_id, n_rects, total_sent, latency_us,
+						  state->bytes_sent, state->bytes_raw,
+						  state->update_count);
 			}
 
 			pixman_region32_clear(&rail_state->damage);
@@ -3181,8 +3373,7 @@ rdp_rail_output_repaint(struct weston_output *output,
 	struct rdp_backend *b = to_rdp_backend(ec);
 	RdpPeerContext *peer_ctx = (RdpPeerContext *)b->rdp_peer->context;
 
-	if (peer_ctx->isAcknowledgedSuspended ||
-		((peer_ctx->currentFrameId - peer_ctx->acknowledgedFrameId) < 2)) {
+	if (rdp_rail_can_send_frame(peer_ctx)) {
 		struct update_window_iter_data iter_data = {};
 
 		/* notify window z order to client first,
@@ -3191,9 +3382,10 @@ rdp_rail_output_repaint(struct weston_output *output,
 			rdp_rail_sync_window_zorder(b->compositor);
 			peer_ctx->is_window_zorder_dirty = false;
 		}
-		rdp_debug_verbose(b, "currentFrameId:0x%x, acknowledgedFrameId:0x%x, isAcknowledgedSuspended:%d\n",
+		rdp_debug_verbose(b, "currentFrameId:0x%x, acknowledgedFrameId:0x%x, frameAckWindow:%u, isAcknowledgedSuspended:%d\n",
 				   peer_ctx->currentFrameId,
 				   peer_ctx->acknowledgedFrameId,
+				   peer_ctx->frameAckWindow,
 				   peer_ctx->isAcknowledgedSuspended);
 
 		iter_data.output_id = output->id;
@@ -3218,10 +3410,17 @@ rdp_rail_output_repaint(struct weston_output *output,
 			weston_compositor_wake(b->compositor);
 		}
 	} else {
-		rdp_debug_verbose(b, "frame update is skipped. currentFrameId:%d, acknowledgedFrameId:%d, isAcknowledgedSuspended:%d\n",
+		/* Window damage keeps accumulating until the client
+		 * acknowledges enough frames, see
+		 * rail_grfx_client_frame_acknowledge_callback(). */
+		peer_ctx->isFrameUpdateDeferred = true;
+		peer_ctx->deferredFrameUpdates++;
+		rdp_debug_verbose(b, "frame update is deferred. currentFrameId:%d, acknowledgedFrameId:%d, frameAckWindow:%u, isAcknowledgedSuspended:%d, %" PRIu64 " deferred so far\n",
 				  peer_ctx->currentFrameId,
 				  peer_ctx->acknowledgedFrameId,
-				  peer_ctx->isAcknowledgedSuspended);
+				  peer_ctx->frameAckWindow,
+				  peer_ctx->isAcknowledgedSuspended,
+				  peer_ctx->deferredFrameUpdates);
 	}
 	return;
 }
@@ -3328,7 +3527,9 @@ disp_client_monitor_layout_change(DispServerContext *context, const DISPLAY_CONT
 		data->monitors[i].orig_screen = 0;
 	}
 
-	rdp_dispatch_task_to_display_loop(peerCtx, disp_monitor_layout_change_callback, &data->_base);
+	/* a newer layout replaces any which is still pending */
+	rdp_dispatch_coalescing_task_to_display_loop(peerCtx, disp_monitor_layout_change_callback,
+						     &data->_base, 1);
 
 	return CHANNEL_RC_OK;
 }
@@ -4041,6 +4242,122 @@ rdp_rail_end_window_move(struct weston_surface *surface)
 	rdp_debug(b, "=============== EndWindowMove ===============\n");
 }
 
+/* upper bound on the icons tracked per peer, whatever the client offers */
+#define RDP_RAIL_ICON_CACHE_MAX_SLOTS 1024
+
+static void
+rdp_rail_icon_cache_init(RdpPeerContext *peer_ctx)
+{
+	struct rdp_rail_icon_cache *cache = &peer_ctx->iconCache;
+	struct rdp_backend *b = peer_ctx->rdpBackend;
+	rdpSettings *settings = peer_ctx->_p.settings;
+	uint32_t num_caches;
+	uint32_t num_entries;
+
+	cache->initialized = true;
+
+	/* Window List Capability Set, 0xFF and 0xFFFF mean "not cached" in
+	 * the icon orders, so those cannot be used as ids. */
+	num_caches = freerdp_settings_get_uint32(settings,
+						 FreeRDP_RemoteAppNumIconCaches);
+	num_entries = freerdp_settings_get_uint32(settings,
+						  FreeRDP_RemoteAppNumIconCacheEntries);
+	num_caches = MIN(num_caches, 0xFF);
+	num_entries = MIN(num_entries, 0xFFFF);
+	if (num_caches == 0 || num_entries == 0) {
+		rdp_debug(b, "%s: client has no icon cache\n", __func__);
+		return;
+	}
+
+	cache->entries_per_cache = num_entries;
+	cache->num_slots = MIN(num_caches * num_entries,
+			       RDP_RAIL_ICON_CACHE_MAX_SLOTS);
+	cache->slots = xcalloc(cache->num_slots, sizeof *cache->slots);
+
+	rdp_debug(b, "%s: %u icon caches of %u entries, using %u\n",
+		  __func__, num_caches, num_entries, cache->num_slots);
+}
+
+static void
+rdp_rail_icon_cache_fini(RdpPeerContext *peer_ctx)
+{
+	struct rdp_rail_icon_cache *cache = &peer_ctx->iconCache;
+
+	if (cache->initialized)
+		rdp_debug(peer_ctx->rdpBackend,
+			  "icon cache: %" PRIu64 " hits, %" PRIu64 " misses, "
+			  "%" PRIu64 " bytes sent\n",
+			  cache->hits, cache->misses, cache->bytes_sent);
+
+	free(cache->slots);
+	memset(cache, 0, sizeof *cache);
+}
+
+/* Hash of the pixels as given by the shell, so identical icons of
+ * different windows are found without scaling them first. */
+static uint64_t
+rdp_rail_icon_hash(pixman_image_t *icon)
+{
+	uint8_t *row = (uint8_t *)pixman_image_get_data(icon);
+	int width = pixman_image_get_width(icon);
+	int height = pixman_image_get_height(icon);
+	int stride = pixman_image_get_stride(icon);
+	int bpp = PIXMAN_FORMAT_BPP(pixman_image_get_format(icon));
+	int row_bytes = (width * bpp + 7) / 8;
+	uint64_t hash = 0xcbf29ce484222325ull; /* FNV-1a */
+	int x, y;
+
+	hash = (hash ^ pixman_image_get_format(icon)) * 0x100000001b3ull;
+	for (y = 0; y < height; y++, row += stride) {
+		uint32_t word;
+
+		for (x = 0; x + 4 <= row_bytes; x += 4) {
+			memcpy(&word, row + x, sizeof word);
+			hash = (hash ^ word) * 0x100000001b3ull;
+		}
+		for (; x < row_bytes; x++)
+			hash = (hash ^ row[x]) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/* Returns the slot holding the icon, or -1 after pointing *victim at the
+ * slot to store it in, -1 as well when the client has no cache. */
+static int
+rdp_rail_icon_cache_lookup(struct rdp_rail_icon_cache *cache,
+			   const struct rdp_rail_icon *key, int *victim)
+{
+	uint32_t i;
+
+	*victim = -1;
+	for (i = 0; i < cache->num_slots; i++) {
+		struct rdp_rail_icon *slot = &cache->slots[i];
+
+		if (!slot->valid) {
+			if (*victim < 0 || cache->slots[*victim].valid)
+				*victim = i;
+			continue;
+		}
+
+		if (slot->hash == key->hash &&
+		    slot->src_width == key->src_width &&
+		    slot->src_height == key->src_height &&
+		    slot->width == key->width &&
+		    slot->height == key->height) {
+			slot->last_use = ++cache->use_count;
+			return i;
+		}
+
+		if (*victim < 0 ||
+		    (cache->slots[*victim].valid &&
+		     slot->last_use < cache->slots[*victim].last_use))
+			*victim = i;
+	}
+
+	return -1;
+}
+
 static void
 rdp_rail_destroy_window_iter(void *element, void *data)
 {
@@ -4092,6 +4409,11 @@ rdp_rail_peer_context_free(freerdp_peer *client, RdpPeerContext *context)
 		rdpgfx_server_context_free(gfx_ctx);
 	}
 
+	if (context->rail_planar_context) {
+		freerdp_bitmap_planar_context_free(context->rail_planar_context);
+		context->rail_planar_context = NULL;
+	}
+
 	if (disp_ctx) {
 		disp_ctx->Close(disp_ctx);
 		disp_server_context_free(disp_ctx);
@@ -4123,6 +4445,8 @@ rdp_rail_peer_context_free(freerdp_peer *client, RdpPeerContext *context)
 #endif /* HAVE_FREERDP_GFXREDIR_H */
 	rdp_id_manager_free(&context->surfaceId);
 	rdp_id_manager_free(&context->windowId);
+	rdp_staging_pool_fini(&context->rail_staging_pool);
+	rdp_rail_icon_cache_fini(context);
 }
 
 bool
@@ -4206,12 +4530,21 @@ rdp_rail_peer_init(freerdp_peer *client, RdpPeerContext *peer_ctx)
 	}
 #endif /* HAVE_FREERDP_GFXREDIR_H */
 
+	if (!rdp_staging_pool_init(b, &peer_ctx->rail_staging_pool, "rail")) {
+		weston_log("unable to create staging pool.\n");
+		goto error_return;
+	}
+
 	peer_ctx->currentFrameId = 0;
 	peer_ctx->acknowledgedFrameId = 0;
+	peer_ctx->frameAckWindow = b->frame_ack_window;
+	peer_ctx->isFrameUpdateDeferred = false;
+	peer_ctx->deferredFrameUpdates = 0;
 
 	return TRUE;
 
 error_return:
+	rdp_staging_pool_fini(&peer_ctx->rail_staging_pool);
 
 #ifdef HAVE_FREERDP_GFXREDIR_H
 	rdp_id_manager_free(&peer_ctx->bufferId);
@@ -4503,6 +4836,7 @@ rdp_rail_dump_window_binding(struct weston_keyboard *keyboard,
 		dump_id_manager_state(fp, &peer_ctx->poolId, "poolId");
 		dump_id_manager_state(fp, &peer_ctx->bufferId, "bufferId");
 #endif /* HAVE_FREERDP_GFXREDIR_H */
+		dump_loop_task_queue_state(fp, &peer_ctx->loop_task_queue);
 		context.peer_ctx = peer_ctx;
 		context.fp = fp;
 		rdp_id_manager_for_each(&peer_ctx->windowId, rdp_rail_dump_window_iter, (void*)&context);
@@ -4562,6 +4896,9 @@ rdp_rail_set_window_icon(struct weston_surface *surface, pixman_image_t *icon)
 	int max_icon_height;
 	int target_icon_width;
 	int target_icon_height;
+	struct rdp_rail_icon cache_key = {};
+	int cache_slot;
+	int cache_victim;
 
 	if (!b || !b->rdp_peer) {
 		rdp_debug(b, "set_window_icon(): rdp_peer is not initalized\n");
@@ -4616,6 +4953,37 @@ rdp_rail_set_window_icon(struct weston_surface *surface, pixman_image_t *icon)
 	else
 		target_icon_height = height;
 
+	if (!peer_ctx->iconCache.initialized)
+		rdp_rail_icon_cache_init(peer_ctx);
+
+	cache_key.hash = rdp_rail_icon_hash(icon);
+	cache_key.src_width = width;
+	cache_key.src_height = height;
+	cache_key.width = target_icon_width;
+	cache_key.height = target_icon_height;
+	cache_slot = rdp_rail_icon_cache_lookup(&peer_ctx->iconCache,
+						&cache_key, &cache_victim);
+	if (cache_slot >= 0) {
+		WINDOW_CACHED_ICON_ORDER cached_icon_order = {};
+		uint32_t entries = peer_ctx->iconCache.entries_per_cache;
+
+		peer_ctx->iconCache.hits++;
+		rdp_debug_verbose(b, "rdp_rail_set_window_icon: window:0x%x uses cached icon %d\n",
+				  rail_state->window_id, cache_slot);
+
+		order_info.windowId = rail_state->window_id;
+		order_info.fieldFlags = WINDOW_ORDER_TYPE_WINDOW | WINDOW_ORDER_CACHED_ICON;
+		cached_icon_order.cachedIcon.cacheEntry = cache_slot % entries;
+		cached_icon_order.cachedIcon.cacheId = cache_slot / entries;
+
+		update->BeginPaint(update->context);
+		update->window->WindowCachedIcon(update->context, &order_info,
+						 &cached_icon_order);
+		update->EndPaint(update->context);
+		return;
+	}
+	peer_ctx->iconCache.misses++;
+
 	/* create icon bitmap with flip in Y-axis, and client always expects a8r8g8b8 format. */
 	scaled_icon = pixman_image_create_bits_no_clear(PIXMAN_a8r8g8b8,
 							target_icon_width,
@@ -4704,8 +5072,20 @@ rdp_rail_set_window_icon(struct weston_surface *surface, pixman_image_t *icon)
 
 	order_info.windowId = rail_state->window_id;
 	order_info.fieldFlags = WINDOW_ORDER_TYPE_WINDOW | WINDOW_ORDER_ICON;
-	icon_info.cacheEntry = 0xFFFF; /* no cache */
-	icon_info.cacheId = 0xFF; /* no cache */
+	if (cache_victim >= 0) {
+		uint32_t entries = peer_ctx->iconCache.entries_per_cache;
+		struct rdp_rail_icon *slot = &peer_ctx->iconCache.slots[cache_victim];
+
+		/* the client replaces whatever it had in this entry */
+		*slot = cache_key;
+		slot->valid = true;
+		slot->last_use = ++peer_ctx->iconCache.use_count;
+		icon_info.cacheEntry = cache_victim % entries;
+		icon_info.cacheId = cache_victim / entries;
+	} else {
+		icon_info.cacheEntry = 0xFFFF; /* no cache */
+		icon_info.cacheId = 0xFF; /* no cache */
+	}
 	icon_info.bpp = 32;
 	icon_info.width = (uint32_t)width;
 	icon_info.height = (uint32_t)height;
@@ -4720,6 +5100,7 @@ rdp_rail_set_window_icon(struct weston_surface *surface, pixman_image_t *icon)
 	update->BeginPaint(update->context);
 	update->window->WindowIcon(update->context, &order_info, &icon_order);
 	update->EndPaint(update->context);
+	peer_ctx->iconCache.bytes_sent += size_mask + size_color;
 
 	free(bits_mask);
 	if (bits_color_allocated)
@@ -5070,6 +5451,10 @@ rdp_rail_backend_create(struct rdp_backend *b, struct weston_rdp_backend_config
 	rdp_debug(b, "RDP backend: enable_display_power_by_screenupdate = %d\n",
 		  b->enable_display_power_by_screenupdate);
 
+	b->frame_ack_window = MIN(MAX(config->rail_config.frame_ack_window, 1), 16);
+	rdp_debug(b, "RDP backend: frame_ack_window = %u\n",
+		  b->frame_ack_window);
+
 	b->enable_distro_name_title = config->rail_config.enable_distro_name_title;
 	rdp_debug(b, "RDP backend: enable_distro_name_title = %d\n",
 		  b->enable_distro_name_title);
@@ -26,6 +26,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,6 +42,8 @@
 
 #include "rdp.h"
 
+#include "shared/xalloc.h"
+
 static int cached_tm_mday = -1;
 
 void rdp_debug_print(struct weston_log_scope *log_scope, bool cont, char *fmt, ...)
@@ -104,10 +107,69 @@ rdp_event_loop_add_fd(struct wl_event_loop *loop,
 	return true;
 }
 
+static void
+rdp_loop_task_queue_init(struct rdp_loop_task_queue *queue)
+{
+	memset(queue, 0, sizeof *queue);
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+}
+
+/* Called from any thread. */
+static void
+rdp_loop_task_queue_push(struct rdp_loop_task_queue *queue,
+			 struct rdp_loop_task *task)
+{
+	struct rdp_loop_task *prev;
+
+	__atomic_store_n(&task->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&queue->head, task, __ATOMIC_ACQ_REL);
+	/* until this store, the consumer sees the queue end at prev */
+	__atomic_store_n(&prev->next, task, __ATOMIC_RELEASE);
+}
+
+/* Called from the display loop only. Returns NULL if the queue is empty,
+ * or if a producer is in the middle of a push, in which case its eventfd
+ * write is still to come and brings us back here.
+ */
+static struct rdp_loop_task *
+rdp_loop_task_queue_pop(struct rdp_loop_task_queue *queue)
+{
+	struct rdp_loop_task *tail = queue->tail;
+	struct rdp_loop_task *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &queue->stub) {
+		if (!next)
+			return NULL;
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	/* tail is the last task, put the stub behind it so it can be taken */
+	rdp_loop_task_queue_push(queue, &queue->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
 void
-rdp_dispatch_task_to_display_loop(RdpPeerContext *peerCtx,
-				  rdp_loop_task_func_t func,
-				  struct rdp_loop_task *task)
+rdp_dispatch_coalescing_task_to_display_loop(RdpPeerContext *peerCtx,
+					     rdp_loop_task_func_t func,
+					     struct rdp_loop_task *task,
+					     uint32_t coalesce_key)
 {
 	/* this function is ONLY used to queue the task from FreeRDP thread,
 	 * and the task to be processed at wayland display loop thread. */
@@ -115,38 +177,97 @@ rdp_dispatch_task_to_display_loop(RdpPeerContext *peerCtx,
 
 	task->peerCtx = peerCtx;
 	task->func = func;
+	task->coalesce_key = coalesce_key;
+	clock_gettime(CLOCK_MONOTONIC, &task->queue_time);
 
-	pthread_mutex_lock(&peerCtx->loop_task_list_mutex);
-	/* this inserts at head */
-	wl_list_insert(&peerCtx->loop_task_list, &task->link);
-	pthread_mutex_unlock(&peerCtx->loop_task_list_mutex);
+	__atomic_add_fetch(&peerCtx->loop_task_queue.depth, 1, __ATOMIC_RELAXED);
+	rdp_loop_task_queue_push(&peerCtx->loop_task_queue, task);
 
 	eventfd_write(peerCtx->loop_task_event_source_fd, 1);
 }
 
+void
+rdp_dispatch_task_to_display_loop(RdpPeerContext *peerCtx,
+				  rdp_loop_task_func_t func,
+				  struct rdp_loop_task *task)
+{
+	rdp_dispatch_coalescing_task_to_display_loop(peerCtx, func, task, 0);
+}
+
+static bool
+rdp_loop_task_is_superseded(struct rdp_loop_task *task)
+{
+	struct rdp_loop_task *later;
+
+	if (!task->coalesce_key)
+		return false;
+
+	for (later = task->next; later; later = later->next) {
+		if (later->func == task->func &&
+		    later->coalesce_key == task->coalesce_key)
+			return true;
+	}
+
+	return false;
+}
+
 static int
 rdp_dispatch_task(int fd, uint32_t mask, void *arg)
 {
 	RdpPeerContext *peerCtx = (RdpPeerContext *)arg;
-	struct rdp_loop_task *task, *tmp;
+	struct rdp_loop_task_queue *queue = &peerCtx->loop_task_queue;
+	struct rdp_loop_task *first = NULL, *last = NULL;
+	struct rdp_loop_task *task, *next;
+	struct timespec now;
+	uint32_t count = 0, coalesced = 0;
+	uint64_t latency_us;
 	eventfd_t dummy;
 
 	/* this must be called back at wayland display loop thread */
 	assert_compositor_thread(peerCtx->rdpBackend);
 
 	eventfd_read(peerCtx->loop_task_event_source_fd, &dummy);
+	queue->wakeups++;
+	queue->max_depth = MAX(queue->max_depth,
+			       __atomic_load_n(&queue->depth, __ATOMIC_RELAXED));
+
+	/* take everything queued so far, so superseded tasks can be
+	 * dropped and a burst is handled in one go. Popped tasks are ours,
+	 * their next pointer now links the batch in queue order. */
+	while ((task = rdp_loop_task_queue_pop(queue))) {
+		__atomic_sub_fetch(&queue->depth, 1, __ATOMIC_RELAXED);
+		task->next = NULL;
+		if (last)
+			last->next = task;
+		else
+			first = task;
+		last = task;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (task = first; task; task = next) {
+		next = task->next;
 
-	pthread_mutex_lock(&peerCtx->loop_task_list_mutex);
-	/* dequeue the first task which is at last, so use reverse. */
-	assert(!wl_list_empty(&peerCtx->loop_task_list));
-	wl_list_for_each_reverse_safe(task, tmp, &peerCtx->loop_task_list, link) {
-		wl_list_remove(&task->link);
-		break;
+		if (rdp_loop_task_is_superseded(task)) {
+			task->func(true /* freeOnly */, task);
+			coalesced++;
+			continue;
+		}
+
+		latency_us = timespec_sub_to_nsec(&now, &task->queue_time) / 1000;
+		queue->latency_total_us += latency_us;
+		queue->latency_max_us = MAX(queue->latency_max_us, latency_us);
+		count++;
+
+		/* Dispatch and task will be freed by caller. */
+		task->func(false, task);
 	}
-	pthread_mutex_unlock(&peerCtx->loop_task_list_mutex);
 
-	/* Dispatch and task will be freed by caller. */
-	task->func(false, task);
+	queue->dispatched += count;
+	queue->coalesced += coalesced;
+	if (count + coalesced > 1)
+		rdp_debug_verbose(peerCtx->rdpBackend, "%s: %u task(s) dispatched, %u coalesced\n",
+				  __func__, count, coalesced);
 
 	return 0;
 }
@@ -158,20 +279,15 @@ rdp_initialize_dispatch_task_event_source(RdpPeerContext *peerCtx)
 	struct wl_event_loop *loop;
 	bool ret;
 
-	if (pthread_mutex_init(&peerCtx->loop_task_list_mutex, NULL) == -1) {
-		weston_log("%s: pthread_mutex_init failed. %s\n", __func__, strerror(errno));
-		goto error_mutex;
-	}
+	rdp_loop_task_queue_init(&peerCtx->loop_task_queue);
 
 	assert(peerCtx->loop_task_event_source_fd == -1);
-	peerCtx->loop_task_event_source_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+	peerCtx->loop_task_event_source_fd = eventfd(0, EFD_CLOEXEC);
 	if (peerCtx->loop_task_event_source_fd == -1) {
-		weston_log("%s: eventfd(EFD_SEMAPHORE) failed. %s\n", __func__, strerror(errno));
-		goto error_event_source_fd;
+		weston_log("%s: eventfd failed. %s\n", __func__, strerror(errno));
+		return false;
 	}
 
-	assert(wl_list_empty(&peerCtx->loop_task_list));
-
 	loop = wl_display_get_event_loop(b->compositor->wl_display);
 	assert(peerCtx->loop_task_event_source == NULL);
 
@@ -180,26 +296,20 @@ rdp_initialize_dispatch_task_event_source(RdpPeerContext *peerCtx)
 				    WL_EVENT_READABLE, rdp_dispatch_task,
 				    peerCtx,
 				    &peerCtx->loop_task_event_source);
-	if (!ret)
-		goto error_event_loop_add_fd;
+	if (!ret) {
+		close(peerCtx->loop_task_event_source_fd);
+		peerCtx->loop_task_event_source_fd = -1;
+		return false;
+	}
 
 	return true;
-
-error_event_loop_add_fd:
-	close(peerCtx->loop_task_event_source_fd);
-	peerCtx->loop_task_event_source_fd = -1;
-
-error_event_source_fd:
-	pthread_mutex_destroy(&peerCtx->loop_task_list_mutex);
-
-error_mutex:
-	return false;
 }
 
 void
 rdp_destroy_dispatch_task_event_source(RdpPeerContext *peerCtx)
 {
-	struct rdp_loop_task *task, *tmp;
+	struct rdp_loop_task_queue *queue = &peerCtx->loop_task_queue;
+	struct rdp_loop_task *task;
 
 	/* This function must be called all virtual channel thread at FreeRDP is terminated,
 	 * that ensures no more incoming tasks. */
@@ -209,20 +319,24 @@ rdp_destroy_dispatch_task_event_source(RdpPeerContext *peerCtx)
 		peerCtx->loop_task_event_source = NULL;
 	}
 
-	wl_list_for_each_reverse_safe(task, tmp, &peerCtx->loop_task_list, link) {
-		wl_list_remove(&task->link);
-		/* inform caller task is not really scheduled prior to context destruction,
-		 * inform them to clean them up. */
-		task->func(true /* freeOnly */, task);
+	if (queue->head) {
+		while ((task = rdp_loop_task_queue_pop(queue))) {
+			/* inform caller task is not really scheduled prior to context destruction,
+			 * inform them to clean them up. */
+			task->func(true /* freeOnly */, task);
+		}
+		assert(queue->tail == queue->head);
+
+		rdp_debug(peerCtx->rdpBackend, "%s: %" PRIu64 " task(s) in %" PRIu64 " wakeup(s), %" PRIu64 " coalesced, max depth %u, latency max %" PRIu64 " us\n",
+			  __func__, queue->dispatched, queue->wakeups,
+			  queue->coalesced, queue->max_depth,
+			  queue->latency_max_us);
 	}
-	assert(wl_list_empty(&peerCtx->loop_task_list));
 
 	if (peerCtx->loop_task_event_source_fd != -1) {
 		close(peerCtx->loop_task_event_source_fd);
 		peerCtx->loop_task_event_source_fd = -1;
 	}
-
-	pthread_mutex_destroy(&peerCtx->loop_task_list_mutex);
 }
 
 /* This is a little tricky - it makes sure there's always at least
@@ -505,3 +619,187 @@ dump_id_manager_state(FILE *fp, struct rdp_id_manager *id_manager, char* title)
 	fprintf(fp,"    used IDs: %u\n", id_manager->id_used);
 	fprintf(fp,"\n");
 }
+
+void
+dump_loop_task_queue_state(FILE *fp, struct rdp_loop_task_queue *queue)
+{
+	fprintf(fp,"Display loop task queue status:\n");
+	fprintf(fp,"    depth: %u\n", __atomic_load_n(&queue->depth, __ATOMIC_RELAXED));
+	fprintf(fp,"    max depth: %u\n", queue->max_depth);
+	fprintf(fp,"    wakeups: %" PRIu64 "\n", queue->wakeups);
+	fprintf(fp,"    dispatched: %" PRIu64 "\n", queue->dispatched);
+	fprintf(fp,"    coalesced: %" PRIu64 "\n", queue->coalesced);
+	fprintf(fp,"    average latency: %" PRIu64 " us\n",
+		queue->dispatched ? queue->latency_total_us / queue->dispatched : 0);
+	fprintf(fp,"    max latency: %" PRIu64 " us\n", queue->latency_max_us);
+	fprintf(fp,"\n");
+}
+
+/* Staging buffers are rounded up to a power of two from 4 KiB, the
+ * largest ones aren't kept around. */
+#define RDP_STAGING_POOL_MIN_SHIFT 12
+#define RDP_STAGING_POOL_MAX_FREE 4
+#define RDP_STAGING_POOL_TRIM_MS 5000
+
+struct rdp_staging_buffer {
+	struct wl_list link;
+	size_t size;
+	int size_class; /* -1 if not pooled */
+};
+
+static int
+rdp_staging_pool_size_class(size_t size)
+{
+	int size_class = 0;
+
+	while (((size_t)1 << (size_class + RDP_STAGING_POOL_MIN_SHIFT)) < size)
+		size_class++;
+
+	return size_class < RDP_STAGING_POOL_CLASSES ? size_class : -1;
+}
+
+static void
+rdp_staging_pool_trim(struct rdp_staging_pool *pool)
+{
+	struct rdp_staging_buffer *buffer, *tmp;
+	size_t trimmed = pool->cached_bytes;
+
+	for (int i = 0; i < RDP_STAGING_POOL_CLASSES; i++) {
+		wl_list_for_each_safe(buffer, tmp, &pool->free[i], link) {
+			wl_list_remove(&buffer->link);
+			free(buffer);
+		}
+		pool->free_count[i] = 0;
+	}
+	pool->cached_bytes = 0;
+
+	rdp_debug(pool->rdp_backend, "%s staging pool: trimmed %zu bytes, high water %zu bytes, %" PRIu64 "/%" PRIu64 " hits (%" PRIu64 "%%)\n",
+		  pool->name, trimmed, pool->high_water, pool->hits,
+		  pool->requests,
+		  pool->requests ? pool->hits * 100 / pool->requests : 0);
+}
+
+static int
+rdp_staging_pool_trim_handler(void *data)
+{
+	struct rdp_staging_pool *pool = data;
+
+	/* only give the memory back once the pool sat unused for a while */
+	if (pool->requests != pool->requests_at_last_trim_check) {
+		pool->requests_at_last_trim_check = pool->requests;
+		wl_event_source_timer_update(pool->trim_timer,
+					     RDP_STAGING_POOL_TRIM_MS);
+		return 0;
+	}
+
+	pool->trim_armed = false;
+	rdp_staging_pool_trim(pool);
+
+	return 0;
+}
+
+bool
+rdp_staging_pool_init(struct rdp_backend *b, struct rdp_staging_pool *pool,
+		      const char *name)
+{
+	struct wl_event_loop *loop;
+
+	assert_compositor_thread(b);
+
+	memset(pool, 0, sizeof *pool);
+	pool->rdp_backend = b;
+	pool->name = name;
+	for (int i = 0; i < RDP_STAGING_POOL_CLASSES; i++)
+		wl_list_init(&pool->free[i]);
+
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	pool->trim_timer = wl_event_loop_add_timer(loop,
+						   rdp_staging_pool_trim_handler,
+						   pool);
+
+	return pool->trim_timer != NULL;
+}
+
+void
+rdp_staging_pool_fini(struct rdp_staging_pool *pool)
+{
+	if (!pool->rdp_backend)
+		return;
+
+	assert_compositor_thread(pool->rdp_backend);
+
+	if (pool->in_use_bytes)
+		weston_log("%s: %s staging pool: possible leak: %zu bytes\n",
+			   __func__, pool->name, pool->in_use_bytes);
+	rdp_staging_pool_trim(pool);
+	if (pool->trim_timer)
+		wl_event_source_remove(pool->trim_timer);
+	pool->trim_timer = NULL;
+	pool->rdp_backend = NULL;
+}
+
+/* Returns a buffer of at least 'size' bytes, to be given back with
+ * rdp_staging_pool_put(). */
+void *
+rdp_staging_pool_get(struct rdp_staging_pool *pool, size_t size)
+{
+	struct rdp_staging_buffer *buffer;
+	int size_class = rdp_staging_pool_size_class(size);
+
+	assert_compositor_thread(pool->rdp_backend);
+
+	pool->requests++;
+	if (!pool->trim_armed && pool->trim_timer) {
+		wl_event_source_timer_update(pool->trim_timer,
+					     RDP_STAGING_POOL_TRIM_MS);
+		pool->trim_armed = true;
+	}
+
+	if (size_class >= 0 && !wl_list_empty(&pool->free[size_class])) {
+		buffer = container_of(pool->free[size_class].next,
+				      struct rdp_staging_buffer, link);
+		wl_list_remove(&buffer->link);
+		pool->free_count[size_class]--;
+		pool->cached_bytes -= buffer->size;
+		pool->hits++;
+	} else {
+		if (size_class >= 0)
+			size = (size_t)1 << (size_class + RDP_STAGING_POOL_MIN_SHIFT);
+		buffer = xmalloc(sizeof *buffer + size);
+		buffer->size = size;
+		buffer->size_class = size_class;
+	}
+	wl_list_init(&buffer->link);
+
+	pool->in_use_bytes += buffer->size;
+	pool->high_water = MAX(pool->high_water,
+			       pool->in_use_bytes + pool->cached_bytes);
+
+	return buffer + 1;
+}
+
+void
+rdp_staging_pool_put(struct rdp_staging_pool *pool, void *data)
+{
+	struct rdp_staging_buffer *buffer;
+	int size_class;
+
+	if (!data)
+		return;
+
+	assert_compositor_thread(pool->rdp_backend);
+
+	buffer = (struct rdp_staging_buffer *)data - 1;
+	size_class = buffer->size_class;
+	pool->in_use_bytes -= buffer->size;
+
+	if (size_class < 0 ||
+	    pool->free_count[size_class] == RDP_STAGING_POOL_MAX_FREE) {
+		free(buffer);
+		return;
+	}
+
+	wl_list_insert(&pool->free[size_class], &buffer->link);
+	pool->free_count[size_class]++;
+	pool->cached_bytes += buffer->size;
+}
@@ -30,6 +30,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -61,6 +62,11 @@
 
 #define DEFAULT_AXIS_STEP_DISTANCE 10
 
+/* Rendered frames neatvnc may still hold on to before rendering pauses */
+#define VNC_MAX_FRAMES_IN_FLIGHT 2
+/* Upper bound of the adaptive minimum interval between renders */
+#define VNC_MAX_FRAME_INTERVAL_NSEC 1000000000LL
+
 struct vnc_output;
 
 struct vnc_backend {
@@ -81,6 +87,12 @@ struct vnc_backend {
 	unsigned int formats_count;
 };
 
+struct vnc_frame {
+	struct nvnc_fb *fb;
+	struct timespec fed; /* handed to neatvnc */
+	struct timespec superseded; /* the next frame got handed over */
+};
+
 struct vnc_output {
 	struct weston_output base;
 	struct weston_plane cursor_plane;
@@ -91,6 +103,17 @@ struct vnc_output {
 
 	struct nvnc_fb_pool *fb_pool;
 
+	/* Frames are only rendered while the encoders keep up with them,
+	 * damage is collected in the meantime. */
+	struct vnc_frame frames[VNC_MAX_FRAMES_IN_FLIGHT];
+	int frames_in_flight;
+	pixman_region32_t pending_damage;
+	struct timespec last_render;
+	int64_t frame_interval_nsec;
+	uint32_t repaints_deferred; /* since the last render */
+	uint64_t frames_rendered;
+	uint64_t frames_coalesced;
+
 	struct wl_list peers;
 
 	bool resizeable;
@@ -673,6 +696,109 @@ vnc_log_damage(struct vnc_backend *backend, pixman_region32_t *buffer_damage,
 	weston_log_scope_printf(backend->debug, "\n\n");
 }
 
+static void
+vnc_fb_release_to_pool(struct nvnc_fb *fb, void *data)
+{
+	struct nvnc_fb_pool *pool = data;
+
+	nvnc_fb_pool_release(pool, fb);
+	nvnc_fb_pool_unref(pool);
+}
+
+/* neatvnc lets go of a frame once no client encodes it anymore */
+static void
+vnc_fb_release(struct nvnc_fb *fb, void *data)
+{
+	struct vnc_output *output = data;
+	struct weston_compositor *ec = output->base.compositor;
+	struct vnc_frame *frame = NULL;
+	struct timespec now;
+	int64_t sample;
+	int i;
+
+	nvnc_fb_pool_release(output->fb_pool, fb);
+
+	for (i = 0; i < output->frames_in_flight; i++) {
+		if (output->frames[i].fb == fb) {
+			frame = &output->frames[i];
+			break;
+		}
+	}
+	if (!frame)
+		return;
+
+	/* How long the encoders lagged behind the newest frame, renders are
+	 * spaced out by about that much. */
+	weston_compositor_read_presentation_clock(ec, &now);
+	if (timespec_is_zero(&frame->superseded))
+		sample = timespec_sub_to_nsec(&now, &frame->fed);
+	else
+		sample = timespec_sub_to_nsec(&now, &frame->superseded);
+	sample = MAX(sample, 0);
+	sample = MIN(sample, VNC_MAX_FRAME_INTERVAL_NSEC);
+	output->frame_interval_nsec += (sample - output->frame_interval_nsec) / 8;
+
+	output->frames_in_flight--;
+	memmove(frame, frame + 1,
+		(output->frames + output->frames_in_flight - frame) * sizeof *frame);
+
+	/* The repaint loop waited for this frame to render deferred damage */
+	if (pixman_region32_not_empty(&output->pending_damage))
+		weston_output_schedule_repaint(&output->base);
+}
+
+static bool
+vnc_output_can_render(struct vnc_output *output, const struct timespec *now)
+{
+	if (output->frames_in_flight >= VNC_MAX_FRAMES_IN_FLIGHT)
+		return false;
+
+	return timespec_sub_to_nsec(now, &output->last_render) >=
+	       output->frame_interval_nsec;
+}
+
+static void
+vnc_output_track_frame(struct vnc_output *output, struct nvnc_fb *fb,
+		       const struct timespec *now)
+{
+	struct vnc_frame *frame;
+	int i;
+
+	assert(output->frames_in_flight < VNC_MAX_FRAMES_IN_FLIGHT);
+
+	for (i = 0; i < output->frames_in_flight; i++) {
+		if (timespec_is_zero(&output->frames[i].superseded))
+			output->frames[i].superseded = *now;
+	}
+
+	frame = &output->frames[output->frames_in_flight++];
+	frame->fb = fb;
+	frame->fed = *now;
+	frame->superseded = (struct timespec) { 0 };
+
+	nvnc_fb_set_release_fn(fb, vnc_fb_release, output);
+}
+
+static void
+vnc_log_pacing(struct vnc_output *output)
+{
+	struct vnc_backend *backend = output->backend;
+	char timestr[128];
+
+	if (!weston_log_scope_is_enabled(backend->debug))
+		return;
+
+	weston_log_scope_timestamp(backend->debug, timestr, sizeof timestr);
+	weston_log_scope_printf(backend->debug,
+				"%s render after %u deferred repaints, "
+				"%d frames in flight, interval %" PRId64 " us; "
+				"%" PRIu64 " rendered, %" PRIu64 " coalesced\n",
+				timestr, output->repaints_deferred,
+				output->frames_in_flight,
+				output->frame_interval_nsec / 1000,
+				output->frames_rendered, output->frames_coalesced);
+}
+
 static void
 vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
 {
@@ -730,7 +856,7 @@ vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
 
 	vnc_log_damage(backend, &renderbuffer->damage, damage);
 
-	ec->renderer->repaint_output(&output->base, damage, renderbuffer);
+	weston_output_render(&output->base, damage, renderbuffer);
 
 	/* Convert to local coordinates */
 	pixman_region32_init(&local_damage);
@@ -740,6 +866,9 @@ vnc_update_buffer(struct nvnc_display *display, struct pixman_region32 *damage)
 	pixman_region_init(&nvnc_damage);
 	vnc_region32_to_region16(&nvnc_damage, &local_damage);
 
+	weston_compositor_read_presentation_clock(ec, &output->last_render);
+	vnc_output_track_frame(output, fb, &output->last_render);
+
 	nvnc_display_feed_buffer(output->display, fb, &nvnc_damage);
 	nvnc_fb_unref(fb);
 	pixman_region32_fini(&local_damage);
@@ -786,6 +915,12 @@ finish_frame_handler(void *data)
 {
 	struct vnc_output *output = data;
 
+	/* Keep repainting until deferred damage got rendered, unless every
+	 * frame is in flight: vnc_fb_release() schedules the repaint then. */
+	if (pixman_region32_not_empty(&output->pending_damage) &&
+	    output->frames_in_flight < VNC_MAX_FRAMES_IN_FLIGHT)
+		weston_output_schedule_repaint(&output->base);
+
 	weston_output_finish_frame_from_timer(&output->base);
 
 	return 1;
@@ -850,6 +985,10 @@ vnc_output_enable(struct weston_output *base)
 
 	output->display = nvnc_display_new(0, 0);
 
+	pixman_region32_init(&output->pending_damage);
+	output->frames_in_flight = 0;
+	output->frame_interval_nsec = 0;
+
 	nvnc_add_display(backend->server, output->display);
 
 	return 0;
@@ -861,6 +1000,7 @@ vnc_output_disable(struct weston_output *base)
 	struct weston_renderer *renderer = base->compositor->renderer;
 	struct vnc_output *output = to_vnc_output(base);
 	struct vnc_backend *backend;
+	int i;
 
 	assert(output);
 
@@ -871,7 +1011,16 @@ vnc_output_disable(struct weston_output *base)
 
 	nvnc_remove_display(backend->server, output->display);
 	nvnc_display_unref(output->display);
+
+	/* Frames still being encoded outlive the output */
+	for (i = 0; i < output->frames_in_flight; i++) {
+		nvnc_fb_pool_ref(output->fb_pool);
+		nvnc_fb_set_release_fn(output->frames[i].fb,
+				       vnc_fb_release_to_pool, output->fb_pool);
+	}
+	output->frames_in_flight = 0;
 	nvnc_fb_pool_unref(output->fb_pool);
+	pixman_region32_fini(&output->pending_damage);
 
 	switch (renderer->type) {
 	case WESTON_RENDERER_PIXMAN:
@@ -1002,6 +1151,8 @@ vnc_output_repaint(struct weston_output *base)
 	struct vnc_output *output = to_vnc_output(base);
 	struct vnc_backend *backend = output->backend;
 	pixman_region32_t damage;
+	struct timespec now;
+	bool new_damage;
 
 	assert(output);
 
@@ -1013,13 +1164,37 @@ vnc_output_repaint(struct weston_output *base)
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(base, &damage);
-
-	if (pixman_region32_not_empty(&damage)) {
-		vnc_update_buffer(output->display, &damage);
-	}
+	new_damage = pixman_region32_not_empty(&damage);
+	pixman_region32_union(&output->pending_damage,
+			      &output->pending_damage, &damage);
+	pixman_region32_intersect(&output->pending_damage,
+				  &output->pending_damage, &base->region);
 
 	pixman_region32_fini(&damage);
 
+	/*
+	 * Only render when the encoders took the previous frames, clients
+	 * that are slow to ask for updates would not see the others anyway.
+	 */
+	if (pixman_region32_not_empty(&output->pending_damage)) {
+		weston_compositor_read_presentation_clock(base->compositor,
+							  &now);
+
+		if (vnc_output_can_render(output, &now)) {
+			vnc_update_buffer(output->display,
+					  &output->pending_damage);
+			pixman_region32_clear(&output->pending_damage);
+
+			output->frames_rendered++;
+			if (output->repaints_deferred > 0)
+				output->frames_coalesced++;
+			vnc_log_pacing(output);
+			output->repaints_deferred = 0;
+		} else if (new_damage) {
+			output->repaints_deferred++;
+		}
+	}
+
 	/*
 	 * Make sure damage of this (or previous) damage is handled
 	 *
@@ -488,13 +488,10 @@ static int
 wayland_output_repaint_gl(struct weston_output *output_base)
 {
 	struct wayland_output *output = to_wayland_output(output_base);
-	struct weston_compositor *ec;
 	pixman_region32_t damage;
 
 	assert(output);
 
-	ec = output->base.compositor;
-
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
@@ -504,7 +501,7 @@ wayland_output_repaint_gl(struct weston_output *output_base)
 
 	wayland_output_update_gl_border(output);
 
-	ec->renderer->repaint_output(&output->base, &damage, NULL);
+	weston_output_render(&output->base, &damage, NULL);
 
 	pixman_region32_fini(&damage);
 
@@ -621,8 +618,7 @@ wayland_output_repaint_pixman(struct weston_output *output_base)
 	sb = wayland_output_get_shm_buffer(output);
 
 	wayland_output_update_shm_border(sb);
-	b->compositor->renderer->repaint_output(output_base, &damage,
-						sb->renderbuffer);
+	weston_output_render(output_base, &damage, sb->renderbuffer);
 
 	wayland_shm_buffer_attach(sb, &damage);
 
@@ -432,18 +432,15 @@ static int
 x11_output_repaint_gl(struct weston_output *output_base)
 {
 	struct x11_output *output = to_x11_output(output_base);
-	struct weston_compositor *ec;
 	pixman_region32_t damage;
 
 	assert(output);
 
-	ec = output->base.compositor;
-
 	pixman_region32_init(&damage);
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(output_base, &damage, NULL);
+	weston_output_render(output_base, &damage, NULL);
 
 	pixman_region32_fini(&damage);
 
@@ -527,7 +524,7 @@ x11_output_repaint_shm(struct weston_output *output_base)
 
 	weston_output_flush_damage_for_primary_plane(output_base, &damage);
 
-	ec->renderer->repaint_output(output_base, &damage, output->renderbuffer);
+	weston_output_render(output_base, &damage, output->renderbuffer);
 
 	set_clip_for_output(output_base, &damage);
 
@@ -349,4 +349,16 @@ void
 weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 					     pixman_region32_t *damage);
 
+struct weston_renderbuffer;
+
+void
+weston_output_render(struct weston_output *output,
+		     pixman_region32_t *output_damage,
+		     struct weston_renderbuffer *renderbuffer);
+
+void
+weston_output_repaint_renderer(struct weston_output *output,
+			       pixman_region32_t *output_damage,
+			       struct weston_renderbuffer *renderbuffer);
+
 #endif
@@ -83,6 +83,10 @@
 #include "color.h"
 #include "color-management.h"
 #include "id-number-allocator.h"
+#include "pick-index.h"
+#include "damage-merge.h"
+#include "frame-stats.h"
+#include "repaint-pool.h"
 #include "output-capture.h"
 #include "pixman-renderer.h"
 #include "renderer-gl/gl-renderer.h"
@@ -699,6 +703,8 @@ weston_view_create_internal(struct weston_surface *surface)
 	wl_list_init(&view->link);
 	wl_list_init(&view->layer_link.link);
 	wl_list_init(&view->paint_node_list);
+	wl_list_init(&view->pick_index.dirty_link);
+	wl_list_init(&view->view_list_dirty.link);
 
 	pixman_region32_init(&view->visible);
 
@@ -1340,11 +1346,13 @@ weston_surface_set_color_profile(struct weston_surface *surface,
 					  "received valid cprof and NULL render intent, " \
 					  "or vice versa; invalid for this function");
 
-	/* Remove outdated cached color transformations */
+	/* Remove outdated cached color transformations, the z-order list
+	 * rebuild installs new ones */
 	wl_list_for_each(pnode, &surface->paint_node_list, surface_link) {
 		weston_surface_color_transform_fini(&pnode->surf_xform);
 		pnode->surf_xform_valid = false;
 	}
+	surface->compositor->view_list_needs_rebuild = true;
 
 	/* Caller gave us a color profile and render intent (or NULL for both,
 	 * which is also valid), so update the surface with them. */
@@ -1956,6 +1964,18 @@ weston_view_update_transform(struct weston_view *view)
 	}
 }
 
+/* Queues a view for the next weston_compositor_update_view_list() */
+static void
+weston_view_dirty_view_list(struct weston_view *view, bool restack)
+{
+	struct weston_compositor *compositor = view->surface->compositor;
+
+	if (wl_list_empty(&view->view_list_dirty.link))
+		wl_list_insert(compositor->view_list_dirty_list.prev,
+			       &view->view_list_dirty.link);
+	view->view_list_dirty.restack |= restack;
+}
+
 static void
 weston_view_geometry_dirty_internal(struct weston_view *view)
 {
@@ -1972,6 +1992,10 @@ weston_view_geometry_dirty_internal(struct weston_view *view)
 		return;
 
 	view->transform.dirty = 1;
+	weston_pick_index_view_dirty(view->surface->compositor->pick_index,
+				     view);
+	/* the output mask may change */
+	weston_view_dirty_view_list(view, false);
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
@@ -1986,7 +2010,6 @@ WL_EXPORT void
 weston_view_geometry_dirty(struct weston_view *view)
 {
 	weston_view_geometry_dirty_internal(view);
-	view->surface->compositor->view_list_needs_rebuild = true;
 }
 
 WL_EXPORT void
@@ -2575,25 +2598,8 @@ WL_EXPORT struct weston_view *
 weston_compositor_pick_view(struct weston_compositor *compositor,
 			    struct weston_coord_global pos)
 {
-	struct weston_view *view;
-
 	/* Can't use paint node list: occlusion by input regions, not opaque. */
-	wl_list_for_each(view, &compositor->view_list, link) {
-		struct weston_coord_surface surf_pos;
-
-		weston_view_update_transform(view);
-
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, pos.c.x, pos.c.y, NULL))
-			continue;
-
-		surf_pos = weston_coord_global_to_surface(view, pos);
-		if (!weston_view_takes_input_at_point(view, surf_pos))
-			continue;
-
-		return view;
-	}
-	return NULL;
+	return weston_pick_index_pick(compositor->pick_index, pos);
 }
 
 static void
@@ -2639,6 +2645,8 @@ weston_view_unmap(struct weston_view *view)
 	wl_list_remove(&view->layer_link.link);
 	wl_list_init(&view->layer_link.link);
 	view->layer_link.layer = NULL;
+	weston_pick_index_remove_view(view->surface->compositor->pick_index,
+				      view);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
 	view->output_mask = 0;
@@ -2719,7 +2727,10 @@ weston_view_destroy(struct weston_view *view)
 
 	if (!wl_list_empty(&view->link))
 		view->surface->compositor->view_list_needs_rebuild = true;
+	weston_pick_index_remove_view(view->surface->compositor->pick_index,
+				      view);
 	wl_list_remove(&view->link);
+	wl_list_remove(&view->view_list_dirty.link);
 
 	wl_list_remove(&view->layer_link.link);
 	wl_list_init(&view->layer_link.link);
@@ -3495,14 +3506,14 @@ view_ensure_paint_node(struct weston_view *view, struct weston_output *output)
 
 static void
 add_to_z_order_list(struct weston_output *output,
-		    struct weston_paint_node *pnode)
+		    struct weston_paint_node *pnode,
+		    struct wl_list *after)
 {
 	if (!pnode)
 		return;
 
 	wl_list_remove(&pnode->z_order_link);
-	wl_list_insert(output->paint_node_z_order_list.prev,
-		       &pnode->z_order_link);
+	wl_list_insert(after, &pnode->z_order_link);
 
 	/*
 	 * Building weston_output::paint_node_z_order_list ensures all
@@ -3514,7 +3525,8 @@ add_to_z_order_list(struct weston_output *output,
 static void
 view_list_add_subsurface_view(struct weston_compositor *compositor,
 			      struct weston_subsurface *sub,
-			      struct weston_view *parent)
+			      struct weston_view *parent,
+			      struct wl_list **pos)
 {
 	struct weston_subsurface *child;
 	struct weston_view *view = NULL, *iv;
@@ -3535,15 +3547,18 @@ view_list_add_subsurface_view(struct weston_compositor *compositor,
 	view->is_mapped = true;
 
 	if (wl_list_empty(&sub->surface->subsurface_list)) {
-		wl_list_insert(compositor->view_list.prev, &view->link);
+		wl_list_insert(*pos, &view->link);
+		*pos = &view->link;
 		return;
 	}
 
 	wl_list_for_each(child, &sub->surface->subsurface_list, parent_link) {
 		if (child->surface == sub->surface) {
-			wl_list_insert(compositor->view_list.prev, &view->link);
+			wl_list_insert(*pos, &view->link);
+			*pos = &view->link;
 		} else {
-			view_list_add_subsurface_view(compositor, child, view);
+			view_list_add_subsurface_view(compositor, child, view,
+						      pos);
 		}
 	}
 }
@@ -3553,64 +3568,214 @@ view_list_add_subsurface_view(struct weston_compositor *compositor,
  * change first happens to the sub-surface list, and then automatically
  * propagates here. See weston_surface_damage_subsurfaces() for how the
  * sub-surfaces receive damage when the client changes the state.
+ *
+ * The views get added after *pos, which is left on the last one.
  */
 static void
 view_list_add(struct weston_compositor *compositor,
-	      struct weston_view *view)
+	      struct weston_view *view,
+	      struct wl_list **pos)
 {
 	struct weston_subsurface *sub;
 
 	weston_view_update_transform(view);
 
 	if (wl_list_empty(&view->surface->subsurface_list)) {
-		wl_list_insert(compositor->view_list.prev, &view->link);
+		wl_list_insert(*pos, &view->link);
+		*pos = &view->link;
 		return;
 	}
 
 	wl_list_for_each(sub, &view->surface->subsurface_list, parent_link) {
 		if (sub->surface == view->surface) {
-			wl_list_insert(compositor->view_list.prev, &view->link);
+			wl_list_insert(*pos, &view->link);
+			*pos = &view->link;
 		} else {
-			view_list_add_subsurface_view(compositor, sub, view);
+			view_list_add_subsurface_view(compositor, sub, view, pos);
 		}
 	}
 }
 
+/* The layer entry view_list_add() added this view along with */
+static struct weston_view *
+view_list_root(struct weston_view *view)
+{
+	while (!view->layer_link.layer && view->parent_view)
+		view = view->parent_view;
+
+	return view;
+}
+
+/* Takes what view_list_add() added off the view list and the z-order lists */
+static void
+view_list_remove(struct weston_view *view)
+{
+	struct weston_subsurface *sub;
+	struct weston_paint_node *pnode;
+	struct weston_view *child;
+
+	wl_list_remove(&view->link);
+	wl_list_init(&view->link);
+
+	wl_list_for_each(pnode, &view->paint_node_list, view_link) {
+		wl_list_remove(&pnode->z_order_link);
+		wl_list_init(&pnode->z_order_link);
+	}
+
+	wl_list_for_each(sub, &view->surface->subsurface_list, parent_link) {
+		if (sub->surface == view->surface)
+			continue;
+
+		wl_list_for_each(child, &sub->surface->views, surface_link) {
+			if (child->parent_view == view)
+				view_list_remove(child);
+		}
+	}
+}
+
+/* Finds the nearest view above in the layers that is on the view list, and
+ * returns the last view added along with it. */
+static struct wl_list *
+view_list_insert_point(struct weston_compositor *compositor,
+		       struct weston_view *view)
+{
+	struct weston_layer *layer = view->layer_link.layer;
+	struct wl_list *entry = &view->layer_link.link;
+	struct weston_view *above, *next;
+	struct wl_list *pos;
+
+	for (;;) {
+		entry = entry->prev;
+
+		if (entry == &layer->view_list.link) {
+			if (layer->link.prev == &compositor->layer_list)
+				return &compositor->view_list;
+
+			layer = container_of(layer->link.prev,
+					     struct weston_layer, link);
+			entry = &layer->view_list.link;
+			continue;
+		}
+
+		above = container_of(entry, struct weston_view,
+				     layer_link.link);
+		if (!wl_list_empty(&above->link))
+			break;
+	}
+
+	pos = &above->link;
+	while (pos->next != &compositor->view_list) {
+		next = container_of(pos->next, struct weston_view, link);
+		if (view_list_root(next) != above)
+			break;
+		pos = pos->next;
+	}
+
+	return pos;
+}
+
+/* Whether a view on the view list belongs to the output z-order list */
+static bool
+view_in_z_order_list(struct weston_compositor *compositor,
+		     struct weston_output *output,
+		     struct weston_view *view)
+{
+	struct weston_paint_node *pnode;
+
+	/* It is possible for a view to appear in the layer list even though
+	 * the view or the surface is unmapped. This is erroneous but difficult
+	 * to fix. */
+	if (!weston_surface_is_mapped(view->surface) ||
+	    !weston_view_is_mapped(view) ||
+	    !weston_surface_has_content(view->surface)) {
+		weston_log_paced(&compositor->unmapped_surface_or_view_pacer,
+				 1, 0,
+				 "Detected an unmapped surface or view in "
+				 "the layer list, which should not occur.\n");
+
+		pnode = weston_view_find_paint_node(view, output);
+		if (pnode)
+			weston_paint_node_destroy(pnode);
+
+		return false;
+	}
+
+	return view->output_mask & (1u << output->id);
+}
+
 static void
 weston_output_build_z_order_list(struct weston_compositor *compositor,
 				 struct weston_output *output)
 {
-	struct weston_paint_node *pnode;
+	struct weston_paint_node *pnode, *pntmp;
 	struct weston_view *view;
 
-	wl_list_remove(&output->paint_node_z_order_list);
+	wl_list_for_each_safe(pnode, pntmp, &output->paint_node_z_order_list,
+			      z_order_link) {
+		wl_list_remove(&pnode->z_order_link);
+		wl_list_init(&pnode->z_order_link);
+	}
 	wl_list_init(&output->paint_node_z_order_list);
 
 	wl_list_for_each(view, &compositor->view_list, link) {
-		/* It is possible for a view to appear in the layer list even though
-		 * the view or the surface is unmapped. This is erroneous but difficult
-		 * to fix. */
-		if (!weston_surface_is_mapped(view->surface) ||
-		    !weston_view_is_mapped(view) ||
-		    !weston_surface_has_content(view->surface)) {
-			weston_log_paced(&compositor->unmapped_surface_or_view_pacer,
-					 1, 0,
-					 "Detected an unmapped surface or view in "
-					 "the layer list, which should not occur.\n");
-
-			pnode = weston_view_find_paint_node(view, output);
-			if (pnode)
-				weston_paint_node_destroy(pnode);
-
+		if (!view_in_z_order_list(compositor, output, view))
 			continue;
+
+		pnode = view_ensure_paint_node(view, output);
+		add_to_z_order_list(output, pnode,
+				    output->paint_node_z_order_list.prev);
+	}
+}
+
+/* Adds or removes the paint node of a view on the view list, placing it
+ * after the nearest paint node above it. */
+static void
+weston_output_update_z_order_list(struct weston_compositor *compositor,
+				  struct weston_output *output,
+				  struct weston_view *view)
+{
+	struct weston_paint_node *pnode;
+	struct weston_view *above;
+	struct wl_list *pos;
+	bool listed;
+
+	listed = view_in_z_order_list(compositor, output, view);
+	pnode = weston_view_find_paint_node(view, output);
+
+	if (!listed) {
+		if (pnode) {
+			wl_list_remove(&pnode->z_order_link);
+			wl_list_init(&pnode->z_order_link);
 		}
+		return;
+	}
 
-		if (!(view->output_mask & (1u << output->id)))
-			continue;
+	if (pnode && !wl_list_empty(&pnode->z_order_link))
+		return;
 
-		pnode = view_ensure_paint_node(view, output);
-		add_to_z_order_list(output, pnode);
+	pos = &output->paint_node_z_order_list;
+	for (above = container_of(view->link.prev, struct weston_view, link);
+	     &above->link != &compositor->view_list;
+	     above = container_of(above->link.prev, struct weston_view, link)) {
+		struct weston_paint_node *above_pnode;
+
+		above_pnode = weston_view_find_paint_node(above, output);
+		if (above_pnode && !wl_list_empty(&above_pnode->z_order_link)) {
+			pos = &above_pnode->z_order_link;
+			break;
+		}
 	}
+
+	pnode = view_ensure_paint_node(view, output);
+	add_to_z_order_list(output, pnode, pos);
+}
+
+static void
+weston_view_clear_view_list_dirty(struct weston_view *view)
+{
+	wl_list_remove(&view->view_list_dirty.link);
+	wl_list_init(&view->view_list_dirty.link);
+	view->view_list_dirty.restack = false;
 }
 
 static void
@@ -3619,14 +3784,22 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	struct weston_output *output;
 	struct weston_view *view, *tmp;
 	struct weston_layer *layer;
+	struct wl_list *pos;
+
+	weston_pick_index_invalidate(compositor->pick_index);
+
+	wl_list_for_each_safe(view, tmp, &compositor->view_list_dirty_list,
+			      view_list_dirty.link)
+		weston_view_clear_view_list_dirty(view);
 
 	wl_list_for_each_safe(view, tmp, &compositor->view_list, link)
 		wl_list_init(&view->link);
 	wl_list_init(&compositor->view_list);
 
+	pos = &compositor->view_list;
 	wl_list_for_each(layer, &compositor->layer_list, link) {
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link) {
-			view_list_add(compositor, view);
+			view_list_add(compositor, view, &pos);
 		}
 	}
 
@@ -3636,6 +3809,146 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	compositor->view_list_needs_rebuild = false;
 }
 
+static void
+view_list_snapshot_add(struct wl_array *snapshot, void *ptr)
+{
+	void **p;
+
+	p = wl_array_add(snapshot, sizeof *p);
+	abort_oom_if_null(p);
+	*p = ptr;
+}
+
+static void
+view_list_snapshot(struct weston_compositor *compositor,
+		   struct wl_array *snapshot)
+{
+	struct weston_output *output;
+	struct weston_paint_node *pnode;
+	struct weston_view *view;
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		view_list_snapshot_add(snapshot, view);
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		view_list_snapshot_add(snapshot, NULL);
+		wl_list_for_each(pnode, &output->paint_node_z_order_list,
+				 z_order_link)
+			view_list_snapshot_add(snapshot, pnode);
+	}
+}
+
+/* Test suite only: an incremental update must leave the same lists as a
+ * full rebuild does. */
+static void
+weston_compositor_check_view_list(struct weston_compositor *compositor)
+{
+	struct wl_array updated, rebuilt;
+	bool same;
+
+	wl_array_init(&updated);
+	wl_array_init(&rebuilt);
+
+	view_list_snapshot(compositor, &updated);
+	weston_compositor_build_view_list(compositor);
+	view_list_snapshot(compositor, &rebuilt);
+
+	same = updated.size == rebuilt.size &&
+	       memcmp(updated.data, rebuilt.data, updated.size) == 0;
+	if (!same)
+		weston_log("view list update mismatch: %zu entries updated, "
+			   "%zu rebuilt\n", updated.size / sizeof(void *),
+			   rebuilt.size / sizeof(void *));
+	weston_assert_true(compositor, same);
+
+	wl_array_release(&updated);
+	wl_array_release(&rebuilt);
+}
+
+/* Restacks the views moved in the layers, and updates the output z-order
+ * lists for the views whose geometry changed, leaving everything else in
+ * place. The view list stays in layer order as long as every other change
+ * to it sets view_list_needs_rebuild. */
+static void
+weston_compositor_update_view_list(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+	struct weston_view *view, *tmp, *iv;
+	struct wl_list *pos;
+	bool restack = false;
+
+	wl_list_for_each(view, &compositor->view_list_dirty_list,
+			 view_list_dirty.link) {
+		if (view->view_list_dirty.restack) {
+			restack = true;
+			break;
+		}
+	}
+
+	if (restack) {
+		/* views keep their order while off the list */
+		weston_pick_index_invalidate(compositor->pick_index);
+
+		wl_list_for_each(view, &compositor->view_list_dirty_list,
+				 view_list_dirty.link) {
+			if (view->view_list_dirty.restack)
+				view_list_remove(view);
+		}
+
+		wl_list_for_each(view, &compositor->view_list_dirty_list,
+				 view_list_dirty.link) {
+			if (!view->view_list_dirty.restack ||
+			    !view->layer_link.layer ||
+			    wl_list_empty(&view->layer_link.layer->link))
+				continue;
+
+			pos = view_list_insert_point(compositor, view);
+			view_list_add(compositor, view, &pos);
+		}
+	}
+
+	wl_list_for_each_safe(view, tmp, &compositor->view_list_dirty_list,
+			      view_list_dirty.link) {
+		bool restacked = view->view_list_dirty.restack;
+
+		weston_view_clear_view_list_dirty(view);
+
+		if (wl_list_empty(&view->link))
+			continue;
+
+		if (!restacked) {
+			weston_view_update_transform(view);
+			wl_list_for_each(output, &compositor->output_list, link)
+				weston_output_update_z_order_list(compositor,
+								  output, view);
+			continue;
+		}
+
+		/* the views added along can sit on both sides of it */
+		iv = view;
+		while (iv->link.prev != &compositor->view_list) {
+			struct weston_view *prev;
+
+			prev = container_of(iv->link.prev,
+					    struct weston_view, link);
+			if (view_list_root(prev) != view)
+				break;
+			iv = prev;
+		}
+
+		for (; &iv->link != &compositor->view_list &&
+		       view_list_root(iv) == view;
+		     iv = container_of(iv->link.next, struct weston_view, link)) {
+			wl_list_for_each(output, &compositor->output_list, link)
+				weston_output_update_z_order_list(compositor,
+								  output, iv);
+		}
+	}
+
+	if (compositor->test_data.test_quirks.check_view_list)
+		weston_compositor_check_view_list(compositor);
+}
+
 static void
 weston_output_take_feedback_list(struct weston_output *output,
 				 struct weston_surface *surface)
@@ -3711,6 +4024,30 @@ weston_output_flush_damage_for_plane(struct weston_output *output,
 	return changed;
 }
 
+static void
+weston_output_merge_damage(struct weston_output *output,
+			   pixman_region32_t *damage)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct damage_merge_stats stats;
+
+	if (output->damage_merge.max_rects <= 0)
+		return;
+
+	if (!damage_merge(damage, output->damage_merge.max_rects,
+			  output->damage_merge.rect_cost, &stats))
+		return;
+
+	if (weston_log_scope_is_enabled(ec->damage_merge_scope)) {
+		weston_log_scope_printf(ec->damage_merge_scope,
+					"output %s: %d -> %d rects, "
+					"%" PRId64 " -> %" PRId64 " px\n",
+					output->name,
+					stats.rects_in, stats.rects_out,
+					stats.area_in, stats.area_out);
+	}
+}
+
 WL_EXPORT void
 weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 					     pixman_region32_t *damage)
@@ -3722,7 +4059,10 @@ weston_output_flush_damage_for_primary_plane(struct weston_output *output,
 	if (output->full_repaint_needed) {
 		pixman_region32_copy(damage, &output->region);
 		output->full_repaint_needed = false;
+		return;
 	}
+
+	weston_output_merge_damage(output, damage);
 }
 
 WL_EXPORT void
@@ -3734,23 +4074,25 @@ weston_output_schedule_repaint_reset(struct weston_output *output)
 		 TLP_OUTPUT(output), TLP_END);
 }
 
-static int
-weston_output_repaint(struct weston_output *output, struct timespec *now)
+/* Brings the scene graph of the output up to date for its repaint */
+static void
+weston_output_repaint_prepare(struct weston_output *output)
 {
 	struct weston_compositor *ec = output->compositor;
 	struct weston_paint_node *pnode;
-	struct weston_animation *animation, *next;
-	struct wl_resource *cb, *cnext;
-	struct wl_list frame_callback_list;
-	int r;
-	uint32_t frame_time_msec;
 	enum weston_hdcp_protection highest_requested = WESTON_HDCP_DISABLE;
+	struct timespec now;
 
 	TL_POINT(ec, "core_repaint_begin", TLP_OUTPUT(output), TLP_END);
 
+	weston_compositor_read_presentation_clock(ec, &now);
+	frame_stats_repaint_begin(output->frame_stats, &now);
+
 	/* Rebuild the surface list and update surface transforms up front. */
 	if (ec->view_list_needs_rebuild)
 		weston_compositor_build_view_list(ec);
+	else if (!wl_list_empty(&ec->view_list_dirty_list))
+		weston_compositor_update_view_list(ec);
 
 	/* If the scene graph is empty, we could end up passing a buffer
 	 * we've never drawn into to a hardware plane later. If that hardware
@@ -3803,13 +4145,36 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 		paint_node_update_late(pnode);
 
 	output_accumulate_damage(output);
+}
 
-	r = output->repaint(output);
+/* Everything after the output got handed over to the backend */
+static int
+weston_output_repaint_finish(struct weston_output *output,
+			     struct timespec *now, int r)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_paint_node *pnode;
+	struct weston_animation *animation, *next;
+	struct wl_resource *cb, *cnext;
+	struct wl_list frame_callback_list;
+	uint32_t frame_time_msec;
+	struct timespec submit;
+	int64_t refresh_nsec = 0;
+
+	/* Any repaint thread is done with the output by now */
+	if (ec->renderer->repaint_output_done)
+		ec->renderer->repaint_output_done(output);
 
 	output->repaint_needed = false;
 	if (r == 0) {
 		output->repaint_status = REPAINT_AWAITING_COMPLETION;
 		output->repainted = true;
+
+		if (output->current_mode && output->current_mode->refresh > 0)
+			refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+		weston_compositor_read_presentation_clock(ec, &submit);
+		frame_stats_submit(output->frame_stats, &submit,
+				   &output->frame_time, refresh_nsec);
 	}
 
 	weston_compositor_repick(ec);
@@ -3867,6 +4232,76 @@ weston_output_repaint(struct weston_output *output, struct timespec *now)
 	return r;
 }
 
+static int
+weston_output_repaint(struct weston_output *output, struct timespec *now)
+{
+	int r;
+
+	weston_output_repaint_prepare(output);
+	r = output->repaint(output);
+
+	return weston_output_repaint_finish(output, now, r);
+}
+
+/** Renders an output right away from its backend repaint() hook
+ *
+ * \param output The output being repainted.
+ * \param output_damage As for weston_renderer::repaint_output.
+ * \param renderbuffer As for weston_renderer::repaint_output.
+ *
+ * Backends which need the rendered image before they return call this
+ * instead of weston_renderer::repaint_output(), so that the render time
+ * shows up in the frame statistics.
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_render(struct weston_output *output,
+		     pixman_region32_t *output_damage,
+		     struct weston_renderbuffer *renderbuffer)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct timespec begin, end;
+
+	weston_compositor_read_presentation_clock(ec, &begin);
+	ec->renderer->repaint_output(output, output_damage, renderbuffer);
+	weston_compositor_read_presentation_clock(ec, &end);
+
+	frame_stats_render(output->frame_stats, &begin, &end);
+}
+
+/** Renders an output from its backend repaint() hook
+ *
+ * \param output The output being repainted.
+ * \param output_damage As for weston_renderer::repaint_output.
+ * \param renderbuffer As for weston_renderer::repaint_output.
+ *
+ * Backends which only need the rendered image once their repaint_flush()
+ * runs call this instead of weston_renderer::repaint_output(). With
+ * repaint threads enabled, the rendering then happens on a worker thread
+ * while the backend goes on with the next output.
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_repaint_renderer(struct weston_output *output,
+			       pixman_region32_t *output_damage,
+			       struct weston_renderbuffer *renderbuffer)
+{
+	struct weston_compositor *ec = output->compositor;
+
+	/* Screenshooting and capture happen inside the renderer, and are
+	 * not thread-safe. */
+	if (ec->repaint_pool &&
+	    wl_list_empty(&output->frame_signal.listener_list) &&
+	    !weston_output_has_renderer_capture_tasks(output) &&
+	    weston_repaint_pool_submit(ec->repaint_pool, output,
+				       output_damage, renderbuffer))
+		return;
+
+	weston_output_render(output, output_damage, renderbuffer);
+}
+
 static bool
 weston_output_check_repaint(struct weston_output *output, struct timespec *now)
 {
@@ -3968,6 +4403,105 @@ weston_output_schedule_repaint_restart(struct weston_output *output)
 	weston_output_damage(output);
 }
 
+struct output_repaint_handover {
+	struct weston_output *output;
+	int result;
+};
+
+/* Same as the serial loop in output_repaint_timer_handler(), except that
+ * all outputs get prepared first, then handed to their backends, which
+ * may render them concurrently, and only then finished. */
+static void
+output_repaint_parallel(struct weston_compositor *compositor,
+			struct timespec *now)
+{
+	struct output_repaint_handover *handover;
+	struct weston_backend *backend;
+	struct weston_output *output;
+	struct wl_array handovers;
+	bool failed;
+	int ret;
+
+	wl_list_for_each(backend, &compositor->backend_list, link) {
+		if (!backend->will_repaint)
+			continue;
+
+		if (backend->repaint_begin)
+			backend->repaint_begin(backend);
+
+		wl_list_for_each(output, &compositor->output_list, link) {
+			if (output->backend == backend && output->will_repaint)
+				weston_output_repaint_prepare(output);
+		}
+	}
+
+	wl_array_init(&handovers);
+
+	weston_repaint_pool_begin(compositor->repaint_pool);
+	wl_list_for_each(backend, &compositor->backend_list, link) {
+		if (!backend->will_repaint)
+			continue;
+
+		failed = false;
+		wl_list_for_each(output, &compositor->output_list, link) {
+			if (output->backend != backend || !output->will_repaint)
+				continue;
+
+			handover = wl_array_add(&handovers, sizeof *handover);
+			abort_oom_if_null(handover);
+			handover->output = output;
+
+			/* The backend gets canceled, don't hand it any more
+			 * outputs, but still finish them below: they have
+			 * all been prepared. */
+			if (failed) {
+				handover->result = -1;
+				continue;
+			}
+
+			handover->result = output->repaint(output);
+			if (handover->result)
+				failed = true;
+		}
+	}
+	weston_repaint_pool_wait(compositor->repaint_pool);
+
+	wl_list_for_each(backend, &compositor->backend_list, link) {
+		if (!backend->will_repaint)
+			continue;
+
+		backend->will_repaint = false;
+		ret = 0;
+
+		wl_array_for_each(handover, &handovers) {
+			if (handover->output->backend != backend)
+				continue;
+
+			if (weston_output_repaint_finish(handover->output, now,
+							 handover->result))
+				ret = -1;
+		}
+
+		if (ret == 0) {
+			if (backend->repaint_flush)
+				backend->repaint_flush(backend);
+		} else {
+			if (backend->repaint_cancel)
+				backend->repaint_cancel(backend);
+
+			wl_list_for_each(output, &compositor->output_list, link) {
+				if (output->backend != backend)
+					continue;
+
+				if (output->repainted)
+					weston_output_schedule_repaint_reset(output);
+			}
+		}
+	}
+
+	wl_array_release(&handovers);
+}
+
 static int
 output_repaint_timer_handler(void *data)
 {
@@ -3993,6 +4527,17 @@ output_repaint_timer_handler(void *data)
 			output->prepare_repaint(output);
 	}
 
+	if (compositor->repaint_threads > 0 && !compositor->repaint_pool &&
+	    compositor->renderer->threaded_repaint)
+		compositor->repaint_pool =
+			weston_repaint_pool_create(compositor,
+						   compositor->repaint_threads);
+
+	if (compositor->repaint_pool) {
+		output_repaint_parallel(compositor, &now);
+		goto out;
+	}
+
 	wl_list_for_each(backend, &compositor->backend_list, link) {
 		if (!backend->will_repaint)
 			continue;
@@ -4030,6 +4575,7 @@ output_repaint_timer_handler(void *data)
 		}
 	}
 
+out:
 	wl_list_for_each(output, &compositor->output_list, link)
 		output->repainted = false;
 
@@ -4114,6 +4660,8 @@ weston_output_finish_frame(struct weston_output *output,
 		 TLP_VBLANK(&vblank_monotonic), TLP_END);
 
 	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	frame_stats_present(output->frame_stats, stamp, refresh_nsec,
+			    presented_flags & WESTON_FINISH_FRAME_TEARING);
 	weston_presentation_feedback_present_list(&output->feedback_list,
 						  output, refresh_nsec, stamp,
 						  output->msc,
@@ -4240,7 +4788,7 @@ weston_view_move_to_layer(struct weston_view *view,
 	if (layer == &view->layer_link)
 		return;
 
-	view->surface->compositor->view_list_needs_rebuild = true;
+	weston_view_dirty_view_list(view, true);
 
 	/* Damage the view's old region, and remove it from the layer. */
 	if (weston_view_is_mapped(view))
@@ -4318,6 +4866,7 @@ weston_layer_set_position(struct weston_layer *layer,
 	struct weston_layer *below;
 
 	wl_list_remove(&layer->link);
+	layer->compositor->view_list_needs_rebuild = true;
 
 	/* layer_list is ordered from top to bottom, the last layer being the
 	 * background with the smallest position value */
@@ -4340,6 +4889,9 @@ weston_layer_set_position(struct weston_layer *layer,
 WL_EXPORT void
 weston_layer_unset_position(struct weston_layer *layer)
 {
+	if (!wl_list_empty(&layer->link))
+		layer->compositor->view_list_needs_rebuild = true;
+
 	wl_list_remove(&layer->link);
 	wl_list_init(&layer->link);
 }
@@ -7759,6 +8311,8 @@ weston_compositor_remove_output(struct weston_output *output)
 		weston_head_remove_global(head);
 
 	weston_output_capture_info_destroy(&output->capture_info);
+	frame_stats_destroy(output->frame_stats);
+	output->frame_stats = NULL;
 
 	compositor->output_id_pool &= ~(1u << output->id);
 	output->id = 0xffffffff; /* invalid */
@@ -7787,6 +8341,28 @@ weston_output_set_scale(struct weston_output *output,
 	wl_signal_emit(&output->compositor->output_resized_signal, output);
 }
 
+/** Sets the damage rectangle budget for a given output.
+ *
+ * \param output    The weston_output object to configure.
+ * \param max_rects Largest number of damage rectangles handed to the
+ *                  renderer per repaint, or 0 to disable merging.
+ * \param rect_cost Area in pixels that is cheaper to repaint needlessly
+ *                  than to issue one more rectangle.
+ *
+ * Before repainting, nearby damage rectangles whose bounding box adds less
+ * than \c rect_cost pixels get merged. If there are still more than
+ * \c max_rects, the cost is raised until there are not.
+ *
+ * \ingroup output
+ */
+WL_EXPORT void
+weston_output_set_damage_merge(struct weston_output *output,
+			       int max_rects, int rect_cost)
+{
+	output->damage_merge.max_rects = max_rects;
+	output->damage_merge.rect_cost = rect_cost;
+}
+
 /** Sets the output transform for a given output.
  *
  * \param output    The weston_output object that the transform is set for.
@@ -7916,11 +8492,13 @@ weston_output_set_color_profile(struct weston_output *output,
 			return false;
 		}
 
-		/* Remove outdated cached color transformations */
+		/* Remove outdated cached color transformations, the z-order
+		 * list rebuild installs new ones */
 		wl_list_for_each(pnode, &output->paint_node_list, output_link) {
 			weston_surface_color_transform_fini(&pnode->surf_xform);
 			pnode->surf_xform_valid = false;
 		}
+		compositor->view_list_needs_rebuild = true;
 
 		/* The preferred color profile of a surface is its primary
 		 * output color profile. For each surface that has this output
@@ -8385,6 +8963,8 @@ weston_output_enable(struct weston_output *output)
 	output->capture_info = weston_output_capture_info_create();
 	assert(output->capture_info);
 
+	output->frame_stats = frame_stats_create();
+
 	/* Backends want to stack planes on top of the primary,
 	 * so we'd better set this up now.
 	 */
@@ -8400,6 +8980,8 @@ weston_output_enable(struct weston_output *output)
 		weston_plane_release(&output->primary_plane);
 		weston_output_color_outcome_destroy(&output->color_outcome);
 		weston_output_capture_info_destroy(&output->capture_info);
+		frame_stats_destroy(output->frame_stats);
+		output->frame_stats = NULL;
 		return -1;
 	}
 
@@ -9566,6 +10148,64 @@ weston_compositor_print_scene_graph(struct weston_compositor *ec)
 	return ret;
 }
 
+static void
+debug_frame_stats_print(struct weston_log_subscription *sub,
+			const char *label, const struct frame_stats *stats,
+			enum frame_stat stat)
+{
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	struct frame_histogram hist;
+	unsigned int i;
+
+	frame_stats_get(stats, stat, &hist);
+
+	weston_log_subscription_printf(sub, "\t%-8s", label);
+	for (i = 0; i < ARRAY_LENGTH(percentiles); i++) {
+		weston_log_subscription_printf(sub, " p%g %7.3f ms,",
+					       percentiles[i],
+					       frame_histogram_percentile(&hist,
+									  percentiles[i]) / 1000.0);
+	}
+	weston_log_subscription_printf(sub, " max %7.3f ms (%u samples)\n",
+				       hist.max / 1000.0, hist.total);
+}
+
+/**
+ * Called when the 'frame-stats' debug scope is bound by a client. Prints
+ * the frame timing percentiles of each output over the last one to two
+ * windows of frames, and then terminates the stream.
+ */
+static void
+debug_frame_stats_cb(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+	struct frame_stats *stats;
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		stats = output->frame_stats;
+		if (!stats)
+			continue;
+
+		weston_log_subscription_printf(sub,
+					       "output %s: %" PRIu64 " frames, "
+					       "%" PRIu64 " missed vblanks, "
+					       "%" PRIu64 " late submissions\n",
+					       output->name, stats->frames,
+					       stats->missed, stats->late);
+		debug_frame_stats_print(sub, "repaint", stats,
+					FRAME_STAT_REPAINT);
+		debug_frame_stats_print(sub, "render", stats,
+					FRAME_STAT_RENDER);
+		debug_frame_stats_print(sub, "latency", stats,
+					FRAME_STAT_LATENCY);
+		debug_frame_stats_print(sub, "slack", stats,
+					FRAME_STAT_SLACK);
+	}
+
+	weston_log_subscription_complete(sub);
+}
+
 /**
  * Called when the 'scene-graph' debug scope is bound by a client. This
  * one-shot weston-debug scope prints the current scene graph when bound,
@@ -9705,8 +10345,10 @@ weston_compositor_create(struct wl_display *display,
 
 	ec->color_profile_id_generator = weston_idalloc_create(ec);
 	ec->color_transform_id_generator = weston_idalloc_create(ec);
+	ec->pick_index = weston_pick_index_create(ec);
 
 	wl_list_init(&ec->view_list);
+	wl_list_init(&ec->view_list_dirty_list);
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -9755,10 +10397,19 @@ weston_compositor_create(struct wl_display *display,
 						weston_timeline_create_subscription,
 						weston_timeline_destroy_subscription,
 						ec);
+	ec->timeline_ring = weston_timeline_ring_create(ec);
 	ec->libseat_debug =
 		weston_compositor_add_log_scope(ec, "libseat-debug",
 						"libseat debug messages\n",
 						NULL, NULL, NULL);
+	ec->damage_merge_scope =
+		weston_compositor_add_log_scope(ec, "damage-merge",
+						"Output damage rectangle merging\n",
+						NULL, NULL, NULL);
+	ec->frame_stats_scope =
+		weston_compositor_add_log_scope(ec, "frame-stats",
+						"Output frame timing percentiles\n",
+						debug_frame_stats_cb, NULL, ec);
 	return ec;
 
 fail:
@@ -9779,6 +10430,9 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	wl_event_source_remove(ec->idle_source);
 	wl_event_source_remove(ec->repaint_timer);
 
+	weston_repaint_pool_destroy(ec->repaint_pool);
+	ec->repaint_pool = NULL;
+
 	if (ec->touch_calibration)
 		weston_compositor_destroy_touch_calibrator(ec);
 
@@ -10230,9 +10884,19 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	weston_log_scope_destroy(compositor->timeline);
 	compositor->timeline = NULL;
 
+	weston_timeline_ring_destroy(compositor->timeline_ring);
+	compositor->timeline_ring = NULL;
+
 	weston_log_scope_destroy(compositor->libseat_debug);
 	compositor->libseat_debug = NULL;
 
+	weston_log_scope_destroy(compositor->damage_merge_scope);
+	compositor->damage_merge_scope = NULL;
+
+	weston_log_scope_destroy(compositor->frame_stats_scope);
+	compositor->frame_stats_scope = NULL;
+
+	weston_pick_index_destroy(compositor->pick_index);
 	weston_idalloc_destroy(compositor->color_transform_id_generator);
 	weston_idalloc_destroy(compositor->color_profile_id_generator);
 
@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "damage-merge.h"
+#include "shared/xalloc.h"
+
+/* Rectangles being grown at once. Regions come sorted top to bottom, so
+ * a few are enough for side-by-side columns of damage. */
+#define DAMAGE_MERGE_OPEN 4
+
+static int64_t
+box_area(const pixman_box32_t *box)
+{
+	return (int64_t)(box->x2 - box->x1) * (box->y2 - box->y1);
+}
+
+static int64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *boxes;
+	int64_t area = 0;
+	int n, i;
+
+	boxes = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += box_area(&boxes[i]);
+
+	return area;
+}
+
+static pixman_box32_t
+box_union(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	pixman_box32_t u = {
+		.x1 = a->x1 < b->x1 ? a->x1 : b->x1,
+		.y1 = a->y1 < b->y1 ? a->y1 : b->y1,
+		.x2 = a->x2 > b->x2 ? a->x2 : b->x2,
+		.y2 = a->y2 > b->y2 ? a->y2 : b->y2,
+	};
+
+	return u;
+}
+
+/* One greedy pass: each box joins the open box it grows the least, if that
+ * adds less area than a rectangle costs, or opens a new one. */
+static int
+merge_pass(const pixman_box32_t *in, int n, pixman_box32_t *out,
+	   int64_t rect_cost)
+{
+	pixman_box32_t acc[DAMAGE_MERGE_OPEN];
+	int n_acc = 0;
+	int n_out = 0;
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		int64_t best_cost = rect_cost;
+		int best = -1;
+
+		for (j = 0; j < n_acc; j++) {
+			pixman_box32_t u = box_union(&acc[j], &in[i]);
+			int64_t added = box_area(&u) - box_area(&acc[j]) -
+					box_area(&in[i]);
+
+			if (added < best_cost) {
+				best_cost = added;
+				best = j;
+			}
+		}
+
+		if (best >= 0) {
+			acc[best] = box_union(&acc[best], &in[i]);
+			continue;
+		}
+
+		if (n_acc == DAMAGE_MERGE_OPEN) {
+			out[n_out++] = acc[0];
+			memmove(&acc[0], &acc[1],
+				(DAMAGE_MERGE_OPEN - 1) * sizeof acc[0]);
+			n_acc--;
+		}
+		acc[n_acc++] = in[i];
+	}
+
+	for (j = 0; j < n_acc; j++)
+		out[n_out++] = acc[j];
+
+	return n_out;
+}
+
+bool
+damage_merge(pixman_region32_t *region, int max_rects, int rect_cost,
+	     struct damage_merge_stats *stats)
+{
+	pixman_region32_t candidate;
+	pixman_box32_t *boxes;
+	pixman_box32_t *merged;
+	int64_t cost = rect_cost > 0 ? rect_cost : 1;
+	bool changed = false;
+	int n_in, n, m;
+
+	pixman_region32_rectangles(region, &n_in);
+	if (stats) {
+		stats->rects_in = n_in;
+		stats->area_in = region_area(region);
+		stats->rects_out = n_in;
+		stats->area_out = stats->area_in;
+	}
+
+	if (max_rects <= 0 || n_in <= 1)
+		return false;
+
+	merged = xcalloc(n_in, sizeof *merged);
+
+	for (;;) {
+		boxes = pixman_region32_rectangles(region, &n);
+		m = merge_pass(boxes, n, merged, cost);
+
+		/* Overlapping boxes get split again, keep real progress only */
+		pixman_region32_init_rects(&candidate, merged, m);
+		pixman_region32_rectangles(&candidate, &m);
+		if (m < n) {
+			pixman_region32_copy(region, &candidate);
+			changed = true;
+			n = m;
+		}
+		pixman_region32_fini(&candidate);
+
+		if (n <= max_rects || cost > INT64_MAX / 4)
+			break;
+		cost *= 4;
+	}
+
+	free(merged);
+
+	if (stats) {
+		stats->rects_out = n;
+		stats->area_out = region_area(region);
+	}
+
+	return changed;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_DAMAGE_MERGE_H
+#define _WESTON_DAMAGE_MERGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pixman.h>
+
+struct damage_merge_stats {
+	int rects_in;
+	int rects_out;
+	int64_t area_in;
+	int64_t area_out;
+};
+
+/*
+ * Merge the rectangles of 'region' into fewer, bigger ones covering at least
+ * the same area. Two rectangles get merged when their bounding box adds less
+ * area than 'rect_cost', the cost of one more rectangle to a consumer
+ * counted in pixels. If that leaves more than 'max_rects' rectangles, the
+ * cost is raised until it does not, so that in the worst case the region
+ * becomes its extents. 'stats' may be NULL. Returns whether 'region'
+ * changed.
+ */
+bool
+damage_merge(pixman_region32_t *region, int max_rects, int rect_cost,
+	     struct damage_merge_stats *stats);
+
+#endif
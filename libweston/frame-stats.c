@@ -0,0 +1,243 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libweston/helpers.h>
+
+#include "frame-stats.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+static int
+frame_histogram_bucket(int64_t usec)
+{
+	int e;
+
+	if (usec < 0)
+		usec = 0;
+	if (usec >= (INT64_C(1) << FRAME_HISTOGRAM_MAX_BITS))
+		usec = (INT64_C(1) << FRAME_HISTOGRAM_MAX_BITS) - 1;
+
+	if (usec < 2 * FRAME_HISTOGRAM_SUB)
+		return usec;
+
+	e = 63 - __builtin_clzll(usec) - FRAME_HISTOGRAM_SUB_BITS;
+
+	return (e + 1) * FRAME_HISTOGRAM_SUB +
+	       (usec >> e) - FRAME_HISTOGRAM_SUB;
+}
+
+/* The middle of the range of values a bucket counts */
+static int64_t
+frame_histogram_bucket_value(int bucket)
+{
+	int e;
+
+	if (bucket < 2 * FRAME_HISTOGRAM_SUB)
+		return bucket;
+
+	e = bucket / FRAME_HISTOGRAM_SUB - 1;
+
+	return ((int64_t)(bucket % FRAME_HISTOGRAM_SUB + FRAME_HISTOGRAM_SUB) << e) +
+	       ((INT64_C(1) << e) >> 1);
+}
+
+void
+frame_histogram_add(struct frame_histogram *hist, int64_t usec)
+{
+	hist->counts[frame_histogram_bucket(usec)]++;
+	hist->total++;
+	if (usec > hist->max)
+		hist->max = usec;
+}
+
+/** Get a percentile, in microseconds
+ *
+ * \param hist The histogram.
+ * \param percentile From 0 to 100.
+ * \return The value, within the precision of the histogram and never above
+ * the largest value added, or 0 if the histogram is empty.
+ */
+int64_t
+frame_histogram_percentile(const struct frame_histogram *hist,
+			   double percentile)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	int i;
+
+	if (hist->total == 0)
+		return 0;
+
+	rank = (uint64_t)(percentile / 100.0 * hist->total + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == FRAME_HISTOGRAM_BUCKETS)
+		return hist->max;
+
+	return MIN(frame_histogram_bucket_value(i), hist->max);
+}
+
+void
+frame_histogram_merge(struct frame_histogram *dst,
+		      const struct frame_histogram *src)
+{
+	int i;
+
+	for (i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->total += src->total;
+	dst->max = MAX(dst->max, src->max);
+}
+
+struct frame_stats *
+frame_stats_create(void)
+{
+	return xzalloc(sizeof(struct frame_stats));
+}
+
+void
+frame_stats_destroy(struct frame_stats *stats)
+{
+	free(stats);
+}
+
+static void
+frame_stats_add(struct frame_stats *stats, enum frame_stat stat,
+		int64_t nsec)
+{
+	frame_histogram_add(&stats->hist[stats->window][stat], nsec / 1000);
+}
+
+void
+frame_stats_repaint_begin(struct frame_stats *stats,
+			  const struct timespec *now)
+{
+	stats->repaint_begin = *now;
+	stats->pending = false;
+}
+
+void
+frame_stats_render(struct frame_stats *stats, const struct timespec *begin,
+		   const struct timespec *end)
+{
+	frame_stats_add(stats, FRAME_STAT_RENDER,
+			timespec_sub_to_nsec(end, begin));
+}
+
+/** Account a frame handed over to the backend
+ *
+ * \param stats The output statistics.
+ * \param now The time of submission.
+ * \param last_present The presentation time of the previous frame, the
+ * frame is meant to be presented a refresh period later.
+ * \param refresh_nsec The refresh period, 0 if unknown.
+ */
+void
+frame_stats_submit(struct frame_stats *stats, const struct timespec *now,
+		   const struct timespec *last_present, int64_t refresh_nsec)
+{
+	int64_t slack;
+
+	frame_stats_add(stats, FRAME_STAT_REPAINT,
+			timespec_sub_to_nsec(now, &stats->repaint_begin));
+
+	stats->submit = *now;
+	stats->pending = true;
+
+	if (refresh_nsec <= 0 || timespec_is_zero(last_present)) {
+		stats->target = (struct timespec) {};
+		return;
+	}
+
+	/* The target vblank is the first one after the previous frame that
+	 * has not passed by the time repainting began. */
+	timespec_add_nsec(&stats->target, last_present, refresh_nsec);
+	while (timespec_sub_to_nsec(&stats->target, &stats->repaint_begin) < 0)
+		timespec_add_nsec(&stats->target, &stats->target, refresh_nsec);
+
+	slack = timespec_sub_to_nsec(&stats->target, now);
+	if (slack < 0)
+		stats->late++;
+	else
+		frame_stats_add(stats, FRAME_STAT_SLACK, slack);
+}
+
+/** Account the presentation of the submitted frame
+ *
+ * \param stats The output statistics.
+ * \param stamp The presentation time.
+ * \param refresh_nsec The refresh period, 0 if unknown.
+ * \param tearing True if the frame was presented without waiting for vblank.
+ */
+void
+frame_stats_present(struct frame_stats *stats, const struct timespec *stamp,
+		    int64_t refresh_nsec, bool tearing)
+{
+	int64_t behind;
+	int w;
+
+	if (!stats->pending)
+		return;
+	stats->pending = false;
+
+	frame_stats_add(stats, FRAME_STAT_LATENCY,
+			timespec_sub_to_nsec(stamp, &stats->submit));
+	stats->frames++;
+
+	if (!tearing && refresh_nsec > 0 && !timespec_is_zero(&stats->target)) {
+		behind = timespec_sub_to_nsec(stamp, &stats->target);
+		if (behind > refresh_nsec / 2)
+			stats->missed += (behind + refresh_nsec / 2) / refresh_nsec;
+	}
+
+	if (++stats->window_frames < FRAME_STATS_WINDOW)
+		return;
+
+	w = !stats->window;
+	memset(stats->hist[w], 0, sizeof stats->hist[w]);
+	stats->window = w;
+	stats->window_frames = 0;
+}
+
+/** Get the histogram of the last one to two windows of frames */
+void
+frame_stats_get(const struct frame_stats *stats, enum frame_stat stat,
+		struct frame_histogram *hist)
+{
+	*hist = stats->hist[stats->window][stat];
+	frame_histogram_merge(hist, &stats->hist[!stats->window][stat]);
+}
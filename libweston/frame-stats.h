@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WESTON_FRAME_STATS_H
+#define _WESTON_FRAME_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Values below 2 * FRAME_HISTOGRAM_SUB get a bucket each, above that every
+ * power of two is split into FRAME_HISTOGRAM_SUB buckets, which keeps the
+ * error within 1 / FRAME_HISTOGRAM_SUB. */
+#define FRAME_HISTOGRAM_SUB_BITS 5
+#define FRAME_HISTOGRAM_SUB (1 << FRAME_HISTOGRAM_SUB_BITS)
+#define FRAME_HISTOGRAM_MAX_BITS 26
+#define FRAME_HISTOGRAM_BUCKETS \
+	((FRAME_HISTOGRAM_MAX_BITS - FRAME_HISTOGRAM_SUB_BITS + 1) * \
+	 FRAME_HISTOGRAM_SUB)
+
+/** Log-linear histogram of durations in microseconds, up to about a minute */
+struct frame_histogram {
+	uint32_t counts[FRAME_HISTOGRAM_BUCKETS];
+	uint32_t total;
+	int64_t max;
+};
+
+void
+frame_histogram_add(struct frame_histogram *hist, int64_t usec);
+
+int64_t
+frame_histogram_percentile(const struct frame_histogram *hist,
+			   double percentile);
+
+void
+frame_histogram_merge(struct frame_histogram *dst,
+		      const struct frame_histogram *src);
+
+enum frame_stat {
+	FRAME_STAT_REPAINT = 0,	/**< repaint start to submission */
+	FRAME_STAT_RENDER,	/**< renderer repaint_output() */
+	FRAME_STAT_LATENCY,	/**< submission to presentation */
+	FRAME_STAT_SLACK,	/**< submission to the target vblank */
+	FRAME_STAT_COUNT,
+};
+
+/** Frames in a statistics window, the last one to two windows are kept */
+#define FRAME_STATS_WINDOW 512
+
+/** Rolling frame timing statistics of an output
+ *
+ * All timestamps are in the compositor presentation clock.
+ */
+struct frame_stats {
+	struct frame_histogram hist[2][FRAME_STAT_COUNT];
+	int window;			/**< index of the current window */
+	uint32_t window_frames;
+
+	uint64_t frames;		/**< presented frames */
+	uint64_t missed;		/**< vblanks missed by presented frames */
+	uint64_t late;			/**< frames submitted past the target */
+
+	struct timespec repaint_begin;
+	struct timespec submit;
+	struct timespec target;
+	bool pending;			/**< a frame awaits presentation */
+};
+
+struct frame_stats *
+frame_stats_create(void);
+
+void
+frame_stats_destroy(struct frame_stats *stats);
+
+void
+frame_stats_repaint_begin(struct frame_stats *stats,
+			  const struct timespec *now);
+
+void
+frame_stats_render(struct frame_stats *stats, const struct timespec *begin,
+		   const struct timespec *end);
+
+void
+frame_stats_submit(struct frame_stats *stats, const struct timespec *now,
+		   const struct timespec *last_present, int64_t refresh_nsec);
+
+void
+frame_stats_present(struct frame_stats *stats, const struct timespec *stamp,
+		    int64_t refresh_nsec, bool tearing);
+
+void
+frame_stats_get(const struct frame_stats *stats, enum frame_stat stat,
+		struct frame_histogram *hist);
+
+#endif /* _WESTON_FRAME_STATS_H */
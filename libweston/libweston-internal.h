@@ -165,6 +165,13 @@ struct weston_renderer {
 					const uint64_t *modifiers, unsigned int count);
 
 	enum weston_renderer_type type;
+	/* repaint_output() may run on several outputs at once, each on its
+	 * own thread, see weston_output_repaint_renderer() */
+	bool threaded_repaint;
+	/* Optional, called on the compositor thread once an output repaint
+	 * is finished, so that repaint_output() need not log from a
+	 * repaint thread */
+	void (*repaint_output_done)(struct weston_output *output);
 	const struct gl_renderer_interface *gl;
 	const struct pixman_renderer_interface *pixman;
 };
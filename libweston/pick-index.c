@@ -0,0 +1,355 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "pick-index.h"
+#include "shared/xalloc.h"
+
+/*
+ * Spatial index for weston_compositor_pick_view().
+ *
+ * The global space is cut into square cells, hashed into a fixed number of
+ * buckets. Each bucket lists the views whose bounding box touches one of its
+ * cells, sorted by their position in weston_compositor::view_list, so a pick
+ * only has to look at the views of one bucket, topmost first. Views spanning
+ * too many cells, like backgrounds, are kept in one more list which every
+ * pick looks at.
+ *
+ * The index is rebuilt from the view list the first time it is needed after
+ * the view list was rebuilt. In between, views whose geometry gets dirty are
+ * queued, and moved to their new cells on the next pick.
+ */
+
+#define PICK_CELL_SHIFT 7 /* 128x128 cells */
+#define PICK_BUCKET_COUNT 1024
+#define PICK_MAX_CELLS 64
+
+struct pick_entry {
+	struct weston_view *view;
+	uint32_t z;
+};
+
+struct pick_bucket {
+	struct pick_entry *entries; /* sorted by z */
+	int count;
+	int alloc;
+};
+
+struct weston_pick_index {
+	struct weston_compositor *compositor;
+	bool valid;
+	struct pick_bucket buckets[PICK_BUCKET_COUNT];
+	struct pick_bucket large;
+	struct wl_list dirty_list; /* weston_view::pick_index.dirty_link */
+};
+
+static struct pick_bucket *
+pick_index_bucket(struct weston_pick_index *index, int32_t cx, int32_t cy)
+{
+	uint32_t hash = (uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u;
+
+	return &index->buckets[hash & (PICK_BUCKET_COUNT - 1)];
+}
+
+/* first entry with a z not below the given one */
+static int
+pick_bucket_lower_bound(struct pick_bucket *bucket, uint32_t z)
+{
+	int lo = 0, hi = bucket->count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (bucket->entries[mid].z < z)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void
+pick_bucket_insert(struct pick_bucket *bucket, struct weston_view *view)
+{
+	uint32_t z = view->pick_index.z;
+	int pos = pick_bucket_lower_bound(bucket, z);
+
+	/* several cells of a view can share a bucket */
+	if (pos < bucket->count && bucket->entries[pos].view == view)
+		return;
+
+	if (bucket->count == bucket->alloc) {
+		bucket->alloc = bucket->alloc ? bucket->alloc * 2 : 8;
+		bucket->entries = xrealloc(bucket->entries,
+					   bucket->alloc * sizeof *bucket->entries);
+	}
+
+	memmove(&bucket->entries[pos + 1], &bucket->entries[pos],
+		(bucket->count - pos) * sizeof *bucket->entries);
+	bucket->entries[pos].view = view;
+	bucket->entries[pos].z = z;
+	bucket->count++;
+}
+
+static void
+pick_bucket_remove(struct pick_bucket *bucket, struct weston_view *view)
+{
+	int pos = pick_bucket_lower_bound(bucket, view->pick_index.z);
+
+	if (pos == bucket->count || bucket->entries[pos].view != view)
+		return;
+
+	bucket->count--;
+	memmove(&bucket->entries[pos], &bucket->entries[pos + 1],
+		(bucket->count - pos) * sizeof *bucket->entries);
+}
+
+static void
+pick_index_insert_view(struct weston_pick_index *index,
+		       struct weston_view *view)
+{
+	const pixman_box32_t *box;
+	int32_t cx, cy;
+
+	box = pixman_region32_extents(&view->transform.boundingbox);
+	if (box->x1 >= box->x2 || box->y1 >= box->y2) {
+		/* nothing to pick, keep it out of every bucket */
+		view->pick_index.cells = 0;
+		return;
+	}
+
+	view->pick_index.cell_x1 = box->x1 >> PICK_CELL_SHIFT;
+	view->pick_index.cell_y1 = box->y1 >> PICK_CELL_SHIFT;
+	view->pick_index.cell_x2 = (box->x2 - 1) >> PICK_CELL_SHIFT;
+	view->pick_index.cell_y2 = (box->y2 - 1) >> PICK_CELL_SHIFT;
+	view->pick_index.cells =
+		(int64_t)(view->pick_index.cell_x2 - view->pick_index.cell_x1 + 1) *
+		(view->pick_index.cell_y2 - view->pick_index.cell_y1 + 1);
+
+	if (view->pick_index.cells > PICK_MAX_CELLS) {
+		pick_bucket_insert(&index->large, view);
+		return;
+	}
+
+	for (cy = view->pick_index.cell_y1; cy <= view->pick_index.cell_y2; cy++)
+		for (cx = view->pick_index.cell_x1; cx <= view->pick_index.cell_x2; cx++)
+			pick_bucket_insert(pick_index_bucket(index, cx, cy), view);
+}
+
+static void
+pick_index_unlink_view(struct weston_pick_index *index,
+		       struct weston_view *view)
+{
+	int32_t cx, cy;
+
+	if (view->pick_index.cells > PICK_MAX_CELLS) {
+		pick_bucket_remove(&index->large, view);
+	} else if (view->pick_index.cells > 0) {
+		for (cy = view->pick_index.cell_y1; cy <= view->pick_index.cell_y2; cy++)
+			for (cx = view->pick_index.cell_x1; cx <= view->pick_index.cell_x2; cx++)
+				pick_bucket_remove(pick_index_bucket(index, cx, cy), view);
+	}
+	view->pick_index.cells = 0;
+}
+
+/* all indexed views are on the view list, call before it gets rebuilt */
+static void
+pick_index_clear(struct weston_pick_index *index)
+{
+	struct weston_view *view;
+	int i;
+
+	wl_list_for_each(view, &index->compositor->view_list, link) {
+		view->pick_index.indexed = false;
+		view->pick_index.cells = 0;
+		wl_list_remove(&view->pick_index.dirty_link);
+		wl_list_init(&view->pick_index.dirty_link);
+	}
+	assert(wl_list_empty(&index->dirty_list));
+
+	for (i = 0; i < PICK_BUCKET_COUNT; i++)
+		index->buckets[i].count = 0;
+	index->large.count = 0;
+
+	index->valid = false;
+}
+
+static void
+pick_index_build(struct weston_pick_index *index)
+{
+	struct weston_view *view;
+	uint32_t z = 0;
+
+	wl_list_for_each(view, &index->compositor->view_list, link) {
+		weston_view_update_transform(view);
+
+		view->pick_index.z = z++;
+		view->pick_index.indexed = true;
+		pick_index_insert_view(index, view);
+	}
+
+	index->valid = true;
+}
+
+static void
+pick_index_update_dirty(struct weston_pick_index *index)
+{
+	struct weston_view *view;
+
+	while (!wl_list_empty(&index->dirty_list)) {
+		view = container_of(index->dirty_list.next,
+				    struct weston_view, pick_index.dirty_link);
+		wl_list_remove(&view->pick_index.dirty_link);
+		wl_list_init(&view->pick_index.dirty_link);
+
+		/* updating a transform never dirties other views */
+		weston_view_update_transform(view);
+		pick_index_unlink_view(index, view);
+		pick_index_insert_view(index, view);
+	}
+}
+
+struct weston_pick_index *
+weston_pick_index_create(struct weston_compositor *compositor)
+{
+	struct weston_pick_index *index;
+
+	index = xzalloc(sizeof *index);
+	index->compositor = compositor;
+	wl_list_init(&index->dirty_list);
+
+	return index;
+}
+
+void
+weston_pick_index_destroy(struct weston_pick_index *index)
+{
+	int i;
+
+	if (!index)
+		return;
+
+	pick_index_clear(index);
+	for (i = 0; i < PICK_BUCKET_COUNT; i++)
+		free(index->buckets[i].entries);
+	free(index->large.entries);
+	free(index);
+}
+
+/** Drops the index, to be rebuilt on the next pick
+ *
+ * To be called right before weston_compositor::view_list gets rebuilt.
+ */
+void
+weston_pick_index_invalidate(struct weston_pick_index *index)
+{
+	pick_index_clear(index);
+}
+
+/** Queues an indexed view whose transform just got dirty */
+void
+weston_pick_index_view_dirty(struct weston_pick_index *index,
+			     struct weston_view *view)
+{
+	if (!view->pick_index.indexed)
+		return;
+
+	wl_list_remove(&view->pick_index.dirty_link);
+	wl_list_insert(index->dirty_list.prev, &view->pick_index.dirty_link);
+}
+
+/** Forgets a view leaving weston_compositor::view_list */
+void
+weston_pick_index_remove_view(struct weston_pick_index *index,
+			      struct weston_view *view)
+{
+	wl_list_remove(&view->pick_index.dirty_link);
+	wl_list_init(&view->pick_index.dirty_link);
+
+	if (!view->pick_index.indexed)
+		return;
+
+	pick_index_unlink_view(index, view);
+	view->pick_index.indexed = false;
+}
+
+static bool
+pick_view_at(struct weston_view *view, struct weston_coord_global pos)
+{
+	struct weston_coord_surface surf_pos;
+
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    pos.c.x, pos.c.y, NULL))
+		return false;
+
+	surf_pos = weston_coord_global_to_surface(view, pos);
+
+	return weston_view_takes_input_at_point(view, surf_pos);
+}
+
+/** Finds the topmost view taking input at a position
+ *
+ * Same result as walking weston_compositor::view_list in order.
+ */
+struct weston_view *
+weston_pick_index_pick(struct weston_pick_index *index,
+		       struct weston_coord_global pos)
+{
+	struct pick_bucket *bucket, *large = &index->large;
+	int32_t x = pos.c.x, y = pos.c.y;
+	int i = 0, j = 0;
+
+	if (!index->valid)
+		pick_index_build(index);
+	pick_index_update_dirty(index);
+
+	bucket = pick_index_bucket(index, x >> PICK_CELL_SHIFT,
+				   y >> PICK_CELL_SHIFT);
+
+	/* merge both lists, topmost first */
+	while (i < bucket->count || j < large->count) {
+		struct weston_view *view;
+
+		if (j == large->count ||
+		    (i < bucket->count &&
+		     bucket->entries[i].z < large->entries[j].z))
+			view = bucket->entries[i++].view;
+		else
+			view = large->entries[j++].view;
+
+		if (pick_view_at(view, pos))
+			return view;
+	}
+
+	return NULL;
+}
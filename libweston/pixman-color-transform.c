@@ -0,0 +1,417 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <libweston/libweston.h>
+#include <libweston/helpers.h>
+#include "color.h"
+#include "pixman-color-transform.h"
+#include "shared/xalloc.h"
+
+/*
+ * This is the CPU counterpart of the color pipeline in
+ * renderer-gl/fragment.glsl, and must produce the same results: curves and
+ * the 3D LUT are sampled the way GL samples LUT textures, with linear and
+ * trilinear interpolation respectively.
+ *
+ * Pixels are processed in chunks, one plain array per channel, so that the
+ * per-channel arithmetic is straight loops the compiler can vectorize.
+ */
+
+/* Pixels per chunk, the stack arrays below are sized by this */
+#define COLOR_CHUNK 64
+
+/* Samples of the table approximating a parametric curve */
+#define CURVE_TABLE_LEN 4096
+
+/*
+ * The table is too coarse where the curve is the steepest, for instance
+ * x^(1/2.4) at 0. Below this many table steps, evaluate exactly instead.
+ */
+#define CURVE_EXACT_STEPS 16
+
+struct pixman_color_curve {
+	enum weston_color_curve_type type;
+
+	/* LUT_3x1D as filled in, or the table for a parametric curve */
+	float *lut; /* 3 * len, R then G then B */
+	unsigned len;
+
+	/* parametric only: */
+	struct weston_color_curve_parametric parametric;
+	float exact_below;
+};
+
+struct pixman_color_mapping {
+	enum weston_color_mapping_type type;
+	union {
+		struct {
+			float *lut; /* 3 * len * len * len */
+			unsigned len;
+		} lut3d;
+		struct weston_color_mapping_matrix mat;
+	} u;
+};
+
+struct pixman_color_transform {
+	struct weston_color_transform *owner;
+	struct wl_listener destroy_listener;
+	struct pixman_color_curve pre_curve;
+	struct pixman_color_mapping mapping;
+	struct pixman_color_curve post_curve;
+};
+
+static void
+pixman_color_transform_destroy(struct pixman_color_transform *pxform)
+{
+	free(pxform->pre_curve.lut);
+	free(pxform->post_curve.lut);
+	if (pxform->mapping.type == WESTON_COLOR_MAPPING_TYPE_3D_LUT)
+		free(pxform->mapping.u.lut3d.lut);
+	wl_list_remove(&pxform->destroy_listener.link);
+	free(pxform);
+}
+
+static void
+color_transform_destroy_handler(struct wl_listener *l, void *data)
+{
+	struct pixman_color_transform *pxform;
+
+	pxform = wl_container_of(l, pxform, destroy_listener);
+	assert(pxform->owner == data);
+
+	pixman_color_transform_destroy(pxform);
+}
+
+/* See WESTON_COLOR_CURVE_TYPE_LINPOW and _POWLIN, and fragment.glsl */
+static float
+curve_parametric_eval(const struct pixman_color_curve *curve,
+		      int chan, float x)
+{
+	const float *p = curve->parametric.params[chan];
+	float g = p[0], a = p[1], b = p[2], c = p[3], d = p[4];
+	float sign = 1.0f;
+	float y;
+
+	if (curve->parametric.clamped_input)
+		x = CLIP(x, 0.0f, 1.0f);
+
+	/* Mirroring for negative input values */
+	if (x < 0.0f) {
+		sign = -1.0f;
+		x = -x;
+	}
+
+	if (x < d)
+		y = c * x;
+	else if (curve->type == WESTON_COLOR_CURVE_TYPE_LINPOW)
+		y = powf(a * x + b, g);
+	else
+		y = a * powf(x, g) + b;
+
+	return sign * y;
+}
+
+static void
+curve_apply(const struct pixman_color_curve *curve, float *chan[3], int n)
+{
+	const float scale = curve->len - 1;
+	int c, i;
+
+	switch (curve->type) {
+	case WESTON_COLOR_CURVE_TYPE_IDENTITY:
+		return;
+	case WESTON_COLOR_CURVE_TYPE_LUT_3x1D:
+		for (c = 0; c < 3; c++) {
+			const float *lut = curve->lut + c * curve->len;
+			float *v = chan[c];
+
+			for (i = 0; i < n; i++) {
+				float pos = CLIP(v[i], 0.0f, 1.0f) * scale;
+				unsigned j = MIN((unsigned)pos, curve->len - 2);
+				float f = pos - j;
+
+				v[i] = lut[j] + f * (lut[j + 1] - lut[j]);
+			}
+		}
+		return;
+	case WESTON_COLOR_CURVE_TYPE_LINPOW:
+	case WESTON_COLOR_CURVE_TYPE_POWLIN:
+		for (c = 0; c < 3; c++) {
+			const float *lut = curve->lut + c * curve->len;
+			float *v = chan[c];
+
+			for (i = 0; i < n; i++) {
+				float pos;
+				unsigned j;
+
+				if (!(v[i] >= curve->exact_below && v[i] <= 1.0f)) {
+					v[i] = curve_parametric_eval(curve, c, v[i]);
+					continue;
+				}
+
+				pos = v[i] * scale;
+				j = MIN((unsigned)pos, curve->len - 2);
+				v[i] = lut[j] + (pos - j) * (lut[j + 1] - lut[j]);
+			}
+		}
+		return;
+	}
+}
+
+static void
+mapping_matrix_apply(const struct weston_color_mapping_matrix *mat,
+		     float *chan[3], int n)
+{
+	/* column-major, like color_mapping_matrix in fragment.glsl */
+	const float *m = mat->matrix;
+	float *r = chan[0], *g = chan[1], *b = chan[2];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		float x = r[i], y = g[i], z = b[i];
+
+		r[i] = m[0] * x + m[3] * y + m[6] * z;
+		g[i] = m[1] * x + m[4] * y + m[7] * z;
+		b[i] = m[2] * x + m[5] * y + m[8] * z;
+	}
+}
+
+static void
+mapping_lut3d_apply(const float *lut, unsigned len, float *chan[3], int n)
+{
+	const float scale = len - 1;
+	const unsigned sr = 3, sg = 3 * len, sb = 3 * len * len;
+	unsigned idx[COLOR_CHUNK];
+	float fr[COLOR_CHUNK], fg[COLOR_CHUNK], fb[COLOR_CHUNK];
+	int i, c;
+
+	assert(n <= COLOR_CHUNK);
+
+	/* Cell and position in it, for all pixels first... */
+	for (i = 0; i < n; i++) {
+		float pr = CLIP(chan[0][i], 0.0f, 1.0f) * scale;
+		float pg = CLIP(chan[1][i], 0.0f, 1.0f) * scale;
+		float pb = CLIP(chan[2][i], 0.0f, 1.0f) * scale;
+		unsigned ir = MIN((unsigned)pr, len - 2);
+		unsigned ig = MIN((unsigned)pg, len - 2);
+		unsigned ib = MIN((unsigned)pb, len - 2);
+
+		fr[i] = pr - ir;
+		fg[i] = pg - ig;
+		fb[i] = pb - ib;
+		idx[i] = ir * sr + ig * sg + ib * sb;
+	}
+
+	/* ...then trilinear interpolation, as texture3D() does in GL. */
+	for (i = 0; i < n; i++) {
+		const float *p = lut + idx[i];
+		float out[3];
+
+		for (c = 0; c < 3; c++) {
+			float c00 = p[c] + fr[i] * (p[sr + c] - p[c]);
+			float c10 = p[sg + c] + fr[i] * (p[sg + sr + c] - p[sg + c]);
+			float c01 = p[sb + c] + fr[i] * (p[sb + sr + c] - p[sb + c]);
+			float c11 = p[sb + sg + c] +
+				    fr[i] * (p[sb + sg + sr + c] - p[sb + sg + c]);
+			float c0 = c00 + fg[i] * (c10 - c00);
+			float c1 = c01 + fg[i] * (c11 - c01);
+
+			out[c] = c0 + fb[i] * (c1 - c0);
+		}
+
+		chan[0][i] = out[0];
+		chan[1][i] = out[1];
+		chan[2][i] = out[2];
+	}
+}
+
+static void
+color_chunk_apply(const struct pixman_color_transform *pxform,
+		  float *rgba, int n)
+{
+	float r[COLOR_CHUNK], g[COLOR_CHUNK], b[COLOR_CHUNK], a[COLOR_CHUNK];
+	float *chan[3] = { r, g, b };
+	int i;
+
+	/* Ensure straight alpha */
+	for (i = 0; i < n; i++) {
+		float inv;
+
+		a[i] = rgba[4 * i + 3];
+		inv = a[i] == 0.0f ? 0.0f : 1.0f / a[i];
+		r[i] = rgba[4 * i + 0] * inv;
+		g[i] = rgba[4 * i + 1] * inv;
+		b[i] = rgba[4 * i + 2] * inv;
+	}
+
+	curve_apply(&pxform->pre_curve, chan, n);
+
+	switch (pxform->mapping.type) {
+	case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+		mapping_lut3d_apply(pxform->mapping.u.lut3d.lut,
+				    pxform->mapping.u.lut3d.len, chan, n);
+		break;
+	case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+		mapping_matrix_apply(&pxform->mapping.u.mat, chan, n);
+		break;
+	}
+
+	curve_apply(&pxform->post_curve, chan, n);
+
+	/* Back to pre-multiplied */
+	for (i = 0; i < n; i++) {
+		rgba[4 * i + 0] = r[i] * a[i];
+		rgba[4 * i + 1] = g[i] * a[i];
+		rgba[4 * i + 2] = b[i] * a[i];
+	}
+}
+
+void
+pixman_color_transform_apply(const struct pixman_color_transform *pxform,
+			     float *rgba, int count)
+{
+	int n;
+
+	for (; count > 0; count -= n, rgba += 4 * n) {
+		n = MIN(count, COLOR_CHUNK);
+		color_chunk_apply(pxform, rgba, n);
+	}
+}
+
+static bool
+pixman_color_curve_init(struct pixman_color_curve *pcurve,
+			const struct weston_color_curve *curve,
+			struct weston_color_transform *xform)
+{
+	unsigned c, i;
+
+	pcurve->type = curve->type;
+
+	switch (curve->type) {
+	case WESTON_COLOR_CURVE_TYPE_IDENTITY:
+		return true;
+	case WESTON_COLOR_CURVE_TYPE_LUT_3x1D:
+		pcurve->len = curve->u.lut_3x1d.optimal_len;
+		if (pcurve->len < 2)
+			return false;
+		pcurve->lut = calloc(3 * pcurve->len, sizeof *pcurve->lut);
+		if (!pcurve->lut)
+			return false;
+		curve->u.lut_3x1d.fill_in(xform, pcurve->lut, pcurve->len);
+		return true;
+	case WESTON_COLOR_CURVE_TYPE_LINPOW:
+	case WESTON_COLOR_CURVE_TYPE_POWLIN:
+		pcurve->parametric = curve->u.parametric;
+		pcurve->len = CURVE_TABLE_LEN;
+		pcurve->exact_below = (float)CURVE_EXACT_STEPS /
+				      (CURVE_TABLE_LEN - 1);
+		pcurve->lut = calloc(3 * pcurve->len, sizeof *pcurve->lut);
+		if (!pcurve->lut)
+			return false;
+		for (c = 0; c < 3; c++) {
+			for (i = 0; i < pcurve->len; i++) {
+				float x = (float)i / (pcurve->len - 1);
+
+				pcurve->lut[c * pcurve->len + i] =
+					curve_parametric_eval(pcurve, c, x);
+			}
+		}
+		return true;
+	}
+
+	return false;
+}
+
+static bool
+pixman_color_mapping_init(struct pixman_color_mapping *pmapping,
+			  const struct weston_color_mapping *mapping,
+			  struct weston_color_transform *xform)
+{
+	unsigned len;
+
+	pmapping->type = mapping->type;
+
+	switch (mapping->type) {
+	case WESTON_COLOR_MAPPING_TYPE_IDENTITY:
+		return true;
+	case WESTON_COLOR_MAPPING_TYPE_3D_LUT:
+		len = mapping->u.lut3d.optimal_len;
+		if (len < 2)
+			return false;
+		pmapping->u.lut3d.len = len;
+		pmapping->u.lut3d.lut = calloc(3 * len * len * len,
+					       sizeof *pmapping->u.lut3d.lut);
+		if (!pmapping->u.lut3d.lut)
+			return false;
+		mapping->u.lut3d.fill_in(xform, pmapping->u.lut3d.lut, len);
+		return true;
+	case WESTON_COLOR_MAPPING_TYPE_MATRIX:
+		pmapping->u.mat = mapping->u.mat;
+		return true;
+	}
+
+	return false;
+}
+
+const struct pixman_color_transform *
+pixman_color_transform_get(struct weston_color_transform *xform)
+{
+	struct pixman_color_transform *pxform;
+	struct wl_listener *l;
+
+	/* Cached transformation */
+	l = wl_signal_get(&xform->destroy_signal,
+			  color_transform_destroy_handler);
+	if (l)
+		return container_of(l, struct pixman_color_transform,
+				    destroy_listener);
+
+	/* New transformation */
+	pxform = xzalloc(sizeof *pxform);
+	pxform->owner = xform;
+	pxform->destroy_listener.notify = color_transform_destroy_handler;
+	wl_signal_add(&xform->destroy_signal, &pxform->destroy_listener);
+
+	if (!pixman_color_curve_init(&pxform->pre_curve,
+				     &xform->pre_curve, xform) ||
+	    !pixman_color_mapping_init(&pxform->mapping,
+				       &xform->mapping, xform) ||
+	    !pixman_color_curve_init(&pxform->post_curve,
+				     &xform->post_curve, xform)) {
+		pixman_color_transform_destroy(pxform);
+		return NULL;
+	}
+
+	return pxform;
+}
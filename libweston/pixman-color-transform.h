@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PIXMAN_COLOR_TRANSFORM_H
+#define PIXMAN_COLOR_TRANSFORM_H
+
+struct weston_color_transform;
+struct pixman_color_transform;
+
+/** Get the CPU realization of a color transformation
+ *
+ * \param xform The color transformation, not NULL.
+ * \return The realization, or NULL on failure.
+ *
+ * The realization is created on first use and cached on \c xform until
+ * that gets destroyed. This is not thread-safe, the caller must serialize
+ * calls.
+ */
+const struct pixman_color_transform *
+pixman_color_transform_get(struct weston_color_transform *xform);
+
+/** Apply a color transformation to pixels in place
+ *
+ * \param xform The color transformation realization.
+ * \param rgba Pixels as pre-multiplied R, G, B, A floats, like
+ * PIXMAN_rgba_float.
+ * \param count The number of pixels.
+ *
+ * Can be called from any thread.
+ */
+void
+pixman_color_transform_apply(const struct pixman_color_transform *xform,
+			     float *rgba, int count);
+
+#endif /* PIXMAN_COLOR_TRANSFORM_H */
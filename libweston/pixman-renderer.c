@@ -28,11 +28,14 @@
 #include "config.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "pixman-renderer.h"
+#include "pixman-color-transform.h"
 #include "color.h"
 #include "pixel-formats.h"
 #include "output-capture.h"
@@ -45,10 +48,17 @@
 struct pixman_output_state {
 	pixman_image_t *shadow_image;
 	const struct pixel_format_info *shadow_format;
+	/* PIXMAN_rgba_float shadow for blending in a linear color space,
+	 * there is no shadow_format for it then */
+	bool shadow_float;
 	pixman_image_t *hw_buffer;
 	const struct pixel_format_info *hw_format;
 	struct weston_size fb_size;
 	struct wl_list renderbuffer_list;
+
+	/* Found by the repaint, logged by repaint_output_done() */
+	int overdraw;
+	bool color_transform_failed;
 };
 
 struct pixman_surface_state {
@@ -70,6 +80,49 @@ struct pixman_renderbuffer {
 	struct wl_list link;
 };
 
+/* Do not bother splitting a repaint into bands shorter than this */
+#define PIXMAN_BAND_MIN_ROWS 32
+
+/** A horizontal band of an output framebuffer
+ *
+ * Everything repaint_surfaces() and copy_to_hw_buffer() draw goes through
+ * one, and gets clipped to it. Bands span the full framebuffer width, so
+ * that pixman computes every scanline exactly as it would unbanded.
+ */
+struct pixman_band {
+	struct weston_output *output;
+	pixman_image_t *shadow_image; /* NULL without a shadow */
+	pixman_image_t *hw_buffer;
+	pixman_region32_t clip; /* output framebuffer coordinates */
+
+	pixman_region32_t *damage; /* global, to repaint, or NULL */
+	pixman_region32_t *hw_damage; /* global, to copy, or NULL */
+	/* applied when copying to hw_buffer, or NULL */
+	const struct pixman_color_transform *blend_to_output;
+	/* reported back to draw_output(), bands must not log */
+	int overdraw;
+	bool color_transform_failed;
+
+	struct pixman_band_batch *batch;
+	struct wl_list link; /* pixman_band_pool::queue */
+};
+
+struct pixman_band_batch {
+	int pending; /* protected by pixman_band_pool::mutex */
+};
+
+/** Worker threads compositing bands for any output */
+struct pixman_band_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond; /* a band got queued, or quit */
+	pthread_cond_t done_cond; /* some batch got done */
+	struct wl_list queue; /* pixman_band::link */
+	bool quit;
+
+	pthread_t *threads;
+	int thread_count;
+};
+
 struct pixman_renderer {
 	struct weston_renderer base;
 
@@ -77,6 +130,11 @@ struct pixman_renderer {
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	struct pixman_band_pool *band_pool;
+
+	/* Serializes realizing color transformations, from any thread */
+	pthread_mutex_t color_mutex;
+
 	struct wl_signal destroy_signal;
 };
 
@@ -118,6 +176,28 @@ get_renderer(struct weston_compositor *ec)
 	return (struct pixman_renderer *)ec->renderer;
 }
 
+/* Repaint and band threads may realize the same transformation at once.
+ * Failures are not logged here, see pixman_renderer_repaint_output_done() */
+static const struct pixman_color_transform *
+get_color_transform(struct pixman_renderer *pr,
+		    struct weston_color_transform *xform)
+{
+	const struct pixman_color_transform *pxform;
+
+	pthread_mutex_lock(&pr->color_mutex);
+	pxform = pixman_color_transform_get(xform);
+	pthread_mutex_unlock(&pr->color_mutex);
+
+	return pxform;
+}
+
+static bool
+output_needs_blend_to_output(struct weston_output *output)
+{
+	return output->color_outcome->from_blend_to_output != NULL &&
+	       !output->from_blend_to_output_by_backend;
+}
+
 static int
 pixman_renderer_read_pixels(struct weston_output *output,
 			    const struct pixel_format_info *format, void *pixels,
@@ -214,28 +294,45 @@ composite_whole(pixman_op_t op,
 {
 	int32_t dest_width;
 	int32_t dest_height;
+	pixman_image_t *img = src;
 
 	dest_width = pixman_image_get_width(dest);
 	dest_height = pixman_image_get_height(dest);
 
-	pixman_image_set_transform(src, transform);
-	pixman_image_set_filter(src, filter, NULL, 0);
-
-	/* bilinear filtering needs the equivalent of OpenGL CLAMP_TO_EDGE */
-	if (filter == PIXMAN_FILTER_NEAREST)
-		pixman_image_set_repeat(src, PIXMAN_REPEAT_NONE);
-	else
-		pixman_image_set_repeat(src, PIXMAN_REPEAT_PAD);
+	/* The surface image may be drawn on other outputs at the same time,
+	 * set the sampling up on an image of our own. Solid fills don't
+	 * need any. */
+	if (pixman_image_get_data(src)) {
+		img = pixman_image_create_bits_no_clear(pixman_image_get_format(src),
+							pixman_image_get_width(src),
+							pixman_image_get_height(src),
+							pixman_image_get_data(src),
+							pixman_image_get_stride(src));
+		abort_oom_if_null(img);
+
+		pixman_image_set_transform(img, transform);
+		pixman_image_set_filter(img, filter, NULL, 0);
+
+		/* bilinear filtering needs the equivalent of OpenGL
+		 * CLAMP_TO_EDGE */
+		if (filter == PIXMAN_FILTER_NEAREST)
+			pixman_image_set_repeat(img, PIXMAN_REPEAT_NONE);
+		else
+			pixman_image_set_repeat(img, PIXMAN_REPEAT_PAD);
+	}
 
-	pixman_image_composite32(op, src, mask, dest,
+	pixman_image_composite32(op, img, mask, dest,
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
 				 dest_width, dest_height);
+
+	if (img != src)
+		pixman_image_unref(img);
 }
 
 static void
-composite_clipped(struct weston_output *output,
+composite_clipped(struct pixman_band *band,
 		  pixman_image_t *src,
 		  pixman_image_t *mask,
 		  pixman_image_t *dest,
@@ -304,16 +401,116 @@ composite_clipped(struct weston_output *output,
 		pixman_image_unref(boximg);
 	}
 
-	if (n_box > 1) {
-		weston_log_paced(&output->pixman_overdraw_pacer, 1, 0,
-				 "Pixman-renderer warning: %dx overdraw\n",
-				 n_box);
+	/* Logged on the compositor thread, see repaint_output_done() */
+	band->overdraw = MAX(band->overdraw, n_box);
+}
+
+/** Make a source image of a surface in the blending color space
+ *
+ * \param pnode The paint node to be painted.
+ * \param xform The surface color transformation.
+ * \param src The surface image.
+ * \param clip What is going to be painted, in output coordinates.
+ * \param transform The output to buffer transformation, adjusted to the
+ *                  returned image.
+ * \param dx The returned image origin in buffer coordinates.
+ * \param dy The returned image origin in buffer coordinates.
+ *
+ * Only the part of the buffer the clip samples from gets converted, plus a
+ * pixel for bilinear filtering, into a PIXMAN_rgba_float image of its own.
+ * Solid fills make another solid fill.
+ */
+static pixman_image_t *
+color_source_create(struct weston_paint_node *pnode,
+		    const struct pixman_color_transform *xform,
+		    pixman_image_t *src,
+		    pixman_region32_t *clip,
+		    pixman_transform_t *transform,
+		    int32_t *dx, int32_t *dy)
+{
+	pixman_image_t *view;
+	pixman_image_t *img;
+	pixman_box32_t box;
+	int32_t width, height;
+	int stride;
+	float *data;
+	int y;
+
+	*dx = 0;
+	*dy = 0;
+
+	if (!pixman_image_get_data(src)) {
+		pixman_color_t color;
+		float px[4];
+
+		img = pixman_image_create_bits_no_clear(PIXMAN_rgba_float, 1, 1,
+							(uint32_t *)px,
+							sizeof px);
+		abort_oom_if_null(img);
+		pixman_image_composite32(PIXMAN_OP_SRC, src, NULL, img,
+					 0, 0, 0, 0, 0, 0, 1, 1);
+		pixman_image_unref(img);
+
+		pixman_color_transform_apply(xform, px, 1);
+		color.red = CLIP(px[0], 0.0f, 1.0f) * 0xffff;
+		color.green = CLIP(px[1], 0.0f, 1.0f) * 0xffff;
+		color.blue = CLIP(px[2], 0.0f, 1.0f) * 0xffff;
+		color.alpha = CLIP(px[3], 0.0f, 1.0f) * 0xffff;
+
+		img = pixman_image_create_solid_fill(&color);
+		abort_oom_if_null(img);
+
+		return img;
 	}
+
+	width = pixman_image_get_width(src);
+	height = pixman_image_get_height(src);
+	box = weston_matrix_transform_rect(&pnode->output_to_buffer_matrix,
+					   *pixman_region32_extents(clip));
+	box.x1 = CLIP(box.x1 - 1, 0, width - 1);
+	box.y1 = CLIP(box.y1 - 1, 0, height - 1);
+	box.x2 = CLIP(box.x2 + 1, box.x1 + 1, width);
+	box.y2 = CLIP(box.y2 + 1, box.y1 + 1, height);
+
+	/* The surface image may be drawn on other outputs at the same time */
+	view = pixman_image_create_bits_no_clear(pixman_image_get_format(src),
+						 width, height,
+						 pixman_image_get_data(src),
+						 pixman_image_get_stride(src));
+	abort_oom_if_null(view);
+
+	img = pixman_image_create_bits_no_clear(PIXMAN_rgba_float,
+						box.x2 - box.x1,
+						box.y2 - box.y1,
+						NULL, 0);
+	abort_oom_if_null(img);
+
+	pixman_image_composite32(PIXMAN_OP_SRC, view, NULL, img,
+				 box.x1, box.y1, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 box.x2 - box.x1, box.y2 - box.y1);
+	pixman_image_unref(view);
+
+	data = (float *)pixman_image_get_data(img);
+	stride = pixman_image_get_stride(img) / sizeof *data;
+	for (y = 0; y < box.y2 - box.y1; y++)
+		pixman_color_transform_apply(xform, data + y * stride,
+					     box.x2 - box.x1);
+
+	pixman_transform_translate(transform, NULL,
+				   pixman_int_to_fixed(-box.x1),
+				   pixman_int_to_fixed(-box.y1));
+	*dx = box.x1;
+	*dy = box.y1;
+
+	return img;
 }
 
 /** Paint an intersected region
  *
  * \param pnode The paint node to be painted.
+ * \param band The band to paint in.
  * \param repaint_output The region to be painted in output coordinates.
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
@@ -321,6 +518,7 @@ composite_clipped(struct weston_output *output,
  */
 static void
 repaint_region(struct weston_paint_node *pnode,
+	       struct pixman_band *band,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
@@ -329,21 +527,40 @@ repaint_region(struct weston_paint_node *pnode,
 	struct weston_view *ev = pnode->view;
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
-	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	struct pixman_surface_state *ps = ev->surface->renderer_state;
 	struct pixman_output_state *po = get_output_state(output);
+	const struct pixman_color_transform *xform = NULL;
+	pixman_region32_t clip;
+	pixman_region32_t color_source_clip;
+	pixman_image_t *src_image = ps->image;
 	pixman_image_t *target_image;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
+	int32_t dx, dy;
 
-	if (po->shadow_image)
-		target_image = po->shadow_image;
+	if (pnode->surf_xform.transform) {
+		xform = get_color_transform(pr, pnode->surf_xform.transform);
+		if (!xform) {
+			band->color_transform_failed = true;
+			return;
+		}
+	}
+
+	if (band->shadow_image)
+		target_image = band->shadow_image;
 	else
-		target_image = po->hw_buffer;
+		target_image = band->hw_buffer;
 
  	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(target_image, repaint_output);
+	pixman_region32_init(&clip);
+	pixman_region32_intersect(&clip, repaint_output, &band->clip);
+	if (!pixman_region32_not_empty(&clip)) {
+		pixman_region32_fini(&clip);
+		return;
+	}
+	pixman_image_set_clip_region32(target_image, &clip);
 
 	weston_matrix_to_pixman_transform(&transform,
 					  &pnode->output_to_buffer_matrix);
@@ -356,6 +573,22 @@ repaint_region(struct weston_paint_node *pnode,
 	if (ps->buffer_ref.buffer)
 		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
 
+	if (xform) {
+		src_image = color_source_create(pnode, xform, ps->image, &clip,
+						&transform, &dx, &dy);
+		if (source_clip && pixman_image_get_data(src_image)) {
+			pixman_region32_init(&color_source_clip);
+			pixman_region32_copy(&color_source_clip, source_clip);
+			pixman_region32_translate(&color_source_clip, -dx, -dy);
+			pixman_region32_intersect_rect(&color_source_clip,
+						       &color_source_clip, 0, 0,
+						       pixman_image_get_width(src_image),
+						       pixman_image_get_height(src_image));
+			source_clip = &color_source_clip;
+		}
+	}
+	pixman_region32_fini(&clip);
+
 	if (ev->alpha < 1.0) {
 		mask.alpha = 0xffff * ev->alpha;
 		mask_image = pixman_image_create_solid_fill(&mask);
@@ -364,15 +597,20 @@ repaint_region(struct weston_paint_node *pnode,
 	}
 
 	if (source_clip)
-		composite_clipped(output, ps->image, mask_image, target_image,
+		composite_clipped(band, src_image, mask_image, target_image,
 				  &transform, filter, source_clip);
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
+		composite_whole(pixman_op, src_image, mask_image,
 				target_image, &transform, filter);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
 
+	if (source_clip == &color_source_clip)
+		pixman_region32_fini(&color_source_clip);
+	if (src_image != ps->image)
+		pixman_image_unref(src_image);
+
 	if (ps->buffer_ref.buffer)
 		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
 
@@ -392,6 +630,7 @@ repaint_region(struct weston_paint_node *pnode,
 
 static void
 draw_node_translated(struct weston_paint_node *pnode,
+		     struct pixman_band *band,
 		     pixman_region32_t *repaint_global)
 {
 	struct weston_output *output = pnode->output;
@@ -424,7 +663,7 @@ draw_node_translated(struct weston_paint_node *pnode,
 						       output,
 						       &repaint_output);
 
-			repaint_region(pnode, &repaint_output, NULL,
+			repaint_region(pnode, band, &repaint_output, NULL,
 				       PIXMAN_OP_SRC);
 		}
 	}
@@ -437,7 +676,8 @@ draw_node_translated(struct weston_paint_node *pnode,
 					       output,
 					       &repaint_output);
 
-		repaint_region(pnode, &repaint_output, NULL, PIXMAN_OP_OVER);
+		repaint_region(pnode, band, &repaint_output, NULL,
+			       PIXMAN_OP_OVER);
 	}
 
 	pixman_region32_fini(&surface_blend);
@@ -446,6 +686,7 @@ draw_node_translated(struct weston_paint_node *pnode,
 
 static void
 draw_node_source_clipped(struct weston_paint_node *pnode,
+			 struct pixman_band *band,
 			 pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = pnode->surface;
@@ -474,7 +715,8 @@ draw_node_source_clipped(struct weston_paint_node *pnode,
 	weston_region_global_to_output(&repaint_output, output,
 				       &repaint_output);
 
-	repaint_region(pnode, &repaint_output, &buffer_region, PIXMAN_OP_OVER);
+	repaint_region(pnode, band, &repaint_output, &buffer_region,
+		       PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
 	pixman_region32_fini(&buffer_region);
@@ -483,33 +725,32 @@ draw_node_source_clipped(struct weston_paint_node *pnode,
 
 static void
 draw_paint_node(struct weston_paint_node *pnode,
+		struct pixman_band *band,
 		pixman_region32_t *damage /* in global coordinates */)
 {
-	struct pixman_surface_state *ps = get_surface_state(pnode->surface);
+	/* Not get_surface_state(): this may run on a repaint thread */
+	struct pixman_surface_state *ps = pnode->surface->renderer_state;
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
 
 	if (!pnode->surf_xform_valid)
 		return;
 
-	assert(pnode->surf_xform.transform == NULL);
-
 	/* No buffer attached */
-	if (!ps->image)
+	if (!ps || !ps->image)
 		return;
 
 	/* if we still have a reference, but the underlying buffer is no longer
-	 * available signal that we should unref image_t as well. This happens
+	 * available, the image points to nothing anymore. This happens
 	 * when using close animations, with the reference surviving the
 	 * animation while the underlying buffer went away as the client was
 	 * terminated. This is a particular use-case and should probably be
 	 * refactored to provide some analogue with the GL-renderer (as in, to
-	 * still maintain the buffer and let the compositor dispose of it). */
-	if (ps->buffer_ref.buffer && !ps->buffer_ref.buffer->shm_buffer) {
-		pixman_image_unref(ps->image);
-		ps->image = NULL;
+	 * still maintain the buffer and let the compositor dispose of it).
+	 * The image gets dropped on the next attach, not here: other outputs
+	 * may be drawing concurrently. */
+	if (ps->buffer_ref.buffer && !ps->buffer_ref.buffer->shm_buffer)
 		return;
-	}
 
 	pixman_region32_init(&repaint);
 	pixman_region32_intersect(&repaint,
@@ -526,7 +767,7 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_node_translated(pnode, &repaint);
+		draw_node_translated(pnode, band, &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -535,49 +776,365 @@ draw_paint_node(struct weston_paint_node *pnode,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_node_source_clipped(pnode, &repaint);
+		draw_node_source_clipped(pnode, band, &repaint);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct pixman_band *band, pixman_region32_t *damage)
 {
+	struct weston_output *output = band->output;
 	struct weston_paint_node *pnode;
 
 	wl_list_for_each_reverse(pnode, &output->paint_node_z_order_list,
 				 z_order_link) {
 		if (pnode->plane == &output->primary_plane)
-			draw_paint_node(pnode, damage);
+			draw_paint_node(pnode, band, damage);
 	}
 }
 
+/* Rows of the shadow to convert at a time */
+#define PIXMAN_COLOR_ROWS 16
+
+/** Copy a region of the float shadow through the blend-to-output transform
+ *
+ * \param band The band to copy in.
+ * \param region The region to copy, in output coordinates, inside the band.
+ *
+ * Whatever the alpha, the result is opaque, like from an XRGB8888 shadow.
+ */
 static void
-copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
+copy_to_hw_buffer_transformed(struct pixman_band *band,
+			      pixman_region32_t *region)
 {
-	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_output_state *po = get_output_state(band->output);
+	pixman_image_t *rows;
+	pixman_box32_t *boxes;
+	float *shadow, *data;
+	int shadow_stride, stride;
+	int n_box, i, y, r, n;
+
+	shadow = (float *)pixman_image_get_data(band->shadow_image);
+	shadow_stride = pixman_image_get_stride(band->shadow_image) /
+			sizeof *shadow;
+
+	rows = pixman_image_create_bits_no_clear(PIXMAN_rgba_float,
+						 po->fb_size.width,
+						 PIXMAN_COLOR_ROWS, NULL, 0);
+	abort_oom_if_null(rows);
+	data = (float *)pixman_image_get_data(rows);
+	stride = pixman_image_get_stride(rows) / sizeof *data;
+
+	boxes = pixman_region32_rectangles(region, &n_box);
+	for (i = 0; i < n_box; i++) {
+		int width = boxes[i].x2 - boxes[i].x1;
+
+		for (y = boxes[i].y1; y < boxes[i].y2; y += n) {
+			n = MIN(PIXMAN_COLOR_ROWS, boxes[i].y2 - y);
+
+			for (r = 0; r < n; r++) {
+				float *row = data + r * stride;
+				int x;
+
+				memcpy(row, shadow + (y + r) * shadow_stride +
+					    boxes[i].x1 * 4,
+				       width * 4 * sizeof *row);
+				pixman_color_transform_apply(band->blend_to_output,
+							     row, width);
+				for (x = 0; x < width; x++)
+					row[4 * x + 3] = 1.0f;
+			}
+
+			pixman_image_composite32(PIXMAN_OP_SRC,
+						 rows, /* src */
+						 NULL /* mask */,
+						 band->hw_buffer, /* dest */
+						 0, 0, /* src_x, src_y */
+						 0, 0, /* mask_x, mask_y */
+						 boxes[i].x1, y, /* dest_x, dest_y */
+						 width, n);
+		}
+	}
+
+	pixman_image_unref(rows);
+}
+
+static void
+copy_to_hw_buffer(struct pixman_band *band, pixman_region32_t *region)
+{
+	struct pixman_output_state *po = get_output_state(band->output);
 	pixman_region32_t output_region;
 
 	pixman_region32_init(&output_region);
 	pixman_region32_copy(&output_region, region);
 
-	weston_region_global_to_output(&output_region, output, &output_region);
+	weston_region_global_to_output(&output_region, band->output,
+				       &output_region);
+	pixman_region32_intersect(&output_region, &output_region, &band->clip);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
+	if (band->blend_to_output) {
+		copy_to_hw_buffer_transformed(band, &output_region);
+		pixman_region32_fini(&output_region);
+		return;
+	}
+
+	pixman_image_set_clip_region32 (band->hw_buffer, &output_region);
 	pixman_region32_fini(&output_region);
 
 	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
+				 band->shadow_image, /* src */
 				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
+				 band->hw_buffer, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
 				 po->fb_size.width, /* width */
 				 po->fb_size.height /* height */);
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	pixman_image_set_clip_region32 (band->hw_buffer, NULL);
+}
+
+static void
+draw_band(struct pixman_band *band)
+{
+	if (band->damage)
+		repaint_surfaces(band, band->damage);
+	if (band->hw_damage)
+		copy_to_hw_buffer(band, band->hw_damage);
+}
+
+static void *
+band_pool_thread(void *data)
+{
+	struct pixman_band_pool *pool = data;
+	struct pixman_band *band;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && wl_list_empty(&pool->queue))
+			pthread_cond_wait(&pool->job_cond, &pool->mutex);
+		if (pool->quit)
+			break;
+
+		band = container_of(pool->queue.next, struct pixman_band, link);
+		wl_list_remove(&band->link);
+		pthread_mutex_unlock(&pool->mutex);
+
+		draw_band(band);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--band->batch->pending == 0)
+			pthread_cond_broadcast(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void
+band_pool_destroy(struct pixman_band_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+static struct pixman_band_pool *
+band_pool_create(int thread_count)
+{
+	struct pixman_band_pool *pool;
+	int i;
+
+	pool = xzalloc(sizeof *pool);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	wl_list_init(&pool->queue);
+
+	pool->threads = xcalloc(thread_count, sizeof *pool->threads);
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   band_pool_thread, pool) != 0)
+			break;
+	}
+	pool->thread_count = i;
+
+	if (pool->thread_count == 0) {
+		weston_log("Error: could not start any Pixman renderer "
+			   "thread.\n");
+		band_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/* Bands get their own view of the output images, to clip them */
+static pixman_image_t *
+band_image_create(pixman_image_t *image)
+{
+	pixman_image_t *band_image;
+
+	band_image =
+		pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						  pixman_image_get_width(image),
+						  pixman_image_get_height(image),
+						  pixman_image_get_data(image),
+						  pixman_image_get_stride(image));
+	abort_oom_if_null(band_image);
+
+	return band_image;
+}
+
+/* How many bands to split the damage into, 1 when not worth it */
+static int
+band_count(struct weston_output *output, struct pixman_band_pool *pool,
+	   pixman_region32_t *damage, pixman_region32_t *hw_damage,
+	   int32_t *y1, int32_t *y2)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	pixman_region32_t output_damage;
+	pixman_box32_t *extents;
+	int rows;
+
+	if (!pool)
+		return 1;
+
+	pixman_region32_init(&output_damage);
+	if (damage)
+		pixman_region32_union(&output_damage, &output_damage, damage);
+	if (hw_damage)
+		pixman_region32_union(&output_damage, &output_damage,
+				      hw_damage);
+	weston_region_global_to_output(&output_damage, output,
+				       &output_damage);
+	extents = pixman_region32_extents(&output_damage);
+	*y1 = MAX(extents->y1, 0);
+	*y2 = MIN(extents->y2, po->fb_size.height);
+	pixman_region32_fini(&output_damage);
+
+	rows = *y2 - *y1;
+	if (rows <= 0)
+		return 1;
+
+	return MAX(1, MIN(pool->thread_count + 1, rows / PIXMAN_BAND_MIN_ROWS));
+}
+
+/** Repaints and/or copies to the hardware buffer, banded if possible
+ *
+ * \param output The output to draw.
+ * \param damage What to repaint in global coordinates, or NULL.
+ * \param hw_damage What to copy from the shadow to the hardware buffer in
+ * global coordinates, or NULL.
+ *
+ * The rows of the damage are split evenly between the band threads, with
+ * the calling thread drawing the first band. Bands do not overlap, and all
+ * have been drawn once this returns, so the result is the same as drawing
+ * everything at once.
+ */
+static void
+draw_output(struct weston_output *output,
+	    pixman_region32_t *damage, pixman_region32_t *hw_damage)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_band_pool *pool = pr->band_pool;
+	struct pixman_band_batch batch = { 0 };
+	const struct pixman_color_transform *blend_to_output = NULL;
+	struct pixman_band *bands;
+	int32_t y1 = 0, y2 = 0;
+	int n, i;
+
+	if (hw_damage && output_needs_blend_to_output(output)) {
+		blend_to_output =
+			get_color_transform(pr,
+					    output->color_outcome->from_blend_to_output);
+		if (!blend_to_output) {
+			po->color_transform_failed = true;
+			hw_damage = NULL;
+		}
+	}
+
+	n = band_count(output, pool, damage, hw_damage, &y1, &y2);
+	bands = xcalloc(n, sizeof *bands);
+
+	for (i = 0; i < n; i++) {
+		struct pixman_band *band = &bands[i];
+		/* The first and last band reach the framebuffer edges, so
+		 * that the bands cover what an unbanded repaint would. */
+		int32_t top = i == 0 ? 0 : y1 + (y2 - y1) * i / n;
+		int32_t bottom = i == n - 1 ?
+			po->fb_size.height : y1 + (y2 - y1) * (i + 1) / n;
+
+		band->output = output;
+		pixman_region32_init_rect(&band->clip, 0, top,
+					  po->fb_size.width, bottom - top);
+		band->damage = damage;
+		band->hw_damage = hw_damage;
+		band->blend_to_output = blend_to_output;
+		band->batch = &batch;
+
+		if (n == 1) {
+			band->shadow_image = po->shadow_image;
+			band->hw_buffer = po->hw_buffer;
+			continue;
+		}
+
+		if (po->shadow_image)
+			band->shadow_image = band_image_create(po->shadow_image);
+		band->hw_buffer = band_image_create(po->hw_buffer);
+	}
+
+	if (n > 1) {
+		pthread_mutex_lock(&pool->mutex);
+		for (i = 1; i < n; i++)
+			wl_list_insert(pool->queue.prev, &bands[i].link);
+		batch.pending = n - 1;
+		pthread_cond_broadcast(&pool->job_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	draw_band(&bands[0]);
+
+	if (n > 1) {
+		pthread_mutex_lock(&pool->mutex);
+		while (batch.pending > 0)
+			pthread_cond_wait(&pool->done_cond, &pool->mutex);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct pixman_band *band = &bands[i];
+
+		po->overdraw = MAX(po->overdraw, band->overdraw);
+		if (band->color_transform_failed)
+			po->color_transform_failed = true;
+		pixman_region32_fini(&band->clip);
+		if (n == 1)
+			continue;
+
+		if (band->shadow_image)
+			pixman_image_unref(band->shadow_image);
+		pixman_image_unref(band->hw_buffer);
+	}
+	free(bands);
 }
 
 static void
@@ -655,8 +1212,7 @@ pixman_renderer_repaint_output(struct weston_output *output,
 
 	pixman_renderer_output_set_buffer(output, rb->image);
 
-	assert(output->from_blend_to_output_by_backend ||
-	       output->color_outcome->from_blend_to_output == NULL);
+	assert(!output_needs_blend_to_output(output) || po->shadow_float);
 
 	if (!po->hw_buffer)
  		return;
@@ -668,14 +1224,18 @@ pixman_renderer_repaint_output(struct weston_output *output,
 				      output_damage);
 	}
 
-	if (po->shadow_image) {
-		repaint_surfaces(output, output_damage);
+	if (po->shadow_format &&
+	    weston_output_has_renderer_capture_tasks(output)) {
+		draw_output(output, output_damage, NULL);
 		pixman_renderer_do_capture_tasks(output,
 						 WESTON_OUTPUT_CAPTURE_SOURCE_BLENDING,
 						 po->shadow_image, po->shadow_format);
-		copy_to_hw_buffer(output, &renderbuffer->damage);
+		draw_output(output, NULL, &renderbuffer->damage);
+	} else if (po->shadow_image) {
+		/* Each band copies what it just drew */
+		draw_output(output, output_damage, &renderbuffer->damage);
 	} else {
-		repaint_surfaces(output, &renderbuffer->damage);
+		draw_output(output, &renderbuffer->damage, NULL);
 	}
 	pixman_renderer_do_capture_tasks(output,
 					 WESTON_OUTPUT_CAPTURE_SOURCE_FRAMEBUFFER,
@@ -687,6 +1247,27 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	/* Actual flip should be done by caller */
 }
 
+static void
+pixman_renderer_repaint_output_done(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (!po)
+		return;
+
+	if (po->overdraw > 1) {
+		weston_log_paced(&output->pixman_overdraw_pacer, 1, 0,
+				 "Pixman-renderer warning: %dx overdraw\n",
+				 po->overdraw);
+	}
+	if (po->color_transform_failed)
+		weston_log("Pixman renderer: failed to realize a color "
+			   "transformation.\n");
+
+	po->overdraw = 0;
+	po->color_transform_failed = false;
+}
+
 static void
 pixman_renderer_flush_damage(struct weston_paint_node *pnode)
 {
@@ -885,6 +1466,8 @@ pixman_renderer_destroy(struct weston_compositor *ec)
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+	band_pool_destroy(pr->band_pool);
+	pthread_mutex_destroy(&pr->color_mutex);
 	free(pr);
 
 	ec->renderer = NULL;
@@ -983,12 +1566,23 @@ pixman_renderer_resize_output(struct weston_output *output,
 						  po->hw_format);
 	}
 
+	if (po->shadow_image) {
+		pixman_image_unref(po->shadow_image);
+		po->shadow_image = NULL;
+	}
+
+	if (po->shadow_float) {
+		/* Cleared, as NaN garbage would survive blending */
+		po->shadow_image =
+			pixman_image_create_bits(PIXMAN_rgba_float,
+						 fb_size->width, fb_size->height,
+						 NULL, 0);
+		return !!po->shadow_image;
+	}
+
 	if (!po->shadow_format)
 		return true;
 
-	if (po->shadow_image)
-		pixman_image_unref(po->shadow_image);
-
 	po->shadow_image =
 		pixman_image_create_bits_no_clear(po->shadow_format->pixman_format,
 						  fb_size->width, fb_size->height,
@@ -1048,15 +1642,29 @@ pixman_renderer_init(struct weston_compositor *ec)
 	renderer->base.surface_copy_content =
 		pixman_renderer_surface_copy_content;
 	renderer->base.type = WESTON_RENDERER_PIXMAN;
+	renderer->base.threaded_repaint = true;
+	renderer->base.repaint_output_done =
+		pixman_renderer_repaint_output_done;
 	renderer->base.pixman = &pixman_renderer_interface;
 	ec->renderer = &renderer->base;
 	ec->capabilities |= WESTON_CAP_ROTATION_ANY;
 	ec->capabilities |= WESTON_CAP_VIEW_CLIP_MASK;
+	ec->capabilities |= WESTON_CAP_COLOR_OPS;
 
 	renderer->debug_binding =
 		weston_compositor_add_debug_binding(ec, KEY_R,
 						    debug_binding, ec);
 
+	pthread_mutex_init(&renderer->color_mutex, NULL);
+
+	if (ec->renderer_threads > 0) {
+		renderer->band_pool = band_pool_create(ec->renderer_threads);
+		if (renderer->band_pool)
+			weston_log("Pixman renderer drawing in bands on %d "
+				   "extra threads.\n",
+				   renderer->band_pool->thread_count);
+	}
+
 	info_argb8888 = pixel_format_get_info_shm(WL_SHM_FORMAT_ARGB8888);
 	info_xrgb8888 = pixel_format_get_info_shm(WL_SHM_FORMAT_XRGB8888);
 
@@ -1132,7 +1740,11 @@ pixman_renderer_output_create(struct weston_output *output,
 
 	output->renderer_state = po;
 
-	if (options->use_shadow)
+	/* Blending happens in a linear color space then, which needs
+	 * more precision than 8 bits. */
+	if (output_needs_blend_to_output(output))
+		po->shadow_float = true;
+	else if (options->use_shadow)
 		po->shadow_format = pixel_format_get_info(DRM_FORMAT_XRGB8888);
 
 	wl_list_init(&po->renderbuffer_list);
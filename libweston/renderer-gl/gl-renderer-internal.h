@@ -141,6 +141,7 @@ static_assert(sizeof(struct gl_shader_requirements) ==
 	      "struct gl_shader_requirements must not contain implicit padding");
 
 struct gl_shader;
+struct gl_program_cache;
 struct weston_color_transform;
 struct dmabuf_allocator;
 
@@ -262,6 +263,11 @@ struct gl_renderer {
 	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
 	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
 
+	/* Ring of pixel unpack buffers staging wl_shm uploads */
+	GLuint upload_pbo[3];
+	GLsizeiptr upload_pbo_size[3];
+	unsigned int upload_pbo_next;
+
 	struct wl_list pending_capture_list;
 
 	struct gl_shader *current_shader;
@@ -304,6 +310,11 @@ struct gl_renderer {
 	struct wl_list shader_list;
 	struct weston_log_scope *shader_scope;
 
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+	/* On-disk program binaries, NULL when disabled */
+	struct gl_program_cache *program_cache;
+
 	struct dmabuf_allocator *allocator;
 };
 
@@ -356,6 +367,15 @@ gl_renderer_create_fallback_shader(struct gl_renderer *gr);
 void
 gl_renderer_garbage_collect_programs(struct gl_renderer *gr);
 
+struct gl_program_cache *
+gl_program_cache_create(struct gl_renderer *gr);
+
+void
+gl_program_cache_destroy(struct gl_program_cache *cache);
+
+void
+gl_renderer_prewarm_programs(struct gl_renderer *gr);
+
 bool
 gl_renderer_use_program(struct gl_renderer *gr,
 			const struct gl_shader_config *sconf);
@@ -223,6 +223,7 @@ struct gl_buffer_state {
 	GLenum gl_format[3];
 	enum gl_channel_order gl_channel_order;
 	int offset[3]; /* per-plane pitch in bytes */
+	int cpp[3]; /* per-plane bytes per texel */
 
 	EGLImageKHR images[3];
 	int num_images;
@@ -2525,6 +2526,192 @@ gl_format_from_internal(GLenum internal_format)
 	}
 }
 
+/* Uploads straight from the wl_shm_buffer, the driver copies the data
+ * before returning. */
+static void
+gl_renderer_upload_shm_direct(struct gl_buffer_state *gb,
+			      struct weston_buffer *buffer,
+			      const pixman_box32_t *boxes, int n_boxes,
+			      bool full)
+{
+	uint8_t *data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	int i, j;
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (i = 0; i < n_boxes; i++) {
+		pixman_box32_t r = boxes[i];
+
+		for (j = 0; j < gb->num_textures; j++) {
+			int hsub = pixel_format_hsub(buffer->pixel_format, j);
+			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+
+			glBindTexture(GL_TEXTURE_2D, gb->textures[j]);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
+				      gb->pitch / hsub);
+
+			if (full) {
+				glTexImage2D(GL_TEXTURE_2D, 0,
+					     gb->gl_format[j],
+					     buffer->width / hsub,
+					     buffer->height / vsub,
+					     0,
+					     gl_format_from_internal(gb->gl_format[j]),
+					     gb->gl_pixel_type,
+					     data + gb->offset[j]);
+				continue;
+			}
+
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1 / hsub);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1 / vsub);
+			glTexSubImage2D(GL_TEXTURE_2D, 0,
+					r.x1 / hsub,
+					r.y1 / vsub,
+					(r.x2 - r.x1) / hsub,
+					(r.y2 - r.y1) / vsub,
+					gl_format_from_internal(gb->gl_format[j]),
+					gb->gl_pixel_type,
+					data + gb->offset[j]);
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+}
+
+/* Size of one box of one plane, tightly packed in a staging buffer */
+static GLsizeiptr
+shm_upload_chunk_size(struct gl_buffer_state *gb,
+		      struct weston_buffer *buffer,
+		      const pixman_box32_t *r, int plane)
+{
+	int hsub = pixel_format_hsub(buffer->pixel_format, plane);
+	int vsub = pixel_format_vsub(buffer->pixel_format, plane);
+	GLsizeiptr size;
+
+	size = (GLsizeiptr) ((r->x2 - r->x1) / hsub) * gb->cpp[plane] *
+	       ((r->y2 - r->y1) / vsub);
+
+	/* Keep every chunk suitably aligned for any pixel type */
+	return ROUND_UP_N(size, 16);
+}
+
+/** Uploads through the next pixel unpack buffer of the ring
+ *
+ * All the boxes of all the planes get copied into one staging buffer, then
+ * the textures get updated from it. The GPU fetches the data whenever it
+ * gets to it, and the wl_shm_buffer is not needed anymore after this.
+ *
+ * \return false if the staging buffer could not be mapped, nothing got
+ * uploaded then.
+ */
+static bool
+gl_renderer_upload_shm_pbo(struct gl_renderer *gr,
+			   struct gl_buffer_state *gb,
+			   struct weston_buffer *buffer,
+			   const pixman_box32_t *boxes, int n_boxes,
+			   bool full)
+{
+	uint8_t *data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	unsigned int slot = gr->upload_pbo_next;
+	GLsizeiptr size = 0;
+	GLintptr offset;
+	uint8_t *dst;
+	int i, j, y;
+
+	for (i = 0; i < n_boxes; i++)
+		for (j = 0; j < gb->num_textures; j++)
+			size += shm_upload_chunk_size(gb, buffer, &boxes[i], j);
+
+	if (size == 0)
+		return true;
+
+	gr->upload_pbo_next = (slot + 1) % ARRAY_LENGTH(gr->upload_pbo);
+	if (gr->upload_pbo[slot] == 0)
+		glGenBuffers(1, &gr->upload_pbo[slot]);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gr->upload_pbo[slot]);
+	if (size > gr->upload_pbo_size[slot]) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL,
+			     GL_STREAM_DRAW);
+		gr->upload_pbo_size[slot] = size;
+	}
+
+	/* Invalidating lets the driver hand out fresh storage rather than
+	 * wait for the GPU to be done with a previous upload. */
+	dst = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0, size,
+				   GL_MAP_WRITE_BIT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	offset = 0;
+	for (i = 0; i < n_boxes; i++) {
+		const pixman_box32_t *r = &boxes[i];
+
+		for (j = 0; j < gb->num_textures; j++) {
+			int hsub = pixel_format_hsub(buffer->pixel_format, j);
+			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+			size_t stride = (size_t) (gb->pitch / hsub) * gb->cpp[j];
+			size_t row = (size_t) ((r->x2 - r->x1) / hsub) *
+				     gb->cpp[j];
+			const uint8_t *src = data + gb->offset[j] +
+					     (r->y1 / vsub) * stride +
+					     (r->x1 / hsub) * gb->cpp[j];
+
+			for (y = 0; y < (r->y2 - r->y1) / vsub; y++)
+				memcpy(dst + offset + y * row,
+				       src + y * stride, row);
+
+			offset += shm_upload_chunk_size(gb, buffer, r, j);
+		}
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	offset = 0;
+	for (i = 0; i < n_boxes; i++) {
+		const pixman_box32_t *r = &boxes[i];
+
+		for (j = 0; j < gb->num_textures; j++) {
+			int hsub = pixel_format_hsub(buffer->pixel_format, j);
+			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+
+			glBindTexture(GL_TEXTURE_2D, gb->textures[j]);
+			if (full) {
+				glTexImage2D(GL_TEXTURE_2D, 0,
+					     gb->gl_format[j],
+					     buffer->width / hsub,
+					     buffer->height / vsub,
+					     0,
+					     gl_format_from_internal(gb->gl_format[j]),
+					     gb->gl_pixel_type,
+					     (void *) offset);
+			} else {
+				glTexSubImage2D(GL_TEXTURE_2D, 0,
+						r->x1 / hsub,
+						r->y1 / vsub,
+						(r->x2 - r->x1) / hsub,
+						(r->y2 - r->y1) / vsub,
+						gl_format_from_internal(gb->gl_format[j]),
+						gb->gl_pixel_type,
+						(void *) offset);
+			}
+
+			offset += shm_upload_chunk_size(gb, buffer, r, j);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	return true;
+}
+
 static void
 gl_renderer_flush_damage(struct weston_paint_node *pnode)
 {
@@ -2534,9 +2721,12 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 	struct weston_buffer *buffer = surface->buffer_ref.buffer;
 	struct gl_surface_state *gs = get_surface_state(surface);
 	struct gl_buffer_state *gb = gs->buffer;
+	struct gl_renderer *gr = get_renderer(surface->compositor);
 	pixman_box32_t *rectangles;
-	uint8_t *data;
-	int i, j, n;
+	pixman_box32_t *boxes;
+	pixman_box32_t whole;
+	bool full;
+	int i, n;
 
 	assert(buffer && gb);
 
@@ -2556,58 +2746,31 @@ gl_renderer_flush_damage(struct weston_paint_node *pnode)
 	    !gb->needs_full_upload)
 		goto done;
 
-	data = wl_shm_buffer_get_data(buffer->shm_buffer);
-
-	if (gb->needs_full_upload || quirks->gl_force_full_upload) {
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-
-		for (j = 0; j < gb->num_textures; j++) {
-			int hsub = pixel_format_hsub(buffer->pixel_format, j);
-			int vsub = pixel_format_vsub(buffer->pixel_format, j);
-
-			glBindTexture(GL_TEXTURE_2D, gb->textures[j]);
-			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
-				      gb->pitch / hsub);
-			glTexImage2D(GL_TEXTURE_2D, 0,
-				     gb->gl_format[j],
-				     buffer->width / hsub,
-				     buffer->height / vsub,
-				     0,
-				     gl_format_from_internal(gb->gl_format[j]),
-				     gb->gl_pixel_type,
-				     data + gb->offset[j]);
-		}
-		wl_shm_buffer_end_access(buffer->shm_buffer);
-		goto done;
+	full = gb->needs_full_upload || quirks->gl_force_full_upload;
+	if (full) {
+		whole = (pixman_box32_t) { 0, 0, buffer->width, buffer->height };
+		boxes = &whole;
+		n = 1;
+	} else {
+		rectangles = pixman_region32_rectangles(&gb->texture_damage, &n);
+		boxes = xcalloc(n, sizeof *boxes);
+		for (i = 0; i < n; i++)
+			boxes[i] = weston_surface_to_buffer_rect(surface,
+								 rectangles[i]);
 	}
 
-	rectangles = pixman_region32_rectangles(&gb->texture_damage, &n);
-	wl_shm_buffer_begin_access(buffer->shm_buffer);
-	for (i = 0; i < n; i++) {
-		pixman_box32_t r;
+	TL_POINT(surface->compositor, "renderer_shm_upload_begin",
+		 TLP_SURFACE(surface), TLP_END);
 
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+	if (!gr->has_pbo ||
+	    !gl_renderer_upload_shm_pbo(gr, gb, buffer, boxes, n, full))
+		gl_renderer_upload_shm_direct(gb, buffer, boxes, n, full);
 
-		for (j = 0; j < gb->num_textures; j++) {
-			int hsub = pixel_format_hsub(buffer->pixel_format, j);
-			int vsub = pixel_format_vsub(buffer->pixel_format, j);
+	TL_POINT(surface->compositor, "renderer_shm_upload_end",
+		 TLP_SURFACE(surface), TLP_END);
 
-			glBindTexture(GL_TEXTURE_2D, gb->textures[j]);
-			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT,
-				      gb->pitch / hsub);
-			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1 / hsub);
-			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1 / vsub);
-			glTexSubImage2D(GL_TEXTURE_2D, 0,
-					r.x1 / hsub,
-					r.y1 / vsub,
-					(r.x2 - r.x1) / hsub,
-					(r.y2 - r.y1) / vsub,
-					gl_format_from_internal(gb->gl_format[j]),
-					gb->gl_pixel_type,
-					data + gb->offset[j]);
-		}
-	}
-	wl_shm_buffer_end_access(buffer->shm_buffer);
+	if (boxes != &whole)
+		free(boxes);
 
 done:
 	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
@@ -2618,6 +2781,8 @@ done:
 	pixman_region32_init(&gb->texture_damage);
 	gb->needs_full_upload = false;
 
+	/* Whichever way it went, the data has been copied out of the
+	 * client's buffer already, so it can be released right away. */
 	weston_buffer_reference(&gs->buffer_ref, buffer,
 				BUFFER_WILL_NOT_BE_ACCESSED);
 	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
@@ -2682,6 +2847,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	enum gl_shader_texture_variant shader_variant;
 	int pitch;
 	int offset[3] = { 0, 0, 0 };
+	int cpp[3] = { 0, 0, 0 };
 	unsigned int num_planes;
 	unsigned int i;
 	bool using_glesv2 = gr->gl_version < gr_gl_version(3, 0);
@@ -2741,6 +2907,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 
 			gl_format[out] = sub_info->gl_format;
 			offset[out] = shm_offset[yuv->plane[out].plane_index];
+			cpp[out] = sub_info->bpp / 8;
 		}
 	} else {
 		int bpp = buffer->pixel_format->bpp;
@@ -2755,6 +2922,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 
 		assert(bpp > 0 && !(bpp & 7));
 		pitch = buffer->stride / (bpp / 8);
+		cpp[0] = bpp / 8;
 
 		gl_format[0] = buffer->pixel_format->gl_format;
 		gl_pixel_type = buffer->pixel_format->gl_type;
@@ -2812,6 +2980,7 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer)
 	gb->pitch = pitch;
 	gb->shader_variant = shader_variant;
 	ARRAY_COPY(gb->offset, offset);
+	ARRAY_COPY(gb->cpp, cpp);
 	ARRAY_COPY(gb->gl_format, gl_format);
 	gb->gl_channel_order = buffer->pixel_format->gl_channel_order;
 	gb->gl_pixel_type = gl_pixel_type;
@@ -4425,10 +4594,13 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	gl_renderer_shader_list_destroy(gr);
 	if (gr->fallback_shader)
 		gl_shader_destroy(gr, gr->fallback_shader);
+	gl_program_cache_destroy(gr->program_cache);
 
 	if (gr->wireframe_size)
 		glDeleteTextures(1, &gr->wireframe_tex);
 
+	glDeleteBuffers(ARRAY_LENGTH(gr->upload_pbo), gr->upload_pbo);
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -4901,6 +5073,20 @@ gl_renderer_setup(struct weston_compositor *ec)
 			   "missing GL_EXT_disjoint_timer_query extension\n");
 	}
 
+	if (gr->gl_version >= gr_gl_version(3, 0)) {
+		gr->get_program_binary =
+			(void *) eglGetProcAddress("glGetProgramBinary");
+		gr->program_binary =
+			(void *) eglGetProcAddress("glProgramBinary");
+	} else if (weston_check_egl_extension(extensions,
+					      "GL_OES_get_program_binary")) {
+		gr->get_program_binary =
+			(void *) eglGetProcAddress("glGetProgramBinaryOES");
+		gr->program_binary =
+			(void *) eglGetProcAddress("glProgramBinaryOES");
+	}
+	gr->program_cache = gl_program_cache_create(gr);
+
 	glActiveTexture(GL_TEXTURE0);
 
 	gr->fallback_shader = gl_renderer_create_fallback_shader(gr);
@@ -4909,6 +5095,8 @@ gl_renderer_setup(struct weston_compositor *ec)
 		return -1;
 	}
 
+	gl_renderer_prewarm_programs(gr);
+
 	gr->debug_mode_binding =
 		weston_compositor_add_debug_binding(ec, KEY_M,
 						    debug_mode_binding, ec);
@@ -4922,6 +5110,10 @@ gl_renderer_setup(struct weston_compositor *ec)
 			    yesno(gr->has_pack_reverse));
 	weston_log_continue(STAMP_SPACE "glReadPixels supports PBO: %s\n",
 			    yesno(gr->has_pbo));
+	weston_log_continue(STAMP_SPACE "wl_shm uploads through PBO: %s\n",
+			    yesno(gr->has_pbo));
+	weston_log_continue(STAMP_SPACE "program binary cache: %s\n",
+			    yesno(gr->program_cache != NULL));
 	weston_log_continue(STAMP_SPACE "wl_shm 10 bpc formats: %s\n",
 			    yesno(gr->has_texture_type_2_10_10_10_rev));
 	weston_log_continue(STAMP_SPACE "wl_shm 16 bpc formats: %s\n",
@@ -30,9 +30,17 @@
 
 #include "config.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <libweston/libweston.h>
 #include <libweston/weston-log.h>
@@ -43,8 +51,11 @@
 
 #include "gl-renderer.h"
 #include "gl-renderer-internal.h"
+#include "git-version.h"
 #include "pixel-formats.h"
+#include "shared/string-helpers.h"
 #include "shared/timespec-util.h"
+#include "shared/xalloc.h"
 
 /* static const char vertex_shader[]; vertex.glsl */
 #include "vertex-shader.h"
@@ -94,6 +105,50 @@ struct gl_shader {
 	} color_post_curve;
 };
 
+/*
+ * Program binaries are kept on disk under $XDG_CACHE_HOME/weston/gl-programs,
+ * one file per struct gl_shader_requirements, so that programs do not need
+ * compiling again on the next start. Each build id, hashing the weston
+ * build, the GL implementation strings and the shader sources, gets a
+ * directory of its own: compositors on other GPUs or drivers may share the
+ * cache. Directories of other build ids are only removed once unused for
+ * GL_PROGRAM_CACHE_MAX_AGE.
+ */
+
+#define GL_PROGRAM_CACHE_MAGIC 0x42504757 /* "WGPB" */
+#define GL_PROGRAM_CACHE_MAX_AGE (30 * 24 * 60 * 60) /* seconds */
+
+struct gl_program_cache_header {
+	uint32_t magic;
+	uint32_t binary_format;
+	uint32_t length;
+	struct gl_shader_requirements key;
+	uint64_t build_id;
+};
+static_assert(sizeof(struct gl_program_cache_header) == 24,
+	      "struct gl_program_cache_header must not contain padding");
+
+struct gl_program_cache_entry {
+	struct wl_list link; /* gl_program_cache::entry_list */
+	struct gl_shader_requirements key;
+	GLenum binary_format;
+	GLsizei length;
+	void *binary;
+};
+
+struct gl_program_cache {
+	char *base_dir;
+	char *dir; /* base_dir/build id */
+	uint64_t build_id;
+	struct wl_list entry_list; /* gl_program_cache_entry::link */
+	bool prewarm;
+
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int rejected;
+	unsigned int stored;
+};
+
 static const char *
 gl_shader_texcoord_input_to_string(enum gl_shader_texcoord_input kind)
 {
@@ -299,6 +354,454 @@ create_fragment_shader_config_string(const struct gl_shader_requirements *req)
 	return str;
 }
 
+static int
+gl_shader_requirements_cmp(const struct gl_shader_requirements *a,
+			   const struct gl_shader_requirements *b)
+{
+	return memcmp(a, b, sizeof(*a));
+}
+
+static uint64_t
+hash_fnv1a(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static uint64_t
+hash_string(uint64_t hash, const char *str)
+{
+	if (!str)
+		str = "";
+
+	/* Include the terminator, to separate consecutive strings */
+	return hash_fnv1a(hash, str, strlen(str) + 1);
+}
+
+static uint32_t
+gl_shader_requirements_to_u32(const struct gl_shader_requirements *key)
+{
+	uint32_t v;
+
+	memcpy(&v, key, sizeof v);
+	return v;
+}
+
+static char *
+gl_program_cache_file_name(struct gl_program_cache *cache,
+			   const struct gl_shader_requirements *key,
+			   const char *suffix)
+{
+	char *name;
+
+	str_printf(&name, "%s/%08" PRIx32 ".bin%s",
+		   cache->dir, gl_shader_requirements_to_u32(key), suffix);
+	abort_oom_if_null(name);
+
+	return name;
+}
+
+static struct gl_program_cache_entry *
+gl_program_cache_find(struct gl_program_cache *cache,
+		      const struct gl_shader_requirements *key)
+{
+	struct gl_program_cache_entry *entry;
+
+	wl_list_for_each(entry, &cache->entry_list, link) {
+		if (gl_shader_requirements_cmp(&entry->key, key) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void
+gl_program_cache_entry_destroy(struct gl_program_cache_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	free(entry->binary);
+	free(entry);
+}
+
+/* Reads one cache file, returns false if it is not valid */
+static bool
+gl_program_cache_read(struct gl_program_cache *cache, int dirfd,
+		      const char *name)
+{
+	struct gl_program_cache_header header;
+	struct gl_program_cache_entry *entry;
+	struct stat st;
+	FILE *fp;
+	int fd;
+
+	fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	fp = fdopen(fd, "rb");
+	if (!fp) {
+		close(fd);
+		return false;
+	}
+
+	if (fstat(fd, &st) < 0 ||
+	    fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != GL_PROGRAM_CACHE_MAGIC ||
+	    header.build_id != cache->build_id ||
+	    header.key.pad_bits_ != 0 ||
+	    header.length == 0 ||
+	    (off_t) (sizeof header + header.length) != st.st_size ||
+	    gl_program_cache_find(cache, &header.key)) {
+		fclose(fp);
+		return false;
+	}
+
+	entry = xzalloc(sizeof *entry);
+	entry->key = header.key;
+	entry->binary_format = header.binary_format;
+	entry->length = header.length;
+	entry->binary = xmalloc(header.length);
+	if (fread(entry->binary, header.length, 1, fp) != 1) {
+		free(entry->binary);
+		free(entry);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	wl_list_insert(cache->entry_list.prev, &entry->link);
+
+	return true;
+}
+
+/* Loads the files of our build id, removing the ones that do not hold
+ * a program for it */
+static void
+gl_program_cache_scan(struct gl_program_cache *cache)
+{
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(cache->dir);
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir))) {
+		uint32_t key;
+		int n = 0;
+
+		if (sscanf(de->d_name, "%8" SCNx32 ".bin%n", &key, &n) != 1 ||
+		    n == 0 || de->d_name[n] != '\0')
+			continue;
+
+		if (!gl_program_cache_read(cache, dirfd(dir), de->d_name))
+			unlinkat(dirfd(dir), de->d_name, 0);
+	}
+
+	closedir(dir);
+}
+
+/* Removes the directories of other build ids that went unused for long.
+ * Opening a cache refreshes the time of its directory. */
+static void
+gl_program_cache_prune(struct gl_program_cache *cache)
+{
+	struct dirent *de, *file;
+	struct stat st;
+	DIR *dir, *sub;
+	time_t now = time(NULL);
+	uint64_t build_id;
+	int fd, n;
+
+	dir = opendir(cache->base_dir);
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir))) {
+		n = 0;
+		if (sscanf(de->d_name, "%16" SCNx64 "%n", &build_id, &n) != 1 ||
+		    n != 16 || de->d_name[n] != '\0' ||
+		    build_id == cache->build_id)
+			continue;
+
+		if (fstatat(dirfd(dir), de->d_name, &st,
+			    AT_SYMLINK_NOFOLLOW) < 0 ||
+		    !S_ISDIR(st.st_mode) ||
+		    now - st.st_mtime < GL_PROGRAM_CACHE_MAX_AGE)
+			continue;
+
+		fd = openat(dirfd(dir), de->d_name,
+			    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		sub = fdopendir(fd);
+		if (!sub) {
+			close(fd);
+			continue;
+		}
+
+		while ((file = readdir(sub))) {
+			if (strcmp(file->d_name, ".") != 0 &&
+			    strcmp(file->d_name, "..") != 0)
+				unlinkat(dirfd(sub), file->d_name, 0);
+		}
+		closedir(sub);
+
+		unlinkat(dirfd(dir), de->d_name, AT_REMOVEDIR);
+	}
+
+	closedir(dir);
+}
+
+static char *
+gl_program_cache_get_dir(void)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	char *dir = NULL;
+
+	if (base && base[0] == '/') {
+		str_printf(&dir, "%s/weston/gl-programs", base);
+	} else {
+		base = getenv("HOME");
+		if (base && base[0] == '/')
+			str_printf(&dir, "%s/.cache/weston/gl-programs", base);
+	}
+
+	return dir;
+}
+
+/* Like mkdir -p */
+static bool
+make_dirs(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			*p = '/';
+			return false;
+		}
+		*p = '/';
+	}
+
+	return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+/** Opens the program binary cache
+ *
+ * Needs a current context. Setting WESTON_GL_PROGRAM_CACHE=0 in the
+ * environment disables the cache, and WESTON_GL_PROGRAM_CACHE=prewarm makes
+ * gl_renderer_prewarm_programs() create every cached program at start-up.
+ *
+ * \return The cache, or NULL if disabled or not supported.
+ */
+struct gl_program_cache *
+gl_program_cache_create(struct gl_renderer *gr)
+{
+	const char *env = getenv("WESTON_GL_PROGRAM_CACHE");
+	struct gl_program_cache *cache;
+	GLint num_formats = 0;
+	uint64_t build_id = 0xcbf29ce484222325ull;
+	size_t key_size = sizeof(struct gl_shader_requirements);
+	char *base_dir, *dir;
+
+	if (env && strcmp(env, "0") == 0)
+		return NULL;
+
+	if (!gr->get_program_binary || !gr->program_binary)
+		return NULL;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+	if (num_formats <= 0)
+		return NULL;
+
+	base_dir = gl_program_cache_get_dir();
+	if (!base_dir)
+		return NULL;
+
+	/* The key layout, the shader configuration strings and the
+	 * attribute bindings come with the weston build */
+	build_id = hash_string(build_id, VERSION);
+	build_id = hash_string(build_id, BUILD_ID);
+	build_id = hash_fnv1a(build_id, &key_size, sizeof key_size);
+	build_id = hash_string(build_id, (const char *) glGetString(GL_VENDOR));
+	build_id = hash_string(build_id, (const char *) glGetString(GL_RENDERER));
+	build_id = hash_string(build_id, (const char *) glGetString(GL_VERSION));
+	build_id = hash_string(build_id, vertex_shader);
+	build_id = hash_string(build_id, fragment_shader);
+
+	str_printf(&dir, "%s/%016" PRIx64, base_dir, build_id);
+	abort_oom_if_null(dir);
+
+	if (!make_dirs(dir)) {
+		weston_log("GL program cache: cannot create %s: %s\n",
+			   dir, strerror(errno));
+		free(dir);
+		free(base_dir);
+		return NULL;
+	}
+	utimensat(AT_FDCWD, dir, NULL, 0);
+
+	cache = xzalloc(sizeof *cache);
+	cache->base_dir = base_dir;
+	cache->dir = dir;
+	cache->build_id = build_id;
+	cache->prewarm = env && strcmp(env, "prewarm") == 0;
+	wl_list_init(&cache->entry_list);
+
+	gl_program_cache_scan(cache);
+	gl_program_cache_prune(cache);
+
+	return cache;
+}
+
+void
+gl_program_cache_destroy(struct gl_program_cache *cache)
+{
+	struct gl_program_cache_entry *entry, *tmp;
+
+	if (!cache)
+		return;
+
+	wl_list_for_each_safe(entry, tmp, &cache->entry_list, link)
+		gl_program_cache_entry_destroy(entry);
+
+	free(cache->dir);
+	free(cache->base_dir);
+	free(cache);
+}
+
+/* Returns a linked program from the cache, or GL_NONE */
+static GLuint
+gl_program_cache_load(struct gl_renderer *gr,
+		      const struct gl_shader_requirements *key)
+{
+	struct gl_program_cache *cache = gr->program_cache;
+	struct gl_program_cache_entry *entry;
+	GLuint program;
+	GLint status;
+	char *name;
+
+	if (!cache)
+		return GL_NONE;
+
+	entry = gl_program_cache_find(cache, key);
+	if (!entry) {
+		cache->misses++;
+		return GL_NONE;
+	}
+
+	program = glCreateProgram();
+	gr->program_binary(program, entry->binary_format,
+			   entry->binary, entry->length);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		/* The driver changed in a way the build id did not catch */
+		glDeleteProgram(program);
+		cache->rejected++;
+
+		name = gl_program_cache_file_name(cache, key, "");
+		unlink(name);
+		free(name);
+		gl_program_cache_entry_destroy(entry);
+
+		return GL_NONE;
+	}
+
+	cache->hits++;
+
+	if (weston_log_scope_is_enabled(gr->shader_scope)) {
+		char *desc = create_shader_description_string(key);
+
+		weston_log_scope_printf(gr->shader_scope,
+					"Loaded shader program binary for: %s\n",
+					desc);
+		free(desc);
+	}
+
+	return program;
+}
+
+static void
+gl_program_cache_store(struct gl_renderer *gr,
+		       const struct gl_shader_requirements *key,
+		       GLuint program)
+{
+	struct gl_program_cache *cache = gr->program_cache;
+	struct gl_program_cache_header header = { 0 };
+	struct gl_program_cache_entry *entry;
+	GLenum binary_format = 0;
+	GLsizei length = 0;
+	GLint size = 0;
+	void *binary;
+	char *name, *tmp_name;
+	FILE *fp;
+	bool ok;
+
+	if (!cache)
+		return;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &size);
+	if (size <= 0)
+		return;
+
+	binary = xmalloc(size);
+	gr->get_program_binary(program, size, &length, &binary_format, binary);
+	if (length <= 0) {
+		free(binary);
+		return;
+	}
+
+	header.magic = GL_PROGRAM_CACHE_MAGIC;
+	header.binary_format = binary_format;
+	header.length = length;
+	header.key = *key;
+	header.build_id = cache->build_id;
+
+	/* Write to a temporary file first, so that a crash or another
+	 * compositor instance never sees a partial file. */
+	name = gl_program_cache_file_name(cache, key, "");
+	tmp_name = gl_program_cache_file_name(cache, key, ".tmp");
+	fp = fopen(tmp_name, "wbe");
+	ok = fp &&
+	     fwrite(&header, sizeof header, 1, fp) == 1 &&
+	     fwrite(binary, length, 1, fp) == 1;
+	if (fp && fclose(fp) != 0)
+		ok = false;
+	if (ok && rename(tmp_name, name) < 0)
+		ok = false;
+	if (!ok)
+		unlink(tmp_name);
+	free(tmp_name);
+	free(name);
+
+	if (ok)
+		cache->stored++;
+
+	entry = gl_program_cache_find(cache, key);
+	if (entry)
+		gl_program_cache_entry_destroy(entry);
+
+	entry = xzalloc(sizeof *entry);
+	entry->key = *key;
+	entry->binary_format = binary_format;
+	entry->length = length;
+	entry->binary = binary;
+	wl_list_insert(cache->entry_list.prev, &entry->link);
+}
+
 static struct gl_shader *
 gl_shader_create(struct gl_renderer *gr,
 		 const struct gl_shader_requirements *requirements)
@@ -319,6 +822,10 @@ gl_shader_create(struct gl_renderer *gr,
 	wl_list_init(&shader->link);
 	shader->key = *requirements;
 
+	shader->program = gl_program_cache_load(gr, requirements);
+	if (shader->program != GL_NONE)
+		goto linked;
+
 	if (verbose) {
 		char *desc;
 
@@ -374,6 +881,10 @@ gl_shader_create(struct gl_renderer *gr,
 		goto error_link;
 	}
 
+	gl_program_cache_store(gr, requirements, shader->program);
+
+linked:
+	/* No-ops for programs loaded from a binary */
 	glDeleteShader(shader->vertex_shader);
 	glDeleteShader(shader->fragment_shader);
 
@@ -501,13 +1012,6 @@ gl_renderer_shader_list_destroy(struct gl_renderer *gr)
 		gl_shader_destroy(gr, shader);
 }
 
-static int
-gl_shader_requirements_cmp(const struct gl_shader_requirements *a,
-			   const struct gl_shader_requirements *b)
-{
-	return memcmp(a, b, sizeof(*a));
-}
-
 static void
 gl_shader_scope_new_subscription(struct weston_log_subscription *subs,
 				 void *data)
@@ -543,6 +1047,20 @@ gl_shader_scope_new_subscription(struct weston_log_subscription *subs,
 					       msecs / 1000.0, desc);
 	}
 	weston_log_subscription_printf(subs, "Total: %d programs.\n", count);
+
+	if (!gr->program_cache) {
+		weston_log_subscription_printf(subs,
+					       "Program binary cache: disabled.\n");
+		return;
+	}
+
+	count = wl_list_length(&gr->program_cache->entry_list);
+	weston_log_subscription_printf(subs,
+		"Program binary cache in %s:\n"
+		"    %d binaries, %u hits, %u misses, %u rejected, %u stored.\n",
+		gr->program_cache->dir, count,
+		gr->program_cache->hits, gr->program_cache->misses,
+		gr->program_cache->rejected, gr->program_cache->stored);
 }
 
 struct weston_log_scope *
@@ -608,6 +1126,47 @@ gl_renderer_get_program(struct gl_renderer *gr,
 	return NULL;
 }
 
+/** Creates every program of the binary cache, when asked to prewarm
+ *
+ * Programs that are not used for a minute after this get garbage collected
+ * as usual, later uses still load them from the cache.
+ */
+void
+gl_renderer_prewarm_programs(struct gl_renderer *gr)
+{
+	struct gl_program_cache *cache = gr->program_cache;
+	struct gl_program_cache_entry *entry;
+	struct gl_shader_requirements *key;
+	struct gl_shader *shader;
+	struct wl_array keys;
+	struct timespec now;
+	int count = 0;
+
+	if (!cache || !cache->prewarm)
+		return;
+
+	/* Loading may drop rejected entries, iterate over a copy */
+	wl_array_init(&keys);
+	wl_list_for_each(entry, &cache->entry_list, link) {
+		key = wl_array_add(&keys, sizeof *key);
+		abort_oom_if_null(key);
+		*key = entry->key;
+	}
+
+	weston_compositor_read_presentation_clock(gr->compositor, &now);
+	wl_array_for_each(key, &keys) {
+		shader = gl_renderer_get_program(gr, key);
+		if (!shader)
+			continue;
+
+		shader->last_used = now;
+		count++;
+	}
+	wl_array_release(&keys);
+
+	weston_log("GL program cache: prewarmed %d programs.\n", count);
+}
+
 void
 gl_renderer_garbage_collect_programs(struct gl_renderer *gr)
 {
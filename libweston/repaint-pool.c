@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libweston/libweston.h>
+#include "libweston-internal.h"
+#include "repaint-pool.h"
+#include "frame-stats.h"
+#include "timeline.h"
+#include "shared/xalloc.h"
+
+/*
+ * Runs the renderer for several outputs at once.
+ *
+ * The repaint timer handler prepares every output on the compositor
+ * thread, as always. Then, between weston_repaint_pool_begin() and
+ * weston_repaint_pool_wait(), the backends hand their renderer->
+ * repaint_output() calls over through weston_output_repaint_renderer(),
+ * and each one runs as a job on a worker thread while the backend carries
+ * on with the next output. Nothing else touches the scene graph until
+ * weston_repaint_pool_wait() has joined them, before the repaints get
+ * flushed.
+ */
+
+struct repaint_job {
+	struct wl_list link; /* weston_repaint_pool::queue or ::done */
+	struct weston_output *output;
+	pixman_region32_t damage;
+	struct weston_renderbuffer *renderbuffer;
+	struct timespec begin;
+	struct timespec end;
+};
+
+struct weston_repaint_pool {
+	struct weston_compositor *compositor;
+	bool accepting;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond; /* a job got queued, or quit */
+	pthread_cond_t done_cond; /* the last pending job got done */
+	struct wl_list queue; /* repaint_job::link */
+	struct wl_list done; /* repaint_job::link */
+	int pending;
+	bool quit;
+
+	pthread_t *threads;
+	int thread_count;
+};
+
+static void *
+repaint_pool_thread(void *data)
+{
+	struct weston_repaint_pool *pool = data;
+	struct weston_compositor *compositor = pool->compositor;
+	struct repaint_job *job;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && wl_list_empty(&pool->queue))
+			pthread_cond_wait(&pool->job_cond, &pool->mutex);
+		if (pool->quit)
+			break;
+
+		job = container_of(pool->queue.next, struct repaint_job, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&pool->mutex);
+
+		clock_gettime(compositor->presentation_clock, &job->begin);
+		compositor->renderer->repaint_output(job->output, &job->damage,
+						     job->renderbuffer);
+		clock_gettime(compositor->presentation_clock, &job->end);
+
+		pthread_mutex_lock(&pool->mutex);
+		wl_list_insert(pool->done.prev, &job->link);
+		if (--pool->pending == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+struct weston_repaint_pool *
+weston_repaint_pool_create(struct weston_compositor *compositor,
+			   int thread_count)
+{
+	struct weston_repaint_pool *pool;
+	int i;
+
+	pool = xzalloc(sizeof *pool);
+	pool->compositor = compositor;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	wl_list_init(&pool->queue);
+	wl_list_init(&pool->done);
+
+	pool->threads = xcalloc(thread_count, sizeof *pool->threads);
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   repaint_pool_thread, pool) != 0)
+			break;
+	}
+	pool->thread_count = i;
+
+	if (pool->thread_count == 0) {
+		weston_log("Error: could not start any repaint thread.\n");
+		weston_repaint_pool_destroy(pool);
+		return NULL;
+	}
+
+	weston_log("Repainting outputs on %d threads.\n", pool->thread_count);
+
+	return pool;
+}
+
+void
+weston_repaint_pool_destroy(struct weston_repaint_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	assert(!pool->accepting);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->thread_count; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+/** Starts taking renderer jobs, until weston_repaint_pool_wait() */
+void
+weston_repaint_pool_begin(struct weston_repaint_pool *pool)
+{
+	assert(!pool->accepting);
+	pool->accepting = true;
+}
+
+/** Queues renderer->repaint_output() for an output
+ *
+ * \return false if the pool isn't taking jobs, the caller must then render
+ * by itself.
+ */
+bool
+weston_repaint_pool_submit(struct weston_repaint_pool *pool,
+			   struct weston_output *output,
+			   pixman_region32_t *damage,
+			   struct weston_renderbuffer *renderbuffer)
+{
+	struct repaint_job *job;
+
+	if (!pool->accepting)
+		return false;
+
+	job = xzalloc(sizeof *job);
+	job->output = output;
+	pixman_region32_init(&job->damage);
+	pixman_region32_copy(&job->damage, damage);
+	job->renderbuffer = weston_renderbuffer_ref(renderbuffer);
+
+	pthread_mutex_lock(&pool->mutex);
+	wl_list_insert(pool->queue.prev, &job->link);
+	pool->pending++;
+	pthread_cond_signal(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return true;
+}
+
+/** Waits for all the jobs, and stops taking new ones */
+void
+weston_repaint_pool_wait(struct weston_repaint_pool *pool)
+{
+	struct weston_compositor *compositor = pool->compositor;
+	struct repaint_job *job, *tmp;
+	struct wl_list done;
+
+	pool->accepting = false;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	wl_list_init(&done);
+	wl_list_insert_list(&done, &pool->done);
+	wl_list_init(&pool->done);
+	pthread_mutex_unlock(&pool->mutex);
+
+	/* The timeline isn't thread-safe, report the times from here. */
+	wl_list_for_each_safe(job, tmp, &done, link) {
+		TL_POINT(compositor, "core_render_thread_begin",
+			 TLP_OUTPUT(job->output), TLP_CPU(&job->begin),
+			 TLP_END);
+		TL_POINT(compositor, "core_render_thread_end",
+			 TLP_OUTPUT(job->output), TLP_CPU(&job->end),
+			 TLP_END);
+		frame_stats_render(job->output->frame_stats,
+				   &job->begin, &job->end);
+
+		pixman_region32_fini(&job->damage);
+		weston_renderbuffer_unref(job->renderbuffer);
+		free(job);
+	}
+}
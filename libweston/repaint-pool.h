@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_REPAINT_POOL_H
+#define WESTON_REPAINT_POOL_H
+
+#include <stdbool.h>
+#include <pixman.h>
+
+struct weston_compositor;
+struct weston_output;
+struct weston_renderbuffer;
+struct weston_repaint_pool;
+
+struct weston_repaint_pool *
+weston_repaint_pool_create(struct weston_compositor *compositor,
+			   int thread_count);
+
+void
+weston_repaint_pool_destroy(struct weston_repaint_pool *pool);
+
+void
+weston_repaint_pool_begin(struct weston_repaint_pool *pool);
+
+bool
+weston_repaint_pool_submit(struct weston_repaint_pool *pool,
+			   struct weston_output *output,
+			   pixman_region32_t *damage,
+			   struct weston_renderbuffer *renderbuffer);
+
+void
+weston_repaint_pool_wait(struct weston_repaint_pool *pool);
+
+#endif /* WESTON_REPAINT_POOL_H */
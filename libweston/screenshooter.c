@@ -33,11 +33,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
-#include <sys/uio.h>
+#include <pthread.h>
 
 #include <libweston/libweston.h>
 #include <libweston/helpers.h>
 #include "shared/timespec-util.h"
+#include "shared/xalloc.h"
 #include "backend.h"
 #include "libweston-internal.h"
 #include "pixel-formats.h"
@@ -238,16 +239,92 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+/* Frames waiting for the encoder may hold this many full output frames
+ * worth of pixels, anything beyond is dropped instead of stalling the
+ * compositor. */
+#define RECORDER_QUEUE_FRAMES 2
+#define RECORDER_WRITE_BUFFER_SIZE (1024 * 1024)
+
+/* A snapshot of the damaged pixels, as read back by the renderer, with the
+ * rectangles laid out one after the other. */
+struct recorder_frame {
+	struct wl_list link; /* weston_recorder::queue */
+	uint32_t msecs;
+	int nrects;
+	pixman_box32_t *rects;
+	uint32_t *pixels;
+	size_t size;
+};
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
-	int fd;
+	int width, height;
+	int do_yflip;
 	struct wl_listener frame_listener;
-	int count, destroying;
+	int count, dropped, destroying;
+
+	/* damage of dropped frames, to be recorded with the next one */
+	pixman_region32_t skipped_damage;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; /* a frame got queued, or quit */
+	struct wl_list queue; /* recorder_frame::link */
+	size_t queued_size;
+	size_t max_queued_size;
+	bool quit;
+
+	/* owned by the encoder thread */
+	uint32_t *frame, *outbuf;
+	uint8_t *wbuf;
+	size_t wbuf_len;
+	uint64_t total;
+	int fd;
 };
 
+static void
+recorder_flush(struct weston_recorder *recorder)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < recorder->wbuf_len) {
+		ret = write(recorder->fd, recorder->wbuf + done,
+			    recorder->wbuf_len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		done += ret;
+	}
+
+	recorder->total += done;
+	recorder->wbuf_len = 0;
+}
+
+static void
+recorder_write(struct weston_recorder *recorder, const void *data, size_t size)
+{
+	if (recorder->wbuf_len + size > RECORDER_WRITE_BUFFER_SIZE)
+		recorder_flush(recorder);
+
+	if (size > RECORDER_WRITE_BUFFER_SIZE) {
+		while (size > 0) {
+			size_t len = MIN(size, RECORDER_WRITE_BUFFER_SIZE);
+
+			memcpy(recorder->wbuf, data, len);
+			recorder->wbuf_len = len;
+			recorder_flush(recorder);
+			data = (const uint8_t *)data + len;
+			size -= len;
+		}
+		return;
+	}
+
+	memcpy(recorder->wbuf + recorder->wbuf_len, data, size);
+	recorder->wbuf_len += size;
+}
+
 static uint32_t *
 output_run(uint32_t *p, uint32_t delta, int run)
 {
@@ -286,6 +363,168 @@ component_delta(uint32_t next, uint32_t prev)
 	return (dr << 16) | (dg << 8) | (db << 0);
 }
 
+typedef uint8_t recorder_v16u8 __attribute__((vector_size(16)));
+typedef uint32_t recorder_v4u32 __attribute__((vector_size(16)));
+
+struct recorder_rle {
+	uint32_t *p;
+	uint32_t prev;
+	int run;
+};
+
+/* Delta codes 'width' pixels of 's' against the previous frame in 'd',
+ * updating 'd', and extends the run in 'rle'. The per component deltas are
+ * byte-wise subtractions, done four pixels at a time; a vector that only
+ * continues the current run costs no scalar work. */
+static void
+encode_row(struct recorder_rle *rle, const uint32_t *s, uint32_t *d, int width)
+{
+	const recorder_v4u32 rgb = { 0x00ffffff, 0x00ffffff,
+				     0x00ffffff, 0x00ffffff };
+	uint32_t *p = rle->p;
+	uint32_t prev = rle->prev;
+	int run = rle->run;
+	uint32_t delta;
+	int k = 0, l;
+
+	for (; k + 4 <= width; k += 4) {
+		recorder_v16u8 next, old;
+		recorder_v4u32 deltas, same;
+		uint64_t all[2];
+
+		memcpy(&next, s + k, sizeof next);
+		memcpy(&old, d + k, sizeof old);
+		memcpy(d + k, &next, sizeof next);
+		deltas = (recorder_v4u32)(next - old) & rgb;
+
+		same = (recorder_v4u32)(deltas == prev);
+		memcpy(all, &same, sizeof all);
+		if (run > 0 && (all[0] & all[1]) == UINT64_MAX) {
+			run += 4;
+			continue;
+		}
+
+		for (l = 0; l < 4; l++) {
+			delta = deltas[l];
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = output_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+	}
+
+	for (; k < width; k++) {
+		delta = component_delta(s[k], d[k]);
+		d[k] = s[k];
+		if (run == 0 || delta == prev) {
+			run++;
+		} else {
+			p = output_run(p, prev, run);
+			run = 1;
+		}
+		prev = delta;
+	}
+
+	rle->p = p;
+	rle->prev = prev;
+	rle->run = run;
+}
+
+static void
+recorder_encode_frame(struct weston_recorder *recorder,
+		      struct recorder_frame *frame)
+{
+	struct {
+		uint32_t msecs;
+		uint32_t nrects;
+	} header;
+	const uint32_t *pixels = frame->pixels;
+	const uint32_t *s;
+	uint32_t *d;
+	pixman_box32_t *r;
+	int i, j, width, height, y;
+
+	header.msecs = frame->msecs;
+	header.nrects = frame->nrects;
+	recorder_write(recorder, &header, sizeof header);
+	recorder_write(recorder, frame->rects,
+		       frame->nrects * sizeof *frame->rects);
+
+	for (i = 0; i < frame->nrects; i++) {
+		struct recorder_rle rle = { .p = recorder->outbuf };
+
+		r = &frame->rects[i];
+		width = r->x2 - r->x1;
+		height = r->y2 - r->y1;
+
+		for (j = 0; j < height; j++) {
+			if (recorder->do_yflip)
+				s = pixels + width * j;
+			else
+				s = pixels + width * (height - j - 1);
+			y = r->y2 - j - 1;
+			d = recorder->frame + recorder->width * y + r->x1;
+
+			encode_row(&rle, s, d, width);
+		}
+
+		rle.p = output_run(rle.p, rle.prev, rle.run);
+		recorder_write(recorder, recorder->outbuf,
+			       (rle.p - recorder->outbuf) * 4);
+
+		pixels += width * height;
+	}
+}
+
+static void
+recorder_frame_destroy(struct recorder_frame *frame)
+{
+	free(frame->rects);
+	free(frame->pixels);
+	free(frame);
+}
+
+static void *
+recorder_thread(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct recorder_frame *frame;
+
+	pthread_mutex_lock(&recorder->mutex);
+	for (;;) {
+		while (!recorder->quit && wl_list_empty(&recorder->queue))
+			pthread_cond_wait(&recorder->cond, &recorder->mutex);
+		if (wl_list_empty(&recorder->queue))
+			break;
+
+		frame = container_of(recorder->queue.next,
+				     struct recorder_frame, link);
+		wl_list_remove(&frame->link);
+		pthread_mutex_unlock(&recorder->mutex);
+
+		recorder_encode_frame(recorder, frame);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->queued_size -= frame->size;
+		recorder_frame_destroy(frame);
+
+		/* nothing left to do for now, get the data to the disk */
+		if (wl_list_empty(&recorder->queue)) {
+			pthread_mutex_unlock(&recorder->mutex);
+			recorder_flush(recorder);
+			pthread_mutex_lock(&recorder->mutex);
+		}
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	recorder_flush(recorder);
+
+	return NULL;
+}
+
 static void
 weston_recorder_destroy(struct weston_recorder *recorder);
 
@@ -296,25 +535,14 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = recorder->output;
 	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = timespec_to_msec(&output->frame_time);
-	pixman_box32_t *r;
 	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
+	struct recorder_frame *frame;
+	pixman_box32_t *r;
+	uint32_t *pixels;
+	size_t size = 0;
+	int i, n, width, height;
 	int y_orig;
-	uint32_t *outbuf;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	bool drop;
 
 	pixman_region32_init(&damage);
 	pixman_region32_init(&transformed_damage);
@@ -323,76 +551,65 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 				       output,
 				       &damage);
 	pixman_region32_fini(&damage);
+	pixman_region32_union(&transformed_damage, &transformed_damage,
+			      &recorder->skipped_damage);
 
 	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
+	if (n == 0)
+		goto out;
+
+	for (i = 0; i < n; i++)
+		size += (size_t)(r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1) * 4;
+
+	pthread_mutex_lock(&recorder->mutex);
+	drop = recorder->queued_size + size > recorder->max_queued_size;
+	if (!drop)
+		recorder->queued_size += size;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	/* The encoder is behind: skip this frame, its damage keeps the next
+	 * recorded one a valid delta to the last recorded one. */
+	if (drop) {
+		pixman_region32_copy(&recorder->skipped_damage,
+				     &transformed_damage);
+		recorder->dropped++;
+		goto out;
 	}
+	pixman_region32_clear(&recorder->skipped_damage);
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	frame = xzalloc(sizeof *frame);
+	frame->msecs = timespec_to_msec(&output->frame_time);
+	frame->nrects = n;
+	frame->rects = xcalloc(n, sizeof *r);
+	memcpy(frame->rects, r, n * sizeof *r);
+	frame->pixels = xmalloc(size);
+	frame->size = size;
 
+	pixels = frame->pixels;
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
+		if (recorder->do_yflip)
+			y_orig = recorder->height - r[i].y2;
 		else
 			y_orig = r[i].y1;
 
 		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
+				compositor->read_format, pixels,
 				r[i].x1, y_orig, width, height);
+		pixels += width * height;
+	}
 
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				s = recorder->rect + width * j;
-			else
-				s = recorder->rect + width * (height - j - 1);
-			y_orig = r[i].y2 - j - 1;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
-
-		p = output_run(p, prev, run);
-
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+	pthread_mutex_lock(&recorder->mutex);
+	wl_list_insert(recorder->queue.prev, &frame->link);
+	pthread_cond_signal(&recorder->cond);
+	pthread_mutex_unlock(&recorder->mutex);
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
-	}
+	recorder->count++;
 
+out:
 	pixman_region32_fini(&transformed_damage);
-	recorder->count++;
 
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
@@ -404,8 +621,9 @@ weston_recorder_free(struct weston_recorder *recorder)
 	if (recorder == NULL)
 		return;
 
-	free(recorder->tmpbuf);
-	free(recorder->rect);
+	pixman_region32_fini(&recorder->skipped_damage);
+	free(recorder->wbuf);
+	free(recorder->outbuf);
 	free(recorder->frame);
 	free(recorder);
 }
@@ -417,9 +635,6 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	struct weston_recorder *recorder;
 	int stride, size;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
 	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
@@ -427,25 +642,28 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return NULL;
 	}
 
+	recorder->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	recorder->width = output->current_mode->width;
+	recorder->height = output->current_mode->height;
+	recorder->output = output;
+	recorder->fd = -1;
+	pixman_region32_init(&recorder->skipped_damage);
+	wl_list_init(&recorder->queue);
+
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
+	recorder->max_queued_size = (size_t)size * RECORDER_QUEUE_FRAMES;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
-	recorder->output = output;
+	/* a rectangle never encodes to more words than it has pixels */
+	recorder->outbuf = malloc(size);
+	recorder->wbuf = malloc(RECORDER_WRITE_BUFFER_SIZE);
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if (!recorder->frame || !recorder->outbuf || !recorder->wbuf) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
 
-	if (!do_yflip) {
-		recorder->tmpbuf = malloc(size);
-		if (recorder->tmpbuf == NULL) {
-			weston_log("%s: out of memory\n", __func__);
-			goto err_recorder;
-		}
-	}
-
 	header.magic = WCAP_HEADER_MAGIC;
 
 	switch (compositor->read_format->pixman_format) {
@@ -472,7 +690,19 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 
 	header.width = output->current_mode->width;
 	header.height = output->current_mode->height;
-	recorder->total += write(recorder->fd, &header, sizeof header);
+	recorder_write(recorder, &header, sizeof header);
+
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->cond, NULL);
+	if (pthread_create(&recorder->thread, NULL,
+			   recorder_thread, recorder) != 0) {
+		weston_log("%s: failed to start the encoder thread\n",
+			   __func__);
+		pthread_cond_destroy(&recorder->cond);
+		pthread_mutex_destroy(&recorder->mutex);
+		close(recorder->fd);
+		goto err_recorder;
+	}
 
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
@@ -490,6 +720,21 @@ static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
+
+	/* the encoder drains the queue before quitting */
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->quit = true;
+	pthread_cond_signal(&recorder->cond);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+	pthread_cond_destroy(&recorder->cond);
+	pthread_mutex_destroy(&recorder->mutex);
+
+	weston_log("recorder stopped, total file size %dM, "
+		   "%d frames, %d dropped\n",
+		   (int)(recorder->total / (1024 * 1024)),
+		   recorder->count, recorder->dropped);
+
 	close(recorder->fd);
 	weston_output_disable_planes_decr(recorder->output);
 	weston_recorder_free(recorder);
@@ -516,8 +761,8 @@ weston_recorder_start(struct weston_output *output, const char *filename)
 WL_EXPORT void
 weston_recorder_stop(struct weston_recorder *recorder)
 {
-	weston_log("stopping recorder, total file size %dM, %d frames\n",
-		   recorder->total / (1024 * 1024), recorder->count);
+	weston_log("stopping recorder on output %s\n",
+		   recorder->output->name);
 
 	recorder->destroying = 1;
 	weston_output_schedule_repaint(recorder->output);
@@ -27,6 +27,8 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
@@ -36,6 +38,8 @@
 #include <libweston/weston-log.h>
 #include "timeline.h"
 #include "weston-log-internal.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
 
 /**
  * Timeline itself is not a subscriber but a scope (a producer of data), and it
@@ -75,6 +79,40 @@ struct timeline_emit_context {
 	struct weston_log_subscription *subscription;
 };
 
+/* Records kept by the binary timeline, a power of two */
+#define TIMELINE_RING_SIZE (1 << 16)
+/* Distinct point names and object descriptions the binary timeline keeps */
+#define TIMELINE_RING_MAX_STRINGS 512
+
+struct timeline_string_slot {
+	uint32_t hash;
+	uint32_t id;				/**< 0 if the slot is free */
+};
+
+/**
+ * The binary timeline: TL_POINT() appends fixed-size records to a ring
+ * while the "timeline-binary" scope has any subscription, and each new
+ * subscription gets a dump of the ring. Keeping the scope subscribed by the
+ * flight recorder keeps the last TIMELINE_RING_SIZE points around at the
+ * cost of a clock read and a few stores per point.
+ *
+ * Timeline points come from the main thread only, so the ring has a single
+ * producer and needs neither locks nor atomics.
+ *
+ * @ingroup internal-log
+ */
+struct weston_timeline_ring {
+	struct weston_log_scope *scope;
+	struct weston_timeline_subscription objects;
+	struct weston_timeline_record *records;
+	uint64_t head;				/**< records ever written */
+
+	/* Interned strings, indexed by id, and a hash table to find them */
+	char *strings[TIMELINE_RING_MAX_STRINGS + 1];
+	uint32_t n_strings;
+	struct timeline_string_slot slots[TIMELINE_RING_MAX_STRINGS * 2];
+};
+
 /** Create a timeline subscription and hang it off the subscription
  *
  * Called when the subscription is created.
@@ -193,6 +231,7 @@ weston_timeline_subscription_output_ensure(struct weston_timeline_subscription *
 	sub_obj = weston_timeline_subscription_search(tl_sub, output);
 	if (!sub_obj) {
 		sub_obj = weston_timeline_subscription_object_create(output, tl_sub);
+		sub_obj->type = TLT_OUTPUT;
 
 		sub_obj->destroy_listener.notify =
 			weston_timeline_destroy_subscription_object_notify;
@@ -211,6 +250,7 @@ weston_timeline_subscription_surface_ensure(struct weston_timeline_subscription
 	sub_obj = weston_timeline_subscription_search(tl_sub, surface);
 	if (!sub_obj) {
 		sub_obj = weston_timeline_subscription_object_create(surface, tl_sub);
+		sub_obj->type = TLT_SURFACE;
 
 		sub_obj->destroy_listener.notify =
 			weston_timeline_destroy_subscription_object_notify;
@@ -366,6 +406,17 @@ emit_present_timestamp(struct timeline_emit_context *ctx, void *obj)
 	return 1;
 }
 
+static int
+emit_cpu_timestamp(struct timeline_emit_context *ctx, void *obj)
+{
+	struct timespec *ts = obj;
+
+	fprintf(ctx->cur, "\"cpu\":[%" PRId64 ", %ld]",
+		(int64_t)ts->tv_sec, ts->tv_nsec);
+
+	return 1;
+}
+
 static struct weston_timeline_subscription_object *
 weston_timeline_get_subscription_object(struct weston_log_subscription *sub,
 		void *object)
@@ -397,13 +448,20 @@ weston_timeline_refresh_subscription_objects(struct weston_compositor *wc,
 {
 	struct weston_log_subscription *sub = NULL;
 
-	while ((sub = weston_log_subscription_iterate(wc->timeline, sub))) {
-		struct weston_timeline_subscription_object *sub_obj;
+	struct weston_timeline_subscription_object *sub_obj;
 
+	while ((sub = weston_log_subscription_iterate(wc->timeline, sub))) {
 		sub_obj = weston_timeline_get_subscription_object(sub, object);
 		if (sub_obj)
 			sub_obj->force_refresh = true;
 	}
+
+	if (wc->timeline_ring) {
+		sub_obj = weston_timeline_subscription_search(&wc->timeline_ring->objects,
+							      object);
+		if (sub_obj)
+			sub_obj->force_refresh = true;
+	}
 }
 
 typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
@@ -415,37 +473,42 @@ static const type_func type_dispatch[] = {
 	[TLT_GPU] = emit_gpu_timestamp,
 	[TLT_MSEC] = emit_msec,
 	[TLT_PRESENT] = emit_present_timestamp,
+	[TLT_CPU] = emit_cpu_timestamp,
 };
 
-/** Disseminates the message to all subscriptions of the scope \c
- * timeline_scope
- *
- * The TL_POINT() is a wrapper over this function, but it  uses the weston_compositor
- * instance to pass the timeline scope.
- *
- * @param timeline_scope the timeline scope
- * @param name the name of the timeline point. Interpretable by the tool reading
- * the output (wesgr).
- *
- * @ingroup log
- */
-WL_EXPORT void
-weston_timeline_point(struct weston_log_scope *timeline_scope,
-		      const char *name, ...)
+/* Points carry an output or surface and a value or two */
+#define TIMELINE_MAX_ARGS 8
+
+struct timeline_arg {
+	enum timeline_type type;
+	void *obj;
+};
+
+static unsigned int
+timeline_collect_args(va_list argp, struct timeline_arg *args)
 {
-	struct timespec ts;
 	enum timeline_type otype;
-	void *obj;
-	char buf[512];
-	struct weston_log_subscription *sub = NULL;
+	unsigned int n_args = 0;
 
-	if (!weston_log_scope_is_enabled(timeline_scope))
-		return;
+	while ((otype = va_arg(argp, enum timeline_type)) != TLT_END) {
+		assert(n_args < TIMELINE_MAX_ARGS);
+		args[n_args].type = otype;
+		args[n_args++].obj = va_arg(argp, void *);
+	}
 
-	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return n_args;
+}
+
+static void
+timeline_scope_point(struct weston_log_scope *timeline_scope,
+		     const struct timespec *ts, const char *name,
+		     const struct timeline_arg *args, unsigned int n_args)
+{
+	char buf[512];
+	struct weston_log_subscription *sub = NULL;
+	unsigned int i;
 
 	while ((sub = weston_log_subscription_iterate(timeline_scope, sub))) {
-		va_list argp;
 		struct timeline_emit_context ctx = {};
 
 		memset(buf, 0, sizeof(buf));
@@ -458,21 +521,14 @@ weston_timeline_point(struct weston_log_scope *timeline_scope,
 		}
 
 		fprintf(ctx.cur, "{ \"T\":[%" PRId64 ", %ld], \"N\":\"%s\"",
-				(int64_t)ts.tv_sec, ts.tv_nsec, name);
+				(int64_t)ts->tv_sec, ts->tv_nsec, name);
 
-		va_start(argp, name);
-		while (1) {
-			otype = va_arg(argp, enum timeline_type);
-			if (otype == TLT_END)
-				break;
-
-			obj = va_arg(argp, void *);
-			if (type_dispatch[otype]) {
+		for (i = 0; i < n_args; i++) {
+			if (type_dispatch[args[i].type]) {
 				fprintf(ctx.cur, ", ");
-				type_dispatch[otype](&ctx, obj);
+				type_dispatch[args[i].type](&ctx, args[i].obj);
 			}
 		}
-		va_end(argp);
 
 		fprintf(ctx.cur, " }\n");
 		fflush(ctx.cur);
@@ -486,3 +542,375 @@ weston_timeline_point(struct weston_log_scope *timeline_scope,
 
 	}
 }
+
+/** Disseminates the message to all subscriptions of the scope \c
+ * timeline_scope
+ *
+ * The TL_POINT() macro uses weston_timeline_emit() instead, which also
+ * feeds the binary timeline.
+ *
+ * @param timeline_scope the timeline scope
+ * @param name the name of the timeline point. Interpretable by the tool reading
+ * the output (wesgr).
+ *
+ * @ingroup log
+ */
+WL_EXPORT void
+weston_timeline_point(struct weston_log_scope *timeline_scope,
+		      const char *name, ...)
+{
+	struct timeline_arg args[TIMELINE_MAX_ARGS];
+	unsigned int n_args;
+	struct timespec ts;
+	va_list argp;
+
+	if (!weston_log_scope_is_enabled(timeline_scope))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	va_start(argp, name);
+	n_args = timeline_collect_args(argp, args);
+	va_end(argp);
+
+	timeline_scope_point(timeline_scope, &ts, name, args, n_args);
+}
+
+static uint32_t
+timeline_ring_intern(struct weston_timeline_ring *ring, const char *str)
+{
+	const uint32_t mask = ARRAY_LENGTH(ring->slots) - 1;
+	struct timeline_string_slot *slot;
+	uint32_t hash = 2166136261u;
+	const char *c;
+	uint32_t i;
+
+	if (!str)
+		return 0;
+
+	/* FNV-1a */
+	for (c = str; *c; c++)
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
+
+	for (i = hash & mask;; i = (i + 1) & mask) {
+		slot = &ring->slots[i];
+		if (slot->id == 0)
+			break;
+		if (slot->hash == hash && strcmp(ring->strings[slot->id], str) == 0)
+			return slot->id;
+	}
+
+	if (ring->n_strings == TIMELINE_RING_MAX_STRINGS)
+		return 0;
+
+	ring->strings[++ring->n_strings] = strdup(str);
+	if (!ring->strings[ring->n_strings]) {
+		ring->n_strings--;
+		return 0;
+	}
+	slot->hash = hash;
+	slot->id = ring->n_strings;
+
+	return slot->id;
+}
+
+static struct weston_timeline_record *
+timeline_ring_next(struct weston_timeline_ring *ring)
+{
+	return &ring->records[ring->head++ & (TIMELINE_RING_SIZE - 1)];
+}
+
+static void
+timeline_ring_describe(struct weston_timeline_record *rec,
+		       struct weston_timeline_ring *ring,
+		       struct weston_timeline_subscription_object *sub_obj,
+		       uint64_t time)
+{
+	struct weston_timeline_subscription_object *main_obj = NULL;
+	struct weston_surface *surface, *mains;
+	struct weston_output *output;
+	char d[512];
+
+	*rec = (struct weston_timeline_record) {
+		.time = time,
+		.value_type = { TLT_END, TLT_END },
+		.flags = WESTON_TIMELINE_RECORD_OBJECT,
+	};
+
+	switch (sub_obj->type) {
+	case TLT_OUTPUT:
+		output = sub_obj->object;
+		rec->output = sub_obj->id;
+		rec->value[0] = timeline_ring_intern(ring, output->name);
+		break;
+	case TLT_SURFACE:
+		surface = sub_obj->object;
+		rec->surface = sub_obj->id;
+		if (!surface->get_label ||
+		    surface->get_label(surface, d, sizeof(d)) < 0)
+			d[0] = '\0';
+		rec->value[0] = timeline_ring_intern(ring, d[0] ? d : NULL);
+
+		mains = weston_surface_get_main_surface(surface);
+		if (mains != surface)
+			main_obj = weston_timeline_subscription_search(&ring->objects,
+								       mains);
+		if (main_obj)
+			rec->value[1] = main_obj->id;
+		break;
+	default:
+		assert(0);
+	}
+}
+
+static uint32_t
+timeline_ring_object_id(struct weston_timeline_ring *ring, uint64_t time,
+			enum timeline_type type, void *object)
+{
+	struct weston_timeline_subscription_object *sub_obj;
+	struct weston_surface *mains;
+
+	if (type == TLT_OUTPUT) {
+		sub_obj = weston_timeline_subscription_output_ensure(&ring->objects,
+								     object);
+	} else {
+		/* Describe the main surface first, so it can be referred to */
+		mains = weston_surface_get_main_surface(object);
+		if (mains != object)
+			timeline_ring_object_id(ring, time, TLT_SURFACE, mains);
+
+		sub_obj = weston_timeline_subscription_surface_ensure(&ring->objects,
+								      object);
+	}
+
+	if (weston_timeline_check_object_refresh(sub_obj))
+		timeline_ring_describe(timeline_ring_next(ring), ring, sub_obj,
+				       time);
+
+	return sub_obj->id;
+}
+
+static bool
+timeline_ring_is_enabled(struct weston_timeline_ring *ring)
+{
+	return ring && ring->records &&
+	       weston_log_scope_is_enabled(ring->scope);
+}
+
+/* Appends a timeline point to the binary timeline, \c name must be a
+ * string literal. */
+static void
+timeline_ring_point(struct weston_timeline_ring *ring,
+		    const struct timespec *ts, const char *name,
+		    const struct timeline_arg *args, unsigned int n_args)
+{
+	struct weston_timeline_record point = {
+		.value_type = { TLT_END, TLT_END },
+	};
+	unsigned int n_values = 0;
+	unsigned int i;
+
+	point.time = timespec_to_nsec(ts);
+	point.name = timeline_ring_intern(ring, name);
+
+	for (i = 0; i < n_args; i++) {
+		enum timeline_type otype = args[i].type;
+		void *obj = args[i].obj;
+
+		/* Objects seen for the first time get described in records
+		 * ahead of the point. */
+		switch (otype) {
+		case TLT_OUTPUT:
+			point.output = timeline_ring_object_id(ring, point.time,
+							       otype, obj);
+			break;
+		case TLT_SURFACE:
+			point.surface = timeline_ring_object_id(ring, point.time,
+								otype, obj);
+			break;
+		case TLT_VBLANK:
+		case TLT_GPU:
+		case TLT_PRESENT:
+		case TLT_CPU:
+		case TLT_MSEC:
+			if (n_values == ARRAY_LENGTH(point.value))
+				break;
+			point.value_type[n_values] = otype;
+			point.value[n_values++] = otype == TLT_MSEC ?
+				*(const int64_t *)obj :
+				timespec_to_nsec(obj);
+			break;
+		case TLT_END:
+			break;
+		}
+	}
+
+	*timeline_ring_next(ring) = point;
+}
+
+/** Adds a point to both the text and the binary timeline
+ *
+ * The TL_POINT() macro wraps this. The arguments are evaluated once, the
+ * same timestamp goes to both timelines.
+ *
+ * @param timeline_scope the timeline scope
+ * @param ring the binary timeline, may be NULL
+ * @param name the name of the timeline point, a string literal
+ *
+ * @ingroup log
+ */
+WL_EXPORT void
+weston_timeline_emit(struct weston_log_scope *timeline_scope,
+		     struct weston_timeline_ring *ring,
+		     const char *name, ...)
+{
+	struct timeline_arg args[TIMELINE_MAX_ARGS];
+	bool to_scope = weston_log_scope_is_enabled(timeline_scope);
+	bool to_ring = timeline_ring_is_enabled(ring);
+	unsigned int n_args;
+	struct timespec ts;
+	va_list argp;
+
+	if (!to_scope && !to_ring)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	va_start(argp, name);
+	n_args = timeline_collect_args(argp, args);
+	va_end(argp);
+
+	if (to_scope)
+		timeline_scope_point(timeline_scope, &ts, name, args, n_args);
+	if (to_ring)
+		timeline_ring_point(ring, &ts, name, args, n_args);
+}
+
+static void
+timeline_ring_write(struct weston_log_subscription *sub,
+		    const void *data, size_t len)
+{
+	weston_log_subscription_write(sub, data, len);
+}
+
+static void
+timeline_ring_dump(struct weston_timeline_ring *ring,
+		   struct weston_log_subscription *sub)
+{
+	struct weston_timeline_bin_header header = {
+		.magic = WESTON_TIMELINE_BIN_MAGIC,
+		.version = WESTON_TIMELINE_BIN_VERSION,
+		.record_size = sizeof(struct weston_timeline_record),
+	};
+	struct weston_timeline_subscription_object *sub_obj;
+	struct weston_timeline_record *objects;
+	uint64_t first, start, count;
+	int n_objects = 0;
+	uint32_t i, len;
+
+	first = ring->head > TIMELINE_RING_SIZE ?
+		ring->head - TIMELINE_RING_SIZE : 0;
+	start = first & (TIMELINE_RING_SIZE - 1);
+	count = ring->head - first;
+
+	/* Describe all live objects up front, in case the ring has wrapped
+	 * over their descriptions. */
+	objects = xcalloc(wl_list_length(&ring->objects.objects) + 1,
+			  sizeof *objects);
+	wl_list_for_each_reverse(sub_obj, &ring->objects.objects,
+				 subscription_link) {
+		timeline_ring_describe(&objects[n_objects++], ring, sub_obj,
+				       ring->records[start].time);
+	}
+
+	header.n_strings = ring->n_strings;
+	header.n_records = n_objects + count;
+	header.n_dropped = first;
+	timeline_ring_write(sub, &header, sizeof header);
+
+	for (i = 1; i <= ring->n_strings; i++) {
+		len = strlen(ring->strings[i]);
+		timeline_ring_write(sub, &i, sizeof i);
+		timeline_ring_write(sub, &len, sizeof len);
+		timeline_ring_write(sub, ring->strings[i], len);
+	}
+
+	timeline_ring_write(sub, objects, n_objects * sizeof *objects);
+	free(objects);
+
+	if (start + count > TIMELINE_RING_SIZE) {
+		timeline_ring_write(sub, &ring->records[start],
+				    (TIMELINE_RING_SIZE - start) *
+				    sizeof *ring->records);
+		count -= TIMELINE_RING_SIZE - start;
+		start = 0;
+	}
+	timeline_ring_write(sub, &ring->records[start],
+			    count * sizeof *ring->records);
+}
+
+static void
+timeline_ring_subscribe(struct weston_log_subscription *sub, void *data)
+{
+	struct weston_timeline_ring *ring = data;
+
+	if (!ring->records) {
+		ring->records = calloc(TIMELINE_RING_SIZE,
+				       sizeof *ring->records);
+		if (!ring->records)
+			weston_log("Timeline error allocating the ring.\n");
+	}
+
+	/* Keep the flight recorder free of binary data when there is
+	 * nothing to dump yet. */
+	if (ring->head > 0)
+		timeline_ring_dump(ring, sub);
+
+	weston_log_subscription_complete(sub);
+}
+
+/** Create the binary timeline and its "timeline-binary" log scope
+ *
+ * @ingroup internal-log
+ */
+struct weston_timeline_ring *
+weston_timeline_ring_create(struct weston_compositor *compositor)
+{
+	struct weston_timeline_ring *ring;
+
+	ring = xzalloc(sizeof *ring);
+	wl_list_init(&ring->objects.objects);
+	ring->scope =
+		weston_compositor_add_log_scope(compositor, "timeline-binary",
+						"Timeline event points, recorded in a "
+						"ring and dumped in binary\n",
+						timeline_ring_subscribe, NULL,
+						ring);
+
+	return ring;
+}
+
+/** Destroy the binary timeline
+ *
+ * @ingroup internal-log
+ */
+void
+weston_timeline_ring_destroy(struct weston_timeline_ring *ring)
+{
+	struct weston_timeline_subscription_object *sub_obj, *tmp;
+	uint32_t i;
+
+	if (!ring)
+		return;
+
+	weston_log_scope_destroy(ring->scope);
+
+	wl_list_for_each_safe(sub_obj, tmp, &ring->objects.objects,
+			      subscription_link)
+		weston_timeline_destroy_subscription_object(sub_obj);
+
+	for (i = 1; i <= ring->n_strings; i++)
+		free(ring->strings[i]);
+	free(ring->records);
+	free(ring);
+}
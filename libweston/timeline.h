@@ -29,6 +29,7 @@
 
 #include <wayland-util.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <libweston/weston-log.h>
 #include <libweston/helpers.h>
@@ -42,6 +43,7 @@ enum timeline_type {
 	TLT_GPU,
 	TLT_MSEC,
 	TLT_PRESENT,
+	TLT_CPU,
 };
 
 /** Timeline subscription created for each subscription
@@ -64,12 +66,62 @@ struct weston_timeline_subscription {
  */
 struct weston_timeline_subscription_object {
 	void *object;                           /**< points to the object */
+	enum timeline_type type;                /**< TLT_OUTPUT or TLT_SURFACE */
 	unsigned int id;
 	bool force_refresh;
 	struct wl_list subscription_link;       /**< weston_timeline_subscription::objects */
 	struct wl_listener destroy_listener;
 };
 
+/** Binary timeline dump, as written to the "timeline-binary" scope
+ *
+ * All fields are in host byte order. A dump is a
+ * struct weston_timeline_bin_header, followed by \c n_strings string table
+ * entries of a uint32_t id, a uint32_t length and that many bytes without
+ * a terminating NUL, followed by \c n_records struct weston_timeline_record.
+ * String and object ids start from 1, 0 means none.
+ *
+ * tools/timeline-convert.py turns a dump into the JSON of the "timeline"
+ * scope or into a Chrome trace.
+ *
+ * @ingroup internal-log
+ */
+#define WESTON_TIMELINE_BIN_MAGIC "WTLBIN1"
+#define WESTON_TIMELINE_BIN_VERSION 1
+
+struct weston_timeline_bin_header {
+	char magic[8];			/**< WESTON_TIMELINE_BIN_MAGIC */
+	uint32_t version;		/**< WESTON_TIMELINE_BIN_VERSION */
+	uint32_t record_size;		/**< sizeof(struct weston_timeline_record) */
+	uint32_t n_strings;
+	uint32_t pad;
+	uint64_t n_records;
+	uint64_t n_dropped;		/**< records lost to ring wrap-around */
+};
+
+#define WESTON_TIMELINE_RECORD_OBJECT (1 << 0)
+
+/** A timeline point, or an object description
+ *
+ * An object description has WESTON_TIMELINE_RECORD_OBJECT in \c flags,
+ * sets either \c output or \c surface to the object id, \c value[0] to the
+ * string id of its name or label, and for sub-surfaces \c value[1] to the
+ * object id of the main surface.
+ *
+ * @ingroup internal-log
+ */
+struct weston_timeline_record {
+	uint64_t time;			/**< CLOCK_MONOTONIC in nanoseconds */
+	uint32_t name;			/**< string id of the point name */
+	uint32_t output;		/**< object id of TLP_OUTPUT */
+	uint32_t surface;		/**< object id of TLP_SURFACE */
+	uint8_t value_type[2];		/**< enum timeline_type, TLT_END if unused */
+	uint16_t flags;
+	int64_t value[2];		/**< nanoseconds, or TLP_MSEC as is */
+};
+
+struct weston_timeline_ring;
+
 /**
  * Should be used as the last argument when using TL_POINT macro
  *
@@ -83,6 +135,8 @@ struct weston_timeline_subscription_object {
 #define TLP_GPU(t) TLT_GPU, TYPEVERIFY(const struct timespec *, (t))
 #define TLP_MSEC(i) TLT_MSEC, TYPEVERIFY(const int64_t *, (i))
 #define TLP_NEXT_PRESENT(t) TLT_PRESENT, TYPEVERIFY(const struct timespec *, (t))
+/* When something happened on another thread, in the presentation clock */
+#define TLP_CPU(t) TLT_CPU, TYPEVERIFY(const struct timespec *, (t))
 
 /** This macro is used to add timeline points.
  *
@@ -92,12 +146,22 @@ struct weston_timeline_subscription_object {
  *
  * @ingroup log
  */
-#define TL_POINT(ec, ...) do { \
-	weston_timeline_point(ec->timeline, __VA_ARGS__); \
-} while (0)
+#define TL_POINT(ec, ...) \
+	weston_timeline_emit(ec->timeline, ec->timeline_ring, __VA_ARGS__)
 
 void
 weston_timeline_point(struct weston_log_scope *timeline_scope,
 		      const char *name, ...);
 
+void
+weston_timeline_emit(struct weston_log_scope *timeline_scope,
+		     struct weston_timeline_ring *ring,
+		     const char *name, ...);
+
+struct weston_timeline_ring *
+weston_timeline_ring_create(struct weston_compositor *compositor);
+
+void
+weston_timeline_ring_destroy(struct weston_timeline_ring *ring);
+
 #endif /* WESTON_TIMELINE_H */
@@ -106,6 +106,10 @@ weston_log_subscription_get_data(struct weston_log_subscription *sub);
 void
 weston_log_subscription_set_data(struct weston_log_subscription *sub, void *data);
 
+void
+weston_log_subscription_write(struct weston_log_subscription *sub,
+			      const char *data, size_t len);
+
 void
 weston_timeline_create_subscription(struct weston_log_subscription *sub,
 				    void *user_data);
@@ -26,6 +26,7 @@
 #ifndef _CAIRO_UTIL_H
 #define _CAIRO_UTIL_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <cairo.h>
 #ifdef HAVE_PANGO
@@ -253,6 +254,13 @@ frame_tablet_tool_motion(struct frame *frame, void *pointer, int x, int y);
 void
 frame_repaint(struct frame *frame, cairo_t *cr);
 
+/* Key of what frame_repaint() draws in the title bar, or with title_bar
+ * false, of what it draws in the rest of the frame. Equal keys mean
+ * equal pixels there, so renderings can be cached by key.
+ */
+uint64_t
+frame_render_key(struct frame *frame, bool title_bar);
+
 void
 cleanup_after_cairo(void);
 
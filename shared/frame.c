@@ -1081,3 +1081,55 @@ frame_repaint(struct frame *frame, cairo_t *cr)
 
 	frame_status_clear(frame, FRAME_STATUS_REPAINT);
 }
+
+static uint64_t
+fnv1a_64(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+#define FNV1A_64_ADD(hash, value) fnv1a_64(hash, &(value), sizeof (value))
+
+uint64_t
+frame_render_key(struct frame *frame, bool title_bar)
+{
+	struct frame_button *button;
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint32_t flags = frame->flags;
+	bool has_title_bar = frame->title || !wl_list_empty(&frame->buttons);
+	uint32_t state;
+
+	frame_refresh_geometry(frame);
+
+	hash = FNV1A_64_ADD(hash, frame->theme);
+	hash = FNV1A_64_ADD(hash, frame->width);
+	hash = FNV1A_64_ADD(hash, frame->height);
+	hash = FNV1A_64_ADD(hash, flags);
+	hash = FNV1A_64_ADD(hash, has_title_bar);
+	hash = FNV1A_64_ADD(hash, title_bar);
+	if (!title_bar)
+		return hash;
+
+	if (frame->title)
+		hash = fnv1a_64(hash, frame->title, strlen(frame->title) + 1);
+
+	wl_list_for_each(button, &frame->buttons, link) {
+		state = button->flags |
+			(button->hover_count ? 1u << 8 : 0) |
+			(button->press_count ? 1u << 9 : 0);
+		hash = FNV1A_64_ADD(hash, button->icon);
+		hash = FNV1A_64_ADD(hash, button->status_effect);
+		hash = FNV1A_64_ADD(hash, state);
+		hash = FNV1A_64_ADD(hash, button->allocation);
+	}
+
+	return hash;
+}
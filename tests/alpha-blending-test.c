@@ -59,6 +59,11 @@ static const struct setup_args my_setup_args[] = {
 		.color_management = true,
 		.meta.name = "GL sRGB EOTF"
 	},
+	{
+		.renderer = WESTON_RENDERER_PIXMAN,
+		.color_management = true,
+		.meta.name = "pixman sRGB EOTF"
+	},
 };
 
 static enum test_result_code
@@ -93,6 +93,7 @@ const struct lcms_pipeline pipeline_BT2020 = {
 
 struct setup_args {
 	struct fixture_metadata meta;
+	enum weston_renderer_type renderer;
 	int ref_image_index;
 	const struct lcms_pipeline *pipeline;
 
@@ -127,16 +128,25 @@ struct setup_args {
 };
 
 static const struct setup_args my_setup_args[] = {
-	/* name,                    ref img, pipeline,     tolerance, dim, profile type, clut tolerance, vcgt_exponents */
-	{ { "sRGB->sRGB MAT" },           0, &pipeline_sRGB,     0.0,  0, PTYPE_MATRIX_SHAPER },
-	{ { "sRGB->sRGB MAT VCGT" },      3, &pipeline_sRGB,     0.8,  0, PTYPE_MATRIX_SHAPER, 0.0000,   {1.1, 1.2, 1.3} },
-	{ { "sRGB->adobeRGB MAT" },       1, &pipeline_adobeRGB, 1.6,  0, PTYPE_MATRIX_SHAPER },
-	{ { "sRGB->adobeRGB MAT VCGT" },  4, &pipeline_adobeRGB, 1.0,  0, PTYPE_MATRIX_SHAPER, 0.0000,   {1.1, 1.2, 1.3} },
-	{ { "sRGB->BT2020 MAT" },         2, &pipeline_BT2020,   1.1,  0, PTYPE_MATRIX_SHAPER },
-	{ { "sRGB->sRGB CLUT" },          0, &pipeline_sRGB,     0.0, 17, PTYPE_CLUT,          0.0005 },
-	{ { "sRGB->sRGB CLUT VCGT" },     3, &pipeline_sRGB,     0.9, 17, PTYPE_CLUT,          0.0005,   {1.1, 1.2, 1.3} },
-	{ { "sRGB->adobeRGB CLUT" },      1, &pipeline_adobeRGB, 1.8, 17, PTYPE_CLUT,          0.0065 },
-	{ { "sRGB->adobeRGB CLUT VCGT" }, 4, &pipeline_adobeRGB, 1.1, 17, PTYPE_CLUT,          0.0065,   {1.1, 1.2, 1.3} },
+	/* name,                                  renderer,               ref img, pipeline,     tolerance, dim, profile type, clut tolerance, vcgt_exponents */
+	{ { "sRGB->sRGB MAT" },                   WESTON_RENDERER_GL,     0, &pipeline_sRGB,     0.0,  0, PTYPE_MATRIX_SHAPER },
+	{ { "sRGB->sRGB MAT VCGT" },              WESTON_RENDERER_GL,     3, &pipeline_sRGB,     0.8,  0, PTYPE_MATRIX_SHAPER, 0.0000,   {1.1, 1.2, 1.3} },
+	{ { "sRGB->adobeRGB MAT" },               WESTON_RENDERER_GL,     1, &pipeline_adobeRGB, 1.6,  0, PTYPE_MATRIX_SHAPER },
+	{ { "sRGB->adobeRGB MAT VCGT" },          WESTON_RENDERER_GL,     4, &pipeline_adobeRGB, 1.0,  0, PTYPE_MATRIX_SHAPER, 0.0000,   {1.1, 1.2, 1.3} },
+	{ { "sRGB->BT2020 MAT" },                 WESTON_RENDERER_GL,     2, &pipeline_BT2020,   1.1,  0, PTYPE_MATRIX_SHAPER },
+	{ { "sRGB->sRGB CLUT" },                  WESTON_RENDERER_GL,     0, &pipeline_sRGB,     0.0, 17, PTYPE_CLUT,          0.0005 },
+	{ { "sRGB->sRGB CLUT VCGT" },             WESTON_RENDERER_GL,     3, &pipeline_sRGB,     0.9, 17, PTYPE_CLUT,          0.0005,   {1.1, 1.2, 1.3} },
+	{ { "sRGB->adobeRGB CLUT" },              WESTON_RENDERER_GL,     1, &pipeline_adobeRGB, 1.8, 17, PTYPE_CLUT,          0.0065 },
+	{ { "sRGB->adobeRGB CLUT VCGT" },         WESTON_RENDERER_GL,     4, &pipeline_adobeRGB, 1.1, 17, PTYPE_CLUT,          0.0065,   {1.1, 1.2, 1.3} },
+	{ { "pixman sRGB->sRGB MAT" },            WESTON_RENDERER_PIXMAN, 0, &pipeline_sRGB,     0.0,  0, PTYPE_MATRIX_SHAPER },
+	{ { "pixman sRGB->sRGB MAT VCGT" },       WESTON_RENDERER_PIXMAN, 3, &pipeline_sRGB,     0.8,  0, PTYPE_MATRIX_SHAPER, 0.0000,   {1.1, 1.2, 1.3} },
+	{ { "pixman sRGB->adobeRGB MAT" },        WESTON_RENDERER_PIXMAN, 1, &pipeline_adobeRGB, 1.6,  0, PTYPE_MATRIX_SHAPER },
+	{ { "pixman sRGB->adobeRGB MAT VCGT" },   WESTON_RENDERER_PIXMAN, 4, &pipeline_adobeRGB, 1.0,  0, PTYPE_MATRIX_SHAPER, 0.0000,   {1.1, 1.2, 1.3} },
+	{ { "pixman sRGB->BT2020 MAT" },          WESTON_RENDERER_PIXMAN, 2, &pipeline_BT2020,   1.1,  0, PTYPE_MATRIX_SHAPER },
+	{ { "pixman sRGB->sRGB CLUT" },           WESTON_RENDERER_PIXMAN, 0, &pipeline_sRGB,     0.0, 17, PTYPE_CLUT,          0.0005 },
+	{ { "pixman sRGB->sRGB CLUT VCGT" },      WESTON_RENDERER_PIXMAN, 3, &pipeline_sRGB,     0.9, 17, PTYPE_CLUT,          0.0005,   {1.1, 1.2, 1.3} },
+	{ { "pixman sRGB->adobeRGB CLUT" },       WESTON_RENDERER_PIXMAN, 1, &pipeline_adobeRGB, 1.8, 17, PTYPE_CLUT,          0.0065 },
+	{ { "pixman sRGB->adobeRGB CLUT VCGT" },  WESTON_RENDERER_PIXMAN, 4, &pipeline_adobeRGB, 1.1, 17, PTYPE_CLUT,          0.0065,   {1.1, 1.2, 1.3} },
 };
 
 /*
@@ -233,7 +243,7 @@ fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 	cmsSetLogErrorHandler(test_lcms_error_logger);
 
 	compositor_setup_defaults(&setup);
-	setup.renderer = WESTON_RENDERER_GL;
+	setup.renderer = arg->renderer;
 	setup.backend = WESTON_BACKEND_HEADLESS;
 	setup.width = WINDOW_WIDTH;
 	setup.height = WINDOW_HEIGHT;
@@ -245,9 +255,11 @@ fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 						arg->meta.name, "icm");
 	build_output_icc_profile(arg, file_name);
 
+	/* Pixman-renderer does not draw output decorations */
 	weston_ini_setup(&setup,
 		cfgln("[core]"),
-		cfgln("output-decorations=true"),
+		cfgln("output-decorations=%s",
+		      arg->renderer == WESTON_RENDERER_GL ? "true" : "false"),
 		cfgln("color-management=true"),
 		cfgln("[output]"),
 		cfgln("name=headless"),
@@ -674,6 +686,12 @@ TEST(output_icc_decorations)
 	pixman_image_t *img;
 	bool match;
 
+	if (arg->renderer != WESTON_RENDERER_GL) {
+		testlog("%s: no output decorations with this renderer\n",
+			__func__);
+		return;
+	}
+
 	client = create_client();
 
 	shot = client_capture_output(client, client->output,
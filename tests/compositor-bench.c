@@ -0,0 +1,606 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Throughput benchmark of commit, damage and repaint on the headless
+ * backend. A number of clients animate a square on their surface, like
+ * simple-damage, each redrawing from its frame callback like simple-shm.
+ * The results of each fixture are written as JSON to
+ * bench-compositor-f<nn>.json in WESTON_TEST_OUTPUT_PATH.
+ *
+ * WESTON_BENCH_CLIENTS overrides the number of clients of every fixture,
+ * WESTON_BENCH_FRAMES the number of frames each client commits.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libweston/helpers.h>
+#include "shared/string-helpers.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+#include "presentation-time-client-protocol.h"
+#include "frame-stats.h"
+
+#define BENCH_WIDTH 1024
+#define BENCH_HEIGHT 768
+#define BENCH_SURFACE_SIZE 192
+#define BENCH_SQUARE_SIZE 48
+#define BENCH_BUFFERS 3
+#define BENCH_DEFAULT_FRAMES 300
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum weston_renderer_type renderer;
+	const char *renderer_name;
+	int clients;
+};
+
+#define BENCH_FIXTURES(r, n)						\
+	{ .meta.name = #r " " #n " clients",				\
+	  .renderer = WESTON_RENDERER_ ## r, .renderer_name = #r,	\
+	  .clients = n, }
+
+static const struct setup_args my_setup_args[] = {
+	BENCH_FIXTURES(PIXMAN, 1),
+	BENCH_FIXTURES(PIXMAN, 4),
+	BENCH_FIXTURES(PIXMAN, 16),
+	BENCH_FIXTURES(GL, 1),
+	BENCH_FIXTURES(GL, 4),
+	BENCH_FIXTURES(GL, 16),
+};
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = arg->renderer;
+	setup.width = BENCH_WIDTH;
+	setup.height = BENCH_HEIGHT;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.refresh = HIGHEST_OUTPUT_REFRESH;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+/* Running mean and variance, Welford's method */
+struct bench_moments {
+	uint64_t n;
+	double mean;
+	double m2;
+};
+
+static void
+bench_moments_add(struct bench_moments *m, double value)
+{
+	double delta = value - m->mean;
+
+	m->n++;
+	m->mean += delta / m->n;
+	m->m2 += delta * (value - m->mean);
+}
+
+static double
+bench_moments_stddev(const struct bench_moments *m)
+{
+	return m->n > 1 ? sqrt(m->m2 / (m->n - 1)) : 0.0;
+}
+
+struct bench_results {
+	clockid_t clock_id;
+	uint64_t commits;
+	uint64_t presented;
+	uint64_t discarded;
+	/* all in microseconds */
+	struct frame_histogram frame_latency;	/* commit to frame callback */
+	struct frame_histogram present_latency;	/* commit to presentation */
+	struct bench_moments present_interval;
+	uint32_t refresh_nsec;
+};
+
+struct bench_client;
+
+struct bench_buffer {
+	struct bench_client *owner;
+	struct buffer *buffer;
+	bool busy;
+};
+
+struct bench_feedback {
+	struct bench_client *owner;
+	struct wp_presentation_feedback *obj;
+	struct timespec commit;
+};
+
+struct bench_client {
+	struct client *client;
+	struct bench_results *results;
+	struct wp_presentation *presentation;
+	struct bench_buffer buffers[BENCH_BUFFERS];
+
+	struct wl_callback *frame;
+	struct timespec frame_commit;
+	int frames_left;
+	int feedback_pending;
+
+	struct rectangle square;
+	int dx, dy;
+
+	struct timespec last_present;
+};
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct bench_results *results = data;
+
+	results->clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id,
+};
+
+static void
+buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct bench_buffer *buf = data;
+
+	buf->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release,
+};
+
+static int64_t
+bench_since_usec(const struct bench_results *results,
+		 const struct timespec *then)
+{
+	struct timespec now;
+
+	clock_gettime(results->clock_id, &now);
+	return timespec_sub_to_nsec(&now, then) / 1000;
+}
+
+static void
+feedback_sync_output(void *data, struct wp_presentation_feedback *obj,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data, struct wp_presentation_feedback *obj,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh_nsec, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct bench_feedback *fb = data;
+	struct bench_client *bc = fb->owner;
+	struct bench_results *results = bc->results;
+	struct timespec stamp;
+
+	timespec_from_proto(&stamp, tv_sec_hi, tv_sec_lo, tv_nsec);
+
+	results->presented++;
+	results->refresh_nsec = refresh_nsec;
+	frame_histogram_add(&results->present_latency,
+			    timespec_sub_to_nsec(&stamp, &fb->commit) / 1000);
+	if (!timespec_is_zero(&bc->last_present)) {
+		bench_moments_add(&results->present_interval,
+				  timespec_sub_to_nsec(&stamp,
+						       &bc->last_present) / 1000.0);
+	}
+	bc->last_present = stamp;
+	bc->feedback_pending--;
+
+	wp_presentation_feedback_destroy(obj);
+	free(fb);
+}
+
+static void
+feedback_discarded(void *data, struct wp_presentation_feedback *obj)
+{
+	struct bench_feedback *fb = data;
+
+	fb->owner->results->discarded++;
+	fb->owner->feedback_pending--;
+
+	wp_presentation_feedback_destroy(obj);
+	free(fb);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded,
+};
+
+static void
+bench_client_draw(struct bench_client *bc);
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct bench_client *bc = data;
+
+	frame_histogram_add(&bc->results->frame_latency,
+			    bench_since_usec(bc->results, &bc->frame_commit));
+
+	wl_callback_destroy(callback);
+	bc->frame = NULL;
+
+	if (bc->frames_left > 0)
+		bench_client_draw(bc);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	frame_done,
+};
+
+static void
+fill_rect(pixman_image_t *image, const struct rectangle *rect,
+	  const pixman_color_t *color)
+{
+	pixman_rectangle16_t r = {
+		rect->x, rect->y, rect->width, rect->height,
+	};
+
+	pixman_image_fill_rectangles(PIXMAN_OP_SRC, image, color, 1, &r);
+}
+
+/* Moves the square and damages its old and new position. The buffers are
+ * redrawn completely since each one lags behind by a few frames. */
+static void
+bench_client_draw(struct bench_client *bc)
+{
+	static const pixman_color_t background = { 0x2000, 0x2000, 0x2000, 0xffff };
+	static const pixman_color_t foreground = { 0xffff, 0x8000, 0x0000, 0xffff };
+	struct wl_surface *surface = bc->client->surface->wl_surface;
+	struct rectangle whole = { 0, 0, BENCH_SURFACE_SIZE, BENCH_SURFACE_SIZE };
+	struct bench_buffer *buf = NULL;
+	struct bench_feedback *fb;
+	struct rectangle old = bc->square;
+	int i;
+
+	for (i = 0; i < BENCH_BUFFERS; i++) {
+		if (!bc->buffers[i].busy) {
+			buf = &bc->buffers[i];
+			break;
+		}
+	}
+	/* all buffers held by the compositor, try again next frame */
+	if (!buf) {
+		bc->frame = wl_surface_frame(surface);
+		wl_callback_add_listener(bc->frame, &frame_listener, bc);
+		wl_surface_commit(surface);
+		clock_gettime(bc->results->clock_id, &bc->frame_commit);
+		return;
+	}
+
+	bc->square.x += bc->dx;
+	bc->square.y += bc->dy;
+	if (bc->square.x < 0 ||
+	    bc->square.x + bc->square.width > BENCH_SURFACE_SIZE) {
+		bc->dx = -bc->dx;
+		bc->square.x += 2 * bc->dx;
+	}
+	if (bc->square.y < 0 ||
+	    bc->square.y + bc->square.height > BENCH_SURFACE_SIZE) {
+		bc->dy = -bc->dy;
+		bc->square.y += 2 * bc->dy;
+	}
+
+	fill_rect(buf->buffer->image, &whole, &background);
+	fill_rect(buf->buffer->image, &bc->square, &foreground);
+
+	wl_surface_attach(surface, buf->buffer->proxy, 0, 0);
+	wl_surface_damage_buffer(surface, old.x, old.y,
+				 old.width, old.height);
+	wl_surface_damage_buffer(surface, bc->square.x, bc->square.y,
+				 bc->square.width, bc->square.height);
+	buf->busy = true;
+
+	bc->frame = wl_surface_frame(surface);
+	wl_callback_add_listener(bc->frame, &frame_listener, bc);
+
+	fb = xzalloc(sizeof *fb);
+	fb->owner = bc;
+	fb->obj = wp_presentation_feedback(bc->presentation, surface);
+	wp_presentation_feedback_add_listener(fb->obj, &feedback_listener, fb);
+	bc->feedback_pending++;
+
+	clock_gettime(bc->results->clock_id, &fb->commit);
+	bc->frame_commit = fb->commit;
+	wl_surface_commit(surface);
+
+	bc->results->commits++;
+	bc->frames_left--;
+}
+
+static struct bench_client *
+bench_client_create(struct bench_results *results, int index, int frames)
+{
+	struct bench_client *bc = xzalloc(sizeof *bc);
+	int per_row = BENCH_WIDTH / BENCH_SURFACE_SIZE;
+	int i;
+
+	bc->results = results;
+	bc->client = create_client_and_test_surface(
+		(index % per_row) * BENCH_SURFACE_SIZE,
+		(index / per_row) * BENCH_SURFACE_SIZE % BENCH_HEIGHT,
+		BENCH_SURFACE_SIZE, BENCH_SURFACE_SIZE);
+
+	bc->presentation = bind_to_singleton_global(bc->client,
+						    &wp_presentation_interface,
+						    1);
+	wp_presentation_add_listener(bc->presentation, &presentation_listener,
+				     results);
+	client_roundtrip(bc->client);
+
+	for (i = 0; i < BENCH_BUFFERS; i++) {
+		bc->buffers[i].owner = bc;
+		bc->buffers[i].buffer =
+			create_shm_buffer_a8r8g8b8(bc->client,
+						   BENCH_SURFACE_SIZE,
+						   BENCH_SURFACE_SIZE);
+		wl_buffer_add_listener(bc->buffers[i].buffer->proxy,
+				       &buffer_listener, &bc->buffers[i]);
+	}
+
+	bc->square = (struct rectangle) {
+		.x = index * 7 % (BENCH_SURFACE_SIZE - BENCH_SQUARE_SIZE),
+		.y = index * 13 % (BENCH_SURFACE_SIZE - BENCH_SQUARE_SIZE),
+		.width = BENCH_SQUARE_SIZE,
+		.height = BENCH_SQUARE_SIZE,
+	};
+	bc->dx = 3;
+	bc->dy = 2;
+	bc->frames_left = frames;
+
+	return bc;
+}
+
+static void
+bench_client_destroy(struct bench_client *bc)
+{
+	int i;
+
+	if (bc->frame)
+		wl_callback_destroy(bc->frame);
+	for (i = 0; i < BENCH_BUFFERS; i++)
+		buffer_destroy(bc->buffers[i].buffer);
+	wp_presentation_destroy(bc->presentation);
+	client_destroy(bc->client);
+	free(bc);
+}
+
+/* Dispatches all clients from one thread until each got its last frame
+ * callback and presentation feedback. */
+static void
+bench_run(struct bench_client **clients, int n)
+{
+	struct pollfd *fds = xcalloc(n, sizeof *fds);
+	bool running = true;
+	int i, ret;
+
+	for (i = 0; i < n; i++) {
+		fds[i].fd = wl_display_get_fd(clients[i]->client->wl_display);
+		fds[i].events = POLLIN;
+	}
+
+	while (running) {
+		for (i = 0; i < n; i++) {
+			struct wl_display *display =
+				clients[i]->client->wl_display;
+
+			while (wl_display_prepare_read(display) != 0)
+				assert(wl_display_dispatch_pending(display) >= 0);
+			assert(wl_display_flush(display) >= 0);
+		}
+
+		ret = poll(fds, n, 10000);
+		assert(ret > 0 && "the compositor stopped responding");
+
+		running = false;
+		for (i = 0; i < n; i++) {
+			struct wl_display *display =
+				clients[i]->client->wl_display;
+
+			if (fds[i].revents & POLLIN)
+				assert(wl_display_read_events(display) == 0);
+			else
+				wl_display_cancel_read(display);
+			assert(wl_display_dispatch_pending(display) >= 0);
+
+			if (clients[i]->frames_left > 0 || clients[i]->frame ||
+			    clients[i]->feedback_pending > 0)
+				running = true;
+		}
+	}
+
+	free(fds);
+}
+
+static void
+print_histogram(FILE *fp, const char *name, const struct frame_histogram *hist,
+		bool last)
+{
+	fprintf(fp, "    \"%s\": { \"count\": %u, \"p50\": %" PRId64
+		", \"p90\": %" PRId64 ", \"p99\": %" PRId64
+		", \"max\": %" PRId64 " }%s\n",
+		name, hist->total,
+		frame_histogram_percentile(hist, 50.0),
+		frame_histogram_percentile(hist, 90.0),
+		frame_histogram_percentile(hist, 99.0),
+		hist->max, last ? "" : ",");
+}
+
+static void
+write_results(const struct setup_args *args, int n_clients, int frames,
+	      const struct bench_results *results, double elapsed_sec,
+	      const struct frame_histogram *repaint,
+	      const struct frame_histogram *render,
+	      uint64_t output_frames, uint64_t missed)
+{
+	char *suffix;
+	char *fname;
+	FILE *fp;
+
+	str_printf(&suffix, "f%02d", get_test_fixture_index() + 1);
+	fname = output_filename_for_test_program(THIS_TEST_NAME, suffix, "json");
+	free(suffix);
+	fp = fopen(fname, "w");
+	if (!fp) {
+		testlog("Error: failed to open file '%s' for writing: %s\n",
+			fname, strerror(errno));
+		assert(fp);
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"version\": \"%s\",\n", VERSION);
+	fprintf(fp, "  \"fixture\": \"%s\",\n", args->meta.name);
+	fprintf(fp, "  \"renderer\": \"%s\",\n", args->renderer_name);
+	fprintf(fp, "  \"clients\": %d,\n", n_clients);
+	fprintf(fp, "  \"frames_per_client\": %d,\n", frames);
+	fprintf(fp, "  \"surface_size\": %d,\n", BENCH_SURFACE_SIZE);
+	fprintf(fp, "  \"output\": { \"width\": %d, \"height\": %d, "
+		"\"refresh_nsec\": %u },\n",
+		BENCH_WIDTH, BENCH_HEIGHT, results->refresh_nsec);
+	fprintf(fp, "  \"elapsed_sec\": %.6f,\n", elapsed_sec);
+	fprintf(fp, "  \"commits\": %" PRIu64 ",\n", results->commits);
+	fprintf(fp, "  \"commits_per_sec\": %.1f,\n",
+		results->commits / elapsed_sec);
+	fprintf(fp, "  \"presented\": %" PRIu64 ",\n", results->presented);
+	fprintf(fp, "  \"discarded\": %" PRIu64 ",\n", results->discarded);
+	fprintf(fp, "  \"output_frames\": %" PRIu64 ",\n", output_frames);
+	fprintf(fp, "  \"output_missed_vblanks\": %" PRIu64 ",\n", missed);
+	fprintf(fp, "  \"present_interval_usec\": { \"mean\": %.1f, "
+		"\"jitter\": %.1f },\n",
+		results->present_interval.mean,
+		bench_moments_stddev(&results->present_interval));
+	fprintf(fp, "  \"usec\": {\n");
+	print_histogram(fp, "repaint", repaint, false);
+	print_histogram(fp, "render", render, false);
+	print_histogram(fp, "frame_callback_latency",
+			&results->frame_latency, false);
+	print_histogram(fp, "presentation_latency",
+			&results->present_latency, true);
+	fprintf(fp, "  }\n");
+	fprintf(fp, "}\n");
+
+	fclose(fp);
+	testlog("Wrote %s: %.1f commits/s\n", fname,
+		results->commits / elapsed_sec);
+	free(fname);
+}
+
+static int
+bench_env_int(const char *name, int default_value)
+{
+	const char *s = getenv(name);
+	int value;
+
+	if (s && safe_strtoint(s, &value) && value > 0)
+		return value;
+
+	return default_value;
+}
+
+TEST(commit_damage_repaint)
+{
+	struct wet_testsuite_data *suite_data = TEST_GET_SUITE_DATA();
+	const struct setup_args *args = &my_setup_args[get_test_fixture_index()];
+	struct bench_results results = { .clock_id = CLOCK_MONOTONIC };
+	struct bench_results *measured;
+	struct frame_histogram repaint, render;
+	struct bench_client **clients;
+	struct bench_client *first;
+	struct timespec begin, end;
+	uint64_t output_frames = 0, missed = 0;
+	int n, frames, i;
+
+	n = bench_env_int("WESTON_BENCH_CLIENTS", args->clients);
+	frames = bench_env_int("WESTON_BENCH_FRAMES", BENCH_DEFAULT_FRAMES);
+
+	clients = xcalloc(n, sizeof *clients);
+	for (i = 0; i < n; i++)
+		clients[i] = bench_client_create(&results, i, frames);
+
+	clock_gettime(results.clock_id, &begin);
+	for (i = 0; i < n; i++)
+		bench_client_draw(clients[i]);
+	bench_run(clients, n);
+	clock_gettime(results.clock_id, &end);
+	measured = xmalloc(sizeof *measured);
+	*measured = results;
+
+	/* one more frame to read the output statistics in the compositor */
+	first = clients[0];
+	client_push_breakpoint(first->client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) first->client->output->wl_output);
+	first->frames_left = 1;
+	bench_client_draw(first);
+
+	RUN_INSIDE_BREAKPOINT(first->client, suite_data) {
+		struct weston_head *head = breakpoint->resource;
+		struct weston_output *output = head->output;
+
+		assert(output->frame_stats);
+		frame_stats_get(output->frame_stats, FRAME_STAT_REPAINT,
+				&repaint);
+		frame_stats_get(output->frame_stats, FRAME_STAT_RENDER,
+				&render);
+		output_frames = output->frame_stats->frames;
+		missed = output->frame_stats->missed;
+	}
+	bench_run(&first, 1);
+
+	write_results(args, n, frames, measured,
+		      timespec_sub_to_nsec(&end, &begin) / 1e9,
+		      &repaint, &render, output_frames, missed);
+
+	for (i = 0; i < n; i++)
+		bench_client_destroy(clients[i]);
+	free(clients);
+	free(measured);
+}
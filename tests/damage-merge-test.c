@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "weston-test-runner.h"
+#include "damage-merge.h"
+
+static int
+region_n_rects(pixman_region32_t *region)
+{
+	int n;
+
+	pixman_region32_rectangles(region, &n);
+
+	return n;
+}
+
+/* The merged region must still cover everything that was damaged. */
+static bool
+region_covers(pixman_region32_t *merged, pixman_region32_t *orig)
+{
+	pixman_region32_t rest;
+	bool covered;
+
+	pixman_region32_init(&rest);
+	pixman_region32_subtract(&rest, orig, merged);
+	covered = !pixman_region32_not_empty(&rest);
+	pixman_region32_fini(&rest);
+
+	return covered;
+}
+
+TEST(damage_merge_disabled)
+{
+	pixman_region32_t region;
+
+	pixman_region32_init_rect(&region, 0, 0, 10, 10);
+	pixman_region32_union_rect(&region, &region, 12, 0, 10, 10);
+
+	assert(!damage_merge(&region, 0, 1024, NULL));
+	assert(region_n_rects(&region) == 2);
+
+	pixman_region32_fini(&region);
+}
+
+TEST(damage_merge_single_rect)
+{
+	struct damage_merge_stats stats;
+	pixman_region32_t region;
+
+	pixman_region32_init_rect(&region, 5, 5, 100, 50);
+
+	assert(!damage_merge(&region, 1, 1024, &stats));
+	assert(stats.rects_in == 1 && stats.rects_out == 1);
+	assert(stats.area_in == 5000 && stats.area_out == 5000);
+
+	pixman_region32_fini(&region);
+}
+
+TEST(damage_merge_close_rects)
+{
+	struct damage_merge_stats stats;
+	pixman_region32_t region;
+	pixman_box32_t *box;
+
+	/* A 2 px gap costs 20 px of overdraw, cheaper than a rectangle. */
+	pixman_region32_init_rect(&region, 0, 0, 10, 10);
+	pixman_region32_union_rect(&region, &region, 12, 0, 10, 10);
+
+	assert(damage_merge(&region, 16, 1024, &stats));
+	assert(stats.rects_in == 2 && stats.rects_out == 1);
+	assert(stats.area_in == 200 && stats.area_out == 220);
+
+	box = pixman_region32_extents(&region);
+	assert(box->x1 == 0 && box->y1 == 0 && box->x2 == 22 && box->y2 == 10);
+
+	pixman_region32_fini(&region);
+}
+
+TEST(damage_merge_far_rects)
+{
+	pixman_region32_t region;
+
+	/* Within budget and far apart: merging would only add overdraw. */
+	pixman_region32_init_rect(&region, 0, 0, 10, 10);
+	pixman_region32_union_rect(&region, &region, 500, 500, 10, 10);
+
+	assert(!damage_merge(&region, 16, 1024, NULL));
+	assert(region_n_rects(&region) == 2);
+
+	pixman_region32_fini(&region);
+}
+
+TEST(damage_merge_budget)
+{
+	struct damage_merge_stats stats;
+	pixman_region32_t region;
+	pixman_region32_t orig;
+	int x, y;
+
+	/* A 10x10 grid of scattered 4x4 rects, too costly to merge by area. */
+	pixman_region32_init(&region);
+	for (y = 0; y < 10; y++)
+		for (x = 0; x < 10; x++)
+			pixman_region32_union_rect(&region, &region,
+						   x * 40, y * 40, 4, 4);
+	pixman_region32_init(&orig);
+	pixman_region32_copy(&orig, &region);
+	assert(region_n_rects(&region) == 100);
+
+	assert(damage_merge(&region, 4, 1, &stats));
+	assert(stats.rects_in == 100);
+	assert(stats.rects_out <= 4);
+	assert(stats.rects_out == region_n_rects(&region));
+	assert(stats.area_in == 1600);
+	assert(stats.area_out >= stats.area_in);
+	assert(region_covers(&region, &orig));
+
+	pixman_region32_fini(&orig);
+	pixman_region32_fini(&region);
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+#include "frame-stats.h"
+#include "shared/timespec-util.h"
+
+#define REFRESH_NSEC 16666667
+
+/* Within the precision of the histogram */
+static bool
+close_enough(int64_t value, int64_t expected)
+{
+	return llabs(value - expected) <= expected / FRAME_HISTOGRAM_SUB + 1;
+}
+
+TEST(histogram_empty)
+{
+	struct frame_histogram hist = {};
+
+	assert(frame_histogram_percentile(&hist, 50.0) == 0);
+}
+
+TEST(histogram_exact_small_values)
+{
+	struct frame_histogram hist = {};
+	int i;
+
+	for (i = 1; i <= 50; i++)
+		frame_histogram_add(&hist, i);
+
+	assert(hist.total == 50);
+	assert(frame_histogram_percentile(&hist, 0.0) == 1);
+	assert(frame_histogram_percentile(&hist, 50.0) == 25);
+	assert(frame_histogram_percentile(&hist, 100.0) == 50);
+}
+
+TEST(histogram_percentiles)
+{
+	struct frame_histogram hist = {};
+	int64_t p;
+	int i;
+
+	for (i = 1; i <= 10000; i++)
+		frame_histogram_add(&hist, i * 10);
+
+	p = frame_histogram_percentile(&hist, 50.0);
+	assert(close_enough(p, 50000));
+	p = frame_histogram_percentile(&hist, 99.0);
+	assert(close_enough(p, 99000));
+	assert(frame_histogram_percentile(&hist, 100.0) <= 100000);
+	assert(hist.max == 100000);
+}
+
+TEST(histogram_clamps)
+{
+	struct frame_histogram hist = {};
+
+	frame_histogram_add(&hist, -5);
+	frame_histogram_add(&hist, INT64_C(1) << 40);
+
+	assert(hist.total == 2);
+	assert(frame_histogram_percentile(&hist, 0.0) == 0);
+	assert(frame_histogram_percentile(&hist, 100.0) > 0);
+}
+
+TEST(histogram_merge)
+{
+	struct frame_histogram a = {};
+	struct frame_histogram b = {};
+
+	frame_histogram_add(&a, 10);
+	frame_histogram_add(&b, 20);
+	frame_histogram_add(&b, 30);
+	frame_histogram_merge(&a, &b);
+
+	assert(a.total == 3);
+	assert(a.max == 30);
+	assert(frame_histogram_percentile(&a, 50.0) == 20);
+}
+
+/* Runs one frame: repaint starts at begin_usec after the previous
+ * presentation, gets submitted after repaint_usec, and gets presented
+ * after vblanks refresh periods. */
+static void
+run_frame(struct frame_stats *stats, struct timespec *present,
+	  int begin_usec, int repaint_usec, int vblanks)
+{
+	struct timespec begin, submit, stamp;
+
+	timespec_add_nsec(&begin, present, begin_usec * INT64_C(1000));
+	timespec_add_nsec(&submit, &begin, repaint_usec * INT64_C(1000));
+	timespec_add_nsec(&stamp, present, vblanks * (int64_t)REFRESH_NSEC);
+
+	frame_stats_repaint_begin(stats, &begin);
+	frame_stats_render(stats, &begin, &submit);
+	frame_stats_submit(stats, &submit, present, REFRESH_NSEC);
+	frame_stats_present(stats, &stamp, REFRESH_NSEC, false);
+
+	*present = stamp;
+}
+
+TEST(stats_on_time)
+{
+	struct frame_stats *stats = frame_stats_create();
+	struct timespec present = { .tv_sec = 100 };
+	struct frame_histogram hist;
+	int i;
+
+	/* Repaint 7 ms before vblank, taking 2 ms. */
+	for (i = 0; i < 100; i++)
+		run_frame(stats, &present, 9667, 2000, 1);
+
+	assert(stats->frames == 100);
+	assert(stats->missed == 0);
+	assert(stats->late == 0);
+
+	frame_stats_get(stats, FRAME_STAT_REPAINT, &hist);
+	assert(hist.total == 100);
+	assert(close_enough(frame_histogram_percentile(&hist, 99.0), 2000));
+
+	frame_stats_get(stats, FRAME_STAT_SLACK, &hist);
+	assert(close_enough(frame_histogram_percentile(&hist, 50.0), 5000));
+
+	frame_stats_get(stats, FRAME_STAT_LATENCY, &hist);
+	assert(close_enough(frame_histogram_percentile(&hist, 50.0), 5000));
+
+	frame_stats_destroy(stats);
+}
+
+TEST(stats_missed_deadline)
+{
+	struct frame_stats *stats = frame_stats_create();
+	struct timespec present = { .tv_sec = 100 };
+
+	run_frame(stats, &present, 9667, 2000, 1);
+	/* Takes 10 ms, misses the vblank and gets presented one later. */
+	run_frame(stats, &present, 9667, 10000, 2);
+
+	assert(stats->frames == 2);
+	assert(stats->missed == 1);
+	assert(stats->late == 1);
+
+	frame_stats_destroy(stats);
+}
+
+TEST(stats_window)
+{
+	struct frame_stats *stats = frame_stats_create();
+	struct timespec present = { .tv_sec = 100 };
+	struct frame_histogram hist;
+	int i;
+
+	for (i = 0; i < FRAME_STATS_WINDOW; i++)
+		run_frame(stats, &present, 9667, 6000, 1);
+	for (i = 0; i < FRAME_STATS_WINDOW * 2; i++)
+		run_frame(stats, &present, 9667, 1000, 1);
+
+	/* The slow frames have rolled out of the statistics. */
+	frame_stats_get(stats, FRAME_STAT_REPAINT, &hist);
+	assert(hist.total <= FRAME_STATS_WINDOW * 2);
+	assert(close_enough(frame_histogram_percentile(&hist, 100.0), 1000));
+	assert(stats->frames == FRAME_STATS_WINDOW * 3);
+
+	frame_stats_destroy(stats);
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+/*
+ * The fixtures run in order against the same $XDG_CACHE_HOME: the first
+ * one starts from an empty cache, the others start from what the previous
+ * run left, possibly damaged on purpose.
+ */
+enum cache_mode {
+	CACHE_COLD,
+	CACHE_WARM,
+	CACHE_CORRUPT,
+	CACHE_FOREIGN_BUILD,
+};
+
+struct setup_args {
+	struct fixture_metadata meta;
+	enum cache_mode mode;
+};
+
+static const struct setup_args my_setup_args[] = {
+	{ .meta.name = "cold", .mode = CACHE_COLD },
+	{ .meta.name = "warm", .mode = CACHE_WARM },
+	{ .meta.name = "corrupt", .mode = CACHE_CORRUPT },
+	{ .meta.name = "foreign build id", .mode = CACHE_FOREIGN_BUILD },
+};
+
+/* Same layout as struct gl_program_cache_header in gl-shaders.c */
+struct cache_header {
+	uint32_t magic;
+	uint32_t binary_format;
+	uint32_t length;
+	uint32_t key;
+	uint64_t build_id;
+};
+
+#define CACHE_MAGIC 0x42504757
+#define MAX_FILES 64
+
+struct cache_file {
+	char name[32];
+	ino_t ino;
+};
+
+/* What the cache held when the compositor started */
+static struct cache_file cached_before[MAX_FILES];
+static int n_cached_before;
+
+static char *
+cache_home(void)
+{
+	return output_filename_for_test_program(THIS_TEST_NAME, NULL, "cache");
+}
+
+static int
+remove_entry(const char *path, const struct stat *st, int flag,
+	     struct FTW *ftw)
+{
+	return remove(path);
+}
+
+/* Returns the directory of the only build id in the cache, or NULL */
+static char *
+find_build_dir(void)
+{
+	char *home = cache_home();
+	char *base, *dir = NULL;
+	struct dirent *de;
+	DIR *d;
+
+	str_printf(&base, "%s/weston/gl-programs", home);
+	free(home);
+	assert(base);
+
+	d = opendir(base);
+	if (!d) {
+		free(base);
+		return NULL;
+	}
+
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		assert(!dir && "one build id only");
+		str_printf(&dir, "%s/%s", base, de->d_name);
+		assert(dir);
+	}
+	closedir(d);
+	free(base);
+
+	return dir;
+}
+
+static int
+list_cache_files(const char *dir, struct cache_file *files)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	int n = 0;
+
+	d = opendir(dir);
+	assert(d);
+
+	while ((de = readdir(d))) {
+		size_t len = strlen(de->d_name);
+
+		if (len < 4 || strcmp(de->d_name + len - 4, ".bin") != 0)
+			continue;
+
+		assert(n < MAX_FILES);
+		assert(len < sizeof files[n].name);
+		assert(fstatat(dirfd(d), de->d_name, &st, 0) == 0);
+		strcpy(files[n].name, de->d_name);
+		files[n].ino = st.st_ino;
+		n++;
+	}
+	closedir(d);
+
+	return n;
+}
+
+static const struct cache_file *
+find_cache_file(const struct cache_file *files, int n, const char *name)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (strcmp(files[i].name, name) == 0)
+			return &files[i];
+	}
+
+	return NULL;
+}
+
+static bool
+read_header(const char *dir, const char *name, struct cache_header *header,
+	    off_t *size)
+{
+	struct stat st;
+	char *path;
+	bool ok;
+	int fd;
+
+	str_printf(&path, "%s/%s", dir, name);
+	assert(path);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0)
+		return false;
+
+	ok = fstat(fd, &st) == 0 &&
+	     pread(fd, header, sizeof *header, 0) == sizeof *header;
+	close(fd);
+	*size = st.st_size;
+
+	return ok;
+}
+
+/* Damages a header field of every cached file */
+static void
+damage_cache_files(const char *dir, enum cache_mode mode)
+{
+	struct cache_header header;
+	char *path;
+	off_t size;
+	int fd, i;
+
+	for (i = 0; i < n_cached_before; i++) {
+		assert(read_header(dir, cached_before[i].name, &header, &size));
+		if (mode == CACHE_CORRUPT)
+			header.magic = 0;
+		else
+			header.build_id = ~header.build_id;
+
+		str_printf(&path, "%s/%s", dir, cached_before[i].name);
+		assert(path);
+		fd = open(path, O_WRONLY | O_CLOEXEC);
+		free(path);
+		assert(fd >= 0);
+		assert(pwrite(fd, &header, sizeof header, 0) == sizeof header);
+		close(fd);
+	}
+}
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
+{
+	struct compositor_setup setup;
+	char *home = cache_home();
+	char *dir;
+
+	/* The compositor fixture turns the cache off unless set */
+	if (setenv("XDG_CACHE_HOME", home, 1) < 0 ||
+	    setenv("WESTON_GL_PROGRAM_CACHE", "1", 1) < 0) {
+		free(home);
+		return RESULT_HARD_ERROR;
+	}
+
+	n_cached_before = 0;
+	if (arg->mode == CACHE_COLD) {
+		nftw(home, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+		assert(mkdir(home, 0700) == 0);
+	} else {
+		/* Needs the runs before, and program binary support */
+		dir = find_build_dir();
+		if (dir)
+			n_cached_before = list_cache_files(dir, cached_before);
+		if (n_cached_before == 0) {
+			free(dir);
+			free(home);
+			return RESULT_SKIP;
+		}
+
+		if (arg->mode != CACHE_WARM)
+			damage_cache_files(dir, arg->mode);
+		free(dir);
+	}
+	free(home);
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = WESTON_RENDERER_GL;
+	setup.shell = SHELL_TEST_DESKTOP;
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
+
+TEST(program_cache)
+{
+	const struct setup_args *arg = &my_setup_args[get_test_fixture_index()];
+	struct cache_file files[MAX_FILES];
+	const struct cache_file *before;
+	struct cache_header header;
+	pixman_color_t color;
+	struct client *client;
+	off_t size;
+	char *dir;
+	int n, i;
+
+	/* Draw something, the programs get linked on the first repaint */
+	color_rgb888(&color, 255, 128, 0);
+	client = create_client();
+	client->surface = create_test_surface(client);
+	client->surface->buffer = create_shm_buffer_a8r8g8b8(client, 64, 64);
+	fill_image_with_color(client->surface->buffer->image, &color);
+	client->surface->width = 64;
+	client->surface->height = 64;
+	move_client_frame_sync(client, 20, 20);
+	client_destroy(client);
+
+	dir = find_build_dir();
+	if (arg->mode == CACHE_COLD && !dir) {
+		testlog("No program binary support, nothing got cached.\n");
+		return;
+	}
+	assert(dir);
+
+	n = list_cache_files(dir, files);
+	assert(n > 0);
+
+	/* Every file holds a program of this build */
+	for (i = 0; i < n; i++) {
+		assert(read_header(dir, files[i].name, &header, &size));
+		assert(header.magic == CACHE_MAGIC);
+		assert(header.length > 0);
+		assert(size == (off_t) (sizeof header + header.length));
+	}
+
+	switch (arg->mode) {
+	case CACHE_COLD:
+		break;
+	case CACHE_WARM:
+		/* Loaded, not linked and stored again */
+		assert(n == n_cached_before);
+		for (i = 0; i < n; i++) {
+			before = find_cache_file(cached_before, n_cached_before,
+						 files[i].name);
+			assert(before);
+			assert(before->ino == files[i].ino);
+		}
+		break;
+	case CACHE_CORRUPT:
+	case CACHE_FOREIGN_BUILD:
+		/* Rejected, then linked and stored again */
+		for (i = 0; i < n_cached_before; i++) {
+			before = find_cache_file(files, n,
+						 cached_before[i].name);
+			assert(before);
+			assert(before->ino != cached_before[i].ino);
+		}
+		break;
+	}
+
+	free(dir);
+}
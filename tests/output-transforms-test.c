@@ -49,9 +49,21 @@
 		.meta.name = "GL " #s " " #t,				\
 	}
 
+/* Pixman drawing in bands must match the same reference images */
+#define PIXMAN_BANDED(s, t)						\
+	{								\
+		.renderer = WESTON_RENDERER_PIXMAN,			\
+		.renderer_threads = 3,					\
+		.scale = s,						\
+		.transform = WL_OUTPUT_TRANSFORM_ ## t,			\
+		.transform_name = #t,					\
+		.meta.name = "pixman banded " #s " " #t,		\
+	}
+
 struct setup_args {
 	struct fixture_metadata meta;
 	enum weston_renderer_type renderer;
+	int renderer_threads;
 	int scale;
 	enum wl_output_transform transform;
 	const char *transform_name;
@@ -72,6 +84,11 @@ static const struct setup_args my_setup_args[] = {
 	RENDERERS(2, 180),
 	RENDERERS(2, FLIPPED),
 	RENDERERS(3, FLIPPED_270),
+	PIXMAN_BANDED(1, NORMAL),
+	PIXMAN_BANDED(1, 90),
+	PIXMAN_BANDED(1, FLIPPED_180),
+	PIXMAN_BANDED(2, 90),
+	PIXMAN_BANDED(3, FLIPPED_270),
 };
 
 static enum test_result_code
@@ -93,6 +110,13 @@ fixture_setup(struct weston_test_harness *harness, const struct setup_args *arg)
 	setup.transform = arg->transform;
 	setup.shell = SHELL_TEST_DESKTOP;
 
+	if (arg->renderer_threads > 0) {
+		weston_ini_setup(&setup,
+				 cfgln("[core]"),
+				 cfgln("renderer-threads=%d",
+				       arg->renderer_threads));
+	}
+
 	return weston_test_harness_execute_as_client(harness, &setup);
 }
 DECLARE_FIXTURE_SETUP_WITH_ARG(fixture_setup, my_setup_args, meta);
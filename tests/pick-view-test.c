@@ -0,0 +1,224 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libweston-internal.h"
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+#define OUTPUT_WIDTH 1024
+#define OUTPUT_HEIGHT 768
+#define VIEW_SIZE 48
+#define PICK_STEP 7
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = WESTON_RENDERER_PIXMAN;
+	setup.width = OUTPUT_WIDTH;
+	setup.height = OUTPUT_HEIGHT;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.logging_scopes = "log,test-harness-plugin";
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+/* The walk weston_compositor_pick_view() used to do. */
+static struct weston_view *
+pick_view_linear(struct weston_compositor *compositor,
+		 struct weston_coord_global pos)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		struct weston_coord_surface surf_pos;
+
+		weston_view_update_transform(view);
+
+		if (!pixman_region32_contains_point(
+				&view->transform.boundingbox, pos.c.x, pos.c.y, NULL))
+			continue;
+
+		surf_pos = weston_coord_global_to_surface(view, pos);
+		if (!weston_view_takes_input_at_point(view, surf_pos))
+			continue;
+
+		return view;
+	}
+	return NULL;
+}
+
+/* Picks on a grid over and around the output, checking every result against
+ * the linear walk, and logs how long both took. */
+static void
+check_picks(struct weston_compositor *compositor, int *hits)
+{
+	struct weston_coord_global pos;
+	struct timespec begin, end;
+	int64_t indexed = 0, linear = 0;
+	int count = 0;
+	int x, y;
+
+	*hits = 0;
+	for (y = -2 * PICK_STEP; y < OUTPUT_HEIGHT + 2 * PICK_STEP; y += PICK_STEP) {
+		for (x = -2 * PICK_STEP; x < OUTPUT_WIDTH + 2 * PICK_STEP; x += PICK_STEP) {
+			struct weston_view *a, *b;
+
+			pos.c = weston_coord(x + 0.5, y + 0.5);
+
+			clock_gettime(CLOCK_MONOTONIC, &begin);
+			a = weston_compositor_pick_view(compositor, pos);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			indexed += timespec_sub_to_nsec(&end, &begin);
+
+			clock_gettime(CLOCK_MONOTONIC, &begin);
+			b = pick_view_linear(compositor, pos);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			linear += timespec_sub_to_nsec(&end, &begin);
+
+			assert(a == b);
+			if (a)
+				(*hits)++;
+			count++;
+		}
+	}
+
+	testlog("%d picks: %" PRId64 " ns indexed, %" PRId64 " ns linear\n",
+		count, indexed / count, linear / count);
+}
+
+static const int view_counts[] = { 10, 100, 1000 };
+
+TEST_P(pick_view_matches_linear_walk, view_counts)
+{
+	const int *view_count = data;
+	struct wet_testsuite_data *suite_data = TEST_GET_SUITE_DATA();
+	struct client *client;
+	struct surface **surfaces;
+	struct buffer *buf, *bg_buf;
+	struct wl_region *region;
+	pixman_color_t color;
+	int i;
+
+	color_rgb888(&color, 0, 128, 255);
+
+	client = create_client();
+	assert(client);
+
+	buf = create_shm_buffer_a8r8g8b8(client, VIEW_SIZE, VIEW_SIZE);
+	fill_image_with_color(buf->image, &color);
+	/* bigger than the output, to not fit in the grid cells */
+	bg_buf = create_shm_buffer_a8r8g8b8(client, OUTPUT_WIDTH + 256,
+					    OUTPUT_HEIGHT + 256);
+	fill_image_with_color(bg_buf->image, &color);
+
+	/* some views let the input through */
+	region = wl_compositor_create_region(client->wl_compositor);
+	wl_region_add(region, 0, 0, VIEW_SIZE / 2, VIEW_SIZE / 2);
+
+	surfaces = xcalloc(*view_count + 1, sizeof *surfaces);
+	srand(*view_count);
+	for (i = 0; i <= *view_count; i++) {
+		struct surface *surface = create_test_surface(client);
+		struct buffer *b = i == 0 ? bg_buf : buf;
+		int x = -128, y = -128;
+
+		if (i > 0) {
+			x = rand() % (OUTPUT_WIDTH + VIEW_SIZE) - VIEW_SIZE;
+			y = rand() % (OUTPUT_HEIGHT + VIEW_SIZE) - VIEW_SIZE;
+		}
+		if (i % 3 == 1)
+			wl_surface_set_input_region(surface->wl_surface, region);
+
+		weston_test_move_surface(client->test->weston_test,
+					 surface->wl_surface, x, y);
+		wl_surface_attach(surface->wl_surface, b->proxy, 0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+		wl_surface_commit(surface->wl_surface);
+		surfaces[i] = surface;
+	}
+	wl_region_destroy(region);
+	client_roundtrip(client);
+
+	client_push_breakpoint(client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) client->output->wl_output);
+
+	wl_surface_damage(surfaces[0]->wl_surface, 0, 0, 1, 1);
+	wl_surface_commit(surfaces[0]->wl_surface);
+
+	RUN_INSIDE_BREAKPOINT(client, suite_data) {
+		struct weston_compositor *compositor = breakpoint->compositor;
+		struct weston_view *view;
+		int views = 0, hits;
+		int moved = 0;
+
+		wl_list_for_each(view, &compositor->view_list, link)
+			views++;
+		assert(views >= *view_count + 1);
+
+		testlog("%d views, index built on first pick\n", views);
+		check_picks(compositor, &hits);
+		assert(hits > 0);
+
+		testlog("%d views, index warm\n", views);
+		check_picks(compositor, &hits);
+
+		/* the index follows views moving around */
+		wl_list_for_each(view, &compositor->view_list, link) {
+			struct weston_coord_global pos;
+
+			if (moved++ % 2)
+				continue;
+
+			pos = weston_view_get_pos_offset_global(view);
+			pos.c.x += 200;
+			pos.c.y -= 100;
+			weston_view_set_position(view, pos);
+		}
+
+		testlog("%d views, half of them moved\n", views);
+		check_picks(compositor, &hits);
+	}
+
+	for (i = 0; i <= *view_count; i++)
+		surface_destroy(surfaces[i]);
+	free(surfaces);
+	buffer_destroy(buf);
+	buffer_destroy(bg_buf);
+	client_destroy(client);
+}
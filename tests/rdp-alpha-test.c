@@ -0,0 +1,191 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend-rdp/rdpalpha.h"
+
+#include "weston-test-runner.h"
+
+#define WIDTH 203
+#define HEIGHT 7
+#define STRIDE (WIDTH * 4 + 12)
+
+static const enum rdp_alpha_impl impls[] = {
+	RDP_ALPHA_IMPL_SCALAR,
+	RDP_ALPHA_IMPL_SSE2,
+	RDP_ALPHA_IMPL_AVX2,
+	RDP_ALPHA_IMPL_NEON,
+};
+
+/* Decodes an RDPGFX_CODECID_ALPHA bitstream, returns the pixel count. */
+static size_t
+decode_alpha(const uint8_t *src, size_t size, uint8_t *alpha, size_t max)
+{
+	size_t i = 4, n = 0;
+
+	assert(size >= 4);
+	assert(src[0] == 'L' && src[1] == 'A' && src[3] == 0);
+
+	if (src[2] == 0) {
+		assert(size - 4 <= max);
+		memcpy(alpha, src + 4, size - 4);
+		return size - 4;
+	}
+
+	while (i < size) {
+		uint8_t value = src[i++];
+		uint32_t count = src[i++];
+
+		if (count == 0xff) {
+			count = src[i] | src[i + 1] << 8;
+			i += 2;
+			if (count == 0xffff) {
+				count = src[i] | src[i + 1] << 8 |
+					src[i + 2] << 16 | (uint32_t)src[i + 3] << 24;
+				i += 4;
+			}
+		}
+		assert(n + count <= max);
+		memset(alpha + n, value, count);
+		n += count;
+	}
+	assert(i == size);
+
+	return n;
+}
+
+enum pattern {
+	PATTERN_OPAQUE,
+	PATTERN_EDGES,
+	PATTERN_NOISE,
+};
+
+static void
+fill_pixels(uint8_t *pixels, enum pattern pattern)
+{
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			uint8_t *px = pixels + y * STRIDE + x * 4;
+
+			px[0] = rand();
+			px[1] = rand();
+			px[2] = rand();
+			switch (pattern) {
+			case PATTERN_OPAQUE:
+				px[3] = 0xff;
+				break;
+			case PATTERN_EDGES:
+				/* antialiased corners, like a rounded window */
+				px[3] = (x < 3 || x >= WIDTH - 3) ? x * 40 : 0xff;
+				break;
+			case PATTERN_NOISE:
+				px[3] = rand();
+				break;
+			}
+		}
+	}
+}
+
+static void
+check_pattern(enum pattern pattern, size_t max_size)
+{
+	uint8_t *pixels = calloc(STRIDE, HEIGHT);
+	uint8_t ref[4 + WIDTH * HEIGHT];
+	uint8_t out[4 + WIDTH * HEIGHT];
+	uint8_t alpha[WIDTH * HEIGHT];
+	size_t ref_size, size;
+
+	assert(pixels);
+	assert(rdp_alpha_encode_bound(WIDTH, HEIGHT) == sizeof(ref));
+	fill_pixels(pixels, pattern);
+
+	ref_size = rdp_alpha_encode_with(RDP_ALPHA_IMPL_SCALAR, ref, pixels,
+					 WIDTH, HEIGHT, STRIDE, false);
+	assert(ref_size <= max_size);
+	assert(decode_alpha(ref, ref_size, alpha, sizeof(alpha)) == sizeof(alpha));
+	for (int y = 0; y < HEIGHT; y++)
+		for (int x = 0; x < WIDTH; x++)
+			assert(alpha[y * WIDTH + x] == pixels[y * STRIDE + x * 4 + 3]);
+
+	/* every implementation produces the very same bitstream */
+	for (unsigned i = 0; i < ARRAY_LENGTH(impls); i++) {
+		if (!rdp_alpha_impl_supported(impls[i]))
+			continue;
+
+		size = rdp_alpha_encode_with(impls[i], out, pixels,
+					     WIDTH, HEIGHT, STRIDE, false);
+		assert(size == ref_size);
+		assert(memcmp(out, ref, size) == 0);
+	}
+
+	size = rdp_alpha_encode(out, pixels, WIDTH, HEIGHT, STRIDE, false);
+	assert(size == ref_size);
+	assert(memcmp(out, ref, size) == 0);
+
+	free(pixels);
+}
+
+TEST(alpha_opaque_is_one_run)
+{
+	/* WIDTH * HEIGHT needs the 16 bit run length */
+	check_pattern(PATTERN_OPAQUE, 4 + 4);
+}
+
+TEST(alpha_edges_are_run_length_encoded)
+{
+	/* 6 runs of 1 pixel per row, one long run between rows */
+	check_pattern(PATTERN_EDGES, 4 + HEIGHT * 7 * 2);
+}
+
+TEST(alpha_noise_falls_back_to_raw)
+{
+	check_pattern(PATTERN_NOISE, 4 + WIDTH * HEIGHT);
+}
+
+TEST(alpha_opaque_flag)
+{
+	uint8_t out[4 + 300 * 300];
+	uint8_t alpha[300 * 300];
+	size_t size;
+
+	/* pixels are not looked at */
+	size = rdp_alpha_encode(out, NULL, 300, 300, 300 * 4, true);
+	assert(size == 4 + 8);
+	assert(out[2] == 1);
+	assert(decode_alpha(out, size, alpha, sizeof(alpha)) == sizeof(alpha));
+	for (unsigned i = 0; i < sizeof(alpha); i++)
+		assert(alpha[i] == 0xff);
+
+	/* a single pixel is smaller raw */
+	size = rdp_alpha_encode(out, NULL, 1, 1, 4, true);
+	assert(size == 4 + 1);
+	assert(out[2] == 0 && out[4] == 0xff);
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+
+#include "libweston-internal.h"
+#include "weston-test-client-helper.h"
+#include "weston-test-fixture-compositor.h"
+
+#define SURFACE_COUNT 8
+
+static enum test_result_code
+fixture_setup(struct weston_test_harness *harness)
+{
+	struct compositor_setup setup;
+
+	compositor_setup_defaults(&setup);
+	setup.renderer = WESTON_RENDERER_PIXMAN;
+	setup.width = 320;
+	setup.height = 240;
+	setup.shell = SHELL_TEST_DESKTOP;
+	setup.logging_scopes = "log,test-harness-plugin";
+
+	return weston_test_harness_execute_as_client(harness, &setup);
+}
+DECLARE_FIXTURE_SETUP(fixture_setup);
+
+/* The views of the layer must come in the same order on the view list and
+ * the z-order list of the output. */
+static void
+check_layer_order(struct weston_compositor *compositor,
+		  struct weston_output *output,
+		  struct weston_layer *layer)
+{
+	struct weston_layer_entry *entry;
+	struct weston_paint_node *pnode;
+	struct weston_view *view;
+	struct wl_list *pos = &compositor->view_list;
+	struct wl_list *z = &output->paint_node_z_order_list;
+	int count = 0;
+
+	wl_list_for_each(entry, &layer->view_list.link, link) {
+		struct weston_view *expected =
+			container_of(entry, struct weston_view, layer_link);
+
+		do {
+			pos = pos->next;
+			assert(pos != &compositor->view_list);
+			view = container_of(pos, struct weston_view, link);
+		} while (view->layer_link.layer != layer);
+		assert(view == expected);
+
+		if (!(view->output_mask & (1u << output->id)))
+			continue;
+
+		do {
+			z = z->next;
+			assert(z != &output->paint_node_z_order_list);
+			pnode = container_of(z, struct weston_paint_node,
+					     z_order_link);
+		} while (pnode->view->layer_link.layer != layer);
+		assert(pnode->view == expected);
+		count++;
+	}
+
+	testlog("%d views of the layer on the output\n", count);
+}
+
+/* With the check_view_list quirk, which the fixtures enable by default,
+ * every incremental update also gets compared with a full rebuild. */
+TEST(restack_views_incrementally)
+{
+	struct wet_testsuite_data *suite_data = TEST_GET_SUITE_DATA();
+	struct surface *surfaces[SURFACE_COUNT];
+	struct client *client;
+	struct buffer *buf;
+	struct weston_view *moved = NULL;
+	pixman_color_t color;
+	int step = 0;
+	int i;
+
+	color_rgb888(&color, 255, 0, 0);
+
+	client = create_client();
+	assert(client);
+
+	buf = create_shm_buffer_a8r8g8b8(client, 40, 40);
+	fill_image_with_color(buf->image, &color);
+
+	for (i = 0; i < SURFACE_COUNT; i++) {
+		surfaces[i] = create_test_surface(client);
+		weston_test_move_surface(client->test->weston_test,
+					 surfaces[i]->wl_surface,
+					 i * 30, i * 20);
+		wl_surface_attach(surfaces[i]->wl_surface, buf->proxy, 0, 0);
+		wl_surface_damage(surfaces[i]->wl_surface, 0, 0, 40, 40);
+		wl_surface_commit(surfaces[i]->wl_surface);
+	}
+	client_roundtrip(client);
+
+	client_push_breakpoint(client, suite_data,
+			       WESTON_TEST_BREAKPOINT_POST_REPAINT,
+			       (struct wl_proxy *) client->output->wl_output);
+
+	wl_surface_damage(surfaces[0]->wl_surface, 0, 0, 1, 1);
+	wl_surface_commit(surfaces[0]->wl_surface);
+
+	RUN_INSIDE_BREAKPOINT(client, suite_data) {
+		struct weston_compositor *compositor = breakpoint->compositor;
+		struct weston_head *head = breakpoint->resource;
+		struct weston_output *output = head->output;
+		struct weston_layer *layer;
+		struct weston_layer_entry *bottom;
+		struct weston_view *view, *top, *last;
+		struct weston_coord_global pos;
+
+		/* the test surfaces are alone in their layer */
+		top = container_of(compositor->view_list.next,
+				   struct weston_view, link);
+		layer = top->layer_link.layer;
+		assert(layer);
+		check_layer_order(compositor, output, layer);
+
+		switch (step++) {
+		case 0:
+			/* raise the bottom view, lower the top one */
+			last = container_of(layer->view_list.link.prev,
+					    struct weston_view, layer_link.link);
+			weston_view_move_to_layer(last, &layer->view_list);
+			bottom = container_of(layer->view_list.link.prev,
+					      struct weston_layer_entry, link);
+			weston_view_move_to_layer(top, bottom);
+			REARM_BREAKPOINT(breakpoint);
+			break;
+		case 1:
+			/* move a view off the output, and raise another one */
+			pos.c = weston_coord(-1000, -1000);
+			moved = top;
+			weston_view_set_position(moved, pos);
+			view = container_of(layer->view_list.link.prev,
+					    struct weston_view, layer_link.link);
+			weston_view_move_to_layer(view, &layer->view_list);
+			REARM_BREAKPOINT(breakpoint);
+			break;
+		case 2:
+			assert(!(moved->output_mask & (1u << output->id)));
+			assert(!weston_view_find_paint_node(moved, output));
+			break;
+		}
+	}
+	assert(step == 3);
+
+	for (i = 0; i < SURFACE_COUNT; i++)
+		surface_destroy(surfaces[i]);
+	buffer_destroy(buf);
+	client_destroy(client);
+}
@@ -188,7 +188,9 @@ compositor_setup_defaults_(struct compositor_setup *setup,
 			   const char *testset_name)
 {
 	*setup = (struct compositor_setup) {
-		.test_quirks = (struct weston_testsuite_quirks){ },
+		.test_quirks = (struct weston_testsuite_quirks){
+			.check_view_list = true,
+		},
 		.backend = WESTON_BACKEND_HEADLESS,
 		.renderer = WESTON_RENDERER_NOOP,
 		.shell = SHELL_TEST_DESKTOP,
@@ -353,8 +355,10 @@ execute_compositor(const struct compositor_setup *setup,
 	if (setup->xwayland)
 		prog_args_take(&args, strdup("--xwayland"));
 
+	/* Keep the GL program binary cache out of the user's home */
 	if (setenv("WESTON_MODULE_MAP", WESTON_MODULE_MAP, 0) < 0 ||
-	    setenv("WESTON_DATA_DIR", WESTON_DATA_DIR, 0) < 0) {
+	    setenv("WESTON_DATA_DIR", WESTON_DATA_DIR, 0) < 0 ||
+	    setenv("WESTON_GL_PROGRAM_CACHE", "0", 0) < 0) {
 		fprintf(stderr, "Error: environment setup failed.\n");
 		ret = RESULT_HARD_ERROR;
 	}
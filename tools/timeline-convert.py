@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+# encoding=utf-8
+# Copyright © 2026 agent
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+# Converts a dump of the "timeline-binary" log scope into the JSON written
+# by the "timeline" scope, for wesgr, or into a Chrome trace that Perfetto
+# and chrome://tracing can open. The format is described in
+# libweston/timeline.h.
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'WTLBIN1\0'
+VERSION = 1
+
+HEADER = struct.Struct('=8sIIIIQQ')
+STRING = struct.Struct('=II')
+RECORD = struct.Struct('=QIII2BHqq')
+
+RECORD_OBJECT = 1 << 0
+
+# enum timeline_type
+TLT_END = 0
+TLT_OUTPUT = 1
+TLT_SURFACE = 2
+TLT_VBLANK = 3
+TLT_GPU = 4
+TLT_MSEC = 5
+TLT_PRESENT = 6
+TLT_CPU = 7
+
+VALUE_KEYS = {
+    TLT_VBLANK: 'vblank_monotonic',
+    TLT_GPU: 'gpu',
+    TLT_MSEC: 'msec',
+    TLT_PRESENT: 'next_present',
+    TLT_CPU: 'cpu',
+}
+
+
+class Record:
+    def __init__(self, fields, strings):
+        (self.time, name, self.output, self.surface, type0, type1,
+         self.flags, value0, value1) = fields
+        self.name = strings.get(name, 'unknown')
+
+        if self.flags & RECORD_OBJECT:
+            self.desc = strings.get(value0)
+            self.main_surface = value1
+            self.values = []
+        else:
+            self.values = [(t, v) for t, v in ((type0, value0),
+                                               (type1, value1))
+                           if t != TLT_END]
+
+    @property
+    def is_object(self):
+        return bool(self.flags & RECORD_OBJECT)
+
+
+def read_dump(f):
+    data = f.read()
+
+    if len(data) < HEADER.size:
+        raise ValueError('truncated header')
+    (magic, version, record_size, n_strings, _, n_records,
+     n_dropped) = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('not a binary timeline dump')
+    if version != VERSION or record_size != RECORD.size:
+        raise ValueError('unsupported dump version {}'.format(version))
+    pos = HEADER.size
+
+    strings = {}
+    for _ in range(n_strings):
+        sid, length = STRING.unpack_from(data, pos)
+        pos += STRING.size
+        strings[sid] = data[pos:pos + length].decode('utf-8', 'replace')
+        pos += length
+
+    records = []
+    for _ in range(n_records):
+        if pos + RECORD.size > len(data):
+            raise ValueError('truncated records')
+        records.append(Record(RECORD.unpack_from(data, pos), strings))
+        pos += RECORD.size
+
+    return records, n_dropped
+
+
+def timespec(nsec):
+    return '[{}, {}]'.format(nsec // 1000000000, nsec % 1000000000)
+
+
+def write_json(out, records):
+    for rec in records:
+        if rec.is_object and rec.output:
+            out.write('{{ "id":{}, "type":"weston_output", "name":{} }}\n'
+                      .format(rec.output, json.dumps(rec.desc)))
+            continue
+        if rec.is_object:
+            main = ''
+            if rec.main_surface:
+                main = ', "main_surface":{}'.format(rec.main_surface)
+            out.write('{{ "id":{}, "type":"weston_surface", "desc":{}{} }}\n'
+                      .format(rec.surface, json.dumps(rec.desc), main))
+            continue
+
+        line = '{{ "T":{}, "N":{}'.format(timespec(rec.time),
+                                           json.dumps(rec.name))
+        if rec.output:
+            line += ', "wo":{}'.format(rec.output)
+        if rec.surface:
+            line += ', "ws":{}'.format(rec.surface)
+        for vtype, value in rec.values:
+            if vtype == TLT_MSEC:
+                line += ', "msec":{}'.format(value)
+            else:
+                line += ', "{}":{}'.format(VALUE_KEYS[vtype], timespec(value))
+        out.write(line + ' }\n')
+
+
+def write_chrome(out, records):
+    """Outputs become threads of one process. A "<name>_begin" point and
+    the next "<name>_end" point on the same output and surface become one
+    complete event, using the GPU or CPU thread timestamps when the points
+    carry them, everything else becomes an instant event."""
+    events = []
+    outputs = {}
+    surfaces = {}
+    begins = {}
+
+    for rec in records:
+        if rec.is_object:
+            if rec.output:
+                outputs[rec.output] = rec.desc
+            else:
+                surfaces[rec.surface] = rec.desc
+            continue
+
+        ts = rec.time
+        args = {}
+        for vtype, value in rec.values:
+            if vtype in (TLT_GPU, TLT_CPU):
+                ts = value
+            elif vtype == TLT_MSEC:
+                args['msec'] = value
+            else:
+                args[VALUE_KEYS[vtype]] = value / 1000.0
+        if rec.surface:
+            args['surface'] = surfaces.get(rec.surface) or rec.surface
+
+        key = (rec.output, rec.surface)
+        event = {
+            'name': rec.name,
+            'pid': 1,
+            'tid': rec.output,
+            'ts': ts / 1000.0,
+            'args': args,
+        }
+
+        if rec.name.endswith('_begin'):
+            pending = begins.pop((rec.name[:-len('_begin')],) + key, None)
+            if pending:
+                pending['ph'] = 'i'
+                pending['s'] = 't'
+                events.append(pending)
+            begins[(rec.name[:-len('_begin')],) + key] = event
+            continue
+        if rec.name.endswith('_end'):
+            begin = begins.pop((rec.name[:-len('_end')],) + key, None)
+            if begin:
+                begin['name'] = rec.name[:-len('_end')]
+                begin['ph'] = 'X'
+                begin['dur'] = event['ts'] - begin['ts']
+                begin['args'].update(args)
+                events.append(begin)
+                continue
+
+        event['ph'] = 'i'
+        event['s'] = 't'
+        events.append(event)
+
+    for begin in begins.values():
+        begin['ph'] = 'i'
+        begin['s'] = 't'
+        events.append(begin)
+
+    events.append({'name': 'process_name', 'ph': 'M', 'pid': 1,
+                   'args': {'name': 'weston'}})
+    events.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': 0,
+                   'args': {'name': 'compositor'}})
+    for oid, name in outputs.items():
+        events.append({'name': 'thread_name', 'ph': 'M', 'pid': 1,
+                       'tid': oid, 'args': {'name': name or str(oid)}})
+
+    json.dump({'traceEvents': events, 'displayTimeUnit': 'ms'}, out)
+    out.write('\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Convert a binary weston timeline dump.')
+    parser.add_argument('input', help='dump of the timeline-binary scope')
+    parser.add_argument('output', nargs='?',
+                        help='output file, standard output by default')
+    parser.add_argument('-f', '--format', choices=['json', 'chrome'],
+                        default='json',
+                        help='json for wesgr, chrome for Perfetto and '
+                             'chrome://tracing (default: json)')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        try:
+            records, n_dropped = read_dump(f)
+        except (ValueError, struct.error) as e:
+            sys.exit('{}: {}'.format(args.input, e))
+
+    if n_dropped:
+        sys.stderr.write('{} older records were overwritten\n'
+                         .format(n_dropped))
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    if args.format == 'chrome':
+        write_chrome(out, records)
+    else:
+        write_json(out, records)
+    if out is not sys.stdout:
+        out.close()
+
+
+if __name__ == '__main__':
+    main()
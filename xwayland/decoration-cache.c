@@ -0,0 +1,230 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "xwayland.h"
+
+#include "shared/timespec-util.h"
+#include "shared/xalloc.h"
+
+/* Decorations are drawn as four tiles around the client: the title bar,
+ * which depends on the title and the buttons, and the bottom, left and
+ * right borders, which only depend on the frame size and state. Tiles
+ * are kept as image surfaces, so cairo-xcb uploads them once and a
+ * cached frame is composed on the server.
+ */
+
+/* Older tiles are dropped past this many bytes */
+#define DECOR_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+enum decor_part {
+	DECOR_PART_TOP = 0,
+	DECOR_PART_BOTTOM,
+	DECOR_PART_LEFT,
+	DECOR_PART_RIGHT,
+	DECOR_PART_COUNT
+};
+
+struct decor_tile {
+	struct wl_list link; /* weston_wm_decor_cache::tiles */
+	uint64_t key;
+	int width, height;
+	size_t size;
+	cairo_surface_t *surface;
+};
+
+struct weston_wm_decor_cache {
+	struct wl_list tiles; /* most recently used first */
+	size_t size;
+	struct weston_wm_decor_stats stats;
+};
+
+struct weston_wm_decor_cache *
+weston_wm_decor_cache_create(void)
+{
+	struct weston_wm_decor_cache *cache;
+
+	cache = xzalloc(sizeof *cache);
+	wl_list_init(&cache->tiles);
+
+	return cache;
+}
+
+static void
+decor_tile_destroy(struct weston_wm_decor_cache *cache, struct decor_tile *tile)
+{
+	cache->size -= tile->size;
+	wl_list_remove(&tile->link);
+	cairo_surface_destroy(tile->surface);
+	free(tile);
+}
+
+void
+weston_wm_decor_cache_destroy(struct weston_wm_decor_cache *cache)
+{
+	struct decor_tile *tile, *tmp;
+
+	wl_list_for_each_safe(tile, tmp, &cache->tiles, link)
+		decor_tile_destroy(cache, tile);
+
+	free(cache);
+}
+
+const struct weston_wm_decor_stats *
+weston_wm_decor_cache_get_stats(struct weston_wm_decor_cache *cache)
+{
+	return &cache->stats;
+}
+
+/* Find the tile, or render it: draw() paints the whole frame, translated
+ * so that the tile's part lands on the tile. */
+static cairo_surface_t *
+decor_cache_get_tile(struct weston_wm_decor_cache *cache, uint64_t key,
+		     const cairo_rectangle_int_t *rect,
+		     weston_wm_decor_draw_func_t draw, void *data)
+{
+	struct decor_tile *tile, *tmp;
+	cairo_surface_t *surface;
+	struct timespec start, end;
+	cairo_t *cr;
+
+	wl_list_for_each(tile, &cache->tiles, link) {
+		if (tile->key == key &&
+		    tile->width == rect->width && tile->height == rect->height) {
+			wl_list_remove(&tile->link);
+			wl_list_insert(&cache->tiles, &tile->link);
+			cache->stats.tiles_reused++;
+			return tile->surface;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					     rect->width, rect->height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	cr = cairo_create(surface);
+	cairo_translate(cr, -rect->x, -rect->y);
+	draw(cr, data);
+	cairo_destroy(cr);
+	cairo_surface_flush(surface);
+
+	tile = xzalloc(sizeof *tile);
+	tile->key = key;
+	tile->width = rect->width;
+	tile->height = rect->height;
+	tile->size = (size_t)cairo_image_surface_get_stride(surface) * rect->height;
+	tile->surface = surface;
+	wl_list_insert(&cache->tiles, &tile->link);
+	cache->size += tile->size;
+
+	wl_list_for_each_reverse_safe(tile, tmp, &cache->tiles, link) {
+		if (cache->size <= DECOR_CACHE_MAX_SIZE ||
+		    tile->surface == surface)
+			break;
+		decor_tile_destroy(cache, tile);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	cache->stats.tiles_rendered++;
+	cache->stats.render_usec += timespec_sub_to_nsec(&end, &start) / 1000;
+
+	return surface;
+}
+
+void
+weston_wm_decor_cache_draw(struct weston_wm_decor_cache *cache, cairo_t *cr,
+			   int width, int height,
+			   const cairo_rectangle_int_t *interior,
+			   uint64_t title_key, uint64_t border_key,
+			   weston_wm_decor_draw_func_t draw, void *data)
+{
+	const int ix = interior->x;
+	const int iy = interior->y;
+	const int iw = interior->width;
+	const int ih = interior->height;
+	const cairo_rectangle_int_t parts[DECOR_PART_COUNT] = {
+		[DECOR_PART_TOP] = { 0, 0, width, iy },
+		[DECOR_PART_BOTTOM] = { 0, iy + ih, width, height - iy - ih },
+		[DECOR_PART_LEFT] = { 0, iy, ix, ih },
+		[DECOR_PART_RIGHT] = { ix + iw, iy, width - ix - iw, ih },
+	};
+	cairo_surface_t *tiles[DECOR_PART_COUNT] = {};
+	uint64_t key;
+	int i;
+
+	cache->stats.draws++;
+
+	if (iw <= 0 || ih <= 0)
+		goto draw_uncached;
+
+	for (i = 0; i < DECOR_PART_COUNT; i++) {
+		if (parts[i].width <= 0 || parts[i].height <= 0)
+			continue;
+
+		key = (i == DECOR_PART_TOP ? title_key : border_key) +
+		      (uint64_t)i * 0x9e3779b97f4a7c15ull;
+		tiles[i] = decor_cache_get_tile(cache, key, &parts[i],
+						draw, data);
+		if (!tiles[i])
+			goto draw_uncached;
+	}
+
+	cairo_save(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
+	for (i = 0; i < DECOR_PART_COUNT; i++) {
+		if (!tiles[i])
+			continue;
+
+		cairo_set_source_surface(cr, tiles[i], parts[i].x, parts[i].y);
+		cairo_rectangle(cr, parts[i].x, parts[i].y,
+				parts[i].width, parts[i].height);
+		cairo_fill(cr);
+	}
+
+	/* covered by the client */
+	cairo_set_source_rgba(cr, 0, 0, 0, 0);
+	cairo_rectangle(cr, ix, iy, iw, ih);
+	cairo_fill(cr);
+
+	cairo_restore(cr);
+
+	return;
+
+draw_uncached:
+	cairo_save(cr);
+	draw(cr, data);
+	cairo_restore(cr);
+}
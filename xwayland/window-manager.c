@@ -151,6 +151,8 @@ struct weston_wm_window {
 	struct wl_event_source *repaint_source;
 	struct wl_event_source *configure_source;
 	int properties_dirty;
+	struct weston_wm_property_fetch *property_fetch;
+	bool repaint_after_fetch;
 	int pid;
 	char *machine;
 	char *class;
@@ -245,6 +247,102 @@ wm_printf(struct weston_wm *wm, const char *fmt, ...)
 	weston_log_scope_vprintf(wm->server->wm_debug, fmt, ap);
 	va_end(ap);
 }
+
+/* Replies to requests sent without waiting, handed to their callback by
+ * weston_wm_dispatch_replies() as they come in. The callback owns the
+ * reply, which is NULL when the request failed. */
+typedef void (*weston_wm_reply_func_t)(struct weston_wm_window *window,
+				       unsigned int sequence, void *reply);
+
+struct weston_wm_reply {
+	struct wl_list link; /* weston_wm::pending_replies, in request order */
+	unsigned int sequence;
+	weston_wm_reply_func_t func;
+	struct weston_wm_window *window;
+};
+
+static bool
+weston_wm_expect_reply(struct weston_wm *wm, struct weston_wm_window *window,
+		       unsigned int sequence, weston_wm_reply_func_t func)
+{
+	struct weston_wm_reply *pending;
+
+	pending = zalloc(sizeof *pending);
+	if (!pending) {
+		xcb_discard_reply(wm->conn, sequence);
+		return false;
+	}
+
+	pending->sequence = sequence;
+	pending->func = func;
+	pending->window = window;
+	wl_list_insert(wm->pending_replies.prev, &pending->link);
+
+	return true;
+}
+
+static void
+weston_wm_reply_done(struct weston_wm_reply *pending, void *reply,
+		     xcb_generic_error_t *error)
+{
+	free(error);
+	wl_list_remove(&pending->link);
+	pending->func(pending->window, pending->sequence, reply);
+	free(pending);
+}
+
+/* Replies arrive in request order, so this stops at the first one still
+ * on its way. */
+static int
+weston_wm_dispatch_replies(struct weston_wm *wm)
+{
+	struct weston_wm_reply *pending;
+	xcb_generic_error_t *error;
+	void *reply;
+	int count = 0;
+
+	while (!wl_list_empty(&wm->pending_replies)) {
+		pending = wl_container_of(wm->pending_replies.next,
+					  pending, link);
+		if (!xcb_poll_for_reply(wm->conn, pending->sequence,
+					&reply, &error))
+			break;
+
+		weston_wm_reply_done(pending, reply, error);
+		count++;
+	}
+
+	return count;
+}
+
+/* Block until the reply has been handled, for callers that cannot
+ * proceed without it. */
+static void
+weston_wm_wait_reply(struct weston_wm *wm, struct weston_wm_reply *pending)
+{
+	xcb_generic_error_t *error = NULL;
+	void *reply;
+
+	reply = xcb_wait_for_reply(wm->conn, pending->sequence, &error);
+	weston_wm_reply_done(pending, reply, error);
+}
+
+/* Drop the replies for the window, or all of them for NULL. */
+static void
+weston_wm_cancel_replies(struct weston_wm *wm, struct weston_wm_window *window)
+{
+	struct weston_wm_reply *pending, *tmp;
+
+	wl_list_for_each_safe(pending, tmp, &wm->pending_replies, link) {
+		if (window && pending->window != window)
+			continue;
+
+		xcb_discard_reply(wm->conn, pending->sequence);
+		wl_list_remove(&pending->link);
+		free(pending);
+	}
+}
+
 static void
 weston_output_weak_ref_init(struct weston_output_weak_ref *ref)
 {
@@ -543,17 +641,31 @@ window_type_atom_to_string(struct weston_wm *wm, xcb_atom_t atom)
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 #define TYPE_WM_WINDOW_TYPE	XCB_ATOM_CUT_BUFFER4
 
+#define WM_PROPERTY_COUNT 11
+
+struct wm_property {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	void *ptr;
+};
+
+/* One request per property, sent together and applied together once the
+ * last reply is in. */
+struct weston_wm_property_fetch {
+	unsigned int sequence[WM_PROPERTY_COUNT];
+	xcb_get_property_reply_t *reply[WM_PROPERTY_COUNT];
+	int outstanding;
+	bool stale; /* one of them changed while on the way */
+};
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+weston_wm_window_get_properties(struct weston_wm_window *window,
+				struct wm_property props[WM_PROPERTY_COUNT])
 {
 	struct weston_wm *wm = window->wm;
 
 #define F(field) (&window->field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		void *ptr;
-	} props[] = {
+	const struct wm_property table[] = {
 		{ XCB_ATOM_WM_CLASS,           XCB_ATOM_STRING,            F(class) },
 		{ XCB_ATOM_WM_NAME,            XCB_ATOM_STRING,            F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR,   XCB_ATOM_WINDOW,            F(transient_for) },
@@ -568,24 +680,41 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	};
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
+	static_assert(ARRAY_LENGTH(table) == WM_PROPERTY_COUNT,
+		      "WM_PROPERTY_COUNT does not match the property table");
+	memcpy(props, table, sizeof table);
+}
+
+static bool
+weston_wm_window_has_property(struct weston_wm_window *window,
+			      xcb_atom_t atom)
+{
+	struct wm_property props[WM_PROPERTY_COUNT];
+	int i;
+
+	weston_wm_window_get_properties(window, props);
+	for (i = 0; i < WM_PROPERTY_COUNT; i++) {
+		if (props[i].atom == atom)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+weston_wm_window_apply_properties(struct weston_wm_window *window,
+				  xcb_get_property_reply_t **replies)
+{
+	struct weston_wm *wm = window->wm;
+	struct wm_property props[WM_PROPERTY_COUNT];
 	xcb_get_property_reply_t *reply;
 	void *p;
 	uint32_t *xid;
 	xcb_atom_t *atom;
-	uint32_t i;
+	uint32_t i, j;
 	char name[1024];
 
-	if (!window->properties_dirty)
-		return;
-	window->properties_dirty = 0;
-
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
-		cookie[i] = xcb_get_property(wm->conn,
-					     0, /* delete */
-					     window->id,
-					     props[i].atom,
-					     XCB_ATOM_ANY, 0, 2048);
+	weston_wm_window_get_properties(window, props);
 
 	window->decorate = window->override_redirect ? 0 : MWM_DECOR_EVERYTHING;
 	window->size_hints.flags = 0;
@@ -594,13 +723,12 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	window->take_focus = 0;
 
 	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
-		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
+		reply = replies[i];
 		if (!reply)
 			/* Bad window, typically */
 			continue;
 		if (reply->type == XCB_ATOM_NONE) {
 			/* No such property */
-			free(reply);
 			continue;
 		}
 
@@ -634,24 +762,24 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			/* pick first one as type */
 			*(xcb_atom_t *) p = *atom;
 			/* scan all atoms */
-			for (i = 0; i < reply->value_len; i++) {
+			for (j = 0; j < reply->value_len; j++) {
 				/* while there is a lot of discussion on this KDE property, but
 				   commonly mentioned there should be no window decoration at all
 				   including window shadow for _NET_WM_WINDOW_TYPE_OVERRIDE. */
-				if (atom[i] == wm->atom.net_wm_window_type_override) {
+				if (atom[j] == wm->atom.net_wm_window_type_override) {
 					window->no_shadow = 1;
 					window->decorate = 0;
 				}
 				wm_printf(wm, "wm_window_read_properties (window %d) window type: %s\n",
-					window->id, window_type_atom_to_string(wm, atom[i]));
+					window->id, window_type_atom_to_string(wm, atom[j]));
 			}
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window) {
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window) {
 					window->delete_window = 1;
-				} else if (atom[i] == wm->atom.wm_take_focus) {
+				} else if (atom[j] == wm->atom.wm_take_focus) {
 					window->take_focus = 1;
 				}
 			break;
@@ -667,12 +795,12 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++) {
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++) {
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_vert)
+				if (atom[j] == wm->atom.net_wm_state_maximized_vert)
 					window->maximized_vert = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_horz)
+				if (atom[j] == wm->atom.net_wm_state_maximized_horz)
 					window->maximized_horz = 1;
 			}
 			break;
@@ -693,7 +821,6 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		default:
 			break;
 		}
-		free(reply);
 	}
 
 	if (window->pid > 0) {
@@ -713,6 +840,116 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	}
 }
 
+static void
+weston_wm_property_fetch_destroy(struct weston_wm_property_fetch *fetch)
+{
+	int i;
+
+	for (i = 0; i < WM_PROPERTY_COUNT; i++)
+		free(fetch->reply[i]);
+	free(fetch);
+}
+
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window);
+
+static void
+weston_wm_window_property_reply(struct weston_wm_window *window,
+				unsigned int sequence, void *reply)
+{
+	struct weston_wm_property_fetch *fetch = window->property_fetch;
+	bool stale;
+	int i;
+
+	for (i = 0; i < WM_PROPERTY_COUNT; i++) {
+		if (fetch->sequence[i] == sequence)
+			break;
+	}
+	assert(i < WM_PROPERTY_COUNT);
+	fetch->reply[i] = reply;
+
+	if (--fetch->outstanding > 0)
+		return;
+
+	window->property_fetch = NULL;
+	stale = fetch->stale;
+	weston_wm_window_apply_properties(window, fetch->reply);
+	weston_wm_property_fetch_destroy(fetch);
+
+	/* changed again while the replies were on their way */
+	if (stale)
+		weston_wm_window_fetch_properties(window);
+
+	if (window->repaint_after_fetch && !window->property_fetch) {
+		window->repaint_after_fetch = false;
+		weston_wm_window_schedule_repaint(window);
+	}
+}
+
+/* Ask for the properties without waiting for the replies, they are
+ * applied by weston_wm_window_property_reply() as they come in. */
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct wm_property props[WM_PROPERTY_COUNT];
+	struct weston_wm_property_fetch *fetch;
+	xcb_get_property_cookie_t cookie;
+	int i;
+
+	/* a fetch on its way may have missed the latest change, so
+	 * properties stay dirty until it is done */
+	if (!window->properties_dirty || window->property_fetch)
+		return;
+
+	fetch = zalloc(sizeof *fetch);
+	if (!fetch)
+		return;
+
+	window->properties_dirty = 0;
+	window->property_fetch = fetch;
+	weston_wm_window_get_properties(window, props);
+
+	for (i = 0; i < WM_PROPERTY_COUNT; i++) {
+		cookie = xcb_get_property(wm->conn,
+					  0, /* delete */
+					  window->id,
+					  props[i].atom,
+					  XCB_ATOM_ANY, 0, 2048);
+		fetch->sequence[i] = cookie.sequence;
+		if (weston_wm_expect_reply(wm, window, cookie.sequence,
+					   weston_wm_window_property_reply))
+			fetch->outstanding++;
+	}
+
+	if (fetch->outstanding == 0) {
+		window->property_fetch = NULL;
+		window->properties_dirty = 1;
+		weston_wm_property_fetch_destroy(fetch);
+	}
+}
+
+/* Bring the properties up to date, waiting for the replies still on
+ * their way. Only for paths that cannot go on without them. */
+static void
+weston_wm_window_read_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_wm_reply *pending;
+
+	weston_wm_window_fetch_properties(window);
+
+	while (window->property_fetch) {
+		wl_list_for_each(pending, &wm->pending_replies, link) {
+			if (pending->window == window &&
+			    pending->func == weston_wm_window_property_reply)
+				break;
+		}
+		assert(&pending->link != &wm->pending_replies);
+		weston_wm_wait_reply(wm, pending);
+	}
+}
+
 #undef TYPE_WM_PROTOCOLS
 #undef TYPE_MOTIF_WM_HINTS
 #undef TYPE_NET_WM_STATE
@@ -1484,9 +1721,22 @@ weston_wm_handle_unmap_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 	xcb_unmap_window(wm->conn, window->frame_id);
 }
 
+static void
+weston_wm_window_draw_frame(cairo_t *cr, void *data)
+{
+	struct weston_wm_window *window = data;
+
+	frame_repaint(window->frame, cr);
+}
+
 static void
 weston_wm_window_draw_decoration(struct weston_wm_window *window)
 {
+	struct weston_wm *wm = window->wm;
+	const struct weston_wm_decor_stats *stats =
+		weston_wm_decor_cache_get_stats(wm->decor_cache);
+	uint32_t tiles_rendered = stats->tiles_rendered;
+	cairo_rectangle_int_t interior;
 	cairo_t *cr;
 	int width, height;
 	const char *how;
@@ -1502,7 +1752,14 @@ weston_wm_window_draw_decoration(struct weston_wm_window *window)
 	} else if (window->decorate) {
 		how = "decorate";
 		frame_set_title(window->frame, window->name);
-		frame_repaint(window->frame, cr);
+		frame_interior(window->frame, &interior.x, &interior.y,
+			       &interior.width, &interior.height);
+		weston_wm_decor_cache_draw(wm->decor_cache, cr, width, height,
+					   &interior,
+					   frame_render_key(window->frame, true),
+					   frame_render_key(window->frame, false),
+					   weston_wm_window_draw_frame, window);
+		frame_status_clear(window->frame, FRAME_STATUS_REPAINT);
 	} else if (window->maximized_vert && window->maximized_horz) {
 		how = "maximized";
 		/* nothing */
@@ -1515,16 +1772,19 @@ weston_wm_window_draw_decoration(struct weston_wm_window *window)
 		cairo_set_source_rgba(cr, 0, 0, 0, 0);
 		cairo_paint(cr);
 
-		render_shadow(cr, window->wm->theme->shadow,
+		render_shadow(cr, wm->theme->shadow,
 			      2, 2, width + 8, height + 8, 64, 64);
 	}
 
-	wm_printf(window->wm, "XWM: draw decoration, win %d, %s\n",
-		  window->id, how);
+	wm_printf(wm, "XWM: draw decoration, win %d, %s, %u tiles rendered "
+		  "(%u draws, %u tiles rendered in %" PRIu64 " us, %u reused)\n",
+		  window->id, how, stats->tiles_rendered - tiles_rendered,
+		  stats->draws, stats->tiles_rendered, stats->render_usec,
+		  stats->tiles_reused);
 
 	cairo_destroy(cr);
 	cairo_surface_flush(window->cairo_surface);
-	xcb_flush(window->wm->conn);
+	xcb_flush(wm->conn);
 }
 
 static void
@@ -1594,8 +1854,17 @@ weston_wm_window_do_repaint(void *data)
 
 	window->repaint_source = NULL;
 
+	/* repaint once the property replies are in, rather than
+	 * waiting for them here */
+	weston_wm_window_fetch_properties(window);
+	weston_wm_dispatch_replies(window->wm);
+	if (window->property_fetch) {
+		window->repaint_after_fetch = true;
+		xcb_flush(window->wm->conn);
+		return;
+	}
+
 	weston_wm_window_set_allow_commits(window, false);
-	weston_wm_window_read_properties(window);
 
 	weston_wm_window_draw_decoration(window);
 	weston_wm_window_set_net_frame_extents(window);
@@ -1649,39 +1918,28 @@ weston_wm_window_schedule_repaint(struct weston_wm_window *window)
 				       weston_wm_window_do_repaint, window);
 }
 
+/* Pass the largest icon in _NET_WM_ICON on to the shell */
 static bool
-weston_wm_window_set_icon(struct weston_wm *wm,
-	struct weston_wm_window *window, xcb_window_t window_id)
+weston_wm_window_apply_icon(struct weston_wm_window *window,
+			    xcb_get_property_reply_t *reply)
 {
-	bool is_set_window_icon_called = false;
+	struct weston_wm *wm = window->wm;
 	const struct weston_desktop_xwayland_interface *xwayland_interface =
 		wm->server->compositor->xwayland_interface;
-	xcb_get_property_reply_t *reply;
-	xcb_get_property_cookie_t cookie;
 	char *data;
 	int length;
 	uint32_t *cur, *selected_bits;
 	uint32_t width, selected_width;
 	uint32_t height, selected_height;
 
-	if (!xwayland_interface->set_window_icon)
-		return false;
-
 	if (!window->shsurf) {
 		/* shell surface is not associated yet */
 		return false;
 	}
 
-	cookie = xcb_get_property(wm->conn, 0, window_id,
-				wm->atom.net_wm_icon, XCB_ATOM_CARDINAL, 0,  0x1fffffff);
-	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
-	if (!reply)
-		return false;
 	length = xcb_get_property_value_length(reply);
-	if (!length) {
-		free(reply);
+	if (!length)
 		return false;
-	}
 	assert(reply->type == XCB_ATOM_CARDINAL);
 	data = xcb_get_property_value(reply);
 	wm_printf(wm, "weston_wm_window_set_icon: data:%p, length:%d\n", data, length);
@@ -1706,14 +1964,69 @@ weston_wm_window_set_icon(struct weston_wm *wm,
 
 	if (selected_width && selected_height && selected_bits) {
 		xwayland_interface->set_window_icon(window->shsurf, selected_width, selected_height, 32, selected_bits);
-		is_set_window_icon_called = true;
+		return true;
 	}
 
+	return false;
+}
+
+static bool
+weston_wm_window_set_icon(struct weston_wm *wm,
+	struct weston_wm_window *window, xcb_window_t window_id)
+{
+	const struct weston_desktop_xwayland_interface *xwayland_interface =
+		wm->server->compositor->xwayland_interface;
+	xcb_get_property_reply_t *reply;
+	xcb_get_property_cookie_t cookie;
+	bool is_set_window_icon_called;
+
+	if (!xwayland_interface->set_window_icon)
+		return false;
+
+	if (!window->shsurf) {
+		/* shell surface is not associated yet */
+		return false;
+	}
+
+	cookie = xcb_get_property(wm->conn, 0, window_id,
+				wm->atom.net_wm_icon, XCB_ATOM_CARDINAL, 0,  0x1fffffff);
+	reply = xcb_get_property_reply(wm->conn, cookie, NULL);
+	if (!reply)
+		return false;
+
+	is_set_window_icon_called = weston_wm_window_apply_icon(window, reply);
 	free(reply);
 
 	return is_set_window_icon_called;
 }
 
+static void
+weston_wm_window_icon_reply(struct weston_wm_window *window,
+			    unsigned int sequence, void *reply)
+{
+	if (reply)
+		weston_wm_window_apply_icon(window, reply);
+	free(reply);
+}
+
+/* Like weston_wm_window_set_icon(), without waiting for the icon */
+static void
+weston_wm_window_fetch_icon(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	const struct weston_desktop_xwayland_interface *xwayland_interface =
+		wm->server->compositor->xwayland_interface;
+	xcb_get_property_cookie_t cookie;
+
+	if (!xwayland_interface->set_window_icon || !window->shsurf)
+		return;
+
+	cookie = xcb_get_property(wm->conn, 0, window->id,
+				  wm->atom.net_wm_icon, XCB_ATOM_CARDINAL, 0, 0x1fffffff);
+	weston_wm_expect_reply(wm, window, cookie.sequence,
+			       weston_wm_window_icon_reply);
+}
+
 static void
 weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *event)
 {
@@ -1757,7 +2070,14 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		return;
 	}
 
+	/* Only the properties we track are worth a fetch, others, like
+	 * _NET_WM_USER_TIME, change on every input event. */
 	window->properties_dirty = 1;
+	if (weston_wm_window_has_property(window, property_notify->atom)) {
+		if (window->property_fetch)
+			window->property_fetch->stale = true;
+		weston_wm_window_fetch_properties(window);
+	}
 
 	if (wm_debug_is_enabled(wm))
 		fp = open_memstream(&logstr, &logsize);
@@ -1791,7 +2111,7 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		weston_wm_window_schedule_repaint(window);
 
 	if (property_notify->atom == wm->atom.net_wm_icon)
-		weston_wm_window_set_icon(wm, window, property_notify->window);
+		weston_wm_window_fetch_icon(window);
 }
 
 static void
@@ -1846,6 +2166,9 @@ weston_wm_window_create(struct weston_wm *wm,
 	free(geometry_reply);
 
 	hash_table_insert(wm->window_hash, id, window);
+
+	/* the replies are usually in by the time the window is mapped */
+	weston_wm_window_fetch_properties(window);
 }
 
 static void
@@ -1859,6 +2182,9 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 		wl_event_source_remove(window->configure_source);
 	if (window->repaint_source)
 		wl_event_source_remove(window->repaint_source);
+	weston_wm_cancel_replies(wm, window);
+	if (window->property_fetch)
+		weston_wm_property_fetch_destroy(window->property_fetch);
 	if (window->cairo_surface)
 		cairo_surface_destroy(window->cairo_surface);
 
@@ -2751,6 +3077,8 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 		count++;
 	}
 
+	count += weston_wm_dispatch_replies(wm);
+
 	if (count != 0)
 		xcb_flush(wm->conn);
 
@@ -3070,6 +3398,7 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 		free(wm);
 		return NULL;
 	}
+	wl_list_init(&wm->pending_replies);
 
 	/* xcb_connect_to_fd takes ownership of the fd. */
 	wm->conn = xcb_connect_to_fd(fd, NULL);
@@ -3105,6 +3434,8 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 					  XCB_COMPOSITE_REDIRECT_MANUAL);
 
 	wm->theme = theme_create();
+	/* tiles are keyed on the theme too, so the cache lives as long */
+	wm->decor_cache = weston_wm_decor_cache_create();
 
 	supported[0] = wm->atom.net_wm_moveresize;
 	supported[1] = wm->atom.net_wm_state;
@@ -3164,7 +3495,9 @@ weston_wm_destroy(struct weston_wm *wm)
 	/* FIXME: Free windows in hash. */
 	hash_table_destroy(wm->window_hash);
 	weston_wm_destroy_cursors(wm);
+	weston_wm_decor_cache_destroy(wm->decor_cache);
 	theme_destroy(wm->theme);
+	weston_wm_cancel_replies(wm, NULL);
 	xcb_disconnect(wm->conn);
 	wl_event_source_remove(wm->source);
 	wl_list_remove(&wm->seat_create_listener.link);
@@ -3695,7 +4028,7 @@ xserver_map_shell_surface(struct weston_wm_window *window,
 	}
 
 	if (!window->override_redirect)
-		weston_wm_window_set_icon(wm, window, window->id);
+		weston_wm_window_fetch_icon(window);
 }
 
 const struct weston_xwayland_surface_api surface_api = {
@@ -98,6 +98,9 @@ struct weston_wm {
 	struct wl_list unpaired_surface_list;
 	bool shell_bound;
 
+	struct wl_list pending_replies; /* weston_wm_reply::link */
+	struct weston_wm_decor_cache *decor_cache;
+
 	struct atom_x11 atom;
 };
 
@@ -124,3 +127,25 @@ weston_wm_handle_dnd_event(struct weston_wm *wm,
 			   xcb_generic_event_t *event);
 void
 weston_wm_dnd_init(struct weston_wm *wm);
+
+struct weston_wm_decor_stats {
+	uint32_t draws;
+	uint32_t tiles_reused;
+	uint32_t tiles_rendered;
+	uint64_t render_usec;
+};
+
+typedef void (*weston_wm_decor_draw_func_t)(cairo_t *cr, void *data);
+
+struct weston_wm_decor_cache *
+weston_wm_decor_cache_create(void);
+void
+weston_wm_decor_cache_destroy(struct weston_wm_decor_cache *cache);
+const struct weston_wm_decor_stats *
+weston_wm_decor_cache_get_stats(struct weston_wm_decor_cache *cache);
+void
+weston_wm_decor_cache_draw(struct weston_wm_decor_cache *cache, cairo_t *cr,
+			   int width, int height,
+			   const cairo_rectangle_int_t *interior,
+			   uint64_t title_key, uint64_t border_key,
+			   weston_wm_decor_draw_func_t draw, void *data);